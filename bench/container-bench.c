@@ -0,0 +1,262 @@
+/**
+ * @file container-bench.c
+ * @author Charles Grunwald <cgrunwald@gmail.com>
+ * @brief Append, sort and iterate throughput of dynarray.
+ *
+ * Compares the current dynarray against a copy of the previous one, which
+ * grew by a fixed 16 elements per realloc and had no notion of capacity.
+ * Each size from 10 to 10^7 is repeated until roughly 10^7 elements have
+ * been processed, and the best of three rounds is reported in ns/element.
+ */
+#include <getopt.h>
+#include <time.h>
+
+#include "shared.h"
+#include "dynarray.h"
+
+#define LEGACY_INCREMENT 16
+#define TARGET_ELEMENTS 10000000UL
+#define ROUNDS 3
+#define INLINE_COUNT 16
+
+struct legacy_dynarray
+{
+	void* base;
+	size_t elements;
+};
+
+DEFINE_ARRAY_TYPE(int_array, uint32_t)
+DEFINE_ARRAY_TYPE_INLINE(small_int_array, uint32_t, INLINE_COUNT)
+
+typedef double(*bench_func)(size_t count, size_t reps);
+
+// Keeps the optimizer from dropping the loops being measured.
+static volatile uint64_t bench_sink;
+
+static void* legacy_append(struct legacy_dynarray* a, size_t element_size)
+{
+	if(!(a->elements % LEGACY_INCREMENT)) {
+		void* new_base = reallocarray(a->base, a->elements + LEGACY_INCREMENT, element_size);
+		if(UNLIKELY(!new_base))
+			return NULL;
+		a->base = new_base;
+	}
+	return ((unsigned char*)a->base) + a->elements++ * element_size;
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static ALWAYS_INLINE uint32_t next_value(uint32_t* state)
+{
+	// xorshift32; cheap and deterministic across runs.
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+static int compare_u32(const void* a, const void* b)
+{
+	uint32_t x = *(const uint32_t*)a;
+	uint32_t y = *(const uint32_t*)b;
+	return (x > y) - (x < y);
+}
+
+static double legacy_append_bench(size_t count, size_t reps)
+{
+	double start = now_ns();
+	for(size_t r = 0; r < reps; r++) {
+		struct legacy_dynarray a = { NULL, 0 };
+		for(size_t i = 0; i < count; i++)
+			*(uint32_t*)legacy_append(&a, sizeof(uint32_t)) = (uint32_t)i;
+		bench_sink += ((uint32_t*)a.base)[count - 1];
+		free(a.base);
+	}
+	return now_ns() - start;
+}
+
+static double dynarray_append_bench(size_t count, size_t reps)
+{
+	double start = now_ns();
+	for(size_t r = 0; r < reps; r++) {
+		struct int_array a;
+		int_array_init(&a);
+		for(size_t i = 0; i < count; i++)
+			*int_array_append(&a) = (uint32_t)i;
+		bench_sink += ((uint32_t*)a.base.base)[count - 1];
+		int_array_reset(&a);
+	}
+	return now_ns() - start;
+}
+
+static double inline_append_bench(size_t count, size_t reps)
+{
+	double start = now_ns();
+	for(size_t r = 0; r < reps; r++) {
+		struct small_int_array a;
+		small_int_array_init(&a);
+		for(size_t i = 0; i < count; i++)
+			*small_int_array_append(&a) = (uint32_t)i;
+		bench_sink += ((uint32_t*)a.base.base)[count - 1];
+		small_int_array_reset(&a);
+	}
+	return now_ns() - start;
+}
+
+static double reserve_append_bench(size_t count, size_t reps)
+{
+	double start = now_ns();
+	for(size_t r = 0; r < reps; r++) {
+		struct int_array a;
+		uint32_t* items;
+		int_array_init(&a);
+		items = int_array_append_n(&a, count);
+		for(size_t i = 0; i < count; i++)
+			items[i] = (uint32_t)i;
+		bench_sink += items[count - 1];
+		int_array_reset(&a);
+	}
+	return now_ns() - start;
+}
+
+static void fill_random(uint32_t* items, size_t count, uint32_t seed)
+{
+	for(size_t i = 0; i < count; i++)
+		items[i] = next_value(&seed);
+}
+
+static double legacy_sort_bench(size_t count, size_t reps)
+{
+	double elapsed = 0;
+	struct legacy_dynarray a = { NULL, 0 };
+	for(size_t i = 0; i < count; i++)
+		legacy_append(&a, sizeof(uint32_t));
+	for(size_t r = 0; r < reps; r++) {
+		double start;
+		fill_random((uint32_t*)a.base, count, (uint32_t)(r + 1));
+		start = now_ns();
+		// The old dynarray_sort left the last element out; match it.
+		qsort(a.base, a.elements - 1, sizeof(uint32_t), compare_u32);
+		elapsed += now_ns() - start;
+	}
+	free(a.base);
+	return elapsed;
+}
+
+static double dynarray_sort_bench(size_t count, size_t reps)
+{
+	double elapsed = 0;
+	struct int_array a;
+	int_array_init(&a);
+	int_array_append_n(&a, count);
+	for(size_t r = 0; r < reps; r++) {
+		double start;
+		fill_random((uint32_t*)a.base.base, count, (uint32_t)(r + 1));
+		start = now_ns();
+		int_array_sort(&a, compare_u32);
+		elapsed += now_ns() - start;
+	}
+	int_array_reset(&a);
+	return elapsed;
+}
+
+static double legacy_iterate_bench(size_t count, size_t reps)
+{
+	double start;
+	uint64_t sum = 0;
+	struct legacy_dynarray a = { NULL, 0 };
+	for(size_t i = 0; i < count; i++)
+		*(uint32_t*)legacy_append(&a, sizeof(uint32_t)) = (uint32_t)i;
+
+	start = now_ns();
+	for(size_t r = 0; r < reps; r++) {
+		for(uint32_t* iter = a.base; iter < (uint32_t*)a.base + a.elements; iter++)
+			sum += *iter;
+	}
+	bench_sink += sum;
+	start = now_ns() - start;
+	free(a.base);
+	return start;
+}
+
+static double dynarray_iterate_bench(size_t count, size_t reps)
+{
+	double start;
+	uint64_t sum = 0;
+	uint32_t* iter;
+	struct int_array a;
+	int_array_init(&a);
+	for(size_t i = 0; i < count; i++)
+		*int_array_append(&a) = (uint32_t)i;
+
+	start = now_ns();
+	for(size_t r = 0; r < reps; r++) {
+		ARRAY_FOREACH(&a, iter)
+			sum += *iter;
+	}
+	bench_sink += sum;
+	start = now_ns() - start;
+	int_array_reset(&a);
+	return start;
+}
+
+static double best_of(bench_func func, size_t count, size_t reps)
+{
+	double best = 0;
+	for(int round = 0; round < ROUNDS; round++) {
+		double elapsed = func(count, reps);
+		if(round == 0 || elapsed < best)
+			best = elapsed;
+	}
+	return best / (double)(count * reps);
+}
+
+static void report(const char* name, size_t count, bench_func legacy, bench_func current, size_t reps)
+{
+	double before = best_of(legacy, count, reps);
+	double after = best_of(current, count, reps);
+	printf("%-16s %10zu %12.2f %12.2f %9.2fx\n", name, count, before, after, after > 0 ? before / after : 0);
+	fflush(stdout);
+}
+
+static void usage(const char* argv0)
+{
+	printf("Usage: %s [-m MAX_ELEMENTS]\n", argv0);
+}
+
+int main(int argc, char** argv)
+{
+	int opt;
+	size_t max_count = TARGET_ELEMENTS;
+
+	while((opt = getopt(argc, argv, "m:h")) != -1) {
+		switch(opt) {
+			case 'm':
+				max_count = (size_t)strtoul(optarg, NULL, 10);
+				break;
+			case 'h':
+				usage(argv[0]);
+				return 0;
+			default:
+				usage(argv[0]);
+				return 2;
+		}
+	}
+
+	printf("%-16s %10s %12s %12s %10s\n", "benchmark", "elements", "legacy ns/el", "ns/el", "speedup");
+	for(size_t count = 10; count <= max_count; count *= 10) {
+		size_t reps = TARGET_ELEMENTS / count;
+		report("append", count, legacy_append_bench, dynarray_append_bench, reps);
+		if(count <= INLINE_COUNT * 10)
+			report("append/inline", count, legacy_append_bench, inline_append_bench, reps);
+		report("append_n", count, legacy_append_bench, reserve_append_bench, reps);
+		report("sort", count, legacy_sort_bench, dynarray_sort_bench, reps > 100 ? reps / 100 : 1);
+		report("iterate", count, legacy_iterate_bench, dynarray_iterate_bench, reps);
+	}
+	return 0;
+}
@@ -0,0 +1,853 @@
+/**
+ * @file toolchain-bench.c
+ * @author Charles Grunwald <cgrunwald@gmail.com>
+ * @brief Compile and link throughput of the cross toolchain, per build profile.
+ *
+ * Generates a fixed corpus: C and C++ translation units with light, medium
+ * and heavy header use, plus a few thousand small functions spread over many
+ * objects that end up in one large link. Each profile (a name and the flags
+ * it adds to every compile and link) builds the corpus from scratch with the
+ * installed <triple>-gcc and <triple>-g++, and reports TUs/sec, link time,
+ * peak RSS of the compiler and the linker, and output size. A directory of
+ * real sources can be added to the compile phase with -r.
+ *
+ * Results are appended to a JSON lines history file. Each profile is compared
+ * against the median of its last few runs there, and a metric that moved past
+ * its threshold is reported as a regression with a non-zero exit status.
+ */
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <getopt.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#include "shared.h"
+#include "strutil.h"
+#include "strarray.h"
+#include "dynarray.h"
+#include "json.h"
+
+#ifndef CROSS_TRIPLE
+#	define CROSS_TRIPLE "x86_64-ubuntu16.04-linux-gnu"
+#endif
+
+#define PATH_SEP_CHR '/'
+
+#define DEFAULT_PROFILE "default=-O2"
+#define DEFAULT_HISTORY_DEPTH 5
+#define UNITS_PER_CLASS 16
+#define LINK_OBJECTS 64
+#define LINK_FUNCTIONS 200
+
+enum header_weight
+{
+	WEIGHT_LIGHT,
+	WEIGHT_MEDIUM,
+	WEIGHT_HEAVY,
+	WEIGHT_COUNT
+};
+
+static const char* const weight_names[WEIGHT_COUNT] = { "light", "medium", "heavy" };
+
+static const char* const c_headers[WEIGHT_COUNT] = {
+	"",
+	"#include <stdio.h>\n#include <stdlib.h>\n#include <string.h>\n#include <math.h>\n",
+	"#include <stdio.h>\n#include <stdlib.h>\n#include <string.h>\n#include <math.h>\n"
+	"#include <ctype.h>\n#include <errno.h>\n#include <fcntl.h>\n#include <unistd.h>\n"
+	"#include <pthread.h>\n#include <signal.h>\n#include <time.h>\n#include <locale.h>\n"
+	"#include <wchar.h>\n#include <regex.h>\n#include <dirent.h>\n#include <sys/stat.h>\n"
+	"#include <sys/socket.h>\n#include <netinet/in.h>\n#include <arpa/inet.h>\n#include <netdb.h>\n"
+};
+
+static const char* const cxx_headers[WEIGHT_COUNT] = {
+	"#include <cstdint>\n",
+	"#include <string>\n#include <vector>\n#include <memory>\n#include <algorithm>\n",
+	"#include <string>\n#include <vector>\n#include <memory>\n#include <algorithm>\n"
+	"#include <map>\n#include <unordered_map>\n#include <functional>\n#include <sstream>\n"
+	"#include <iostream>\n#include <regex>\n#include <thread>\n#include <chrono>\n"
+};
+
+// Metrics compared against the history; a positive direction means higher is worse.
+struct metric
+{
+	const char* key;
+	const char* label;
+	int direction;
+	double threshold;
+};
+
+enum metric_id
+{
+	METRIC_TUS,
+	METRIC_LINK,
+	METRIC_COMPILE_RSS,
+	METRIC_LINK_RSS,
+	METRIC_EXE_SIZE,
+	METRIC_OBJECT_SIZE,
+	METRIC_COUNT
+};
+
+static struct metric metrics[METRIC_COUNT] = {
+	{ "tus_per_sec",    "TUs/sec",          -1,  5.0 },
+	{ "link_s",         "link time",         1, 10.0 },
+	{ "compile_rss_kb", "compile peak RSS",  1, 10.0 },
+	{ "link_rss_kb",    "link peak RSS",     1, 10.0 },
+	{ "exe_bytes",      "executable size",   1,  2.0 },
+	{ "object_bytes",   "object size",       1,  2.0 },
+};
+
+struct profile
+{
+	char* name;
+	char* flags;
+	string_array* args;
+};
+
+DEFINE_ARRAY_TYPE(profile_array, struct profile)
+
+struct source
+{
+	char* path;
+	char* object;
+	bool cxx;
+};
+
+DEFINE_ARRAY_TYPE(source_array, struct source)
+
+struct bench
+{
+	const char* cc;
+	const char* cxx;
+	const char* real_dir;
+	const char* history;
+	char* work_dir;
+	int jobs;
+	int rounds;
+	int scale;
+	bool keep;
+	bool existed;
+	struct source_array sources;
+	struct profile_array profiles;
+};
+
+struct result
+{
+	size_t units;
+	double compile_s;
+	double values[METRIC_COUNT];
+};
+
+static CC_NORETURN fatal_message(int code, const char* format, ...)
+{
+	va_list args;
+	fprintf(stderr, "ERROR: ");
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+	fprintf(stderr, "\n");
+	exit(code != 0 ? code : 1);
+}
+
+static double now_seconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static unsigned long long file_size(const char* path)
+{
+	struct stat st;
+	return stat(path, &st) == 0 ? (unsigned long long)st.st_size : 0;
+}
+
+static string_array* split_flags(const char* flags)
+{
+	string_array* args = NULL;
+	char* copy = strdup(flags);
+	char* saveptr = NULL;
+
+	for(char* tok = strtok_r(copy, " \t", &saveptr); tok != NULL; tok = strtok_r(NULL, " \t", &saveptr))
+		args = string_array_push(args, strdup(tok));
+	free(copy);
+	return args;
+}
+
+static void add_profile(struct bench* bench, const char* spec)
+{
+	struct profile* profile;
+	const char* flags = strchr(spec, '=');
+
+	if(flags == NULL || flags == spec)
+		fatal_message(EINVAL, "Profiles are NAME=FLAGS, not '%s'", spec);
+	if((profile = profile_array_append0(&bench->profiles)) == NULL)
+		fatal_message(ENOMEM, "Out of memory");
+	profile->name = strndup(spec, (size_t)(flags - spec));
+	profile->flags = strdup(flags + 1);
+	profile->args = split_flags(profile->flags);
+}
+
+/*
+ * Corpus
+ */
+
+static FILE* create_file(const char* path)
+{
+	FILE* file = fopen(path, "w");
+	if(file == NULL)
+		fatal_message(errno, "Failed to create %s: %s", path, strerror(errno));
+	return file;
+}
+
+static void close_file(FILE* file, const char* path)
+{
+	if(ferror(file) || fclose(file) != 0)
+		fatal_message(errno, "Failed to write %s: %s", path, strerror(errno));
+}
+
+static void write_file(const char* path, const char* contents)
+{
+	FILE* file = create_file(path);
+	fputs(contents, file);
+	close_file(file, path);
+}
+
+static void add_source(struct bench* bench, char* path, bool cxx)
+{
+	struct source* source = source_array_append0(&bench->sources);
+	if(source == NULL)
+		fatal_message(ENOMEM, "Out of memory");
+	source->path = path;
+	source->cxx = cxx;
+}
+
+static char* c_unit(size_t index, enum header_weight weight)
+{
+	const char* body;
+
+	switch(weight) {
+		case WEIGHT_LIGHT:
+			body = "\tint acc = n;\n"
+			       "\tfor(int i = 0; i < n; i++)\n"
+			       "\t\tacc = acc * 31 + (i ^ (acc >> 7));\n"
+			       "\treturn acc;\n";
+			break;
+		case WEIGHT_MEDIUM:
+			body = "\tchar buffer[64];\n"
+			       "\tint* values = malloc(sizeof(int) * (size_t)(n + 1));\n"
+			       "\tfor(int i = 0; i <= n; i++)\n"
+			       "\t\tvalues[i] = (int)(sqrt((double)i) * 1000) ^ i;\n"
+			       "\tsnprintf(buffer, sizeof(buffer), \"%d\", values[n / 2]);\n"
+			       "\tfree(values);\n"
+			       "\treturn (int)strlen(buffer);\n";
+			break;
+		default:
+			body = "\tregex_t re;\n"
+			       "\tchar buffer[64];\n"
+			       "\tstruct sockaddr_in addr;\n"
+			       "\tmemset(&addr, 0, sizeof(addr));\n"
+			       "\taddr.sin_port = htons((uint16_t)n);\n"
+			       "\tsnprintf(buffer, sizeof(buffer), \"%d-%ld\", ntohs(addr.sin_port), (long)time(NULL));\n"
+			       "\tif(regcomp(&re, \"^[0-9]+-\", REG_EXTENDED) != 0)\n"
+			       "\t\treturn -1;\n"
+			       "\tn = regexec(&re, buffer, 0, NULL, 0) == 0 ? isdigit((unsigned char)buffer[0]) : 0;\n"
+			       "\tregfree(&re);\n"
+			       "\treturn n;\n";
+			break;
+	}
+	return sprintf_alloc("%s\nint c_unit_%zu(int n)\n{\n%s}\n", c_headers[weight], index, body);
+}
+
+static char* cxx_unit(size_t index, enum header_weight weight)
+{
+	const char* body;
+
+	switch(weight) {
+		case WEIGHT_LIGHT:
+			body = "\tstd::uint64_t acc = static_cast<std::uint64_t>(n);\n"
+			       "\tfor(int i = 0; i < n; i++)\n"
+			       "\t\tacc = acc * 31 + static_cast<std::uint64_t>(i);\n"
+			       "\treturn static_cast<int>(acc);\n";
+			break;
+		case WEIGHT_MEDIUM:
+			body = "\tstd::vector<std::string> names;\n"
+			       "\tfor(int i = 0; i < n; i++)\n"
+			       "\t\tnames.push_back(std::to_string(i * 7919 % 1000));\n"
+			       "\tstd::sort(names.begin(), names.end());\n"
+			       "\tauto unique = std::make_unique<std::vector<std::string>>(names.begin(),\n"
+			       "\t\tstd::unique(names.begin(), names.end()));\n"
+			       "\treturn static_cast<int>(unique->size());\n";
+			break;
+		default:
+			body = "\tstd::map<std::string, std::vector<int>> groups;\n"
+			       "\tstd::unordered_map<int, std::function<int(int)>> ops;\n"
+			       "\tops[0] = [](int x) { return x + 1; };\n"
+			       "\tfor(int i = 0; i < n; i++)\n"
+			       "\t\tgroups[std::to_string(i % 10)].push_back(ops[0](i));\n"
+			       "\tstd::ostringstream out;\n"
+			       "\tfor(const auto& group : groups)\n"
+			       "\t\tout << group.first << ':' << group.second.size() << ';';\n"
+			       "\tconst std::string text = out.str();\n"
+			       "\tstd::regex pattern(\"[0-9]+:[0-9]+;\");\n"
+			       "\tauto start = std::chrono::steady_clock::now();\n"
+			       "\tint matches = static_cast<int>(std::distance(\n"
+			       "\t\tstd::sregex_iterator(text.begin(), text.end(), pattern), std::sregex_iterator()));\n"
+			       "\tif(std::chrono::steady_clock::now() < start)\n"
+			       "\t\tstd::cerr << std::this_thread::get_id() << std::endl;\n"
+			       "\treturn matches;\n";
+			break;
+	}
+	return sprintf_alloc("%s\nextern \"C\" int cxx_unit_%zu(int n)\n{\n%s}\n", cxx_headers[weight], index, body);
+}
+
+static void write_link_unit(FILE* file, size_t index)
+{
+	fprintf(file, "static const unsigned table_%zu[1024] = { %zu };\n", index, index + 1);
+	for(size_t i = 0; i < LINK_FUNCTIONS; i++)
+		fprintf(file, "int link_%zu_%zu(int x)\n{\n\treturn (int)(table_%zu[(unsigned)x & 1023] + %zuu) ^ (x >> %zu);\n}\n",
+		        index, i, index, i, i % 7 + 1);
+}
+
+/*
+ * main() calls through a table of every function in the corpus, so nothing
+ * can be dropped at link time.
+ */
+static void write_main_unit(FILE* file, size_t c_units, size_t cxx_units, size_t link_units)
+{
+	for(size_t i = 0; i < c_units; i++)
+		fprintf(file, "int c_unit_%zu(int);\n", i);
+	for(size_t i = 0; i < cxx_units; i++)
+		fprintf(file, "int cxx_unit_%zu(int);\n", i);
+	for(size_t i = 0; i < link_units; i++) {
+		for(size_t j = 0; j < LINK_FUNCTIONS; j++)
+			fprintf(file, "int link_%zu_%zu(int);\n", i, j);
+	}
+
+	fprintf(file, "\nstatic int (*const functions[])(int) = {\n");
+	for(size_t i = 0; i < c_units; i++)
+		fprintf(file, "\tc_unit_%zu,\n", i);
+	for(size_t i = 0; i < cxx_units; i++)
+		fprintf(file, "\tcxx_unit_%zu,\n", i);
+	for(size_t i = 0; i < link_units; i++) {
+		for(size_t j = 0; j < LINK_FUNCTIONS; j++)
+			fprintf(file, "\tlink_%zu_%zu,\n", i, j);
+	}
+	fprintf(file, "};\n\nint main(int argc, char** argv)\n{\n\tint sum = 0;\n\t(void)argv;\n"
+	              "\tfor(unsigned i = 0; i < sizeof(functions) / sizeof(functions[0]); i++)\n"
+	              "\t\tsum += functions[i](argc);\n\treturn sum == 42;\n}\n");
+}
+
+static void add_real_sources(struct bench* bench, const char* dir)
+{
+	struct dirent* entry;
+	DIR* handle = opendir(dir);
+
+	if(handle == NULL)
+		fatal_message(errno, "Failed to read %s: %s", dir, strerror(errno));
+	while((entry = readdir(handle)) != NULL) {
+		char* path;
+		const char* ext;
+		struct stat st;
+
+		if(entry->d_name[0] == '.')
+			continue;
+		path = sprintf_alloc("%s/%s", dir, entry->d_name);
+		if(path == NULL || stat(path, &st) != 0) {
+			free(path);
+			continue;
+		}
+		if(S_ISDIR(st.st_mode)) {
+			add_real_sources(bench, path);
+			free(path);
+			continue;
+		}
+		ext = strrchr(entry->d_name, '.');
+		if(ext != NULL && strcmp(ext, ".c") == 0)
+			add_source(bench, path, false);
+		else if(ext != NULL && (strcmp(ext, ".cc") == 0 || strcmp(ext, ".cpp") == 0 || strcmp(ext, ".cxx") == 0))
+			add_source(bench, path, true);
+		else
+			free(path);
+	}
+	closedir(handle);
+}
+
+static size_t generate_corpus(struct bench* bench, size_t* link_sources)
+{
+	FILE* file;
+	char* path;
+	char* text;
+	size_t units = (size_t)bench->scale * UNITS_PER_CLASS;
+	size_t links = (size_t)bench->scale * LINK_OBJECTS;
+	size_t index = 0;
+
+	for(int weight = 0; weight < WEIGHT_COUNT; weight++) {
+		for(size_t i = 0; i < units; i++, index++) {
+			path = sprintf_alloc("%s/c_%s_%zu.c", bench->work_dir, weight_names[weight], i);
+			text = c_unit(index, (enum header_weight)weight);
+			write_file(path, text);
+			free(text);
+			add_source(bench, path, false);
+		}
+	}
+	index = 0;
+	for(int weight = 0; weight < WEIGHT_COUNT; weight++) {
+		for(size_t i = 0; i < units; i++, index++) {
+			path = sprintf_alloc("%s/cxx_%s_%zu.cpp", bench->work_dir, weight_names[weight], i);
+			text = cxx_unit(index, (enum header_weight)weight);
+			write_file(path, text);
+			free(text);
+			add_source(bench, path, true);
+		}
+	}
+	for(size_t i = 0; i < links; i++) {
+		path = sprintf_alloc("%s/link_%zu.c", bench->work_dir, i);
+		file = create_file(path);
+		write_link_unit(file, i);
+		close_file(file, path);
+		add_source(bench, path, false);
+	}
+	path = sprintf_alloc("%s/main.c", bench->work_dir);
+	file = create_file(path);
+	write_main_unit(file, units * WEIGHT_COUNT, units * WEIGHT_COUNT, links);
+	close_file(file, path);
+	add_source(bench, path, false);
+
+	// Everything so far goes into the link; real sources are compiled only.
+	*link_sources = bench->sources.base.elements;
+	if(bench->real_dir != NULL)
+		add_real_sources(bench, bench->real_dir);
+	return bench->sources.base.elements;
+}
+
+/*
+ * Running the toolchain
+ */
+
+static pid_t spawn(char** argv)
+{
+	int fd;
+	pid_t pid = fork();
+
+	if(pid != 0)
+		return pid;
+	if((fd = open("/dev/null", O_WRONLY)) >= 0) {
+		dup2(fd, STDOUT_FILENO);
+		close(fd);
+	}
+	execvp(argv[0], argv);
+	fprintf(stderr, "ERROR: Failed to run %s: %s\n", argv[0], strerror(errno));
+	_exit(127);
+}
+
+static bool reap(long* peak_rss_kb)
+{
+	int status;
+	struct rusage usage;
+
+	while(wait4(-1, &status, 0, &usage) < 0) {
+		if(errno != EINTR)
+			return false;
+	}
+	if(usage.ru_maxrss > *peak_rss_kb)
+		*peak_rss_kb = usage.ru_maxrss;
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static char** compile_argv(const struct bench* bench, const struct profile* profile, const struct source* source)
+{
+	size_t argi = 0;
+	size_t nflags = profile->args != NULL ? profile->args->len : 0;
+	char** argv = (char**)calloc(nflags + 10, sizeof(char*));
+
+	argv[argi++] = (char*)(source->cxx ? bench->cxx : bench->cc);
+	for(size_t i = 0; i < nflags; i++)
+		argv[argi++] = profile->args->ptr[i];
+	if(bench->real_dir != NULL) {
+		argv[argi++] = "-I";
+		argv[argi++] = (char*)bench->real_dir;
+	}
+	argv[argi++] = "-c";
+	argv[argi++] = source->path;
+	argv[argi++] = "-o";
+	argv[argi++] = source->object;
+	return argv;
+}
+
+static bool compile_all(const struct bench* bench, const struct profile* profile, long* peak_rss_kb)
+{
+	int running = 0;
+	bool ok = true;
+	struct source* source;
+
+	ARRAY_FOREACH(&bench->sources, source) {
+		char** argv;
+		if(running >= bench->jobs) {
+			ok = reap(peak_rss_kb) && ok;
+			running--;
+		}
+		if(!ok)
+			break;
+		argv = compile_argv(bench, profile, source);
+		if(spawn(argv) > 0)
+			running++;
+		else
+			ok = false;
+		free(argv);
+	}
+	for(; running > 0; running--)
+		ok = reap(peak_rss_kb) && ok;
+	return ok;
+}
+
+static bool link_all(const struct bench* bench, const struct profile* profile, size_t link_sources,
+                     const char* output, long* peak_rss_kb)
+{
+	size_t argi = 0;
+	size_t nflags = profile->args != NULL ? profile->args->len : 0;
+	char** argv = (char**)calloc(nflags + link_sources + 8, sizeof(char*));
+	struct source* sources = (struct source*)bench->sources.base.base;
+	bool ok;
+
+	argv[argi++] = (char*)bench->cxx;
+	for(size_t i = 0; i < nflags; i++)
+		argv[argi++] = profile->args->ptr[i];
+	for(size_t i = 0; i < link_sources; i++)
+		argv[argi++] = sources[i].object;
+	argv[argi++] = "-o";
+	argv[argi++] = (char*)output;
+	argv[argi++] = "-lpthread";
+	ok = spawn(argv) > 0 && reap(peak_rss_kb);
+	free(argv);
+	return ok;
+}
+
+static bool run_profile(struct bench* bench, const struct profile* profile, size_t link_sources, struct result* result)
+{
+	char* dir = sprintf_alloc("%s/%s", bench->work_dir, profile->name);
+	char* output = sprintf_alloc("%s/bench-link", dir);
+	struct source* source;
+
+	memset((void*)result, 0, sizeof(*result));
+	mkdir(dir, 0755);
+	ARRAY_FOREACH(&bench->sources, source) {
+		const char* base = strrchr(source->path, PATH_SEP_CHR) + 1;
+		free(source->object);
+		source->object = sprintf_alloc("%s/%zu-%s.o", dir, (size_t)(source - (struct source*)bench->sources.base.base), base);
+	}
+
+	// Best of the rounds for times, worst for memory.
+	for(int round = 0; round < bench->rounds; round++) {
+		long compile_rss = 0, link_rss = 0;
+		double start = now_seconds(), compile_s, link_s;
+
+		if(!compile_all(bench, profile, &compile_rss)) {
+			fprintf(stderr, "ERROR: %s: compiling the corpus failed\n", profile->name);
+			return false;
+		}
+		compile_s = now_seconds() - start;
+		start = now_seconds();
+		if(!link_all(bench, profile, link_sources, output, &link_rss)) {
+			fprintf(stderr, "ERROR: %s: linking the corpus failed\n", profile->name);
+			return false;
+		}
+		link_s = now_seconds() - start;
+
+		if(round == 0 || compile_s < result->compile_s)
+			result->compile_s = compile_s;
+		if(round == 0 || link_s < result->values[METRIC_LINK])
+			result->values[METRIC_LINK] = link_s;
+		if((double)compile_rss > result->values[METRIC_COMPILE_RSS])
+			result->values[METRIC_COMPILE_RSS] = (double)compile_rss;
+		if((double)link_rss > result->values[METRIC_LINK_RSS])
+			result->values[METRIC_LINK_RSS] = (double)link_rss;
+	}
+
+	result->units = bench->sources.base.elements;
+	result->values[METRIC_TUS] = result->compile_s > 0 ? (double)result->units / result->compile_s : 0;
+	result->values[METRIC_EXE_SIZE] = (double)file_size(output);
+	ARRAY_FOREACH(&bench->sources, source)
+		result->values[METRIC_OBJECT_SIZE] += (double)file_size(source->object);
+	free(output);
+	free(dir);
+	return true;
+}
+
+/*
+ * History
+ */
+
+static void write_json_string(FILE* file, const char* value)
+{
+	fputc('"', file);
+	for(const unsigned char* p = (const unsigned char*)value; *p != '\0'; p++) {
+		if(*p == '"' || *p == '\\')
+			fprintf(file, "\\%c", *p);
+		else if(*p < 0x20)
+			fprintf(file, "\\u%04x", *p);
+		else
+			fputc(*p, file);
+	}
+	fputc('"', file);
+}
+
+static void append_history(const struct bench* bench, const struct profile* profile, const struct result* result)
+{
+	FILE* file = fopen(bench->history, "a");
+
+	if(file == NULL) {
+		fprintf(stderr, "WARNING: Failed to open %s: %s\n", bench->history, strerror(errno));
+		return;
+	}
+	fprintf(file, "{\"time\":%lld,\"profile\":", (long long)time(NULL));
+	write_json_string(file, profile->name);
+	fprintf(file, ",\"flags\":");
+	write_json_string(file, profile->flags);
+	fprintf(file, ",\"cc\":");
+	write_json_string(file, bench->cc);
+	fprintf(file, ",\"cxx\":");
+	write_json_string(file, bench->cxx);
+	fprintf(file, ",\"scale\":%d,\"units\":%zu,\"compile_s\":%.4f", bench->scale, result->units, result->compile_s);
+	for(int i = 0; i < METRIC_COUNT; i++)
+		fprintf(file, ",\"%s\":%.4f", metrics[i].key, result->values[i]);
+	fprintf(file, "}\n");
+	fclose(file);
+}
+
+static int compare_doubles(const void* a, const void* b)
+{
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+static double json_number(const struct json_value* value)
+{
+	return value != NULL && value->type == JSON_NUMBER ? value->number : 0;
+}
+
+/*
+ * The median of each metric over the last runs of the same profile, flags
+ * and scale. Returns how many runs that was.
+ */
+static size_t history_baseline(const struct bench* bench, const struct profile* profile, double* baseline)
+{
+	double samples[METRIC_COUNT][DEFAULT_HISTORY_DEPTH];
+	size_t count = 0;
+	char* line = NULL;
+	size_t line_size = 0;
+	ssize_t len;
+	FILE* file = fopen(bench->history, "r");
+
+	if(file == NULL)
+		return 0;
+	while((len = getline(&line, &line_size, file)) > 0) {
+		struct json_value* entry = NULL;
+		const char* name;
+		const char* flags;
+
+		if(json_parse(line, (size_t)len, &entry) != 0)
+			continue;
+		name = json_string(json_get(entry, "profile"));
+		flags = json_string(json_get(entry, "flags"));
+		if(name != NULL && flags != NULL && strcmp(name, profile->name) == 0 && strcmp(flags, profile->flags) == 0 &&
+		   (int)json_number(json_get(entry, "scale")) == bench->scale) {
+			for(int i = 0; i < METRIC_COUNT; i++)
+				samples[i][count % DEFAULT_HISTORY_DEPTH] = json_number(json_get(entry, metrics[i].key));
+			count++;
+		}
+		json_free(entry);
+	}
+	free(line);
+	fclose(file);
+
+	if(count > DEFAULT_HISTORY_DEPTH)
+		count = DEFAULT_HISTORY_DEPTH;
+	for(int i = 0; count > 0 && i < METRIC_COUNT; i++) {
+		qsort(samples[i], count, sizeof(double), compare_doubles);
+		baseline[i] = count % 2 ? samples[i][count / 2] : (samples[i][count / 2 - 1] + samples[i][count / 2]) / 2;
+	}
+	return count;
+}
+
+static int check_regressions(const struct profile* profile, const struct result* result, const double* baseline)
+{
+	int regressions = 0;
+
+	for(int i = 0; i < METRIC_COUNT; i++) {
+		double change;
+		if(baseline[i] <= 0)
+			continue;
+		change = (result->values[i] - baseline[i]) / baseline[i] * 100.0;
+		if(change * metrics[i].direction > metrics[i].threshold) {
+			printf("REGRESSION: %s: %s %.4g vs %.4g baseline (%+.1f%%, threshold %.1f%%)\n", profile->name,
+			       metrics[i].label, result->values[i], baseline[i], change, metrics[i].threshold);
+			regressions++;
+		}
+	}
+	return regressions;
+}
+
+/*
+ * METRIC=PERCENT,... using the history keys.
+ */
+static void parse_thresholds(const char* spec)
+{
+	char* copy = strdup(spec);
+	char* saveptr = NULL;
+
+	for(char* tok = strtok_r(copy, ",", &saveptr); tok != NULL; tok = strtok_r(NULL, ",", &saveptr)) {
+		char* value = strchr(tok, '=');
+		int i;
+		if(value != NULL)
+			*value++ = '\0';
+		for(i = 0; i < METRIC_COUNT && strcmp(tok, metrics[i].key) != 0; i++)
+			;
+		if(value == NULL || i == METRIC_COUNT)
+			fatal_message(EINVAL, "Unknown threshold '%s'", tok);
+		metrics[i].threshold = strtod(value, NULL);
+	}
+	free(copy);
+}
+
+// The work directory is removed afterwards, so it must not hold anything else.
+static bool is_empty_folder(const char* dir)
+{
+	struct dirent* entry;
+	bool empty = true;
+	DIR* handle = opendir(dir);
+
+	if(handle == NULL)
+		return false;
+	while(empty && (entry = readdir(handle)) != NULL)
+		empty = strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0;
+	closedir(handle);
+	return empty;
+}
+
+static void usage(const char* argv0)
+{
+	printf("Usage: %s [-p NAME=FLAGS]... [-c CC] [-x CXX] [-r DIR] [-j JOBS] [-s SCALE]\n", argv0);
+	printf("       %*s [-n ROUNDS] [-H HISTORY] [-t METRIC=PERCENT,...] [-w DIR] [-k]\n\n", (int)strlen(argv0), "");
+	printf("  -p NAME=FLAGS  Build profile; FLAGS go to every compile and link (default: " DEFAULT_PROFILE ")\n");
+	printf("  -c CC, -x CXX  Compilers (default: " CROSS_TRIPLE "-gcc, " CROSS_TRIPLE "-g++)\n");
+	printf("  -r DIR         Also compile the C and C++ sources under DIR\n");
+	printf("  -j JOBS        Concurrent compiles (default: online CPUs)\n");
+	printf("  -s SCALE       Corpus size multiplier (default: 1)\n");
+	printf("  -n ROUNDS      Builds per profile; the best times are kept (default: 1)\n");
+	printf("  -H HISTORY     JSON lines file results are compared against and appended to\n");
+	printf("  -t THRESHOLDS  Regression thresholds in percent, by history key\n");
+	printf("  -w DIR         Work directory, new or empty (default: a temporary one)\n");
+	printf("  -k             Keep the work directory\n");
+}
+
+int main(int argc, char** argv)
+{
+	int opt, regressions = 0;
+	size_t link_sources = 0;
+	struct bench bench;
+	struct profile* profile;
+	struct source* source;
+
+	memset((void*)&bench, 0, sizeof(bench));
+	bench.cc = CROSS_TRIPLE "-gcc";
+	bench.cxx = CROSS_TRIPLE "-g++";
+	bench.jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	bench.rounds = 1;
+	bench.scale = 1;
+	profile_array_init(&bench.profiles);
+	source_array_init(&bench.sources);
+
+	while((opt = getopt(argc, argv, "p:c:x:r:j:s:n:H:t:w:kh")) != -1) {
+		switch(opt) {
+			case 'p': add_profile(&bench, optarg); break;
+			case 'c': bench.cc = optarg; break;
+			case 'x': bench.cxx = optarg; break;
+			case 'r': bench.real_dir = optarg; break;
+			case 'j': bench.jobs = atoi(optarg); break;
+			case 's': bench.scale = atoi(optarg); break;
+			case 'n': bench.rounds = atoi(optarg); break;
+			case 'H': bench.history = optarg; break;
+			case 't': parse_thresholds(optarg); break;
+			case 'w': bench.work_dir = strdup(optarg); break;
+			case 'k': bench.keep = true; break;
+			case 'h':
+				usage(argv[0]);
+				return 0;
+			default:
+				usage(argv[0]);
+				return 2;
+		}
+	}
+	if(bench.profiles.base.elements == 0)
+		add_profile(&bench, DEFAULT_PROFILE);
+	if(bench.jobs < 1)
+		bench.jobs = 1;
+	if(bench.scale < 1)
+		bench.scale = 1;
+	if(bench.rounds < 1)
+		bench.rounds = 1;
+
+	if(bench.work_dir == NULL) {
+		char* tmpdir = getenv("TMPDIR");
+		bench.work_dir = sprintf_alloc("%s/toolchain-bench.XXXXXX", tmpdir != NULL ? tmpdir : "/tmp");
+		if(mkdtemp(bench.work_dir) == NULL)
+			fatal_message(errno, "Failed to create a work directory: %s", strerror(errno));
+	} else if(mkdir(bench.work_dir, 0755) != 0) {
+		if(errno != EEXIST)
+			fatal_message(errno, "Failed to create %s: %s", bench.work_dir, strerror(errno));
+		if(!is_empty_folder(bench.work_dir))
+			fatal_message(EEXIST, "Work directory %s isn't empty", bench.work_dir);
+		bench.existed = true;
+	}
+
+	generate_corpus(&bench, &link_sources);
+	printf("%zu TUs (%zu in the link), %d jobs, %s / %s\n\n", bench.sources.base.elements, link_sources,
+	       bench.jobs, bench.cc, bench.cxx);
+	printf("%-12s %8s %9s %8s %12s %12s %12s %12s\n", "profile", "TUs/sec", "compile", "link",
+	       "compile RSS", "link RSS", "exe size", "objects");
+	fflush(stdout);
+
+	ARRAY_FOREACH(&bench.profiles, profile) {
+		struct result result;
+		double baseline[METRIC_COUNT] = { 0 };
+
+		if(!run_profile(&bench, profile, link_sources, &result)) {
+			regressions++;
+			continue;
+		}
+		printf("%-12s %8.1f %8.2fs %7.2fs %9.1f MB %9.1f MB %9.1f MB %9.1f MB\n", profile->name,
+		       result.values[METRIC_TUS], result.compile_s, result.values[METRIC_LINK],
+		       result.values[METRIC_COMPILE_RSS] / 1024, result.values[METRIC_LINK_RSS] / 1024,
+		       result.values[METRIC_EXE_SIZE] / (1024 * 1024), result.values[METRIC_OBJECT_SIZE] / (1024 * 1024));
+		if(bench.history != NULL) {
+			if(history_baseline(&bench, profile, baseline) > 0)
+				regressions += check_regressions(profile, &result, baseline);
+			append_history(&bench, profile, &result);
+		}
+		fflush(stdout);
+	}
+
+	if(!bench.keep) {
+		remove_tree(bench.work_dir);
+		// Leave an existing -w directory behind, empty as it was given
+		if(bench.existed)
+			mkdir(bench.work_dir, 0755);
+	}
+	ARRAY_FOREACH(&bench.sources, source) {
+		free(source->path);
+		free(source->object);
+	}
+	ARRAY_FOREACH(&bench.profiles, profile) {
+		free(profile->name);
+		free(profile->flags);
+		string_array_free(profile->args);
+	}
+	source_array_reset(&bench.sources);
+	profile_array_reset(&bench.profiles);
+	free(bench.work_dir);
+	return regressions > 0 ? 1 : 0;
+}
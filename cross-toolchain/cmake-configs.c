@@ -0,0 +1,399 @@
+/**
+ * @file cmake-configs.c
+ * @author Charles Grunwald <cgrunwald@gmail.com>
+ * @brief Concurrent multi-configuration configures for the cross-cmake wrapper.
+ *
+ * The cmake command line is resolved once and shared by every variant; only
+ * the build directory and CMAKE_BUILD_TYPE differ. Trees that were already
+ * configured are reconfigured concurrently right away. Of the new ones, the
+ * first is configured on its own, and its system and compiler detection
+ * (CMakeFiles/<version>/ plus the cache entries that mark it as done) seeds
+ * the rest, which then configure concurrently without rerunning compiler
+ * identification or the ABI checks.
+ *
+ * Each variant's output goes to cmake-configure.log in its build directory;
+ * only a line per finished variant is printed.
+ */
+#include <ctype.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#include "shared.h"
+#include "strutil.h"
+#include "dynarray.h"
+#include "libcross.h"
+#include "cmake-configs.h"
+
+#define JOBS_ENVNAME "CROSS_CMAKE_JOBS"
+#define LOG_NAME "cmake-configure.log"
+#define CACHE_NAME "CMakeCache.txt"
+#define BUILD_TYPE_ARG "-DCMAKE_BUILD_TYPE="
+#define DEFAULT_JOBS 4
+
+// Cache entries copied from the leader, so the seeded trees skip detection
+// and don't report the toolchain file as an unused variable.
+static const char* const seed_cache_keys[] = {
+	"CMAKE_PLATFORM_INFO_INITIALIZED", "CMAKE_TOOLCHAIN_FILE", NULL
+};
+
+enum variant_state
+{
+	VARIANT_BLOCKED,
+	VARIANT_PENDING,
+	VARIANT_RUNNING,
+	VARIANT_DONE
+};
+
+struct variant
+{
+	char* config;
+	char* build_dir;
+	char* build_type_arg;
+	enum variant_state state;
+	bool leader;
+	pid_t pid;
+	int status;
+	double started;
+};
+
+DEFINE_ARRAY_TYPE(variant_array, struct variant)
+
+static double now_seconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static bool has_cache(const struct variant* variant)
+{
+	char path[PATH_MAX];
+	snprintf(path, PATH_MAX, "%s/" CACHE_NAME, variant->build_dir);
+	return is_regular_file(path);
+}
+
+static void variants_reset(struct variant_array* variants)
+{
+	struct variant* variant;
+	ARRAY_FOREACH(variants, variant) {
+		free(variant->config);
+		free(variant->build_dir);
+		free(variant->build_type_arg);
+	}
+	variant_array_reset(variants);
+}
+
+/*
+ * CONFIG[=BUILD_DIR],... where BUILD_DIR defaults to build-<config>.
+ */
+static bool parse_variants(const char* spec, struct variant_array* variants)
+{
+	char* list = strdup(spec);
+	char* saveptr = NULL;
+	char* tok;
+
+	if(list == NULL)
+		return false;
+	for(tok = strtok_r(list, ",", &saveptr); tok != NULL; tok = strtok_r(NULL, ",", &saveptr)) {
+		struct variant* variant;
+		char* dir = strchr(tok, '=');
+
+		if(dir != NULL)
+			*dir++ = '\0';
+		if(*tok == '\0' || (dir != NULL && *dir == '\0'))
+			break;
+		if((variant = variant_array_append0(variants)) == NULL)
+			break;
+		variant->config = strdup(tok);
+		variant->build_dir = dir != NULL ? strdup(dir) : sprintf_alloc("build-%s", tok);
+		variant->build_type_arg = sprintf_alloc(BUILD_TYPE_ARG "%s", tok);
+		if(variant->config == NULL || variant->build_dir == NULL || variant->build_type_arg == NULL)
+			break;
+		if(dir == NULL) {
+			for(char* p = variant->build_dir; *p != '\0'; p++)
+				*p = (char)tolower((unsigned char)*p);
+		}
+	}
+	free(list);
+	return tok == NULL && variants->base.elements > 0;
+}
+
+static bool copy_file(const char* source, const char* dest)
+{
+	char buffer[16 * 1024];
+	ssize_t count = 0;
+	int in, out;
+
+	if((in = open(source, O_RDONLY | O_CLOEXEC)) < 0)
+		return false;
+	if((out = open(dest, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0) {
+		close(in);
+		return false;
+	}
+	while((count = read(in, buffer, sizeof(buffer))) > 0) {
+		if(write(out, buffer, (size_t)count) != count) {
+			count = -1;
+			break;
+		}
+	}
+	close(in);
+	close(out);
+	return count == 0;
+}
+
+/*
+ * Copy the files directly under the leader's CMakeFiles/<version>/ and the
+ * cache entries that say detection already ran. Compiler ID trees below it
+ * are only kept for reference and aren't needed.
+ */
+static bool seed_variant(const struct variant* leader, const struct variant* variant)
+{
+	char source[PATH_MAX], dest[PATH_MAX], line[PATH_MAX + 256];
+	bool seeded = false;
+	struct dirent* entry;
+	DIR* dir;
+	FILE* in;
+	FILE* out;
+
+	snprintf(source, PATH_MAX, "%s/CMakeFiles", leader->build_dir);
+	if((dir = opendir(source)) == NULL)
+		return false;
+	while((entry = readdir(dir)) != NULL) {
+		struct dirent* file;
+		DIR* version;
+
+		if(!isdigit((unsigned char)entry->d_name[0]))
+			continue;
+		snprintf(source, PATH_MAX, "%s/CMakeFiles/%s", leader->build_dir, entry->d_name);
+		snprintf(dest, PATH_MAX, "%s/CMakeFiles/%s", variant->build_dir, entry->d_name);
+		if((version = opendir(source)) == NULL || mkdir_p(dest, 0755) != 0) {
+			if(version != NULL)
+				closedir(version);
+			continue;
+		}
+		while((file = readdir(version)) != NULL) {
+			snprintf(source, PATH_MAX, "%s/CMakeFiles/%s/%s", leader->build_dir, entry->d_name, file->d_name);
+			snprintf(dest, PATH_MAX, "%s/CMakeFiles/%s/%s", variant->build_dir, entry->d_name, file->d_name);
+			if(is_regular_file(source))
+				seeded = copy_file(source, dest) || seeded;
+		}
+		closedir(version);
+	}
+	closedir(dir);
+	if(!seeded)
+		return false;
+
+	snprintf(source, PATH_MAX, "%s/" CACHE_NAME, leader->build_dir);
+	snprintf(dest, PATH_MAX, "%s/" CACHE_NAME, variant->build_dir);
+	if((in = fopen(source, "r")) == NULL)
+		return false;
+	if((out = fopen(dest, "w")) == NULL) {
+		fclose(in);
+		return false;
+	}
+	while(fgets(line, sizeof(line), in) != NULL) {
+		for(size_t i = 0; seed_cache_keys[i] != NULL; i++) {
+			size_t len = strlen(seed_cache_keys[i]);
+			if(strncmp(line, seed_cache_keys[i], len) == 0 && line[len] == ':') {
+				fputs(line, out);
+				break;
+			}
+		}
+	}
+	fclose(in);
+	return fclose(out) == 0;
+}
+
+/*
+ * The build directory and build type are the last two arguments of the
+ * shared command line; the child fills them in.
+ */
+static pid_t start_variant(struct variant* variant, int child_argc, char** child_argv)
+{
+	char log_path[PATH_MAX];
+	pid_t pid;
+	int fd;
+
+	if(mkdir_p(variant->build_dir, 0755) != 0)
+		return -errno;
+	snprintf(log_path, PATH_MAX, "%s/" LOG_NAME, variant->build_dir);
+	fflush(stdout);
+	if((pid = fork()) != 0)
+		return pid < 0 ? -errno : pid;
+
+	if((fd = open(log_path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) >= 0) {
+		dup2(fd, STDOUT_FILENO);
+		dup2(fd, STDERR_FILENO);
+		close(fd);
+	}
+	if((fd = open("/dev/null", O_RDONLY)) >= 0) {
+		dup2(fd, STDIN_FILENO);
+		close(fd);
+	}
+	child_argv[child_argc - 2] = variant->build_dir;
+	child_argv[child_argc - 1] = variant->build_type_arg;
+	execv(child_argv[0], child_argv);
+	fprintf(stderr, "ERROR: Failed to run %s: %s\n", child_argv[0], strerror(errno));
+	_exit(127);
+}
+
+static void finish_variant(struct variant* variant, int status)
+{
+	double seconds = now_seconds() - variant->started;
+
+	variant->state = VARIANT_DONE;
+	variant->status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+	if(variant->status == 0)
+		printf("-- [%s] Configured %s in %.2fs\n", variant->config, variant->build_dir, seconds);
+	else
+		printf("-- [%s] Configure FAILED (%d) after %.2fs, see %s/" LOG_NAME "\n",
+		       variant->config, variant->status, seconds, variant->build_dir);
+	fflush(stdout);
+}
+
+/*
+ * Once the leader is done, seed the trees waiting on it. If it failed they
+ * detect on their own, since the failure may be specific to its config.
+ */
+static void release_blocked(struct variant_array* variants, const struct variant* leader)
+{
+	struct variant* variant;
+	ARRAY_FOREACH(variants, variant) {
+		if(variant->state != VARIANT_BLOCKED)
+			continue;
+		if(leader->status == 0 && mkdir_p(variant->build_dir, 0755) == 0 && !seed_variant(leader, variant))
+			fprintf(stderr, "WARNING: Failed to seed %s from %s\n", variant->build_dir, leader->build_dir);
+		variant->state = VARIANT_PENDING;
+	}
+}
+
+static int run_variants(struct variant_array* variants, int jobs, int child_argc, char** child_argv)
+{
+	int running = 0, failed = 0, status;
+	struct variant* variant;
+	pid_t pid;
+
+	for(;;) {
+		ARRAY_FOREACH(variants, variant) {
+			if(running >= jobs)
+				break;
+			if(variant->state != VARIANT_PENDING)
+				continue;
+			variant->started = now_seconds();
+			if((pid = start_variant(variant, child_argc, child_argv)) < 0) {
+				fprintf(stderr, "ERROR: Failed to configure %s: %s\n", variant->build_dir, strerror((int)-pid));
+				variant->state = VARIANT_DONE;
+				variant->status = 1;
+				failed++;
+				if(variant->leader)
+					release_blocked(variants, variant);
+				continue;
+			}
+			variant->pid = pid;
+			variant->state = VARIANT_RUNNING;
+			running++;
+		}
+		if(running == 0)
+			break;
+
+		if((pid = waitpid(-1, &status, 0)) < 0) {
+			if(errno == EINTR)
+				continue;
+			break;
+		}
+		ARRAY_FOREACH(variants, variant) {
+			if(variant->state != VARIANT_RUNNING || variant->pid != pid)
+				continue;
+			running--;
+			finish_variant(variant, status);
+			if(variant->status != 0)
+				failed++;
+			if(variant->leader)
+				release_blocked(variants, variant);
+			break;
+		}
+	}
+	return failed;
+}
+
+static int default_jobs(void)
+{
+	struct cross_host_resources resources;
+	const char* value = getenv(JOBS_ENVNAME);
+	int jobs = value != NULL ? atoi(value) : 0;
+
+	if(jobs > 0)
+		return jobs;
+	cross_query_host_resources(&resources);
+	return resources.cpus > 0 ? (int)resources.cpus : DEFAULT_JOBS;
+}
+
+int cmake_configs(struct cross_context* ctx, const struct cross_paths* paths, int argc, char** argv)
+{
+	int code, failed, jobs, argi = 1, child_argc = 0;
+	char** template_argv;
+	char** child_argv = NULL;
+	struct variant* variant;
+	struct variant* leader = NULL;
+	struct variant_array variants;
+
+	variant_array_init(&variants);
+	if(argc < 1 || !parse_variants(argv[0], &variants)) {
+		fprintf(stderr, "ERROR: " CMAKE_CONFIGS_ARG " takes CONFIG[=BUILD_DIR][,CONFIG[=BUILD_DIR]...]\n");
+		variants_reset(&variants);
+		return 2;
+	}
+	jobs = default_jobs();
+	if(argi + 1 < argc && strcmp(argv[argi], "-j") == 0) {
+		jobs = atoi(argv[argi + 1]) > 0 ? atoi(argv[argi + 1]) : jobs;
+		argi += 2;
+	}
+	for(int i = argi; i < argc; i++) {
+		if(strncmp(argv[i], "-B", 2) == 0 || strncmp(argv[i], BUILD_TYPE_ARG, sizeof(BUILD_TYPE_ARG) - 1) == 0) {
+			fprintf(stderr, "ERROR: %s can't be combined with " CMAKE_CONFIGS_ARG "; use CONFIG=BUILD_DIR\n", argv[i]);
+			variants_reset(&variants);
+			return 2;
+		}
+	}
+
+	// [cmake] CMAKE_ARGS... -B <build dir> <build type>, resolved once.
+	template_argv = (char**)calloc((size_t)(argc - argi) + 4, sizeof(char*));
+	if(template_argv == NULL) {
+		variants_reset(&variants);
+		return ENOMEM;
+	}
+	template_argv[0] = CMAKE_CONFIGS_ARG;
+	memcpy((void*)(template_argv + 1), (void*)(argv + argi), sizeof(char*) * (size_t)(argc - argi));
+	template_argv[argc - argi + 1] = "-B";
+	template_argv[argc - argi + 2] = "";
+	template_argv[argc - argi + 3] = BUILD_TYPE_ARG;
+	code = cross_cmake_argv(ctx, paths, argc - argi + 4, template_argv, &child_argc, &child_argv);
+	free(template_argv);
+	if(code != CROSS_OK) {
+		fprintf(stderr, "ERROR: %s\n", cross_context_error(ctx));
+		variants_reset(&variants);
+		return cross_exit_code(ctx);
+	}
+
+	ARRAY_FOREACH(&variants, variant) {
+		if(has_cache(variant)) {
+			variant->state = VARIANT_PENDING;
+		} else if(leader == NULL) {
+			leader = variant;
+			variant->leader = true;
+			variant->state = VARIANT_PENDING;
+		} else {
+			variant->state = VARIANT_BLOCKED;
+		}
+	}
+	if(leader != NULL)
+		printf("-- Detecting the toolchain in %s\n", leader->build_dir);
+	fflush(stdout);
+
+	failed = run_variants(&variants, jobs, child_argc, child_argv);
+	cross_free_argv(ctx, child_argc, child_argv);
+	variants_reset(&variants);
+	return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,30 @@
+/**
+ * @file cmake-configs.h
+ * @author Charles Grunwald <cgrunwald@gmail.com>
+ * @brief Concurrent multi-configuration configures for the cross-cmake wrapper.
+ */
+#ifndef _CMAKE_CONFIGS_H_
+#define _CMAKE_CONFIGS_H_
+#pragma once
+
+#include "shared.h"
+#include "libcross.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CMAKE_CONFIGS_ARG "--configs"
+
+/**
+ * Implements `<triple>-cmake --configs CONFIG[=BUILD_DIR][,...] [-j JOBS] [CMAKE_ARGS...]`.
+ * Configures one build tree per CONFIG, as CMAKE_BUILD_TYPE, with the same
+ * CMAKE_ARGS. Returns the process exit code: 0 when every configure succeeded.
+ */
+int cmake_configs(struct cross_context* ctx, const struct cross_paths* paths, int argc, char** argv);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* _CMAKE_CONFIGS_H_ */
@@ -0,0 +1,493 @@
+/**
+ * @file cmake-profile.c
+ * @author Charles Grunwald <cgrunwald@gmail.com>
+ * @brief Configure-time profiling for the cross-cmake wrapper.
+ *
+ * With CROSS_PROFILE=<dir>, configures run with CMake's own profiler writing
+ * a google-trace of every command into <dir>, and the trace is summarized
+ * into <dir>/cmake-profile.txt: where the time went by kind (try_compile,
+ * find_*, child processes, script), the commands with the most self time,
+ * and the slowest try_compile and find_* calls and modules included. Each
+ * try_compile is attributed to the check_* call or top-level command that
+ * led to it, which is what to pre-seed in the cache or drop.
+ *
+ * The trace is a flat list of begin and end events in the order they
+ * happened, on a single thread, and is replayed against a stack here.
+ */
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "shared.h"
+#include "strutil.h"
+#include "dynarray.h"
+#include "hashmap.h"
+#include "json.h"
+#include "libcross.h"
+#include "cmake-profile.h"
+
+#define TRACE_NAME "cmake-trace.json"
+#define SUMMARY_NAME "cmake-profile.txt"
+#define FORMAT_ARG "--profiling-format=google-trace"
+#define OUTPUT_ARG "--profiling-output="
+
+#define TOP_COUNT 15
+#define ARGS_WIDTH 60
+
+enum command_kind
+{
+	KIND_SCRIPT,
+	KIND_TRY_COMPILE,
+	KIND_FIND,
+	KIND_PROCESS,
+	KIND_COUNT
+};
+
+static const char* const kind_names[KIND_COUNT] = {
+	"script", "try_compile", "find_*", "processes"
+};
+
+struct frame
+{
+	const char* name;
+	const char* args;
+	const char* location;
+	double start;
+	double children;
+	enum command_kind kind;
+	// The innermost check_* call (or else the top-level command) around this one.
+	size_t origin;
+};
+
+DEFINE_ARRAY_TYPE(frame_stack, struct frame)
+
+// Totals per command name, or per module for includes.
+struct command_stats
+{
+	size_t calls;
+	size_t active;
+	double self;
+	double total;
+};
+
+struct call
+{
+	double duration;
+	char* what;
+	char* where;
+};
+
+DEFINE_ARRAY_TYPE(call_array, struct call)
+
+struct profile
+{
+	struct hashmap commands;
+	struct hashmap modules;
+	struct call_array try_compiles;
+	struct call_array finds;
+	double kind_time[KIND_COUNT];
+	size_t kind_calls[KIND_COUNT];
+	double first;
+	double last;
+	size_t events;
+	// Wrapper phases, in seconds.
+	double resolve;
+	double cmake;
+	double summary;
+};
+
+double cmake_profile_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/*
+ * Replaying the trace
+ */
+
+static double json_number(const struct json_value* value)
+{
+	return value != NULL && value->type == JSON_NUMBER ? value->number : 0;
+}
+
+static enum command_kind command_kind(const char* name)
+{
+	if(strcmp(name, "try_compile") == 0 || strcmp(name, "try_run") == 0)
+		return KIND_TRY_COMPILE;
+	if(strcmp(name, "find_library") == 0 || strcmp(name, "find_path") == 0 || strcmp(name, "find_file") == 0 ||
+	   strcmp(name, "find_program") == 0 || strcmp(name, "find_package") == 0)
+		return KIND_FIND;
+	if(strcmp(name, "execute_process") == 0)
+		return KIND_PROCESS;
+	return KIND_SCRIPT;
+}
+
+static struct command_stats* stats_for(struct hashmap* map, const char* key)
+{
+	struct command_stats* stats = (struct command_stats*)hashmap_get(map, key);
+	if(stats == NULL && (stats = (struct command_stats*)calloc(1, sizeof(struct command_stats))) != NULL &&
+	   hashmap_put(map, key, stats, NULL) != 0) {
+		free(stats);
+		stats = NULL;
+	}
+	return stats;
+}
+
+// "name(args)", cut down to something that fits on a line.
+static char* describe_call(const char* name, const char* args)
+{
+	size_t len = strlen(args);
+	if(len > ARGS_WIDTH)
+		return sprintf_alloc("%s(%.*s...)", name, ARGS_WIDTH - 3, args);
+	return sprintf_alloc("%s(%s)", name, args);
+}
+
+static void add_call(struct call_array* calls, double duration, char* what, const char* where)
+{
+	struct call* call = call_array_append(calls);
+	if(call == NULL) {
+		free(what);
+		return;
+	}
+	call->duration = duration;
+	call->what = what;
+	call->where = strdup(where != NULL ? where : "");
+}
+
+// The module an include() or find_package() is for: its first argument.
+static char* module_key(const char* name, const char* args)
+{
+	size_t len = strcspn(args, " ");
+	return sprintf_alloc("%s(%.*s)", name, (int)len, args);
+}
+
+static void end_frame(struct profile* profile, struct frame_stack* stack, double ts)
+{
+	struct frame* frames = (struct frame*)stack->base.base;
+	struct frame* frame = &frames[stack->base.elements - 1];
+	double duration = ts - frame->start;
+	double self = duration - frame->children;
+	struct command_stats* stats;
+	enum command_kind kind = frame->kind;
+
+	if(stack->base.elements > 1)
+		frames[stack->base.elements - 2].children += duration;
+
+	// Everything under a try_compile is part of its cost.
+	for(size_t i = 0; i + 1 < stack->base.elements; i++) {
+		if(frames[i].kind == KIND_TRY_COMPILE)
+			kind = KIND_TRY_COMPILE;
+	}
+	profile->kind_time[kind] += self;
+	if(frame->kind == kind)
+		profile->kind_calls[kind]++;
+
+	if((stats = stats_for(&profile->commands, frame->name)) != NULL) {
+		stats->self += self;
+		// Recursion would count the same time twice.
+		if(--stats->active == 0)
+			stats->total += duration;
+	}
+
+	if(frame->kind == KIND_TRY_COMPILE) {
+		const struct frame* origin = &frames[frame->origin];
+		char* what = describe_call(frame->name, frame->args);
+		char* where = origin != frame ? describe_call(origin->name, origin->args) : NULL;
+		char* from = where != NULL ? sprintf_alloc("%s at %s", where, origin->location) : NULL;
+		add_call(&profile->try_compiles, duration, what, from != NULL ? from : frame->location);
+		free(where);
+		free(from);
+	} else if(frame->kind == KIND_FIND) {
+		add_call(&profile->finds, duration, describe_call(frame->name, frame->args), frame->location);
+	}
+
+	if(strcmp(frame->name, "include") == 0 || strcmp(frame->name, "find_package") == 0) {
+		char* key = module_key(frame->name, frame->args);
+		if(key != NULL && (stats = stats_for(&profile->modules, key)) != NULL) {
+			stats->calls++;
+			stats->self += self;
+			if(--stats->active == 0)
+				stats->total += duration;
+		}
+		free(key);
+	}
+	stack->base.elements--;
+}
+
+static void begin_frame(struct profile* profile, struct frame_stack* stack, const struct json_value* event, double ts)
+{
+	const struct json_value* args = json_get(event, "args");
+	const char* name = json_string(json_get(event, "name"));
+	struct frame* frame;
+	struct command_stats* stats;
+	size_t index = stack->base.elements;
+
+	if((frame = frame_stack_append(stack)) == NULL)
+		return;
+	frame->name = name != NULL ? name : "?";
+	frame->args = json_string(json_get(args, "functionArgs"));
+	frame->location = json_string(json_get(args, "location"));
+	if(frame->args == NULL)
+		frame->args = "";
+	if(frame->location == NULL)
+		frame->location = "";
+	frame->start = ts;
+	frame->children = 0;
+	frame->kind = command_kind(frame->name);
+
+	// Appending may have moved the stack.
+	if(index == 0 || strncmp(frame->name, "check_", 6) == 0) {
+		frame->origin = index;
+	} else {
+		const struct frame* parent = &((struct frame*)stack->base.base)[index - 1];
+		frame->origin = parent->origin;
+	}
+
+	if((stats = stats_for(&profile->commands, frame->name)) != NULL) {
+		stats->calls++;
+		stats->active++;
+	}
+	if(strcmp(frame->name, "include") == 0 || strcmp(frame->name, "find_package") == 0) {
+		char* key = module_key(frame->name, frame->args);
+		if(key != NULL && (stats = stats_for(&profile->modules, key)) != NULL)
+			stats->active++;
+		free(key);
+	}
+}
+
+static int replay_trace(struct profile* profile, const struct json_value* trace)
+{
+	struct frame_stack stack;
+	size_t count = json_count(trace);
+
+	if(trace == NULL || trace->type != JSON_ARRAY)
+		return -EINVAL;
+	frame_stack_init(&stack);
+	for(size_t i = 0; i < count; i++) {
+		const struct json_value* event = json_at(trace, i);
+		const char* phase = json_string(json_get(event, "ph"));
+		double ts = json_number(json_get(event, "ts"));
+
+		if(phase == NULL)
+			continue;
+		if(profile->events++ == 0)
+			profile->first = ts;
+		profile->last = ts;
+		if(strcmp(phase, "B") == 0)
+			begin_frame(profile, &stack, event, ts);
+		else if(strcmp(phase, "E") == 0 && stack.base.elements > 0)
+			end_frame(profile, &stack, ts);
+	}
+	// A configure that failed part way leaves commands open.
+	while(stack.base.elements > 0)
+		end_frame(profile, &stack, profile->last);
+	frame_stack_reset(&stack);
+	return 0;
+}
+
+/*
+ * The summary
+ */
+
+struct ranked
+{
+	const char* key;
+	const struct command_stats* stats;
+};
+
+DEFINE_ARRAY_TYPE(ranked_array, struct ranked)
+
+static bool collect_ranked(const char* key, struct command_stats* stats, struct ranked_array* ranked)
+{
+	struct ranked* entry = ranked_array_append(ranked);
+	if(entry != NULL) {
+		entry->key = key;
+		entry->stats = stats;
+	}
+	return true;
+}
+
+static int compare_self(const void* a, const void* b)
+{
+	double left = ((const struct ranked*)a)->stats->self, right = ((const struct ranked*)b)->stats->self;
+	return left < right ? 1 : left > right ? -1 : strcmp(((const struct ranked*)a)->key, ((const struct ranked*)b)->key);
+}
+
+static int compare_total(const void* a, const void* b)
+{
+	double left = ((const struct ranked*)a)->stats->total, right = ((const struct ranked*)b)->stats->total;
+	return left < right ? 1 : left > right ? -1 : strcmp(((const struct ranked*)a)->key, ((const struct ranked*)b)->key);
+}
+
+static int compare_calls(const void* a, const void* b)
+{
+	double left = ((const struct call*)a)->duration, right = ((const struct call*)b)->duration;
+	return left < right ? 1 : left > right ? -1 : 0;
+}
+
+static void print_ms(FILE* out, double microseconds)
+{
+	fprintf(out, "%10.1f ms", microseconds / 1000.0);
+}
+
+static void print_ranked(FILE* out, const struct hashmap* map, bool by_total, const char* title)
+{
+	struct ranked_array ranked;
+	struct ranked* entry;
+	size_t shown = 0;
+
+	ranked_array_init(&ranked);
+	hashmap_foreach(map, (hashmap_iter_func)collect_ranked, &ranked);
+	ranked_array_sort(&ranked, by_total ? compare_total : compare_self);
+	fprintf(out, "\n%s\n  %13s %13s %7s  %s\n", title, by_total ? "total" : "self", by_total ? "self" : "total", "calls",
+	        by_total ? "module" : "command");
+	ARRAY_FOREACH(&ranked, entry) {
+		if(shown++ == TOP_COUNT)
+			break;
+		fprintf(out, "  ");
+		print_ms(out, by_total ? entry->stats->total : entry->stats->self);
+		fprintf(out, " ");
+		print_ms(out, by_total ? entry->stats->self : entry->stats->total);
+		fprintf(out, " %7zu  %s\n", entry->stats->calls, entry->key);
+	}
+	ranked_array_reset(&ranked);
+}
+
+static void print_calls(FILE* out, const struct call_array* calls, const char* title)
+{
+	const struct call* call;
+	size_t shown = 0;
+
+	fprintf(out, "\n%s\n", title);
+	if(calls->base.elements == 0)
+		fprintf(out, "  (none)\n");
+	ARRAY_FOREACH(calls, call) {
+		if(shown++ == TOP_COUNT)
+			break;
+		fprintf(out, "  ");
+		print_ms(out, call->duration);
+		fprintf(out, "  %s\n                 %s\n", call->what, call->where);
+	}
+}
+
+static void write_summary(FILE* out, const struct profile* profile, const char* trace_path)
+{
+	double traced = profile->last - profile->first;
+	double cmake_us = profile->cmake * 1e6;
+
+	fprintf(out, "Configure profile (trace: %s)\n", trace_path);
+	fprintf(out, "\nWrapper phases\n");
+	fprintf(out, "  ");
+	print_ms(out, profile->resolve * 1e6);
+	fprintf(out, "  resolving cmake and the toolchain arguments\n  ");
+	print_ms(out, traced);
+	fprintf(out, "  traced CMake commands (%zu events)\n  ", profile->events);
+	print_ms(out, cmake_us > traced ? cmake_us - traced : 0);
+	fprintf(out, "  CMake startup, generation and untraced work\n  ");
+	print_ms(out, profile->summary * 1e6);
+	fprintf(out, "  reading the trace\n");
+
+	fprintf(out, "\nTime by kind (self time, try_compile including what runs inside it)\n");
+	for(int kind = 0; kind < KIND_COUNT; kind++) {
+		fprintf(out, "  ");
+		print_ms(out, profile->kind_time[kind]);
+		fprintf(out, "  %5.1f%%  %-12s %zu calls\n", traced > 0 ? 100.0 * profile->kind_time[kind] / traced : 0.0,
+		        kind_names[kind], profile->kind_calls[kind]);
+	}
+
+	print_ranked(out, &profile->commands, false, "Slowest commands");
+	print_calls(out, &profile->try_compiles, "Slowest try_compile calls");
+	print_calls(out, &profile->finds, "Slowest find_* calls");
+	print_ranked(out, &profile->modules, true, "Slowest includes and packages");
+}
+
+static void calls_reset(struct call_array* calls)
+{
+	struct call* call;
+	ARRAY_FOREACH(calls, call) {
+		free(call->what);
+		free(call->where);
+	}
+	call_array_reset(calls);
+}
+
+int cmake_profile(struct cross_context* CPP_UNUSED(ctx), const char* dir, double started, double resolved,
+                  int child_argc, char** child_argv)
+{
+	int status, code;
+	char** profile_argv;
+	char* output_arg;
+	char trace_path[PATH_MAX] = "";
+	char summary_path[PATH_MAX] = "";
+	double cmake_started;
+	double summary_started;
+	struct json_value* trace = NULL;
+	struct profile profile;
+	FILE* summary;
+
+	if(mkdir_p(dir, 0755) != 0) {
+		fprintf(stderr, "ERROR: Failed to create %s: %s\n", dir, strerror(errno));
+		return 1;
+	}
+	snprintf(trace_path, PATH_MAX, "%s/" TRACE_NAME, dir);
+	snprintf(summary_path, PATH_MAX, "%s/" SUMMARY_NAME, dir);
+	unlink(trace_path);
+
+	// [cmake] ARGS... --profiling-format=google-trace --profiling-output=<trace>
+	profile_argv = (char**)calloc((size_t)child_argc + 3, sizeof(char*));
+	output_arg = sprintf_alloc(OUTPUT_ARG "%s", trace_path);
+	if(profile_argv == NULL || output_arg == NULL) {
+		free(profile_argv);
+		free(output_arg);
+		return ENOMEM;
+	}
+	memcpy((void*)profile_argv, (void*)child_argv, sizeof(char*) * (size_t)child_argc);
+	profile_argv[child_argc] = FORMAT_ARG;
+	profile_argv[child_argc + 1] = output_arg;
+
+	cmake_started = cmake_profile_now();
+	status = run_command(profile_argv);
+	summary_started = cmake_profile_now();
+	free(profile_argv);
+	free(output_arg);
+	if(status < 0) {
+		fprintf(stderr, "ERROR: Failed to run cmake: %s\n", strerror(-status));
+		return 1;
+	}
+
+	if((code = json_parse_file(trace_path, &trace)) != 0) {
+		fprintf(stderr, "WARNING: No profile was written to %s (%s); CMake 3.18 or later is needed\n",
+		        trace_path, strerror(-code));
+		return status;
+	}
+	memset((void*)&profile, 0, sizeof(profile));
+	hashmap_init(&profile.commands, 256);
+	hashmap_init(&profile.modules, 256);
+	call_array_init(&profile.try_compiles);
+	call_array_init(&profile.finds);
+	if(replay_trace(&profile, trace) != 0)
+		fprintf(stderr, "WARNING: %s isn't a google-trace profile\n", trace_path);
+	json_free(trace);
+	call_array_sort(&profile.try_compiles, compare_calls);
+	call_array_sort(&profile.finds, compare_calls);
+
+	profile.resolve = resolved - started;
+	profile.cmake = summary_started - cmake_started;
+	profile.summary = cmake_profile_now() - summary_started;
+	if((summary = fopen(summary_path, "w")) != NULL) {
+		write_summary(summary, &profile, trace_path);
+		fclose(summary);
+	} else {
+		fprintf(stderr, "WARNING: Failed to write %s: %s\n", summary_path, strerror(errno));
+	}
+	printf("\n");
+	write_summary(stdout, &profile, trace_path);
+
+	hashmap_reset(&profile.commands, free);
+	hashmap_reset(&profile.modules, free);
+	calls_reset(&profile.try_compiles);
+	calls_reset(&profile.finds);
+	return status;
+}
@@ -0,0 +1,37 @@
+/**
+ * @file cmake-profile.h
+ * @author Charles Grunwald <cgrunwald@gmail.com>
+ * @brief Configure-time profiling for the cross-cmake wrapper.
+ */
+#ifndef _CMAKE_PROFILE_H_
+#define _CMAKE_PROFILE_H_
+#pragma once
+
+#include "shared.h"
+#include "libcross.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CMAKE_PROFILE_ENVNAME "CROSS_PROFILE"
+
+/**
+ * Seconds on the monotonic clock, for the wrapper's phase timings.
+ */
+double cmake_profile_now(void);
+
+/**
+ * Runs the configure in @p child_argv under CMake's profiler (CMake 3.18+),
+ * leaving cmake-trace.json and a summary of it, cmake-profile.txt, in @p dir.
+ * @p started and @p resolved are when the wrapper started and when it had
+ * the command line ready. Returns cmake's exit code.
+ */
+int cmake_profile(struct cross_context* ctx, const char* dir, double started, double resolved,
+                  int child_argc, char** child_argv);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* _CMAKE_PROFILE_H_ */
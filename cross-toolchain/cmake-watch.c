@@ -0,0 +1,894 @@
+/**
+ * @file cmake-watch.c
+ * @author Charles Grunwald <cgrunwald@gmail.com>
+ * @brief Continuous rebuilds for the cross-cmake wrapper.
+ *
+ * Watches the source tree, and the sysroot's headers, with inotify. A burst
+ * of events (an editor saving, a git checkout) is debounced into one change
+ * set. Changed sources are mapped to their targets through CMake's file API,
+ * and only those targets and the targets linking them are rebuilt. Anything
+ * else, such as a header or a CMakeLists.txt, rebuilds the default target
+ * and leaves it to the build tool to work out what is stale.
+ *
+ * The build tool is run directly instead of through `cmake --build`, and the
+ * target map stays in memory between builds, so a small change only pays for
+ * the build tool's own startup. Hosts without inotify fall back to polling
+ * modification times.
+ */
+#include <dirent.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <time.h>
+#if defined(HAVE_SYS_INOTIFY_H)
+#	include <sys/inotify.h>
+#endif
+
+#include "shared.h"
+#include "strutil.h"
+#include "strarray.h"
+#include "dynarray.h"
+#include "hashmap.h"
+#include "json.h"
+#include "libcross.h"
+#include "cmake-watch.h"
+
+#define PATH_SEP_CHR '/'
+
+#define DEBOUNCE_ENVNAME "CROSS_WATCH_DEBOUNCE"
+#define INTERVAL_ENVNAME "CROSS_WATCH_INTERVAL"
+#define DEFAULT_DEBOUNCE_MS 50
+#define DEFAULT_INTERVAL_MS 250
+#define MAX_DEBOUNCE_MS 1000
+
+#define API_CLIENT "client-cross-watch"
+#define API_QUERY_DIR ".cmake/api/v1/query/" API_CLIENT
+#define API_REPLY_DIR ".cmake/api/v1/reply"
+
+DEFINE_ARRAY_TYPE(index_array, size_t)
+DEFINE_ARRAY_TYPE(watch_paths, char*)
+
+struct watch_target
+{
+	char* name;
+	char* id;
+	struct index_array dependents;
+};
+
+DEFINE_ARRAY_TYPE(target_array, struct watch_target)
+
+struct watcher
+{
+	const char* skip_dir;
+	size_t skip_len;
+	string_array* roots;
+#if defined(HAVE_SYS_INOTIFY_H)
+	int fd;
+	struct watch_paths paths;
+	string_array** changes;
+#else
+	int interval_ms;
+	bool scanning;
+	struct hashmap snapshot;
+#endif
+};
+
+struct watch_session
+{
+	struct cross_context* ctx;
+	char* build_dir;
+	char* source_dir;
+	char* sysroot;
+	char* generator;
+	char* make_program;
+	char* cmake;
+	int tool_argc;
+	char** tool_argv;
+	int debounce_ms;
+
+	char reply_index[NAME_MAX + 1];
+	struct target_array targets;
+	struct hashmap target_names;
+	struct hashmap sources;
+	struct watcher watcher;
+};
+
+static void watch_log(const char* format, ...)
+{
+	va_list args;
+	printf("[watch] ");
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
+	printf("\n");
+	fflush(stdout);
+}
+
+static double now_seconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int env_int(const char* name, int fallback)
+{
+	const char* value = getenv(name);
+	int result = value != NULL ? atoi(value) : 0;
+	return result > 0 ? result : fallback;
+}
+
+static bool is_ignored_name(const char* name)
+{
+	size_t len = strlen(name);
+
+	// Hidden files and directories (.git), and editor scratch files.
+	if(name[0] == '.' || len == 0 || name[len - 1] == '~' || strcmp(name, "4913") == 0)
+		return true;
+	return len > 4 && (strcmp(name + len - 4, ".swp") == 0 || strcmp(name + len - 4, ".swx") == 0);
+}
+
+static bool is_cmake_script(const char* path)
+{
+	const char* base = strrchr(path, PATH_SEP_CHR);
+	size_t len = strlen(path);
+	base = base != NULL ? base + 1 : path;
+	return strcmp(base, "CMakeLists.txt") == 0 || (len > 6 && strcmp(path + len - 6, ".cmake") == 0);
+}
+
+static bool has_path_prefix(const char* path, const char* prefix, size_t prefix_len)
+{
+	return strncmp(path, prefix, prefix_len) == 0 && (path[prefix_len] == PATH_SEP_CHR || path[prefix_len] == '\0');
+}
+
+/*
+ * Tree walking, shared by both watcher implementations.
+ */
+
+typedef void(*walk_handler)(struct watcher* watcher, const char* path, const struct stat* st);
+
+static void walk_tree(struct watcher* watcher, const char* root, walk_handler handler)
+{
+	DIR* dir;
+	struct dirent* entry;
+	struct stat st;
+	char path[PATH_MAX];
+
+	if(watcher->skip_dir != NULL && has_path_prefix(root, watcher->skip_dir, watcher->skip_len))
+		return;
+	if(stat(root, &st) != 0)
+		return;
+	handler(watcher, root, &st);
+	if(!S_ISDIR(st.st_mode) || (dir = opendir(root)) == NULL)
+		return;
+
+	while((entry = readdir(dir)) != NULL) {
+		if(is_ignored_name(entry->d_name))
+			continue;
+		if((size_t)snprintf(path, PATH_MAX, "%s/%s", root, entry->d_name) >= PATH_MAX)
+			continue;
+#ifdef _DIRENT_HAVE_D_TYPE
+		if(entry->d_type == DT_DIR) {
+			walk_tree(watcher, path, handler);
+			continue;
+		}
+		if(entry->d_type != DT_UNKNOWN && entry->d_type != DT_LNK) {
+			if(lstat(path, &st) == 0)
+				handler(watcher, path, &st);
+			continue;
+		}
+#endif
+		walk_tree(watcher, path, handler);
+	}
+	closedir(dir);
+}
+
+static void changes_add(string_array** changes, const char* path)
+{
+	for(size_t i = 0; *changes != NULL && i < (*changes)->len; i++) {
+		if(strcmp((*changes)->ptr[i], path) == 0)
+			return;
+	}
+	*changes = string_array_push(*changes, strdup(path));
+}
+
+#if defined(HAVE_SYS_INOTIFY_H)
+
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF)
+
+static void inotify_add_dir(struct watcher* watcher, const char* path, const struct stat* st)
+{
+	int wd;
+	char** slot;
+	size_t count;
+
+	if(!S_ISDIR(st->st_mode))
+		return;
+	wd = inotify_add_watch(watcher->fd, path, WATCH_EVENTS | IN_ONLYDIR);
+	if(wd < 0) {
+		fprintf(stderr, "WARNING: Failed to watch %s: %s\n", path, strerror(errno));
+		return;
+	}
+
+	// Watch descriptors are small integers, so they index the path table.
+	count = watcher->paths.base.elements;
+	if((size_t)wd >= count) {
+		slot = watch_paths_append_n(&watcher->paths, (size_t)wd + 1 - count);
+		if(slot == NULL)
+			return;
+		memset((void*)slot, 0, sizeof(char*) * ((size_t)wd + 1 - count));
+	}
+	slot = (char**)watcher->paths.base.base + wd;
+	free(*slot);
+	*slot = strdup(path);
+}
+
+// A directory that appears may already hold files by the time it's watched,
+// and their events are gone, so they count as changed.
+static void inotify_add_new(struct watcher* watcher, const char* path, const struct stat* st)
+{
+	if(S_ISDIR(st->st_mode))
+		inotify_add_dir(watcher, path, st);
+	else
+		changes_add(watcher->changes, path);
+}
+
+static int watcher_init(struct watcher* watcher, const char* skip_dir)
+{
+	memset((void*)watcher, 0, sizeof(*watcher));
+	watcher->skip_dir = skip_dir;
+	watcher->skip_len = skip_dir != NULL ? strlen(skip_dir) : 0;
+	watch_paths_init(&watcher->paths);
+	watcher->fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+	return watcher->fd < 0 ? -errno : 0;
+}
+
+static void watcher_add(struct watcher* watcher, const char* root)
+{
+	watcher->roots = string_array_push(watcher->roots, strdup(root));
+	walk_tree(watcher, root, inotify_add_dir);
+}
+
+static void watcher_reset(struct watcher* watcher)
+{
+	char** path;
+	ARRAY_FOREACH(&watcher->paths, path)
+		free(*path);
+	watch_paths_reset(&watcher->paths);
+	string_array_free(watcher->roots);
+	if(watcher->fd >= 0)
+		close(watcher->fd);
+}
+
+static void drain_events(struct watcher* watcher, string_array** changes)
+{
+	char buffer[64 * 1024] CC_ATTR(aligned(__alignof__(struct inotify_event)));
+	char path[PATH_MAX];
+	ssize_t len;
+	bool overflowed = false;
+
+	watcher->changes = changes;
+	while((len = read(watcher->fd, buffer, sizeof(buffer))) > 0) {
+		for(char* p = buffer; p < buffer + len; p += sizeof(struct inotify_event) + ((struct inotify_event*)p)->len) {
+			const struct inotify_event* event = (const struct inotify_event*)p;
+			const char* dir = (event->wd >= 0 && (size_t)event->wd < watcher->paths.base.elements) ?
+				((char**)watcher->paths.base.base)[event->wd] : NULL;
+			if(event->mask & IN_Q_OVERFLOW)
+				overflowed = true;
+			if(dir == NULL || (event->len > 0 && is_ignored_name(event->name)))
+				continue;
+			if(event->len == 0 || (size_t)snprintf(path, PATH_MAX, "%s/%s", dir, event->name) >= PATH_MAX)
+				continue;
+			// New directories (mkdir -p, git checkout) need watches of their own.
+			if((event->mask & (IN_CREATE | IN_MOVED_TO)) && (event->mask & IN_ISDIR))
+				walk_tree(watcher, path, inotify_add_new);
+			if(!(event->mask & IN_ISDIR))
+				changes_add(changes, path);
+		}
+	}
+
+	// Events were dropped, so anything may have changed (a large checkout, say).
+	// Watch whatever directories appeared and report the roots, which no target
+	// owns, so everything is built.
+	if(overflowed) {
+		fprintf(stderr, "WARNING: Too many changes at once to follow; building everything\n");
+		for(size_t i = 0; watcher->roots != NULL && i < watcher->roots->len; i++) {
+			walk_tree(watcher, watcher->roots->ptr[i], inotify_add_dir);
+			changes_add(changes, watcher->roots->ptr[i]);
+		}
+	}
+	watcher->changes = NULL;
+}
+
+/*
+ * Block until something changes, then keep collecting into @p changes until
+ * the tree has been quiet for @p debounce_ms, or for MAX_DEBOUNCE_MS at most.
+ * Returns 0 or a negative errno when the watch itself fails.
+ */
+static int watcher_wait(struct watcher* watcher, int debounce_ms, string_array** changes)
+{
+	struct pollfd pfd = { watcher->fd, POLLIN, 0 };
+	double deadline = 0;
+
+	*changes = NULL;
+	for(;;) {
+		int timeout = *changes == NULL ? -1 : debounce_ms;
+		int ready = poll(&pfd, 1, timeout);
+		if(ready < 0 && errno == EINTR)
+			continue;
+		if(ready < 0 && *changes == NULL)
+			return -errno;
+		if(ready <= 0)
+			return 0;
+		drain_events(watcher, changes);
+		if(*changes != NULL && deadline == 0)
+			deadline = now_seconds() + MAX_DEBOUNCE_MS / 1000.0;
+		if(*changes != NULL && now_seconds() >= deadline)
+			return 0;
+	}
+}
+
+#else /* HAVE_SYS_INOTIFY_H */
+
+struct file_stamp
+{
+	long long mtime;
+	long mtime_nsec;
+	off_t size;
+	bool seen;
+};
+
+static ALWAYS_INLINE long stat_mtime_nsec(const struct stat* st)
+{
+#if defined(__APPLE__)
+	return st->st_mtimespec.tv_nsec;
+#else
+	return st->st_mtim.tv_nsec;
+#endif
+}
+
+static string_array* poll_changes;
+
+static void snapshot_file(struct watcher* watcher, const char* path, const struct stat* st)
+{
+	struct file_stamp* stamp = NULL;
+
+	if(S_ISDIR(st->st_mode))
+		return;
+	if(!hashmap_find(&watcher->snapshot, path, (void**)&stamp)) {
+		stamp = (struct file_stamp*)calloc(1, sizeof(struct file_stamp));
+		if(stamp == NULL || hashmap_put(&watcher->snapshot, path, stamp, NULL) != 0)
+			return;
+		// Files found after the first scan are new.
+		if(watcher->scanning)
+			changes_add(&poll_changes, path);
+	} else if(stamp->mtime != (long long)st->st_mtime || stamp->mtime_nsec != stat_mtime_nsec(st) ||
+	          stamp->size != st->st_size) {
+		changes_add(&poll_changes, path);
+	}
+	stamp->mtime = (long long)st->st_mtime;
+	stamp->mtime_nsec = stat_mtime_nsec(st);
+	stamp->size = st->st_size;
+	stamp->seen = true;
+}
+
+static bool collect_removed(const char* key, struct file_stamp* stamp, string_array** removed)
+{
+	if(!stamp->seen)
+		*removed = string_array_push(*removed, strdup(key));
+	stamp->seen = false;
+	return true;
+}
+
+static int watcher_init(struct watcher* watcher, const char* skip_dir)
+{
+	memset((void*)watcher, 0, sizeof(*watcher));
+	watcher->skip_dir = skip_dir;
+	watcher->skip_len = skip_dir != NULL ? strlen(skip_dir) : 0;
+	watcher->interval_ms = env_int(INTERVAL_ENVNAME, DEFAULT_INTERVAL_MS);
+	return hashmap_init(&watcher->snapshot, 4096);
+}
+
+static void watcher_add(struct watcher* watcher, const char* root)
+{
+	watcher->roots = string_array_push(watcher->roots, strdup(root));
+	walk_tree(watcher, root, snapshot_file);
+}
+
+static void watcher_reset(struct watcher* watcher)
+{
+	hashmap_reset(&watcher->snapshot, free);
+	string_array_free(watcher->roots);
+}
+
+static string_array* watcher_scan(struct watcher* watcher)
+{
+	string_array* removed = NULL;
+	string_array* changes;
+
+	poll_changes = NULL;
+	watcher->scanning = true;
+	for(size_t i = 0; watcher->roots != NULL && i < watcher->roots->len; i++)
+		walk_tree(watcher, watcher->roots->ptr[i], snapshot_file);
+	changes = poll_changes;
+	poll_changes = NULL;
+
+	hashmap_foreach(&watcher->snapshot, (hashmap_iter_func)collect_removed, &removed);
+	for(size_t i = 0; removed != NULL && i < removed->len; i++) {
+		void* stamp = NULL;
+		if(hashmap_remove(&watcher->snapshot, removed->ptr[i], &stamp))
+			free(stamp);
+		changes_add(&changes, removed->ptr[i]);
+	}
+	string_array_free(removed);
+	return changes;
+}
+
+static int watcher_wait(struct watcher* watcher, int debounce_ms, string_array** changes)
+{
+	double deadline = 0;
+
+	// A poll that comes back empty after a change means the burst is over.
+	*changes = NULL;
+	for(;;) {
+		string_array* found;
+		usleep((useconds_t)(*changes == NULL ? watcher->interval_ms : debounce_ms) * 1000);
+		found = watcher_scan(watcher);
+		if(found == NULL) {
+			if(*changes != NULL)
+				return 0;
+			continue;
+		}
+		for(size_t i = 0; i < found->len; i++)
+			changes_add(changes, found->ptr[i]);
+		string_array_free(found);
+		if(deadline == 0)
+			deadline = now_seconds() + MAX_DEBOUNCE_MS / 1000.0;
+		if(now_seconds() >= deadline)
+			return 0;
+	}
+}
+
+#endif /* HAVE_SYS_INOTIFY_H */
+
+/*
+ * Build tree
+ */
+
+static char* cache_value(const char* cache_path, const char* key)
+{
+	char line[PATH_MAX + 256];
+	char* result = NULL;
+	size_t key_len = strlen(key);
+	FILE* file = fopen(cache_path, "r");
+
+	if(file == NULL)
+		return NULL;
+	while(result == NULL && fgets(line, sizeof(line), file) != NULL) {
+		char* value;
+		size_t len;
+		if(strncmp(line, key, key_len) != 0 || line[key_len] != ':')
+			continue;
+		if((value = strchr(line + key_len, '=')) == NULL)
+			continue;
+		value++;
+		len = strlen(value);
+		while(len > 0 && (value[len - 1] == '\n' || value[len - 1] == '\r'))
+			value[--len] = '\0';
+		result = strdup(value);
+	}
+	fclose(file);
+	return result;
+}
+
+static bool write_api_query(const struct watch_session* session)
+{
+	int fd;
+	char path[PATH_MAX];
+
+	if((size_t)snprintf(path, PATH_MAX, "%s/" API_QUERY_DIR, session->build_dir) >= PATH_MAX || mkdir_p(path, 0755) != 0)
+		return false;
+	strcat(path, "/codemodel-v2");
+	if((fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644)) < 0)
+		return false;
+	close(fd);
+	return true;
+}
+
+/*
+ * The newest reply index; CMake names them index-<timestamp>.json.
+ */
+static bool latest_reply_index(const struct watch_session* session, char* name, size_t name_size)
+{
+	DIR* dir;
+	struct dirent* entry;
+	char path[PATH_MAX];
+
+	name[0] = '\0';
+	snprintf(path, PATH_MAX, "%s/" API_REPLY_DIR, session->build_dir);
+	if((dir = opendir(path)) == NULL)
+		return false;
+	while((entry = readdir(dir)) != NULL) {
+		if(strncmp(entry->d_name, "index-", 6) == 0 && strcmp(entry->d_name, name) > 0 &&
+		   strlen(entry->d_name) < name_size)
+			strcpy(name, entry->d_name);
+	}
+	closedir(dir);
+	return name[0] != '\0';
+}
+
+static void owners_free(void* value)
+{
+	index_array_reset((struct index_array*)value);
+	free(value);
+}
+
+static void targets_clear(struct watch_session* session)
+{
+	struct watch_target* target;
+
+	ARRAY_FOREACH(&session->targets, target) {
+		free(target->name);
+		free(target->id);
+		index_array_reset(&target->dependents);
+	}
+	target_array_reset(&session->targets);
+	hashmap_reset(&session->target_names, NULL);
+	hashmap_reset(&session->sources, owners_free);
+}
+
+static void targets_reset(struct watch_session* session)
+{
+	targets_clear(session);
+	target_array_init(&session->targets);
+	hashmap_init(&session->target_names, 64);
+	hashmap_init(&session->sources, 1024);
+}
+
+static struct json_value* load_reply(const struct watch_session* session, const char* name)
+{
+	struct json_value* value = NULL;
+	char* path = sprintf_alloc("%s/" API_REPLY_DIR "/%s", session->build_dir, name);
+	if(path != NULL)
+		json_parse_file(path, &value);
+	free(path);
+	return value;
+}
+
+static void add_source(struct watch_session* session, const char* path, size_t target)
+{
+	struct index_array* owners = NULL;
+
+	if(!hashmap_find(&session->sources, path, (void**)&owners)) {
+		owners = (struct index_array*)malloc(sizeof(struct index_array));
+		if(owners == NULL)
+			return;
+		index_array_init(owners);
+		if(hashmap_put(&session->sources, path, owners, NULL) != 0) {
+			free(owners);
+			return;
+		}
+	}
+	if(owners->base.elements == 0 || ((size_t*)owners->base.base)[owners->base.elements - 1] != target) {
+		size_t* slot = index_array_append(owners);
+		if(slot != NULL)
+			*slot = target;
+	}
+}
+
+static void load_target(struct watch_session* session, const struct json_value* entry, struct json_value* reply)
+{
+	size_t index = session->targets.base.elements;
+	const char* name = json_string(json_get(reply, "name"));
+	const char* type = json_string(json_get(reply, "type"));
+	const char* id = json_string(json_get(entry, "id"));
+	const struct json_value* sources = json_get(reply, "sources");
+	struct watch_target* target;
+	char path[PATH_MAX];
+
+	if(name == NULL || id == NULL || (type != NULL && strcmp(type, "INTERFACE_LIBRARY") == 0))
+		return;
+	if((target = target_array_append0(&session->targets)) == NULL)
+		return;
+	target->name = strdup(name);
+	target->id = strdup(id);
+	index_array_init(&target->dependents);
+	hashmap_put(&session->target_names, id, (void*)(uintptr_t)(index + 1), NULL);
+
+	for(size_t i = 0; i < json_count(sources); i++) {
+		const char* source = json_string(json_get(json_at(sources, i), "path"));
+		if(source == NULL)
+			continue;
+		if(source[0] == PATH_SEP_CHR)
+			snprintf(path, PATH_MAX, "%s", source);
+		else
+			snprintf(path, PATH_MAX, "%s/%s", session->source_dir, source);
+		add_source(session, path, index);
+	}
+}
+
+/*
+ * Map every source file to the targets that compile it, and every target to
+ * the targets that depend on it, from CMake's codemodel reply.
+ */
+static bool load_targets(struct watch_session* session)
+{
+	struct json_value* index;
+	struct json_value* codemodel;
+	const struct json_value* targets;
+	const char* codemodel_file;
+	string_array* target_files = NULL;
+
+	if(!latest_reply_index(session, session->reply_index, sizeof(session->reply_index)))
+		return false;
+	if((index = load_reply(session, session->reply_index)) == NULL)
+		return false;
+	codemodel_file = json_string(json_get(json_get(json_get(json_get(index, "reply"), API_CLIENT), "codemodel-v2"), "jsonFile"));
+	codemodel = codemodel_file != NULL ? load_reply(session, codemodel_file) : NULL;
+	json_free(index);
+	if(codemodel == NULL)
+		return false;
+
+	targets_reset(session);
+	targets = json_get(json_at(json_get(codemodel, "configurations"), 0), "targets");
+	for(size_t i = 0; i < json_count(targets); i++) {
+		const struct json_value* entry = json_at(targets, i);
+		const char* file = json_string(json_get(entry, "jsonFile"));
+		struct json_value* reply = file != NULL ? load_reply(session, file) : NULL;
+		if(reply == NULL)
+			continue;
+		load_target(session, entry, reply);
+
+		// Dependencies are resolved once every id is known.
+		if(json_count(json_get(reply, "dependencies")) > 0)
+			target_files = string_array_push(target_files, strdup(file));
+		json_free(reply);
+	}
+
+	for(size_t i = 0; target_files != NULL && i < target_files->len; i++) {
+		struct json_value* reply = load_reply(session, target_files->ptr[i]);
+		const struct json_value* dependencies = json_get(reply, "dependencies");
+		const char* id = json_string(json_get(reply, "id"));
+		void* value = NULL;
+		if(id == NULL || !hashmap_find(&session->target_names, id, &value)) {
+			json_free(reply);
+			continue;
+		}
+		for(size_t d = 0; d < json_count(dependencies); d++) {
+			void* dep = NULL;
+			const char* dep_id = json_string(json_get(json_at(dependencies, d), "id"));
+			if(dep_id != NULL && hashmap_find(&session->target_names, dep_id, &dep)) {
+				struct watch_target* target = (struct watch_target*)session->targets.base.base + ((uintptr_t)dep - 1);
+				size_t* slot = index_array_append(&target->dependents);
+				if(slot != NULL)
+					*slot = (uintptr_t)value - 1;
+			}
+		}
+		json_free(reply);
+	}
+
+	string_array_free(target_files);
+	json_free(codemodel);
+	return true;
+}
+
+static void refresh_targets(struct watch_session* session)
+{
+	char latest[NAME_MAX + 1];
+	if(latest_reply_index(session, latest, sizeof(latest)) && strcmp(latest, session->reply_index) != 0) {
+		if(load_targets(session))
+			watch_log("Loaded %zu targets", session->targets.base.elements);
+	}
+}
+
+/*
+ * Returns the targets to build for @p changes, or NULL to build everything.
+ */
+static string_array* affected_targets(struct watch_session* session, const string_array* changes)
+{
+	size_t count = session->targets.base.elements;
+	struct watch_target* targets = (struct watch_target*)session->targets.base.base;
+	struct index_array queue;
+	string_array* result = NULL;
+	bool* queued;
+
+	if(count == 0 || (queued = (bool*)calloc(count, sizeof(bool))) == NULL)
+		return NULL;
+	index_array_init(&queue);
+
+	for(size_t i = 0; i < changes->len; i++) {
+		struct index_array* owners = NULL;
+		size_t* owner;
+		if(!hashmap_find(&session->sources, changes->ptr[i], (void**)&owners)) {
+			index_array_reset(&queue);
+			free(queued);
+			return NULL;
+		}
+		ARRAY_FOREACH(owners, owner) {
+			if(!queued[*owner]) {
+				queued[*owner] = true;
+				*index_array_append(&queue) = *owner;
+			}
+		}
+	}
+
+	// Everything that links a rebuilt target has to relink too.
+	for(size_t i = 0; i < queue.base.elements; i++) {
+		struct watch_target* target = &targets[((size_t*)queue.base.base)[i]];
+		size_t* dependent;
+		result = string_array_push(result, strdup(target->name));
+		ARRAY_FOREACH(&target->dependents, dependent) {
+			if(!queued[*dependent]) {
+				queued[*dependent] = true;
+				*index_array_append(&queue) = *dependent;
+			}
+		}
+	}
+
+	index_array_reset(&queue);
+	free(queued);
+	return result;
+}
+
+static int build(struct watch_session* session, const string_array* targets)
+{
+	int code, argi = 0;
+	// Other makes (NMake, MinGW) don't take -C.
+	bool direct = strstr(session->generator, "Ninja") != NULL || strcmp(session->generator, "Unix Makefiles") == 0;
+	size_t target_count = targets != NULL ? targets->len : 0;
+	char** argv = (char**)calloc((size_t)session->tool_argc + target_count + 8, sizeof(char*));
+
+	if(argv == NULL)
+		return -ENOMEM;
+
+	// Ninja and make take CMake's target names directly.
+	if(direct && session->make_program != NULL && strstr(session->make_program, "-NOTFOUND") == NULL) {
+		argv[argi++] = session->make_program;
+		argv[argi++] = "-C";
+		argv[argi++] = session->build_dir;
+		for(size_t i = 0; i < target_count; i++)
+			argv[argi++] = targets->ptr[i];
+		for(int i = 0; i < session->tool_argc; i++)
+			argv[argi++] = session->tool_argv[i];
+	} else {
+		argv[argi++] = session->cmake;
+		argv[argi++] = "--build";
+		argv[argi++] = session->build_dir;
+		if(target_count > 0)
+			argv[argi++] = "--target";
+		for(size_t i = 0; i < target_count; i++)
+			argv[argi++] = targets->ptr[i];
+		if(session->tool_argc > 0)
+			argv[argi++] = "--";
+		for(int i = 0; i < session->tool_argc; i++)
+			argv[argi++] = session->tool_argv[i];
+	}
+
+	code = run_command(argv);
+	free(argv);
+	return code;
+}
+
+static void build_changes(struct watch_session* session, const string_array* changes)
+{
+	bool reconfigure = false;
+	double start = now_seconds();
+	string_array* targets = NULL;
+	int code;
+
+	for(size_t i = 0; i < changes->len; i++) {
+		if(is_cmake_script(changes->ptr[i]))
+			reconfigure = true;
+	}
+	if(!reconfigure)
+		targets = affected_targets(session, changes);
+
+	if(targets != NULL) {
+		watch_log("%zu change(s): building %zu target(s), starting with %s",
+		          changes->len, targets->len, targets->ptr[0]);
+	} else {
+		watch_log("%zu change(s), starting with %s: building all", changes->len, changes->ptr[0]);
+	}
+
+	code = build(session, targets);
+	watch_log("%s in %.2fs", code == 0 ? "Built" : "Build FAILED", now_seconds() - start);
+	string_array_free(targets);
+
+	// A regeneration leaves a new codemodel behind.
+	if(targets == NULL)
+		refresh_targets(session);
+}
+
+static void session_reset(struct watch_session* session)
+{
+	targets_clear(session);
+	watcher_reset(&session->watcher);
+	free(session->build_dir);
+	free(session->source_dir);
+	free(session->generator);
+	free(session->make_program);
+	cross_free(session->ctx, session->sysroot);
+	cross_free(session->ctx, session->cmake);
+}
+
+int cmake_watch(struct cross_context* ctx, const struct cross_paths* paths, int argc, char** argv)
+{
+	int code;
+	char* cache_path;
+	char* include_dir;
+	struct watch_session session;
+
+	memset((void*)&session, 0, sizeof(session));
+	session.ctx = ctx;
+	session.debounce_ms = env_int(DEBOUNCE_ENVNAME, DEFAULT_DEBOUNCE_MS);
+	if(session.debounce_ms > MAX_DEBOUNCE_MS)
+		session.debounce_ms = MAX_DEBOUNCE_MS;
+	target_array_init(&session.targets);
+	hashmap_init(&session.target_names, 64);
+	hashmap_init(&session.sources, 1024);
+
+	session.build_dir = realpath(argc > 0 ? argv[0] : ".", NULL);
+	session.tool_argc = argc > 1 ? argc - 1 : 0;
+	session.tool_argv = argv + 1;
+	if(session.build_dir == NULL) {
+		fprintf(stderr, "ERROR: Failed to resolve the build directory: %s\n", strerror(errno));
+		return 1;
+	}
+
+	cache_path = sprintf_alloc("%s/CMakeCache.txt", session.build_dir);
+	session.source_dir = cache_path != NULL ? cache_value(cache_path, "CMAKE_HOME_DIRECTORY") : NULL;
+	session.generator = cache_path != NULL ? cache_value(cache_path, "CMAKE_GENERATOR") : NULL;
+	session.make_program = cache_path != NULL ? cache_value(cache_path, "CMAKE_MAKE_PROGRAM") : NULL;
+	free(cache_path);
+	if(session.source_dir == NULL || session.generator == NULL) {
+		fprintf(stderr, "ERROR: %s is not a configured CMake build tree\n", session.build_dir);
+		session_reset(&session);
+		return 1;
+	}
+
+	if(cross_find_cmake(ctx, paths, &session.cmake) != CROSS_OK) {
+		fprintf(stderr, "ERROR: %s\n", cross_context_error(ctx));
+		session_reset(&session);
+		return cross_exit_code(ctx);
+	}
+
+	// The target map comes from the file API, which needs one configure run
+	// to produce its first reply.
+	if(!write_api_query(&session))
+		fprintf(stderr, "WARNING: Failed to write the file API query; rebuilding everything on change\n");
+	if(!latest_reply_index(&session, session.reply_index, sizeof(session.reply_index))) {
+		char* configure[] = { session.cmake, session.build_dir, NULL };
+		run_command(configure);
+	}
+	if(load_targets(&session))
+		watch_log("Loaded %zu targets", session.targets.base.elements);
+
+	if((code = watcher_init(&session.watcher, session.build_dir)) != 0) {
+		fprintf(stderr, "ERROR: Failed to start watching: %s\n", strerror(-code));
+		session_reset(&session);
+		return 1;
+	}
+	watcher_add(&session.watcher, session.source_dir);
+	if(cross_resolve_sysroot(ctx, paths, &session.sysroot) == CROSS_OK &&
+	   (include_dir = sprintf_alloc("%s/usr/include", session.sysroot)) != NULL) {
+		watcher_add(&session.watcher, include_dir);
+		free(include_dir);
+	}
+	watch_log("Watching %s", session.source_dir);
+
+	code = build(&session, NULL);
+	watch_log("%s; waiting for changes", code == 0 ? "Up to date" : "Build FAILED");
+	refresh_targets(&session);
+
+	for(;;) {
+		string_array* changes = NULL;
+		if((code = watcher_wait(&session.watcher, session.debounce_ms, &changes)) != 0) {
+			fprintf(stderr, "ERROR: Stopped watching: %s\n", strerror(-code));
+			session_reset(&session);
+			return 1;
+		}
+		if(changes == NULL)
+			continue;
+		build_changes(&session, changes);
+		string_array_free(changes);
+	}
+}
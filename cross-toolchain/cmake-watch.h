@@ -0,0 +1,31 @@
+/**
+ * @file cmake-watch.h
+ * @author Charles Grunwald <cgrunwald@gmail.com>
+ * @brief Continuous rebuilds for the cross-cmake wrapper.
+ */
+#ifndef _CMAKE_WATCH_H_
+#define _CMAKE_WATCH_H_
+#pragma once
+
+#include "shared.h"
+#include "libcross.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CMAKE_WATCH_ARG "--watch"
+
+/**
+ * Implements `<triple>-cmake --watch [BUILD_DIR] [BUILD_TOOL_ARGS...]`.
+ * Builds the tree once, then rebuilds the targets affected by every change
+ * to the source tree or the sysroot's headers until interrupted. Only
+ * returns on failure, with the process exit code.
+ */
+int cmake_watch(struct cross_context* ctx, const struct cross_paths* paths, int argc, char** argv);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* _CMAKE_WATCH_H_ */
@@ -0,0 +1,752 @@
+/**
+ * @file cross-bench.c
+ * @author Charles Grunwald <cgrunwald@gmail.com>
+ * @brief Benchmarks target programs on the build host against the sysroot.
+ *
+ * Usage: <triple>-bench [OPTIONS] [--] PROGRAM [ARGS...]
+ *
+ * PROGRAM runs through <triple>-run, so it gets the sysroot's loader and
+ * libraries exactly as under ctest. Each run is pinned to the isolated CPUs
+ * (or the ones given with -c), and after the warmup runs every run records
+ * wall and CPU time, peak RSS and, where the kernel lets us, cycles,
+ * instructions, cache misses, branch misses, L1 instruction cache misses and
+ * iTLB misses from perf_event_open. The counters follow every thread and
+ * child process PROGRAM starts, and count user space only so
+ * perf_event_paranoid=2 is enough. They include the few microseconds
+ * <triple>-run takes to exec the loader, the same in every build.
+ *
+ * The samples are appended to a JSON lines history. A build is identified by
+ * a label (-b, by default a hash of PROGRAM), and each run is compared with
+ * the latest run of the same benchmark from a different build: a metric whose
+ * median moved past its threshold, with a Mann-Whitney U test saying the
+ * shift isn't noise, is reported as a regression with a non-zero exit status.
+ * Runs sharing a history file hold a lock on it, so benchmarks started in
+ * parallel by the build don't disturb each other.
+ */
+#define _GNU_SOURCE
+
+#include <getopt.h>
+#include <math.h>
+#include <sched.h>
+#include <sys/file.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#ifdef HAVE_LINUX_PERF_EVENT_H
+#	include <linux/perf_event.h>
+#endif
+
+#include "shared.h"
+#include "strutil.h"
+#include "sha256.h"
+#include "json.h"
+#include "libcross.h"
+
+#define PATH_SEP_CHR '/'
+
+#define UNAME_SUFFIX "-bench"
+#define RUN_SUFFIX "-run"
+#define ISOLATED_CPUS "/sys/devices/system/cpu/isolated"
+
+#define DEFAULT_WARMUP 1
+#define DEFAULT_RUNS 10
+#define DEFAULT_ALPHA 0.05
+#define BUILD_LABEL_SIZE 12
+
+struct metric
+{
+	const char* key;
+	const char* label;
+	const char* unit;
+	double scale;
+	// Regression threshold in percent of the baseline median.
+	double threshold;
+	bool counter;
+};
+
+enum metric_id
+{
+	METRIC_WALL,
+	METRIC_CPU,
+	METRIC_RSS,
+	METRIC_CYCLES,
+	METRIC_INSTRUCTIONS,
+	METRIC_CACHE_MISSES,
+	METRIC_BRANCH_MISSES,
+	METRIC_ICACHE_MISSES,
+	METRIC_ITLB_MISSES,
+	METRIC_COUNT
+};
+
+static struct metric metrics[METRIC_COUNT] = {
+	{ "wall_ns",       "wall time",     "ms", 1e-6,  3.0, false },
+	{ "cpu_ns",        "CPU time",      "ms", 1e-6,  3.0, false },
+	{ "max_rss_kb",    "peak RSS",      "MB", 1.0 / 1024, 5.0, false },
+	{ "cycles",        "cycles",        "M",  1e-6,  3.0, true },
+	{ "instructions",  "instructions",  "M",  1e-6,  1.0, true },
+	{ "cache_misses",  "cache misses",  "K",  1e-3, 10.0, true },
+	{ "branch_misses", "branch misses", "K",  1e-3, 10.0, true },
+	{ "icache_misses", "L1i misses",    "K",  1e-3, 10.0, true },
+	{ "itlb_misses",   "iTLB misses",   "K",  1e-3, 10.0, true },
+};
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+#define CACHE_READ_MISSES(CACHE) \
+	((CACHE) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+struct counter
+{
+	uint32_t type;
+	unsigned long long config;
+};
+
+static const struct counter counter_events[METRIC_COUNT] = {
+	[METRIC_CYCLES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	[METRIC_INSTRUCTIONS] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	[METRIC_CACHE_MISSES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+	[METRIC_BRANCH_MISSES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	[METRIC_ICACHE_MISSES] = { PERF_TYPE_HW_CACHE, CACHE_READ_MISSES(PERF_COUNT_HW_CACHE_L1I) },
+	[METRIC_ITLB_MISSES] = { PERF_TYPE_HW_CACHE, CACHE_READ_MISSES(PERF_COUNT_HW_CACHE_ITLB) },
+};
+#endif
+
+struct samples
+{
+	double* values;
+	size_t count;
+};
+
+struct bench
+{
+	const char* name;
+	const char* build;
+	const char* history;
+	const char* cpus;
+	char* runner;
+	char* program;
+	int warmup;
+	int runs;
+	double alpha;
+	bool verbose;
+	bool pinned;
+	cpu_set_t cpu_set;
+	// Counters the kernel refused; reported once and left out.
+	bool unavailable[METRIC_COUNT];
+	struct samples samples[METRIC_COUNT];
+};
+
+static CC_NORETURN fatal_message(int code, const char* format, ...)
+{
+	va_list args;
+	fprintf(stderr, "ERROR: ");
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+	fprintf(stderr, "\n");
+	exit(code != 0 ? code : 1);
+}
+
+static void usage(const char* exe)
+{
+	printf("Usage: %s [OPTIONS] [--] PROGRAM [ARGS...]\n\n", exe);
+	printf("Runs a target PROGRAM repeatedly through the sysroot's loader, pinned to\n");
+	printf("isolated CPUs, and compares its timings and hardware counters with the\n");
+	printf("previous build's in a history file.\n\n");
+	printf("  -n NAME        Benchmark name in the history (default: PROGRAM's file name)\n");
+	printf("  -b BUILD       Label of this build (default: a hash of PROGRAM)\n");
+	printf("  -H HISTORY     JSON lines file results are compared against and appended to\n");
+	printf("  -c CPUS        CPUs to pin to, as a list (ex: 2-3,6) (default: the isolated CPUs)\n");
+	printf("  -w WARMUP      Unmeasured runs first (default: %d)\n", DEFAULT_WARMUP);
+	printf("  -r RUNS        Measured runs (default: %d)\n", DEFAULT_RUNS);
+	printf("  -t THRESHOLDS  Regression thresholds in percent, as METRIC=PERCENT,... by history key\n");
+	printf("  -a ALPHA       Significance level of the comparison (default: %.2f)\n", DEFAULT_ALPHA);
+	printf("  -v             Show PROGRAM's output\n");
+}
+
+static double now_seconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/*
+ * METRIC=PERCENT,... using the history keys.
+ */
+static void parse_thresholds(const char* spec)
+{
+	char* copy = strdup(spec);
+	char* saveptr = NULL;
+
+	for(char* tok = strtok_r(copy, ",", &saveptr); tok != NULL; tok = strtok_r(NULL, ",", &saveptr)) {
+		char* value = strchr(tok, '=');
+		int i;
+		if(value != NULL)
+			*value++ = '\0';
+		for(i = 0; i < METRIC_COUNT && strcmp(tok, metrics[i].key) != 0; i++)
+			;
+		if(value == NULL || i == METRIC_COUNT)
+			fatal_message(EINVAL, "Unknown threshold '%s'", tok);
+		metrics[i].threshold = strtod(value, NULL);
+	}
+	free(copy);
+}
+
+/*
+ * CPU lists as the kernel writes them: "2-3,6".
+ */
+static bool parse_cpus(const char* spec, cpu_set_t* set)
+{
+	const char* p = spec;
+
+	CPU_ZERO(set);
+	while(*p != '\0' && *p != '\n') {
+		char* end;
+		long first = strtol(p, &end, 10), last;
+		if(end == p || first < 0)
+			return false;
+		last = first;
+		if(*end == '-') {
+			p = end + 1;
+			last = strtol(p, &end, 10);
+			if(end == p || last < first)
+				return false;
+		}
+		if(last >= CPU_SETSIZE)
+			return false;
+		for(long cpu = first; cpu <= last; cpu++)
+			CPU_SET((size_t)cpu, set);
+		p = end;
+		if(*p == ',')
+			p++;
+		else if(*p != '\0' && *p != '\n')
+			return false;
+	}
+	return CPU_COUNT(set) > 0;
+}
+
+static char* isolated_cpus(void)
+{
+	char buffer[256] = "";
+	size_t len;
+	FILE* file = fopen(ISOLATED_CPUS, "r");
+
+	if(file == NULL)
+		return NULL;
+	len = fread(buffer, 1, sizeof(buffer) - 1, file);
+	fclose(file);
+	while(len > 0 && (buffer[len - 1] == '\n' || buffer[len - 1] == ' '))
+		len--;
+	buffer[len] = '\0';
+	return len > 0 ? strdup(buffer) : NULL;
+}
+
+static const char* default_build(const char* program)
+{
+	static char label[SHA256_HEX_SIZE];
+	unsigned char digest[SHA256_DIGEST_SIZE];
+
+	if(sha256_file(program, digest) != 0)
+		fatal_message(errno, "Failed to read %s: %s", program, strerror(errno));
+	sha256_hex(digest, label);
+	label[BUILD_LABEL_SIZE] = '\0';
+	return label;
+}
+
+/*
+ * Counters
+ */
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+static int open_counter(struct bench* bench, int metric, pid_t pid)
+{
+	int fd;
+	struct perf_event_attr attr;
+
+	if(bench->unavailable[metric])
+		return -1;
+	memset((void*)&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = counter_events[metric].type;
+	attr.config = counter_events[metric].config;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	attr.disabled = 1;
+	attr.enable_on_exec = 1;
+	attr.inherit = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	fd = (int)syscall(SYS_perf_event_open, &attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+	if(fd < 0) {
+		fprintf(stderr, "WARNING: No %s counter: %s%s\n", metrics[metric].label, strerror(errno),
+		        errno == EACCES || errno == EPERM ? " (see /proc/sys/kernel/perf_event_paranoid)" : "");
+		bench->unavailable[metric] = true;
+	}
+	return fd;
+}
+
+/*
+ * Scaled up for the time the counter was multiplexed out.
+ */
+static bool read_counter(int fd, double* value)
+{
+	unsigned long long data[3];
+
+	if(read(fd, data, sizeof(data)) != (ssize_t)sizeof(data) || data[2] == 0)
+		return false;
+	*value = (double)data[0] * ((double)data[1] / (double)data[2]);
+	return true;
+}
+#endif
+
+/*
+ * Running the program
+ */
+
+static void add_sample(struct bench* bench, int metric, double value)
+{
+	struct samples* samples = &bench->samples[metric];
+	double* values = (double*)realloc(samples->values, (samples->count + 1) * sizeof(double));
+
+	if(values == NULL)
+		fatal_message(ENOMEM, "Out of memory");
+	values[samples->count++] = value;
+	samples->values = values;
+}
+
+/*
+ * The child waits on a pipe until the counters are attached, and they start
+ * counting when it execs.
+ */
+static void run_once(struct bench* bench, char** argv, bool measure)
+{
+	int status, fd, sync[2];
+#ifdef HAVE_LINUX_PERF_EVENT_H
+	int counters[METRIC_COUNT];
+#endif
+	char go = 0;
+	double started, finished;
+	pid_t pid;
+	struct rusage usage;
+
+	if(pipe2(sync, O_CLOEXEC) != 0)
+		fatal_message(errno, "pipe: %s", strerror(errno));
+	fflush(stdout);
+	if((pid = fork()) < 0)
+		fatal_message(errno, "fork: %s", strerror(errno));
+	if(pid == 0) {
+		close(sync[1]);
+		if(bench->pinned && sched_setaffinity(0, sizeof(cpu_set_t), &bench->cpu_set) != 0) {
+			fprintf(stderr, "ERROR: Failed to pin to CPUs %s: %s\n", bench->cpus, strerror(errno));
+			_exit(127);
+		}
+		if(!bench->verbose && (fd = open("/dev/null", O_WRONLY)) >= 0) {
+			dup2(fd, STDOUT_FILENO);
+			close(fd);
+		}
+		if(read(sync[0], &go, 1) != 1)
+			_exit(127);
+		execv(argv[0], argv);
+		fprintf(stderr, "ERROR: Failed to run %s: %s\n", argv[0], strerror(errno));
+		_exit(127);
+	}
+
+	close(sync[0]);
+#ifdef HAVE_LINUX_PERF_EVENT_H
+	for(int i = 0; i < METRIC_COUNT; i++)
+		counters[i] = measure && metrics[i].counter ? open_counter(bench, i, pid) : -1;
+#endif
+	started = now_seconds();
+	if(write(sync[1], &go, 1) != 1)
+		fatal_message(errno, "Failed to start %s: %s", bench->program, strerror(errno));
+	close(sync[1]);
+	while(wait4(pid, &status, 0, &usage) < 0) {
+		if(errno != EINTR)
+			fatal_message(errno, "wait4: %s", strerror(errno));
+	}
+	finished = now_seconds();
+
+	if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		if(WIFSIGNALED(status))
+			fatal_message(1, "%s died with signal %d", bench->program, WTERMSIG(status));
+		fatal_message(1, "%s failed with exit status %d", bench->program, WEXITSTATUS(status));
+	}
+	if(!measure)
+		return;
+
+	add_sample(bench, METRIC_WALL, (finished - started) * 1e9);
+	add_sample(bench, METRIC_CPU, ((double)usage.ru_utime.tv_sec + (double)usage.ru_stime.tv_sec) * 1e9 +
+	                              ((double)usage.ru_utime.tv_usec + (double)usage.ru_stime.tv_usec) * 1e3);
+	add_sample(bench, METRIC_RSS, (double)usage.ru_maxrss);
+#ifdef HAVE_LINUX_PERF_EVENT_H
+	for(int i = 0; i < METRIC_COUNT; i++) {
+		double value;
+		if(counters[i] < 0)
+			continue;
+		if(read_counter(counters[i], &value))
+			add_sample(bench, i, value);
+		close(counters[i]);
+	}
+#endif
+}
+
+static char** runner_argv(const struct bench* bench, int argc, char** argv)
+{
+	char** result = (char**)calloc((size_t)argc + 4, sizeof(char*));
+	size_t index = 0;
+
+	if(result == NULL)
+		fatal_message(ENOMEM, "Out of memory");
+	result[index++] = bench->runner;
+	result[index++] = "--";
+	result[index++] = bench->program;
+	for(int i = 1; i < argc; i++)
+		result[index++] = argv[i];
+	return result;
+}
+
+/*
+ * Statistics
+ */
+
+static int compare_doubles(const void* a, const void* b)
+{
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+static double median(const struct samples* samples)
+{
+	double result;
+	double* sorted;
+	size_t n = samples->count;
+
+	if(n == 0 || (sorted = (double*)malloc(n * sizeof(double))) == NULL)
+		return 0;
+	memcpy(sorted, samples->values, n * sizeof(double));
+	qsort(sorted, n, sizeof(double), compare_doubles);
+	result = n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+	free(sorted);
+	return result;
+}
+
+static double stddev(const struct samples* samples)
+{
+	double mean = 0, sum = 0;
+
+	if(samples->count < 2)
+		return 0;
+	for(size_t i = 0; i < samples->count; i++)
+		mean += samples->values[i];
+	mean /= (double)samples->count;
+	for(size_t i = 0; i < samples->count; i++)
+		sum += (samples->values[i] - mean) * (samples->values[i] - mean);
+	return sqrt(sum / (double)(samples->count - 1));
+}
+
+struct ranked_value
+{
+	double value;
+	bool first;
+};
+
+static int compare_ranked(const void* a, const void* b)
+{
+	return compare_doubles(&((const struct ranked_value*)a)->value, &((const struct ranked_value*)b)->value);
+}
+
+/*
+ * Two-sided p-value of a Mann-Whitney U test, from the normal approximation
+ * with a correction for ties. It makes no assumption about how run times are
+ * distributed, and a few outliers can't swing it.
+ */
+static double mann_whitney(const struct samples* a, const struct samples* b)
+{
+	size_t n = a->count + b->count;
+	double n1 = (double)a->count, n2 = (double)b->count;
+	double rank_sum = 0, ties = 0, u, mean, variance;
+	struct ranked_value* values;
+
+	if(a->count == 0 || b->count == 0 || (values = (struct ranked_value*)calloc(n, sizeof(*values))) == NULL)
+		return 1;
+	for(size_t i = 0; i < a->count; i++) {
+		values[i].value = a->values[i];
+		values[i].first = true;
+	}
+	for(size_t i = 0; i < b->count; i++)
+		values[a->count + i].value = b->values[i];
+	qsort(values, n, sizeof(*values), compare_ranked);
+
+	for(size_t i = 0; i < n;) {
+		size_t j = i;
+		double rank, t;
+		while(j < n && values[j].value == values[i].value)
+			j++;
+		// Tied values share the average of their ranks.
+		rank = (double)(i + 1 + j) / 2;
+		t = (double)(j - i);
+		ties += t * t * t - t;
+		for(; i < j; i++) {
+			if(values[i].first)
+				rank_sum += rank;
+		}
+	}
+	free(values);
+
+	u = rank_sum - n1 * (n1 + 1) / 2;
+	mean = n1 * n2 / 2;
+	variance = n1 * n2 / 12 * ((double)n + 1 - ties / ((double)n * (double)(n - 1)));
+	if(variance <= 0)
+		return 1;
+	return erfc(fabs(u - mean) / sqrt(variance) / sqrt(2.0));
+}
+
+/*
+ * History
+ */
+
+static void write_json_string(FILE* file, const char* value)
+{
+	fputc('"', file);
+	for(const unsigned char* p = (const unsigned char*)value; *p != '\0'; p++) {
+		if(*p == '"' || *p == '\\')
+			fprintf(file, "\\%c", *p);
+		else if(*p < 0x20)
+			fprintf(file, "\\u%04x", *p);
+		else
+			fputc(*p, file);
+	}
+	fputc('"', file);
+}
+
+static void append_history(const struct bench* bench, FILE* file, int argc, char** argv)
+{
+	fprintf(file, "{\"time\":%lld,\"name\":", (long long)time(NULL));
+	write_json_string(file, bench->name);
+	fprintf(file, ",\"build\":");
+	write_json_string(file, bench->build);
+	fprintf(file, ",\"program\":");
+	write_json_string(file, bench->program);
+	fprintf(file, ",\"args\":[");
+	for(int i = 1; i < argc; i++) {
+		if(i > 1)
+			fputc(',', file);
+		write_json_string(file, argv[i]);
+	}
+	fprintf(file, "],\"cpus\":");
+	write_json_string(file, bench->pinned ? bench->cpus : "");
+	fprintf(file, ",\"warmup\":%d,\"samples\":{", bench->warmup);
+	for(int i = 0, written = 0; i < METRIC_COUNT; i++) {
+		const struct samples* samples = &bench->samples[i];
+		if(samples->count == 0)
+			continue;
+		fprintf(file, "%s\"%s\":[", written++ > 0 ? "," : "", metrics[i].key);
+		for(size_t j = 0; j < samples->count; j++)
+			fprintf(file, "%s%.0f", j > 0 ? "," : "", samples->values[j]);
+		fputc(']', file);
+	}
+	fprintf(file, "}}\n");
+	fflush(file);
+}
+
+static void reset_samples(struct samples* samples)
+{
+	for(int i = 0; i < METRIC_COUNT; i++) {
+		free(samples[i].values);
+		samples[i].values = NULL;
+		samples[i].count = 0;
+	}
+}
+
+static void load_samples(const struct json_value* entry, struct samples* samples)
+{
+	const struct json_value* recorded = json_get(entry, "samples");
+
+	reset_samples(samples);
+	for(int i = 0; i < METRIC_COUNT; i++) {
+		const struct json_value* values = json_get(recorded, metrics[i].key);
+		size_t count = json_count(values);
+		if(values == NULL || values->type != JSON_ARRAY || count == 0)
+			continue;
+		if((samples[i].values = (double*)calloc(count, sizeof(double))) == NULL)
+			fatal_message(ENOMEM, "Out of memory");
+		for(size_t j = 0; j < count; j++) {
+			const struct json_value* value = json_at(values, j);
+			samples[i].values[j] = value != NULL && value->type == JSON_NUMBER ? value->number : 0;
+		}
+		samples[i].count = count;
+	}
+}
+
+/*
+ * The latest run of this benchmark from another build. Returns its label,
+ * or NULL if there isn't one.
+ */
+static char* history_baseline(const struct bench* bench, FILE* file, struct samples* baseline)
+{
+	char* line = NULL;
+	char* build = NULL;
+	size_t line_size = 0;
+	ssize_t len;
+
+	rewind(file);
+	while((len = getline(&line, &line_size, file)) > 0) {
+		struct json_value* entry = NULL;
+		const char* name;
+		const char* label;
+
+		if(json_parse(line, (size_t)len, &entry) != 0)
+			continue;
+		name = json_string(json_get(entry, "name"));
+		label = json_string(json_get(entry, "build"));
+		if(name != NULL && label != NULL && strcmp(name, bench->name) == 0 && strcmp(label, bench->build) != 0) {
+			load_samples(entry, baseline);
+			free(build);
+			build = strdup(label);
+		}
+		json_free(entry);
+	}
+	free(line);
+	return build;
+}
+
+static int report(const struct bench* bench, const struct samples* baseline, const char* baseline_build)
+{
+	int regressions = 0;
+
+	printf("\n%-14s %12s %8s", "metric", "median", "stddev");
+	if(baseline_build != NULL)
+		printf(" %12s %8s %7s", "baseline", "change", "p");
+	printf("\n");
+	for(int i = 0; i < METRIC_COUNT; i++) {
+		const struct samples* samples = &bench->samples[i];
+		double value = median(samples), base, change, p;
+		if(samples->count == 0)
+			continue;
+		printf("%-14s %9.3f %-2s %7.1f%%", metrics[i].label, value * metrics[i].scale, metrics[i].unit,
+		       value > 0 ? 100.0 * stddev(samples) / value : 0.0);
+		if(baseline_build == NULL || baseline[i].count == 0 || (base = median(&baseline[i])) <= 0) {
+			printf("\n");
+			continue;
+		}
+		change = (value - base) / base * 100.0;
+		p = mann_whitney(samples, &baseline[i]);
+		printf(" %9.3f %-2s %+7.1f%% %7.3f\n", base * metrics[i].scale, metrics[i].unit, change, p);
+		if(change > metrics[i].threshold && p < bench->alpha) {
+			printf("REGRESSION: %s: %s %+.1f%% vs build %s (threshold %.1f%%, p=%.3g)\n", bench->name,
+			       metrics[i].label, change, baseline_build, metrics[i].threshold, p);
+			regressions++;
+		}
+	}
+	if(bench->samples[METRIC_CYCLES].count > 0 && bench->samples[METRIC_INSTRUCTIONS].count > 0) {
+		double cycles = median(&bench->samples[METRIC_CYCLES]);
+		if(cycles > 0)
+			printf("%-14s %9.2f\n", "IPC", median(&bench->samples[METRIC_INSTRUCTIONS]) / cycles);
+	}
+	return regressions;
+}
+
+int main(int argc, char** argv)
+{
+	int opt, regressions = 0;
+	char exe[PATH_MAX] = "";
+	char* baseline_build = NULL;
+	char** child_argv;
+	FILE* history = NULL;
+	struct bench bench;
+	struct samples baseline[METRIC_COUNT];
+	struct cross_paths paths;
+	struct cross_context ctx;
+
+	memset((void*)&bench, 0, sizeof(bench));
+	memset((void*)baseline, 0, sizeof(baseline));
+	bench.warmup = DEFAULT_WARMUP;
+	bench.runs = DEFAULT_RUNS;
+	bench.alpha = DEFAULT_ALPHA;
+
+	while((opt = getopt(argc, argv, "+n:b:H:c:w:r:t:a:vh")) != -1) {
+		switch(opt) {
+			case 'n': bench.name = optarg; break;
+			case 'b': bench.build = optarg; break;
+			case 'H': bench.history = optarg; break;
+			case 'c': bench.cpus = optarg; break;
+			case 'w': bench.warmup = atoi(optarg); break;
+			case 'r': bench.runs = atoi(optarg); break;
+			case 't': parse_thresholds(optarg); break;
+			case 'a': bench.alpha = strtod(optarg, NULL); break;
+			case 'v': bench.verbose = true; break;
+			case 'h':
+				usage(argv[0]);
+				return 0;
+			default:
+				usage(argv[0]);
+				return 2;
+		}
+	}
+	if(optind >= argc) {
+		usage(argv[0]);
+		return 2;
+	}
+	if(bench.warmup < 0)
+		bench.warmup = 0;
+	if(bench.runs < 1)
+		bench.runs = 1;
+
+	if(cross_context_init(&ctx, NULL) != CROSS_OK || proc_path(exe, PATH_MAX) != 0)
+		fatal_message(errno, "Failed to look up our own path");
+	if(cross_paths_init(&ctx, &paths, exe, UNAME_SUFFIX) != CROSS_OK)
+		fatal_message(cross_exit_code(&ctx), "%s", cross_context_error(&ctx));
+	bench.runner = sprintf_alloc("%s/%s" RUN_SUFFIX, paths.bindir.value, paths.uname.value);
+	if(bench.runner == NULL || access(bench.runner, X_OK) != 0)
+		fatal_message(ENOENT, "Failed to locate %s", bench.runner);
+	if((bench.program = realpath(argv[optind], NULL)) == NULL)
+		fatal_message(errno, "Failed to locate %s: %s", argv[optind], strerror(errno));
+	if(bench.name == NULL)
+		bench.name = strrchr(bench.program, PATH_SEP_CHR) + 1;
+	if(bench.build == NULL)
+		bench.build = default_build(bench.program);
+
+	if(bench.cpus == NULL)
+		bench.cpus = isolated_cpus();
+	if(bench.cpus != NULL) {
+		if(!parse_cpus(bench.cpus, &bench.cpu_set))
+			fatal_message(EINVAL, "Invalid CPU list '%s'", bench.cpus);
+		bench.pinned = true;
+	} else {
+		fprintf(stderr, "WARNING: No isolated CPUs (isolcpus=) and no -c; runs aren't pinned\n");
+	}
+
+	// Held until we're done, so benchmarks sharing the history run one at a time.
+	if(bench.history != NULL) {
+		if((history = fopen(bench.history, "a+")) == NULL)
+			fatal_message(errno, "Failed to open %s: %s", bench.history, strerror(errno));
+		if(flock(fileno(history), LOCK_EX) != 0)
+			fatal_message(errno, "Failed to lock %s: %s", bench.history, strerror(errno));
+	}
+
+	printf("%s: %s (build %s), %d runs after %d warmup, CPUs %s\n", bench.name, bench.program, bench.build,
+	       bench.runs, bench.warmup, bench.pinned ? bench.cpus : "unpinned");
+	child_argv = runner_argv(&bench, argc - optind, argv + optind);
+	for(int run = 0; run < bench.warmup + bench.runs; run++)
+		run_once(&bench, child_argv, run >= bench.warmup);
+
+	if(history != NULL)
+		baseline_build = history_baseline(&bench, history, baseline);
+	regressions = report(&bench, baseline, baseline_build);
+	if(history != NULL) {
+		append_history(&bench, history, argc - optind, argv + optind);
+		fclose(history);
+	}
+
+	reset_samples(baseline);
+	reset_samples(bench.samples);
+	free(baseline_build);
+	free(child_argv);
+	free(bench.program);
+	free(bench.runner);
+	cross_paths_reset(&ctx, &paths);
+	return regressions > 0 ? 1 : 0;
+}
@@ -0,0 +1,906 @@
+/**
+ * @file cross-bundle.c
+ * @author Charles Grunwald <cgrunwald@gmail.com>
+ * @brief Packages files from the staging prefix into a deploy bundle.
+ *
+ * Reads a list of files (one per line, such as CMake's install_manifest.txt)
+ * and writes them out as a ustar stream. With compression enabled, the stream
+ * is cut into fixed-size blocks that are compressed concurrently as separate
+ * gzip members, which any gzip reader treats as one stream. Without it, file
+ * bodies are copied straight from file to bundle in the kernel.
+ *
+ * Each file is read exactly once; its SHA-256 is computed from the same buffer
+ * that feeds the archive. The hashes are written to a manifest next to the
+ * bundle, and the bundle is left untouched when its content hasn't changed.
+ */
+#define _GNU_SOURCE
+
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <zlib.h>
+#if defined(HAVE_SENDFILE)
+#	include <sys/sendfile.h>
+#endif
+
+#include "shared.h"
+#include "strutil.h"
+#include "dynarray.h"
+#include "hashmap.h"
+#include "libcross.h"
+#include "sha256.h"
+#include "workqueue.h"
+
+#define PATH_SEP_CHR '/'
+
+#define UNAME_SUFFIX "-bundle"
+#define MANIFEST_SUFFIX ".manifest"
+#define MANIFEST_MAGIC "# cross-bundle manifest v1"
+#define MANIFEST_DIGEST "# digest "
+#define MANIFEST_SETTINGS "# settings "
+
+#define TAR_BLOCK_SIZE 512
+#define TAR_NAME_SIZE 100
+#define TAR_PREFIX_SIZE 155
+#define TAR_LONGLINK "././@LongLink"
+
+#define DEFAULT_BLOCK_KB 1024
+#define DEFAULT_LEVEL 6
+
+struct tar_header
+{
+	char name[100];
+	char mode[8];
+	char uid[8];
+	char gid[8];
+	char size[12];
+	char mtime[12];
+	char chksum[8];
+	char typeflag;
+	char linkname[100];
+	char magic[6];
+	char version[2];
+	char uname[32];
+	char gname[32];
+	char devmajor[8];
+	char devminor[8];
+	char prefix[155];
+	char padding[12];
+};
+
+struct bundle_entry
+{
+	char* path;
+	char* name;
+	char* linkname;
+	struct stat st;
+	char hash[SHA256_HEX_SIZE];
+};
+
+DEFINE_ARRAY_TYPE(entry_array, struct bundle_entry)
+
+struct manifest_record
+{
+	unsigned long long size;
+	unsigned int mode;
+	long long mtime_sec;
+	long mtime_nsec;
+	char hash[SHA256_HEX_SIZE];
+};
+
+struct bundle_block
+{
+	unsigned char* input;
+	size_t input_len;
+	unsigned char* output;
+	size_t output_len;
+	size_t output_size;
+	bool busy;
+	int status;
+};
+
+struct bundle_stream
+{
+	int fd;
+	bool compress;
+	int level;
+	size_t block_size;
+
+	struct workqueue wq;
+	pthread_mutex_t lock;
+	pthread_cond_t done;
+	struct bundle_block* slots;
+	size_t slot_count;
+	size_t next_slot;
+	size_t flush_slot;
+
+	// Block currently being filled.
+	unsigned char* buffer;
+	size_t buffer_len;
+	unsigned long long written;
+};
+
+struct bundle_options
+{
+	const char* prefix;
+	const char* output;
+	const char* manifest;
+	size_t jobs;
+	bool force;
+	bool verbose;
+};
+
+static CC_NORETURN fatal_message(int code, const char* format, ...)
+{
+	va_list args;
+	fprintf(stderr, "ERROR: ");
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+	fprintf(stderr, "\n");
+	exit(code != 0 ? code : 1);
+}
+
+static void usage(const char* exe)
+{
+	printf("Usage: %s -o BUNDLE [-C PREFIX] [-m MANIFEST] [-z gzip|none] [-l LEVEL]\n", exe);
+	printf("       %*s [-b BLOCK_KB] [-j JOBS] [-f] [-v] [LIST...]\n\n", (int)strlen(exe), "");
+	printf("Packages the files named in each LIST (or stdin) into a tar bundle. Paths\n");
+	printf("are archived relative to PREFIX, the staging prefix by default.\n\n");
+	printf("  -o BUNDLE    Output bundle\n");
+	printf("  -C PREFIX    Directory archive names are relative to\n");
+	printf("  -m MANIFEST  Content manifest (default: BUNDLE" MANIFEST_SUFFIX ")\n");
+	printf("  -z METHOD    Compression: gzip (default) or none\n");
+	printf("  -l LEVEL     Compression level, 1-9 (default: %d)\n", DEFAULT_LEVEL);
+	printf("  -b BLOCK_KB  Size of independently compressed blocks (default: %d)\n", DEFAULT_BLOCK_KB);
+	printf("  -j JOBS      Number of compression threads (default: online CPUs)\n");
+	printf("  -f           Rebuild the bundle even if it looks up to date\n");
+	printf("  -v           List files as they're added\n");
+}
+
+static ssize_t write_all(int fd, const void* data, size_t length)
+{
+	const unsigned char* p = (const unsigned char*)data;
+	size_t remaining = length;
+	while(remaining > 0) {
+		ssize_t count = write(fd, p, remaining);
+		if(count < 0) {
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += count;
+		remaining -= (size_t)count;
+	}
+	return (ssize_t)length;
+}
+
+/*
+ * Compressed stream
+ */
+
+static void compress_block(struct workqueue* wq, struct bundle_block* block, struct bundle_stream* stream)
+{
+	int code;
+	z_stream zs;
+
+	memset((void*)&zs, 0, sizeof(zs));
+	code = deflateInit2(&zs, stream->level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+	if(code == Z_OK) {
+		uLong bound = deflateBound(&zs, (uLong)block->input_len);
+		if(block->output_size < bound) {
+			free(block->output);
+			block->output = (unsigned char*)malloc(bound);
+			block->output_size = block->output ? bound : 0;
+		}
+
+		if(block->output != NULL) {
+			zs.next_in = block->input;
+			zs.avail_in = (uInt)block->input_len;
+			zs.next_out = block->output;
+			zs.avail_out = (uInt)block->output_size;
+			code = deflate(&zs, Z_FINISH);
+			block->output_len = zs.total_out;
+		} else {
+			code = Z_MEM_ERROR;
+		}
+		deflateEnd(&zs);
+	}
+
+	pthread_mutex_lock(&stream->lock);
+	block->status = code == Z_STREAM_END ? 0 : ENOMEM;
+	block->busy = false;
+	pthread_cond_broadcast(&stream->done);
+	pthread_mutex_unlock(&stream->lock);
+}
+
+// Wait for the oldest in-flight block and write it out. Blocks are written in
+// submission order, which is all that's needed for a valid gzip stream.
+static void stream_flush_slot(struct bundle_stream* stream)
+{
+	struct bundle_block* block = &stream->slots[stream->flush_slot % stream->slot_count];
+
+	pthread_mutex_lock(&stream->lock);
+	while(block->busy)
+		pthread_cond_wait(&stream->done, &stream->lock);
+	pthread_mutex_unlock(&stream->lock);
+
+	if(block->status != 0)
+		fatal_message(block->status, "Failed to compress bundle block");
+	if(write_all(stream->fd, block->output, block->output_len) < 0)
+		fatal_message(errno, "Failed to write bundle: %s", strerror(errno));
+
+	stream->written += block->output_len;
+	stream->flush_slot++;
+}
+
+static void stream_submit(struct bundle_stream* stream)
+{
+	struct bundle_block* block;
+	unsigned char* swap;
+
+	if(stream->buffer_len == 0)
+		return;
+
+	if(!stream->compress) {
+		if(write_all(stream->fd, stream->buffer, stream->buffer_len) < 0)
+			fatal_message(errno, "Failed to write bundle: %s", strerror(errno));
+		stream->written += stream->buffer_len;
+		stream->buffer_len = 0;
+		return;
+	}
+
+	// Reusing a slot means its previous block has to be written first.
+	if(stream->next_slot - stream->flush_slot == stream->slot_count)
+		stream_flush_slot(stream);
+
+	block = &stream->slots[stream->next_slot++ % stream->slot_count];
+	swap = block->input;
+	block->input = stream->buffer;
+	block->input_len = stream->buffer_len;
+	block->busy = true;
+	stream->buffer = swap;
+	stream->buffer_len = 0;
+
+	if(workqueue_push(&stream->wq, block) != 0)
+		fatal_message(ENOMEM, "Failed to queue bundle block");
+}
+
+static void stream_write(struct bundle_stream* stream, const void* data, size_t length)
+{
+	const unsigned char* p = (const unsigned char*)data;
+	while(length > 0) {
+		size_t take = stream->block_size - stream->buffer_len;
+		if(take > length)
+			take = length;
+		memcpy(stream->buffer + stream->buffer_len, p, take);
+		stream->buffer_len += take;
+		p += take;
+		length -= take;
+		if(stream->buffer_len == stream->block_size)
+			stream_submit(stream);
+	}
+}
+
+static void stream_pad(struct bundle_stream* stream, unsigned long long length)
+{
+	static const unsigned char zeros[TAR_BLOCK_SIZE] = { 0 };
+	size_t remainder = (size_t)(length % TAR_BLOCK_SIZE);
+	if(remainder != 0)
+		stream_write(stream, zeros, TAR_BLOCK_SIZE - remainder);
+}
+
+static void stream_init(struct bundle_stream* stream, int fd, bool compress, int level, size_t block_size, size_t jobs)
+{
+	memset((void*)stream, 0, sizeof(*stream));
+	stream->fd = fd;
+	stream->compress = compress;
+	stream->level = level;
+	stream->block_size = block_size;
+	stream->buffer = (unsigned char*)malloc(block_size);
+	if(stream->buffer == NULL)
+		fatal_message(ENOMEM, "Failed to allocate bundle buffer");
+
+	if(compress) {
+		if(workqueue_init(&stream->wq, jobs, (workqueue_handler)compress_block, stream) != 0)
+			fatal_message(1, "Failed to start compression threads");
+
+		// Two blocks per worker keeps them busy while we're writing.
+		stream->slot_count = stream->wq.thread_count * 2;
+		stream->slots = (struct bundle_block*)calloc(stream->slot_count, sizeof(struct bundle_block));
+		if(stream->slots == NULL)
+			fatal_message(ENOMEM, "Failed to allocate bundle blocks");
+		for(size_t i = 0; i < stream->slot_count; i++) {
+			stream->slots[i].input = (unsigned char*)malloc(block_size);
+			if(stream->slots[i].input == NULL)
+				fatal_message(ENOMEM, "Failed to allocate bundle blocks");
+		}
+		pthread_mutex_init(&stream->lock, NULL);
+		pthread_cond_init(&stream->done, NULL);
+	}
+}
+
+static void stream_finish(struct bundle_stream* stream)
+{
+	stream_submit(stream);
+	if(stream->compress) {
+		while(stream->flush_slot < stream->next_slot)
+			stream_flush_slot(stream);
+		workqueue_finish(&stream->wq);
+		for(size_t i = 0; i < stream->slot_count; i++) {
+			free(stream->slots[i].input);
+			free(stream->slots[i].output);
+		}
+		free(stream->slots);
+		pthread_cond_destroy(&stream->done);
+		pthread_mutex_destroy(&stream->lock);
+	}
+	free(stream->buffer);
+	stream->buffer = NULL;
+}
+
+// Copy a file body into the stream, hashing it on the way through.
+static void stream_copy_file(struct bundle_stream* stream, const struct bundle_entry* entry, struct sha256* hash)
+{
+	unsigned long long remaining = (unsigned long long)entry->st.st_size;
+	bool hashed = false;
+	int fd = open(entry->path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+		fatal_message(errno, "Failed to open %s: %s", entry->path, strerror(errno));
+
+#if defined(HAVE_COPY_FILE_RANGE) || defined(HAVE_SENDFILE)
+	// Uncompressed bundles never need the data in userspace, except for the
+	// hash, which we take from the page cache through a read-only mapping.
+	if(!stream->compress && remaining > 0) {
+		void* data = mmap(NULL, (size_t)remaining, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(data != MAP_FAILED) {
+			sha256_update(hash, data, (size_t)remaining);
+			munmap(data, (size_t)remaining);
+			hashed = true;
+			stream_submit(stream);
+			while(remaining > 0) {
+				ssize_t count;
+#	if defined(HAVE_COPY_FILE_RANGE)
+				count = copy_file_range(fd, NULL, stream->fd, NULL, (size_t)remaining, 0);
+#	else
+				count = sendfile(stream->fd, fd, NULL, (size_t)remaining);
+#	endif
+				if(count <= 0)
+					break;
+				remaining -= (unsigned long long)count;
+				stream->written += (unsigned long long)count;
+			}
+			if(remaining > 0 && lseek(fd, (off_t)((unsigned long long)entry->st.st_size - remaining), SEEK_SET) < 0)
+				fatal_message(errno, "Failed to seek %s: %s", entry->path, strerror(errno));
+		}
+	}
+#endif
+
+	// Read straight into the block being filled to avoid an extra copy. If the
+	// kernel copy stopped partway, the mapping already hashed the whole file.
+	while(remaining > 0) {
+		ssize_t count;
+		size_t take = stream->block_size - stream->buffer_len;
+		if(take > remaining)
+			take = (size_t)remaining;
+
+		count = read(fd, stream->buffer + stream->buffer_len, take);
+		if(count < 0 && errno == EINTR)
+			continue;
+		if(count <= 0)
+			fatal_message(count < 0 ? errno : EIO, "Failed to read %s: %s", entry->path,
+			              count < 0 ? strerror(errno) : "file shrank while reading");
+
+		if(!hashed)
+			sha256_update(hash, stream->buffer + stream->buffer_len, (size_t)count);
+		stream->buffer_len += (size_t)count;
+		remaining -= (unsigned long long)count;
+		if(stream->buffer_len == stream->block_size)
+			stream_submit(stream);
+	}
+
+	close(fd);
+	stream_pad(stream, (unsigned long long)entry->st.st_size);
+}
+
+/*
+ * Tar format
+ */
+
+static void tar_number(char* field, size_t field_len, unsigned long long value)
+{
+	// Octal when it fits, otherwise GNU's base-256 extension.
+	if(value < (1ULL << (3 * (field_len - 1)))) {
+		field[field_len - 1] = '\0';
+		for(size_t i = field_len - 1; i > 0; i--) {
+			field[i - 1] = (char)('0' + (value & 7));
+			value >>= 3;
+		}
+		return;
+	}
+
+	memset(field, 0, field_len);
+	for(size_t i = field_len - 1; i > 0 && value > 0; i--) {
+		field[i] = (char)(value & 0xff);
+		value >>= 8;
+	}
+	field[0] = (char)0x80;
+}
+
+static void tar_checksum(struct tar_header* header)
+{
+	unsigned int sum = 0;
+	const unsigned char* p = (const unsigned char*)header;
+	memset(header->chksum, ' ', sizeof(header->chksum));
+	for(size_t i = 0; i < sizeof(*header); i++)
+		sum += p[i];
+	// Six octal digits, a NUL and the space already there.
+	tar_number(header->chksum, sizeof(header->chksum) - 1, sum);
+}
+
+static void tar_init_header(struct tar_header* header, char typeflag, unsigned long long size, unsigned int mode, long long mtime)
+{
+	memset((void*)header, 0, sizeof(*header));
+	header->typeflag = typeflag;
+	tar_number(header->mode, sizeof(header->mode), mode);
+	tar_number(header->uid, sizeof(header->uid), 0);
+	tar_number(header->gid, sizeof(header->gid), 0);
+	tar_number(header->size, sizeof(header->size), size);
+	tar_number(header->mtime, sizeof(header->mtime), mtime > 0 ? (unsigned long long)mtime : 0);
+	memcpy(header->magic, "ustar", 6);
+	memcpy(header->version, "00", 2);
+	strcpy(header->uname, "root");
+	strcpy(header->gname, "root");
+}
+
+static void tar_write_longlink(struct bundle_stream* stream, char typeflag, const char* value)
+{
+	struct tar_header header;
+	size_t len = strlen(value) + 1;
+	tar_init_header(&header, typeflag, len, 0644, 0);
+	strcpy(header.name, TAR_LONGLINK);
+	tar_checksum(&header);
+	stream_write(stream, &header, sizeof(header));
+	stream_write(stream, value, len);
+	stream_pad(stream, len);
+}
+
+static void tar_set_name(struct bundle_stream* stream, struct tar_header* header, const char* name)
+{
+	size_t len = strlen(name);
+	if(len <= TAR_NAME_SIZE) {
+		memcpy(header->name, name, len);
+		return;
+	}
+
+	// Try a ustar prefix/name split first, and fall back to a GNU long name.
+	for(const char* slash = name + len - TAR_NAME_SIZE - 1; slash < name + len; slash++) {
+		if(*slash == PATH_SEP_CHR && (size_t)(slash - name) <= TAR_PREFIX_SIZE && slash > name) {
+			memcpy(header->prefix, name, (size_t)(slash - name));
+			memcpy(header->name, slash + 1, len - (size_t)(slash - name) - 1);
+			return;
+		}
+	}
+
+	tar_write_longlink(stream, 'L', name);
+	memcpy(header->name, name, TAR_NAME_SIZE);
+}
+
+static void tar_write_entry(struct bundle_stream* stream, struct bundle_entry* entry)
+{
+	char typeflag;
+	struct sha256 hash;
+	struct tar_header header;
+	unsigned char digest[SHA256_DIGEST_SIZE];
+	unsigned long long size = 0;
+
+	if(S_ISLNK(entry->st.st_mode)) {
+		typeflag = '2';
+	} else if(S_ISDIR(entry->st.st_mode)) {
+		typeflag = '5';
+	} else {
+		typeflag = '0';
+		size = (unsigned long long)entry->st.st_size;
+	}
+
+	tar_init_header(&header, typeflag, size, (unsigned int)(entry->st.st_mode & 07777), (long long)entry->st.st_mtime);
+	tar_set_name(stream, &header, entry->name);
+	if(entry->linkname != NULL) {
+		// The field needn't be NUL-terminated when it's full.
+		size_t len = strlen(entry->linkname);
+		if(len > sizeof(header.linkname)) {
+			tar_write_longlink(stream, 'K', entry->linkname);
+			len = sizeof(header.linkname);
+		}
+		memcpy(header.linkname, entry->linkname, len);
+	}
+	tar_checksum(&header);
+	stream_write(stream, &header, sizeof(header));
+
+	// Links hash their target, directories hash to the empty string.
+	sha256_init(&hash);
+	if(typeflag == '0')
+		stream_copy_file(stream, entry, &hash);
+	else if(entry->linkname != NULL)
+		sha256_update(&hash, entry->linkname, strlen(entry->linkname));
+	sha256_final(&hash, digest);
+	sha256_hex(digest, entry->hash);
+}
+
+static void tar_write_trailer(struct bundle_stream* stream)
+{
+	static const unsigned char zeros[TAR_BLOCK_SIZE * 2] = { 0 };
+	stream_write(stream, zeros, sizeof(zeros));
+}
+
+/*
+ * File list
+ */
+
+static int entry_compare(const void* a, const void* b)
+{
+	return strcmp(((const struct bundle_entry*)a)->name, ((const struct bundle_entry*)b)->name);
+}
+
+static void entries_add(struct entry_array* entries, const char* prefix, const char* line)
+{
+	struct bundle_entry* entry;
+	size_t prefix_len = strlen(prefix);
+	char* path;
+	const char* name;
+
+	path = *line == PATH_SEP_CHR ? strdup(line) : sprintf_alloc("%s/%s", prefix, line);
+	if(path == NULL)
+		fatal_message(ENOMEM, "Failed to add %s", line);
+
+	// Archive names are relative to the prefix, or just made relative if the
+	// file lives outside of it.
+	name = path;
+	if(strncmp(path, prefix, prefix_len) == 0 && path[prefix_len] == PATH_SEP_CHR)
+		name = path + prefix_len;
+	while(*name == PATH_SEP_CHR)
+		name++;
+	if(*name == '\0') {
+		free(path);
+		return;
+	}
+
+	entry = entry_array_append0(entries);
+	if(entry == NULL)
+		fatal_message(ENOMEM, "Failed to add %s", line);
+	entry->path = path;
+	entry->name = (char*)name;
+	if(lstat(path, &entry->st) != 0)
+		fatal_message(errno, "Failed to stat %s: %s", path, strerror(errno));
+
+	if(S_ISLNK(entry->st.st_mode)) {
+		char target[PATH_MAX] = "";
+		ssize_t len = readlink(path, target, PATH_MAX - 1);
+		if(len < 0)
+			fatal_message(errno, "Failed to read link %s: %s", path, strerror(errno));
+		target[len] = '\0';
+		entry->linkname = strdup(target);
+	} else if(!S_ISREG(entry->st.st_mode) && !S_ISDIR(entry->st.st_mode)) {
+		fatal_message(EINVAL, "Unsupported file type: %s", path);
+	}
+}
+
+static void entries_load(struct entry_array* entries, const char* prefix, FILE* file)
+{
+	char line[PATH_MAX] = "";
+	while(fgets(line, sizeof(line), file) != NULL) {
+		size_t len = strlen(line);
+		while(len > 0 && isspace((unsigned char)line[len - 1]))
+			line[--len] = '\0';
+		if(len == 0 || line[0] == '#')
+			continue;
+		entries_add(entries, prefix, line);
+	}
+}
+
+static void entries_sort_unique(struct entry_array* entries)
+{
+	size_t count = entries->base.elements;
+	struct bundle_entry* items;
+	size_t kept = 0;
+
+	// Sorted archives are reproducible regardless of install order.
+	entry_array_sort(entries, entry_compare);
+	items = (struct bundle_entry*)entries->base.base;
+	for(size_t i = 0; i < count; i++) {
+		if(kept > 0 && strcmp(items[kept - 1].name, items[i].name) == 0) {
+			free(items[i].path);
+			free(items[i].linkname);
+			continue;
+		}
+		items[kept++] = items[i];
+	}
+	entries->base.elements = kept;
+}
+
+/*
+ * Manifest
+ */
+
+static bool manifest_load(const char* path, struct hashmap* records, char digest[SHA256_HEX_SIZE], char** settings)
+{
+	FILE* file;
+	char line[PATH_MAX + 128] = "";
+	bool valid = false;
+
+	file = fopen(path, "r");
+	if(file == NULL)
+		return false;
+
+	*digest = '\0';
+	while(fgets(line, sizeof(line), file) != NULL) {
+		int name_offset = 0;
+		struct manifest_record* record;
+		size_t len = strlen(line);
+		if(len > 0 && line[len - 1] == '\n')
+			line[--len] = '\0';
+
+		if(strcmp(line, MANIFEST_MAGIC) == 0) {
+			valid = true;
+			continue;
+		} else if(strncmp(line, MANIFEST_DIGEST, sizeof(MANIFEST_DIGEST) - 1) == 0) {
+			if(sscanf(line + sizeof(MANIFEST_DIGEST) - 1, "%64s", digest) != 1)
+				*digest = '\0';
+			continue;
+		} else if(strncmp(line, MANIFEST_SETTINGS, sizeof(MANIFEST_SETTINGS) - 1) == 0) {
+			free(*settings);
+			*settings = strdup(line + sizeof(MANIFEST_SETTINGS) - 1);
+			continue;
+		} else if(!valid || line[0] == '#') {
+			continue;
+		}
+
+		record = (struct manifest_record*)calloc(1, sizeof(struct manifest_record));
+		if(record == NULL)
+			fatal_message(ENOMEM, "Failed to load %s", path);
+		if(sscanf(line, "%64s %llu %o %lld.%ld %n", record->hash, &record->size, &record->mode,
+		          &record->mtime_sec, &record->mtime_nsec, &name_offset) != 5 || name_offset == 0) {
+			free(record);
+			continue;
+		}
+		hashmap_put(records, line + name_offset, record, NULL);
+	}
+
+	fclose(file);
+	return valid && *digest != '\0' && *settings != NULL;
+}
+
+static ALWAYS_INLINE long mtime_nsec(const struct stat* st)
+{
+#if defined(__APPLE__)
+	return st->st_mtimespec.tv_nsec;
+#else
+	return st->st_mtim.tv_nsec;
+#endif
+}
+
+// An entry list is up to date when it was bundled with the same settings and
+// every file's size, mode and mtime still match what we recorded, so no file
+// needs to be read at all.
+static bool manifest_is_current(const struct hashmap* records, const char* old_settings, const char* settings,
+                                const struct entry_array* entries)
+{
+	const struct bundle_entry* entry;
+
+	if(strcmp(old_settings, settings) != 0 || records->count != entries->base.elements)
+		return false;
+
+	ARRAY_FOREACH(entries, entry) {
+		const struct manifest_record* record = (const struct manifest_record*)hashmap_get(records, entry->name);
+		if(record == NULL ||
+		   record->size != (unsigned long long)entry->st.st_size ||
+		   record->mode != (unsigned int)entry->st.st_mode ||
+		   record->mtime_sec != (long long)entry->st.st_mtime ||
+		   record->mtime_nsec != mtime_nsec(&entry->st))
+			return false;
+	}
+	return true;
+}
+
+static void manifest_digest(const struct entry_array* entries, const char* settings, char digest[SHA256_HEX_SIZE])
+{
+	struct sha256 ctx;
+	const struct bundle_entry* entry;
+	unsigned char raw[SHA256_DIGEST_SIZE];
+
+	// The same files bundled differently make a different bundle.
+	sha256_init(&ctx);
+	sha256_update(&ctx, settings, strlen(settings));
+	sha256_update(&ctx, "\n", 1);
+	ARRAY_FOREACH(entries, entry) {
+		char* line = sprintf_alloc("%s %llu %o %s\n", entry->hash, (unsigned long long)entry->st.st_size,
+		                           (unsigned int)entry->st.st_mode, entry->name);
+		if(line == NULL)
+			fatal_message(ENOMEM, "Failed to compute bundle digest");
+		sha256_update(&ctx, line, strlen(line));
+		free(line);
+	}
+	sha256_final(&ctx, raw);
+	sha256_hex(raw, digest);
+}
+
+static void manifest_write(const char* path, const struct entry_array* entries, const char* settings, const char* digest)
+{
+	FILE* file;
+	const struct bundle_entry* entry;
+	char* temp = sprintf_alloc("%s.tmp", path);
+
+	if(temp == NULL || (file = fopen(temp, "w")) == NULL)
+		fatal_message(errno, "Failed to write %s: %s", path, strerror(errno));
+
+	fprintf(file, MANIFEST_MAGIC "\n" MANIFEST_DIGEST "%s\n" MANIFEST_SETTINGS "%s\n", digest, settings);
+	ARRAY_FOREACH(entries, entry) {
+		fprintf(file, "%s %llu %o %lld.%09ld %s\n", entry->hash, (unsigned long long)entry->st.st_size,
+		        (unsigned int)entry->st.st_mode, (long long)entry->st.st_mtime, mtime_nsec(&entry->st), entry->name);
+	}
+
+	if(fclose(file) != 0 || rename(temp, path) != 0)
+		fatal_message(errno, "Failed to write %s: %s", path, strerror(errno));
+	free(temp);
+}
+
+static char* default_prefix(void)
+{
+	char* result = NULL;
+	char exe[PATH_MAX] = "";
+	struct cross_paths paths;
+	struct cross_context ctx;
+
+	// <prefix>/bin/<triple>-bundle => <prefix>/<triple>/sysroot/usr
+	if(proc_path(exe, PATH_MAX) != 0 || cross_context_init(&ctx, NULL) != CROSS_OK)
+		return NULL;
+	if(cross_paths_init(&ctx, &paths, exe, UNAME_SUFFIX) == CROSS_OK) {
+		cross_resolve_install_prefix(&ctx, &paths, &result);
+		cross_paths_reset(&ctx, &paths);
+	}
+	return result;
+}
+
+int main(int argc, char** argv)
+{
+	int opt, fd;
+	int level = DEFAULT_LEVEL;
+	bool compress = true;
+	bool compress_set = false;
+	size_t block_kb = DEFAULT_BLOCK_KB;
+	char* prefix = NULL;
+	char* manifest = NULL;
+	char* temp = NULL;
+	char* settings = NULL;
+	char* old_settings = NULL;
+	struct hashmap records;
+	struct entry_array entries;
+	struct bundle_entry* entry;
+	struct bundle_stream stream;
+	struct bundle_options options = { NULL, NULL, NULL, 0, false, false };
+	char old_digest[SHA256_HEX_SIZE] = "";
+	char new_digest[SHA256_HEX_SIZE] = "";
+
+	while((opt = getopt(argc, argv, "o:C:m:z:l:b:j:fvh")) != -1) {
+		switch(opt) {
+			case 'o': options.output = optarg; break;
+			case 'C': options.prefix = optarg; break;
+			case 'm': options.manifest = optarg; break;
+			case 'z':
+				compress_set = true;
+				if(strcmp(optarg, "gzip") == 0)
+					compress = true;
+				else if(strcmp(optarg, "none") == 0)
+					compress = false;
+				else
+					fatal_message(EINVAL, "Unknown compression method: %s", optarg);
+				break;
+			case 'l': level = atoi(optarg); break;
+			case 'b': block_kb = (size_t)strtoul(optarg, NULL, 10); break;
+			case 'j': options.jobs = (size_t)strtoul(optarg, NULL, 10); break;
+			case 'f': options.force = true; break;
+			case 'v': options.verbose = true; break;
+			case 'h':
+				usage(argv[0]);
+				return 0;
+			default:
+				usage(argv[0]);
+				return 2;
+		}
+	}
+
+	if(options.output == NULL) {
+		usage(argv[0]);
+		return 2;
+	}
+	if(level < 1 || level > 9 || block_kb == 0)
+		fatal_message(EINVAL, "Invalid compression level or block size");
+
+	// A plain .tar output implies no compression unless asked otherwise.
+	if(!compress_set) {
+		size_t len = strlen(options.output);
+		compress = !(len > 4 && strcmp(options.output + len - 4, ".tar") == 0);
+	}
+
+	prefix = options.prefix ? strdup(options.prefix) : default_prefix();
+	if(prefix == NULL || !is_folder(prefix))
+		fatal_message(ENOENT, "Failed to resolve the staging prefix; use -C to specify it.");
+	while(strlen(prefix) > 1 && prefix[strlen(prefix) - 1] == PATH_SEP_CHR)
+		prefix[strlen(prefix) - 1] = '\0';
+
+	manifest = options.manifest ? strdup(options.manifest) : sprintf_alloc("%s" MANIFEST_SUFFIX, options.output);
+	// Everything besides the files that shapes the bundle.
+	settings = compress ? sprintf_alloc("gzip %d %zu %s", level, block_kb, prefix) : sprintf_alloc("none %s", prefix);
+	if(manifest == NULL || settings == NULL)
+		fatal_message(ENOMEM, "Out of memory");
+
+	// Gather the entries up front; the quick check only needs lstat.
+	entry_array_init(&entries);
+	if(optind >= argc) {
+		entries_load(&entries, prefix, stdin);
+	} else {
+		for(int i = optind; i < argc; i++) {
+			FILE* file = strcmp(argv[i], "-") == 0 ? stdin : fopen(argv[i], "r");
+			if(file == NULL)
+				fatal_message(errno, "Failed to open %s: %s", argv[i], strerror(errno));
+			entries_load(&entries, prefix, file);
+			if(file != stdin)
+				fclose(file);
+		}
+	}
+	entries_sort_unique(&entries);
+
+	if(hashmap_init(&records, entries.base.elements) != 0)
+		fatal_message(ENOMEM, "Out of memory");
+	if(!options.force && is_regular_file(options.output) &&
+	   manifest_load(manifest, &records, old_digest, &old_settings) &&
+	   manifest_is_current(&records, old_settings, settings, &entries)) {
+		printf("%s is up to date.\n", options.output);
+		return 0;
+	}
+
+	// Build into a temp file next to the output so the swap is atomic.
+	temp = sprintf_alloc("%s.XXXXXX", options.output);
+	fd = temp ? mkstemp(temp) : -1;
+	if(fd < 0)
+		fatal_message(errno, "Failed to create %s: %s", options.output, strerror(errno));
+
+	stream_init(&stream, fd, compress, level, block_kb * 1024, options.jobs);
+	ARRAY_FOREACH(&entries, entry) {
+		if(options.verbose)
+			printf("%s\n", entry->name);
+		tar_write_entry(&stream, entry);
+	}
+	tar_write_trailer(&stream);
+	stream_finish(&stream);
+
+	if(fchmod(fd, 0644) != 0 || fsync(fd) != 0 || close(fd) != 0)
+		fatal_message(errno, "Failed to write %s: %s", temp, strerror(errno));
+
+	manifest_digest(&entries, settings, new_digest);
+	if(*old_digest != '\0' && strcmp(old_digest, new_digest) == 0 && is_regular_file(options.output)) {
+		// Same content; keep the existing bundle so its timestamp stays put.
+		unlink(temp);
+		printf("%s is unchanged (%s).\n", options.output, new_digest);
+	} else {
+		if(rename(temp, options.output) != 0)
+			fatal_message(errno, "Failed to rename %s: %s", temp, strerror(errno));
+		printf("Wrote %s: %zu entries, %llu bytes (%s).\n", options.output, entries.base.elements,
+		       stream.written, new_digest);
+	}
+	manifest_write(manifest, &entries, settings, new_digest);
+
+	ARRAY_FOREACH(&entries, entry) {
+		free(entry->path);
+		free(entry->linkname);
+	}
+	entry_array_reset(&entries);
+	hashmap_reset(&records, free);
+	free(old_settings);
+	free(settings);
+	free(manifest);
+	free(prefix);
+	free(temp);
+	return 0;
+}
@@ -0,0 +1,638 @@
+/**
+ * @file cross-elfdeps.c
+ * @author Charles Grunwald <cgrunwald@gmail.com>
+ * @brief Checks the DT_NEEDED closure of target binaries against the sysroot.
+ *
+ * For every ELF executable or shared object given on the command line (or
+ * found under a given directory), resolve its dependencies the way the target's
+ * ld.so would - DT_RPATH, DT_RUNPATH, the sysroot's ld.so.conf and the default
+ * library directories - and report libraries that can't be found and symbol
+ * versions (GLIBC_2.x and friends) that the resolved library doesn't define.
+ *
+ * Parsed objects are cached by path and shared between the worker threads, so
+ * each library in the sysroot is only mapped once per run.
+ */
+#include <dirent.h>
+#include <getopt.h>
+#include <glob.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "shared.h"
+#include "strutil.h"
+#include "strbuf.h"
+#include "strarray.h"
+#include "hashmap.h"
+#include "libcross.h"
+#include "dynarray.h"
+#include "elffile.h"
+#include "workqueue.h"
+
+#define ENV_SEP ":"
+#define PATH_SEP_CHR '/'
+
+#define UNAME_SUFFIX "-elfdeps"
+#define LDSO_CONF "/etc/ld.so.conf"
+#define LDSO_CONF_MAX_DEPTH 8
+
+// What $LIB expands to for our x86_64 target.
+#define TARGET_LIB_DIR "lib64"
+
+struct elf_object
+{
+	char* path;
+	char* origin;
+	char* interp;
+	char* soname;
+	char* rpath;
+	char* runpath;
+	uint16_t machine;
+	string_array* needed;
+	string_array* verdefs;
+	string_array* verneed_files;
+	string_array* verneed_versions;
+};
+
+struct elfdeps
+{
+	char* sysroot;
+	size_t sysroot_len;
+	string_array* libdirs;
+	bool verbose;
+	bool quiet;
+
+	pthread_rwlock_t cache_lock;
+	struct hashmap cache;
+
+	pthread_mutex_t output_lock;
+	size_t checked_count;
+	size_t failed_count;
+};
+
+struct scan_item
+{
+	bool is_dir;
+	char path[];
+};
+
+DEFINE_ARRAY_TYPE(object_queue, struct elf_object*)
+
+struct closure_state
+{
+	struct elfdeps* ctx;
+	struct hashmap visited;
+	struct hashmap loaded;
+	struct object_queue queue;
+	strbuf_t* report;
+};
+
+static CC_NORETURN fatal_message(int code, const char* format, ...)
+{
+	va_list args;
+	fprintf(stderr, "ERROR: ");
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+	fprintf(stderr, "\n");
+	exit(code != 0 ? code : 1);
+}
+
+static void usage(const char* exe)
+{
+	printf("Usage: %s [-s SYSROOT] [-L DIR]... [-j JOBS] [-v] [-q] PATH...\n\n", exe);
+	printf("Checks that the DT_NEEDED closure of each ELF binary under PATH resolves\n");
+	printf("within the sysroot and that every required symbol version is defined.\n\n");
+	printf("  -s SYSROOT  Sysroot to resolve against (default: derived from our path)\n");
+	printf("  -L DIR      Additional target library directory to search (repeatable)\n");
+	printf("  -j JOBS     Number of worker threads (default: online CPUs)\n");
+	printf("  -v          Also list binaries without problems\n");
+	printf("  -q          Don't print the summary line\n");
+}
+
+static bool string_array_contains(const string_array* array, const char* value)
+{
+	for(size_t i = 0; array != NULL && i < array->len; i++) {
+		if(strcmp(array->ptr[i], value) == 0)
+			return true;
+	}
+	return false;
+}
+
+static void report_append(strbuf_t** report, const char* format, ...)
+{
+	va_list args;
+	char* line;
+	va_start(args, format);
+	line = vsprintf_alloc(format, args);
+	va_end(args);
+	if(line != NULL) {
+		*report = strbuf_append(*report, line);
+		free(line);
+	}
+}
+
+static void elf_object_free(struct elf_object* obj)
+{
+	if(obj != NULL) {
+		free(obj->path);
+		free(obj->origin);
+		free(obj->interp);
+		free(obj->soname);
+		free(obj->rpath);
+		free(obj->runpath);
+		string_array_free(obj->needed);
+		string_array_free(obj->verdefs);
+		string_array_free(obj->verneed_files);
+		string_array_free(obj->verneed_versions);
+		free(obj);
+	}
+}
+
+static ALWAYS_INLINE char* strdup_or_null(const char* value)
+{
+	return value != NULL ? strdup(value) : NULL;
+}
+
+static bool collect_needed(const char* value, struct elf_object* obj)
+{
+	obj->needed = string_array_push(obj->needed, strdup(value));
+	return obj->needed != NULL;
+}
+
+static bool collect_verdef(const char* value, struct elf_object* obj)
+{
+	obj->verdefs = string_array_push(obj->verdefs, strdup(value));
+	return obj->verdefs != NULL;
+}
+
+static bool collect_verneed(const char* file, const char* version, struct elf_object* obj)
+{
+	obj->verneed_files = string_array_push(obj->verneed_files, strdup(file));
+	obj->verneed_versions = string_array_push(obj->verneed_versions, strdup(version));
+	return obj->verneed_files != NULL && obj->verneed_versions != NULL;
+}
+
+static struct elf_object* elf_object_load(const char* path)
+{
+	char* slash;
+	struct elf_file elf;
+	struct elf_object* obj;
+
+	if(elf_file_open(&elf, path) != 0)
+		return NULL;
+
+	if(!elf_file_is_loadable(&elf)) {
+		elf_file_close(&elf);
+		return NULL;
+	}
+
+	obj = (struct elf_object*)calloc(1, sizeof(struct elf_object));
+	if(obj == NULL) {
+		elf_file_close(&elf);
+		return NULL;
+	}
+
+	obj->path = strdup(path);
+	obj->origin = strdup(path);
+	slash = strrchr(obj->origin, PATH_SEP_CHR);
+	if(slash == obj->origin)
+		slash[1] = '\0';
+	else if(slash != NULL)
+		*slash = '\0';
+
+	obj->machine = elf.ehdr->e_machine;
+	obj->interp = strdup_or_null(elf.interp);
+	obj->soname = strdup_or_null(elf_file_soname(&elf));
+	obj->rpath = strdup_or_null(elf_file_rpath(&elf));
+	obj->runpath = strdup_or_null(elf_file_runpath(&elf));
+	elf_file_foreach_needed(&elf, (elf_string_handler)collect_needed, obj);
+	elf_file_foreach_verdef(&elf, (elf_string_handler)collect_verdef, obj);
+	elf_file_foreach_verneed(&elf, (elf_verneed_handler)collect_verneed, obj);
+
+	elf_file_close(&elf);
+	return obj;
+}
+
+// Returns the cached object for path, loading it on a miss. Negative results
+// are cached too, since most library probes are misses.
+static struct elf_object* elfdeps_object(struct elfdeps* ctx, const char* path)
+{
+	void* value = NULL;
+	bool found;
+	struct elf_object* obj;
+
+	pthread_rwlock_rdlock(&ctx->cache_lock);
+	found = hashmap_find(&ctx->cache, path, &value);
+	pthread_rwlock_unlock(&ctx->cache_lock);
+	if(found)
+		return (struct elf_object*)value;
+
+	// Parse outside of the lock. If another thread beats us to it, keep its copy.
+	obj = elf_object_load(path);
+	pthread_rwlock_wrlock(&ctx->cache_lock);
+	if(hashmap_find(&ctx->cache, path, &value)) {
+		elf_object_free(obj);
+		obj = (struct elf_object*)value;
+	} else if(hashmap_put(&ctx->cache, path, obj, NULL) != 0) {
+		pthread_rwlock_unlock(&ctx->cache_lock);
+		fatal_message(ENOMEM, "Failed to cache %s", path);
+	}
+	pthread_rwlock_unlock(&ctx->cache_lock);
+	return obj;
+}
+
+// Expand a DT_RPATH/DT_RUNPATH entry into a host path. $ORIGIN is already a
+// host path, everything else is relative to the sysroot.
+static bool expand_search_dir(struct elfdeps* ctx, const struct elf_object* obj, const char* dir, char* buffer, size_t buffer_len)
+{
+	const char* rest = NULL;
+	const char* base = NULL;
+
+	if(strncmp(dir, "$ORIGIN", 7) == 0) {
+		base = obj->origin;
+		rest = dir + 7;
+	} else if(strncmp(dir, "${ORIGIN}", 9) == 0) {
+		base = obj->origin;
+		rest = dir + 9;
+	} else if(*dir == PATH_SEP_CHR) {
+		base = ctx->sysroot;
+		rest = dir;
+	} else {
+		return false;
+	}
+
+	if(strncmp(rest, "/$LIB", 5) == 0 || strncmp(rest, "/${LIB}", 7) == 0) {
+		rest += rest[2] == '{' ? 7 : 5;
+		return (size_t)snprintf(buffer, buffer_len, "%s/" TARGET_LIB_DIR "%s", base, rest) < buffer_len;
+	}
+	return (size_t)snprintf(buffer, buffer_len, "%s%s", base, rest) < buffer_len;
+}
+
+static struct elf_object* probe_dir(struct elfdeps* ctx, const struct elf_object* obj, const char* dir, const char* name)
+{
+	struct elf_object* dep;
+	char path[PATH_MAX] = "";
+
+	if((size_t)snprintf(path, PATH_MAX, "%s/%s", dir, name) >= PATH_MAX)
+		return NULL;
+
+	dep = elfdeps_object(ctx, path);
+	return dep != NULL && dep->machine == obj->machine ? dep : NULL;
+}
+
+static struct elf_object* probe_path_list(struct elfdeps* ctx, const struct elf_object* obj, const char* list, const char* name)
+{
+	char *paths, *tok, *saveptr = NULL;
+	struct elf_object* dep = NULL;
+	char dir[PATH_MAX] = "";
+
+	paths = strdup(list);
+	if(paths == NULL)
+		return NULL;
+
+	for(tok = strtok_r(paths, ENV_SEP, &saveptr); tok != NULL && dep == NULL; tok = strtok_r(NULL, ENV_SEP, &saveptr)) {
+		if(expand_search_dir(ctx, obj, tok, dir, PATH_MAX))
+			dep = probe_dir(ctx, obj, dir, name);
+	}
+
+	free(paths);
+	return dep;
+}
+
+static struct elf_object* resolve_needed(struct elfdeps* ctx, const struct elf_object* obj, const char* name)
+{
+	struct elf_object* dep = NULL;
+
+	// Names containing a slash are used as-is.
+	if(strchr(name, PATH_SEP_CHR) != NULL) {
+		char path[PATH_MAX] = "";
+		if(!expand_search_dir(ctx, obj, name, path, PATH_MAX))
+			return NULL;
+		dep = elfdeps_object(ctx, path);
+		return dep != NULL && dep->machine == obj->machine ? dep : NULL;
+	}
+
+	// DT_RPATH is ignored when DT_RUNPATH is present. We don't model the
+	// inheritance of the executable's DT_RPATH by its libraries.
+	if(obj->rpath != NULL && obj->runpath == NULL)
+		dep = probe_path_list(ctx, obj, obj->rpath, name);
+	if(dep == NULL && obj->runpath != NULL)
+		dep = probe_path_list(ctx, obj, obj->runpath, name);
+	for(size_t i = 0; dep == NULL && i < ctx->libdirs->len; i++)
+		dep = probe_dir(ctx, obj, ctx->libdirs->ptr[i], name);
+	return dep;
+}
+
+static void check_versions(struct closure_state* state, const struct elf_object* obj, const char* name, const struct elf_object* dep)
+{
+	for(size_t i = 0; obj->verneed_files != NULL && i < obj->verneed_files->len; i++) {
+		const char* version = obj->verneed_versions->ptr[i];
+		if(strcmp(obj->verneed_files->ptr[i], name) == 0 && !string_array_contains(dep->verdefs, version)) {
+			report_append(&state->report, "  missing version %s in %s (%s, required by %s)\n",
+			              version, name, dep->path, obj->path);
+		}
+	}
+}
+
+// Objects are loaded breadth-first, and a DT_NEEDED entry matching the soname
+// of an object that's already loaded reuses it, just like ld.so.
+static void visit_closure(struct closure_state* state, struct elf_object* root)
+{
+	struct elf_object** iter;
+
+	hashmap_put(&state->visited, root->path, root, NULL);
+	if(root->soname != NULL)
+		hashmap_put(&state->loaded, root->soname, root, NULL);
+	iter = object_queue_append(&state->queue);
+	if(iter == NULL)
+		fatal_message(ENOMEM, "Failed to queue %s", root->path);
+	*iter = root;
+
+	for(size_t i = 0; i < state->queue.base.elements; i++) {
+		struct elf_object* obj = ((struct elf_object**)state->queue.base.base)[i];
+		for(size_t j = 0; obj->needed != NULL && j < obj->needed->len; j++) {
+			const char* name = obj->needed->ptr[j];
+			struct elf_object* dep = (struct elf_object*)hashmap_get(&state->loaded, name);
+			if(dep == NULL)
+				dep = resolve_needed(state->ctx, obj, name);
+			if(dep == NULL) {
+				report_append(&state->report, "  unresolved %s (needed by %s)\n", name, obj->path);
+				continue;
+			}
+
+			check_versions(state, obj, name, dep);
+			hashmap_put(&state->loaded, name, dep, NULL);
+			if(!hashmap_find(&state->visited, dep->path, NULL)) {
+				hashmap_put(&state->visited, dep->path, dep, NULL);
+				if(dep->soname != NULL)
+					hashmap_put(&state->loaded, dep->soname, dep, NULL);
+				iter = object_queue_append(&state->queue);
+				if(iter == NULL)
+					fatal_message(ENOMEM, "Failed to queue %s", dep->path);
+				*iter = dep;
+			}
+		}
+	}
+}
+
+static void check_binary(struct elfdeps* ctx, const char* path)
+{
+	struct elf_object* obj;
+	struct closure_state state;
+
+	obj = elfdeps_object(ctx, path);
+	if(obj == NULL)
+		return;
+
+	memset((void*)&state, 0, sizeof(state));
+	state.ctx = ctx;
+	object_queue_init(&state.queue);
+	if(hashmap_init(&state.visited, 64) != 0 || hashmap_init(&state.loaded, 64) != 0)
+		fatal_message(ENOMEM, "Failed to allocate closure for %s", path);
+
+	if(obj->interp != NULL) {
+		char interp[PATH_MAX] = "";
+		snprintf(interp, PATH_MAX, "%s%s", ctx->sysroot, obj->interp);
+		if(access(interp, R_OK) != 0)
+			report_append(&state.report, "  missing program interpreter %s\n", obj->interp);
+	}
+	visit_closure(&state, obj);
+	hashmap_reset(&state.visited, NULL);
+	hashmap_reset(&state.loaded, NULL);
+	object_queue_reset(&state.queue);
+
+	pthread_mutex_lock(&ctx->output_lock);
+	ctx->checked_count++;
+	if(state.report != NULL) {
+		ctx->failed_count++;
+		printf("%s:\n%s", path, state.report->ptr);
+	} else if(ctx->verbose) {
+		printf("%s: OK\n", path);
+	}
+	pthread_mutex_unlock(&ctx->output_lock);
+	strbuf_free(state.report);
+}
+
+static struct scan_item* scan_item_new(const char* path, bool is_dir)
+{
+	size_t len = strlen(path);
+	struct scan_item* item = (struct scan_item*)malloc(sizeof(struct scan_item) + len + 1);
+	if(item == NULL)
+		fatal_message(ENOMEM, "Failed to queue %s", path);
+	item->is_dir = is_dir;
+	memcpy(item->path, path, len + 1);
+	return item;
+}
+
+static void scan_queue(struct workqueue* wq, const char* path, bool is_dir)
+{
+	if(workqueue_push(wq, scan_item_new(path, is_dir)) != 0)
+		fatal_message(ENOMEM, "Failed to queue %s", path);
+}
+
+static void scan_directory(struct workqueue* wq, const char* dirpath)
+{
+	DIR* dir;
+	struct dirent* entry;
+	char path[PATH_MAX] = "";
+
+	dir = opendir(dirpath);
+	if(dir == NULL) {
+		fprintf(stderr, "WARNING: Failed to open %s: %s\n", dirpath, strerror(errno));
+		return;
+	}
+
+	while((entry = readdir(dir)) != NULL) {
+		bool is_dir, is_file;
+		if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+			continue;
+		if((size_t)snprintf(path, PATH_MAX, "%s/%s", dirpath, entry->d_name) >= PATH_MAX)
+			continue;
+
+		// Symlinks are skipped inside of trees; they'd only point us at files we
+		// already check (libfoo.so -> libfoo.so.1.2.3) or out of the tree.
+#ifdef _DIRENT_HAVE_D_TYPE
+		if(entry->d_type != DT_UNKNOWN) {
+			is_dir = entry->d_type == DT_DIR;
+			is_file = entry->d_type == DT_REG;
+		} else
+#endif
+		{
+			struct stat st;
+			if(lstat(path, &st) != 0)
+				continue;
+			is_dir = S_ISDIR(st.st_mode);
+			is_file = S_ISREG(st.st_mode);
+		}
+
+		if(is_dir || is_file)
+			scan_queue(wq, path, is_dir);
+	}
+	closedir(dir);
+}
+
+static void scan_handler(struct workqueue* wq, struct scan_item* item, struct elfdeps* ctx)
+{
+	if(item->is_dir)
+		scan_directory(wq, item->path);
+	else
+		check_binary(ctx, item->path);
+	free(item);
+}
+
+static void add_libdir(struct elfdeps* ctx, const char* dir, bool in_sysroot)
+{
+	char* path = in_sysroot ? sprintf_alloc("%s%s", ctx->sysroot, dir) : strdup(dir);
+	if(path == NULL || !is_folder(path) || string_array_contains(ctx->libdirs, path)) {
+		free(path);
+		return;
+	}
+	ctx->libdirs = string_array_push(ctx->libdirs, path);
+	if(ctx->libdirs == NULL)
+		fatal_message(ENOMEM, "Failed to add library directory %s", dir);
+}
+
+static void load_ldso_conf(struct elfdeps* ctx, const char* conf, int depth)
+{
+	FILE* file;
+	char line[PATH_MAX] = "";
+	char path[PATH_MAX] = "";
+
+	if(depth > LDSO_CONF_MAX_DEPTH)
+		return;
+
+	snprintf(path, PATH_MAX, "%s%s", ctx->sysroot, conf);
+	file = fopen(path, "r");
+	if(file == NULL)
+		return;
+
+	while(fgets(line, sizeof(line), file) != NULL) {
+		char *start = line, *end;
+		end = strchr(start, '#');
+		if(end != NULL)
+			*end = '\0';
+		while(isspace((unsigned char)*start))
+			start++;
+		end = start + strlen(start);
+		while(end > start && isspace((unsigned char)end[-1]))
+			*--end = '\0';
+		if(*start == '\0')
+			continue;
+
+		if(strncmp(start, "include", 7) == 0 && isspace((unsigned char)start[7])) {
+			glob_t matches;
+			char pattern[PATH_MAX] = "";
+			start += 8;
+			while(isspace((unsigned char)*start))
+				start++;
+			// Relative includes are relative to /etc.
+			snprintf(pattern, PATH_MAX, "%s%s%s", ctx->sysroot, *start == PATH_SEP_CHR ? "" : "/etc/", start);
+			if(glob(pattern, 0, NULL, &matches) == 0) {
+				for(size_t i = 0; i < matches.gl_pathc; i++)
+					load_ldso_conf(ctx, matches.gl_pathv[i] + ctx->sysroot_len, depth + 1);
+				globfree(&matches);
+			}
+		} else if(*start == PATH_SEP_CHR) {
+			add_libdir(ctx, start, true);
+		}
+	}
+	fclose(file);
+}
+
+static char* default_sysroot(void)
+{
+	char* result = NULL;
+	char exe[PATH_MAX] = "";
+	struct cross_paths paths;
+	struct cross_context ctx;
+
+	// <prefix>/bin/<triple>-elfdeps => <prefix>/<triple>/sysroot
+	if(proc_path(exe, PATH_MAX) != 0 || cross_context_init(&ctx, NULL) != CROSS_OK)
+		return NULL;
+	if(cross_paths_init(&ctx, &paths, exe, UNAME_SUFFIX) == CROSS_OK) {
+		cross_resolve_sysroot(&ctx, &paths, &result);
+		cross_paths_reset(&ctx, &paths);
+	}
+	return result;
+}
+
+int main(int argc, char** argv)
+{
+	int opt;
+	size_t jobs = 0;
+	struct workqueue wq;
+	string_array* extra_dirs = NULL;
+	struct elfdeps ctx;
+
+	memset((void*)&ctx, 0, sizeof(ctx));
+	while((opt = getopt(argc, argv, "s:L:j:vqh")) != -1) {
+		switch(opt) {
+			case 's':
+				free(ctx.sysroot);
+				ctx.sysroot = strdup(optarg);
+				break;
+			case 'L':
+				extra_dirs = string_array_push(extra_dirs, strdup(optarg));
+				break;
+			case 'j':
+				jobs = (size_t)strtoul(optarg, NULL, 10);
+				break;
+			case 'v':
+				ctx.verbose = true;
+				break;
+			case 'q':
+				ctx.quiet = true;
+				break;
+			case 'h':
+				usage(argv[0]);
+				return 0;
+			default:
+				usage(argv[0]);
+				return 2;
+		}
+	}
+
+	if(optind >= argc) {
+		usage(argv[0]);
+		return 2;
+	}
+
+	if(ctx.sysroot == NULL && (ctx.sysroot = default_sysroot()) == NULL)
+		fatal_message(1, "Failed to resolve the sysroot; use -s to specify it.");
+	if(!is_folder(ctx.sysroot))
+		fatal_message(ENOENT, "Sysroot does not exist: %s", ctx.sysroot);
+	ctx.sysroot_len = strlen(ctx.sysroot);
+
+	// Search order: -L, ld.so.conf, then the trusted directories.
+	ctx.libdirs = string_array_alloc(8);
+	for(size_t i = 0; extra_dirs != NULL && i < extra_dirs->len; i++)
+		add_libdir(&ctx, extra_dirs->ptr[i], false);
+	load_ldso_conf(&ctx, LDSO_CONF, 0);
+	add_libdir(&ctx, "/lib64", true);
+	add_libdir(&ctx, "/usr/lib64", true);
+	add_libdir(&ctx, "/lib", true);
+	add_libdir(&ctx, "/usr/lib", true);
+
+	if(hashmap_init(&ctx.cache, 4096) != 0)
+		fatal_message(ENOMEM, "Failed to allocate object cache");
+	pthread_rwlock_init(&ctx.cache_lock, NULL);
+	pthread_mutex_init(&ctx.output_lock, NULL);
+
+	if(workqueue_init(&wq, jobs, (workqueue_handler)scan_handler, &ctx) != 0)
+		fatal_message(1, "Failed to start worker threads");
+
+	for(int i = optind; i < argc; i++)
+		scan_queue(&wq, argv[i], is_folder(argv[i]));
+	workqueue_finish(&wq);
+
+	if(!ctx.quiet)
+		fprintf(stderr, "Checked %zu ELF files, %zu with problems.\n", ctx.checked_count, ctx.failed_count);
+
+	hashmap_reset(&ctx.cache, (hashmap_free_func)elf_object_free);
+	pthread_rwlock_destroy(&ctx.cache_lock);
+	pthread_mutex_destroy(&ctx.output_lock);
+	string_array_free(extra_dirs);
+	string_array_free(ctx.libdirs);
+	free(ctx.sysroot);
+	return ctx.failed_count > 0 ? 1 : 0;
+}
@@ -0,0 +1,838 @@
+/**
+ * @file cross-func-order.c
+ * @author Charles Grunwald <cgrunwald@gmail.com>
+ * @brief Profile-driven hot/cold function ordering for target programs.
+ *
+ * Usage: <triple>-func-order record [-o PROFILE] [-F HZ] [--] PROGRAM [ARGS...]
+ *        <triple>-func-order order [-f symbols|sections] -o ORDER PROFILE...
+ *        <triple>-func-order verify -p PROFILE [-r RUNS] [-c CPUS] BEFORE AFTER [-- ARGS...]
+ *
+ * record runs PROGRAM through <triple>-run with a sampling profiler from
+ * perf_event_open on it (cycles, or the task clock where there's no PMU) and
+ * attributes the samples that land in PROGRAM to its functions. order turns
+ * one or more of those profiles into the list of functions to place first,
+ * hottest first: symbol names for lld's --symbol-ordering-file, or the
+ * -ffunction-sections section names for gold's --section-ordering-file.
+ * verify compares where the profiled functions ended up in two links of the
+ * program, and runs both under <triple>-bench for their L1i and iTLB misses.
+ */
+#define _GNU_SOURCE
+
+#include <getopt.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#ifdef HAVE_LINUX_PERF_EVENT_H
+#	include <linux/perf_event.h>
+#endif
+
+#include "shared.h"
+#include "strutil.h"
+#include "dynarray.h"
+#include "hashmap.h"
+#include "elffile.h"
+#include "libcross.h"
+
+#define PATH_SEP_CHR '/'
+
+#define UNAME_SUFFIX "-func-order"
+#define RUN_SUFFIX "-run"
+#define BENCH_SUFFIX "-bench"
+
+#define PROFILE_HEADER "# cross-func-order profile"
+#define DEFAULT_PROFILE "func-order.profile"
+#define DEFAULT_FREQUENCY 4000
+#define RING_PAGES 128
+#define POLL_INTERVAL_MS 10
+
+#define SMALL_PAGE (4ULL << 10)
+#define HUGE_PAGE (2ULL << 20)
+
+struct function
+{
+	const char* name;
+	uint64_t vaddr;
+	uint64_t size;
+	size_t samples;
+};
+
+DEFINE_ARRAY_TYPE(function_array, struct function)
+
+struct mapping
+{
+	uint64_t start;
+	uint64_t end;
+	uint64_t pgoff;
+};
+
+DEFINE_ARRAY_TYPE(mapping_array, struct mapping)
+DEFINE_ARRAY_TYPE(ip_array, uint64_t)
+
+struct recording
+{
+	const char* program;
+	struct mapping_array mappings;
+	struct ip_array ips;
+	size_t lost;
+	bool software;
+};
+
+static CC_NORETURN fatal_message(int code, const char* format, ...)
+{
+	va_list args;
+	fprintf(stderr, "ERROR: ");
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+	fprintf(stderr, "\n");
+	exit(code != 0 ? code : 1);
+}
+
+static void usage(const char* exe)
+{
+	printf("Usage: %s record [-o PROFILE] [-F HZ] [--] PROGRAM [ARGS...]\n", exe);
+	printf("       %s order [-f symbols|sections] -o ORDER PROFILE...\n", exe);
+	printf("       %s verify -p PROFILE [-r RUNS] [-c CPUS] BEFORE AFTER [-- ARGS...]\n\n", exe);
+	printf("record  Runs a target PROGRAM through the sysroot's loader, sampling where\n");
+	printf("        it spends its time, and writes how hot each of its functions is to\n");
+	printf("        PROFILE (default: " DEFAULT_PROFILE "). HZ is the sampling rate\n");
+	printf("        (default: %d).\n", DEFAULT_FREQUENCY);
+	printf("order   Merges PROFILEs into ORDER, the hottest functions first, as symbol\n");
+	printf("        names for lld (default) or section names for gold.\n");
+	printf("verify  Reports where PROFILE's functions are in the BEFORE and AFTER links\n");
+	printf("        of a program, and their L1i and iTLB misses running with ARGS.\n");
+}
+
+static char* tool_path(const char* suffix)
+{
+	char exe[PATH_MAX] = "";
+	char* path;
+	struct cross_paths paths;
+	struct cross_context ctx;
+
+	if(cross_context_init(&ctx, NULL) != CROSS_OK || proc_path(exe, PATH_MAX) != 0)
+		fatal_message(errno, "Failed to look up our own path");
+	if(cross_paths_init(&ctx, &paths, exe, UNAME_SUFFIX) != CROSS_OK)
+		fatal_message(cross_exit_code(&ctx), "%s", cross_context_error(&ctx));
+	path = sprintf_alloc("%s/%s%s", paths.bindir.value, paths.uname.value, suffix);
+	cross_paths_reset(&ctx, &paths);
+	if(path == NULL)
+		fatal_message(ENOMEM, "Out of memory");
+	return path;
+}
+
+/*
+ * Function symbols
+ */
+
+static bool collect_function(const char* name, uint64_t vaddr, uint64_t size, struct function_array* functions)
+{
+	struct function* function = function_array_append0(functions);
+	if(function == NULL)
+		fatal_message(ENOMEM, "Out of memory");
+	function->name = name;
+	function->vaddr = vaddr;
+	function->size = size;
+	return true;
+}
+
+static int compare_vaddr(const void* a, const void* b)
+{
+	uint64_t x = ((const struct function*)a)->vaddr;
+	uint64_t y = ((const struct function*)b)->vaddr;
+	return (x > y) - (x < y);
+}
+
+static void load_functions(struct elf_file* elf, const char* path, struct function_array* functions)
+{
+	int code = elf_file_open(elf, path);
+
+	if(code != 0)
+		fatal_message(-code, "Failed to open %s: %s", path, strerror(-code));
+	function_array_init(functions);
+	elf_file_foreach_function(elf, (elf_symbol_handler)collect_function, functions);
+	if(functions->base.elements == 0)
+		fatal_message(ENOENT, "%s has no function symbols", path);
+	function_array_sort(functions, compare_vaddr);
+}
+
+static struct function* function_at(struct function_array* functions, uint64_t vaddr)
+{
+	struct function* base = (struct function*)functions->base.base;
+	size_t low = 0, high = functions->base.elements;
+
+	while(low < high) {
+		size_t mid = low + (high - low) / 2;
+		if(base[mid].vaddr <= vaddr)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	if(low == 0 || vaddr - base[low - 1].vaddr >= base[low - 1].size)
+		return NULL;
+	return &base[low - 1];
+}
+
+/*
+ * Recording
+ */
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+/*
+ * One sampler per CPU, since the kernel won't map a buffer shared by an
+ * inherited per-task event. Returns -1 for offline CPUs.
+ */
+static int open_sampler(pid_t pid, int cpu, int frequency, bool* software)
+{
+	int fd;
+	struct perf_event_attr attr;
+
+	memset((void*)&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = *software ? PERF_TYPE_SOFTWARE : PERF_TYPE_HARDWARE;
+	attr.config = *software ? PERF_COUNT_SW_TASK_CLOCK : PERF_COUNT_HW_CPU_CYCLES;
+	attr.freq = 1;
+	attr.sample_freq = (unsigned long long)frequency;
+	attr.sample_type = PERF_SAMPLE_IP;
+	attr.disabled = 1;
+	attr.enable_on_exec = 1;
+	attr.inherit = 1;
+	attr.mmap = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	fd = (int)syscall(SYS_perf_event_open, &attr, pid, cpu, -1, PERF_FLAG_FD_CLOEXEC);
+	if(fd < 0 && !*software && (errno == ENOENT || errno == EOPNOTSUPP)) {
+		// No PMU (most VMs): the task clock samples the same way, just coarser.
+		*software = true;
+		return open_sampler(pid, cpu, frequency, software);
+	}
+	if(fd < 0 && errno == ENODEV)
+		return -1;
+	if(fd < 0)
+		fatal_message(errno, "perf_event_open: %s%s", strerror(errno),
+		              errno == EACCES || errno == EPERM ? " (see /proc/sys/kernel/perf_event_paranoid)" : "");
+	return fd;
+}
+
+static void add_sample(struct recording* recording, uint64_t ip)
+{
+	uint64_t* sample = ip_array_append(&recording->ips);
+	if(sample == NULL)
+		fatal_message(ENOMEM, "Out of memory");
+	*sample = ip;
+}
+
+static void add_mapping(struct recording* recording, const unsigned char* record, size_t size)
+{
+	// u32 pid, tid; u64 addr, len, pgoff; char filename[]
+	const size_t filename_at = sizeof(struct perf_event_header) + 8 + 24;
+	uint64_t values[3];
+	struct mapping* mapping;
+	const char* filename = (const char*)record + filename_at;
+
+	if(size <= filename_at || memchr(filename, '\0', size - filename_at) == NULL ||
+	   strcmp(filename, recording->program) != 0)
+		return;
+	memcpy(values, record + sizeof(struct perf_event_header) + 8, sizeof(values));
+	if((mapping = mapping_array_append(&recording->mappings)) == NULL)
+		fatal_message(ENOMEM, "Out of memory");
+	mapping->start = values[0];
+	mapping->end = values[0] + values[1];
+	mapping->pgoff = values[2];
+}
+
+static void drain_ring(struct recording* recording, struct perf_event_mmap_page* meta, const unsigned char* data,
+                       uint64_t data_size, unsigned char* scratch)
+{
+	uint64_t head = __atomic_load_n(&meta->data_head, __ATOMIC_ACQUIRE);
+	uint64_t tail = meta->data_tail;
+
+	while(tail < head) {
+		const struct perf_event_header* header = (const struct perf_event_header*)(data + tail % data_size);
+		const unsigned char* record = (const unsigned char*)header;
+		size_t size = header->size;
+		uint64_t value;
+
+		if(size < sizeof(*header))
+			break;
+		// Records that wrap around the end of the ring are copied out whole.
+		if(tail % data_size + size > data_size) {
+			size_t first = (size_t)(data_size - tail % data_size);
+			memcpy(scratch, record, first);
+			memcpy(scratch + first, data, size - first);
+			record = scratch;
+		}
+		switch(((const struct perf_event_header*)record)->type) {
+			case PERF_RECORD_SAMPLE:
+				memcpy(&value, record + sizeof(*header), sizeof(value));
+				add_sample(recording, value);
+				break;
+			case PERF_RECORD_MMAP:
+				add_mapping(recording, record, size);
+				break;
+			case PERF_RECORD_LOST:
+				memcpy(&value, record + sizeof(*header) + 8, sizeof(value));
+				recording->lost += (size_t)value;
+				break;
+			default:
+				break;
+		}
+		tail += size;
+	}
+	__atomic_store_n(&meta->data_tail, tail, __ATOMIC_RELEASE);
+}
+
+struct sampler
+{
+	int fd;
+	struct perf_event_mmap_page* meta;
+};
+
+/*
+ * The child waits on a pipe until the samplers are attached, which start
+ * when it execs.
+ */
+static int run_sampled(struct recording* recording, char** argv, int frequency)
+{
+	int status, sync[2];
+	int cpus = (int)sysconf(_SC_NPROCESSORS_CONF);
+	nfds_t count = 0;
+	char go = 0;
+	bool software = false;
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t ring_size = page * (RING_PAGES + 1);
+	unsigned char* scratch;
+	struct sampler* samplers;
+	struct pollfd* pollers;
+	pid_t pid;
+
+	if(pipe2(sync, O_CLOEXEC) != 0)
+		fatal_message(errno, "pipe: %s", strerror(errno));
+	fflush(stdout);
+	if((pid = fork()) < 0)
+		fatal_message(errno, "fork: %s", strerror(errno));
+	if(pid == 0) {
+		close(sync[1]);
+		if(read(sync[0], &go, 1) != 1)
+			_exit(127);
+		execv(argv[0], argv);
+		fprintf(stderr, "ERROR: Failed to run %s: %s\n", argv[0], strerror(errno));
+		_exit(127);
+	}
+
+	close(sync[0]);
+	samplers = (struct sampler*)calloc((size_t)cpus, sizeof(struct sampler));
+	pollers = (struct pollfd*)calloc((size_t)cpus, sizeof(struct pollfd));
+	if(samplers == NULL || pollers == NULL || (scratch = (unsigned char*)malloc(page * RING_PAGES)) == NULL)
+		fatal_message(ENOMEM, "Out of memory");
+	for(int cpu = 0; cpu < cpus; cpu++) {
+		struct sampler* sampler = &samplers[count];
+		if((sampler->fd = open_sampler(pid, cpu, frequency, &software)) < 0)
+			continue;
+		sampler->meta = (struct perf_event_mmap_page*)mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		                                                   sampler->fd, 0);
+		if(sampler->meta == MAP_FAILED)
+			fatal_message(errno, "Failed to map the sample buffer: %s", strerror(errno));
+		pollers[count].fd = sampler->fd;
+		pollers[count].events = POLLIN;
+		count++;
+	}
+	if(count == 0)
+		fatal_message(ENODEV, "No CPUs to sample on");
+	if(write(sync[1], &go, 1) != 1)
+		fatal_message(errno, "Failed to start %s: %s", recording->program, strerror(errno));
+	close(sync[1]);
+
+	for(;;) {
+		pid_t done = waitpid(pid, &status, WNOHANG);
+
+		for(nfds_t i = 0; i < count; i++)
+			drain_ring(recording, samplers[i].meta, (const unsigned char*)samplers[i].meta + page, page * RING_PAGES,
+			           scratch);
+		if(done == pid)
+			break;
+		if(done < 0 && errno != EINTR)
+			fatal_message(errno, "waitpid: %s", strerror(errno));
+		poll(pollers, count, POLL_INTERVAL_MS);
+	}
+	recording->software = software;
+
+	for(nfds_t i = 0; i < count; i++) {
+		munmap((void*)samplers[i].meta, ring_size);
+		close(samplers[i].fd);
+	}
+	free(scratch);
+	free(pollers);
+	free(samplers);
+	return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+#endif
+
+static int compare_samples(const void* a, const void* b)
+{
+	const struct function* x = (const struct function*)a;
+	const struct function* y = (const struct function*)b;
+	if(x->samples != y->samples)
+		return x->samples < y->samples ? 1 : -1;
+	return strcmp(x->name, y->name);
+}
+
+static struct mapping* mapping_at(struct recording* recording, uint64_t ip)
+{
+	struct mapping* mapping;
+
+	// Newest first, in case a later exec reused the address range.
+	ARRAY_FOREACH_REVERSE(&recording->mappings, mapping) {
+		if(ip >= mapping->start && ip < mapping->end)
+			return mapping;
+	}
+	return NULL;
+}
+
+static void write_profile(struct recording* recording, const char* path)
+{
+	size_t attributed = 0, functions = 0;
+	uint64_t* ip;
+	struct mapping* mapping;
+	struct function* function;
+	struct function_array symbols;
+	struct elf_file elf;
+	FILE* file;
+
+	load_functions(&elf, recording->program, &symbols);
+	ARRAY_FOREACH(&recording->ips, ip) {
+		uint64_t vaddr;
+		if((mapping = mapping_at(recording, *ip)) != NULL &&
+		   elf_file_vaddr(&elf, *ip - mapping->start + mapping->pgoff, &vaddr) &&
+		   (function = function_at(&symbols, vaddr)) != NULL) {
+			function->samples++;
+			attributed++;
+		}
+	}
+	function_array_sort(&symbols, compare_samples);
+
+	if((file = fopen(path, "w")) == NULL)
+		fatal_message(errno, "Failed to create %s: %s", path, strerror(errno));
+	fprintf(file, PROFILE_HEADER " of %s: %zu of %zu samples\n", recording->program, attributed,
+	        recording->ips.base.elements);
+	ARRAY_FOREACH(&symbols, function) {
+		if(function->samples == 0)
+			break;
+		fprintf(file, "%zu %s\n", function->samples, function->name);
+		functions++;
+	}
+	if(ferror(file) || fclose(file) != 0)
+		fatal_message(errno, "Failed to write %s: %s", path, strerror(errno));
+
+	printf("%zu %s samples, %zu in %zu functions of %s", recording->ips.base.elements,
+	       recording->software ? "task clock" : "cycles", attributed, functions, recording->program);
+	if(recording->lost > 0)
+		printf(" (%zu lost)", recording->lost);
+	printf("\nWrote %s\n", path);
+	function_array_reset(&symbols);
+	elf_file_close(&elf);
+}
+
+static int command_record(int argc, char** argv)
+{
+	int opt, frequency = DEFAULT_FREQUENCY, status = 0;
+	const char* output = DEFAULT_PROFILE;
+	char* runner;
+	char** child_argv;
+	struct recording recording;
+
+	while((opt = getopt(argc, argv, "+o:F:h")) != -1) {
+		switch(opt) {
+			case 'o': output = optarg; break;
+			case 'F': frequency = atoi(optarg); break;
+			case 'h':
+				usage(argv[0]);
+				return 0;
+			default:
+				usage(argv[0]);
+				return 2;
+		}
+	}
+	if(optind >= argc) {
+		usage(argv[0]);
+		return 2;
+	}
+	if(frequency < 1)
+		frequency = DEFAULT_FREQUENCY;
+
+	memset((void*)&recording, 0, sizeof(recording));
+	mapping_array_init(&recording.mappings);
+	ip_array_init(&recording.ips);
+	runner = tool_path(RUN_SUFFIX);
+	if(access(runner, X_OK) != 0)
+		fatal_message(ENOENT, "Failed to locate %s", runner);
+	if((recording.program = realpath(argv[optind], NULL)) == NULL)
+		fatal_message(errno, "Failed to locate %s: %s", argv[optind], strerror(errno));
+
+	// <triple>-run -- PROGRAM ARGS...
+	if((child_argv = (char**)calloc((size_t)(argc - optind) + 3, sizeof(char*))) == NULL)
+		fatal_message(ENOMEM, "Out of memory");
+	child_argv[0] = runner;
+	child_argv[1] = "--";
+	child_argv[2] = (char*)recording.program;
+	for(opt = optind + 1; opt < argc; opt++)
+		child_argv[opt - optind + 2] = argv[opt];
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+	status = run_sampled(&recording, child_argv, frequency);
+#else
+	fatal_message(ENOSYS, "Built without perf_event_open support");
+#endif
+	// A failing workload still profiled something; pass its status on.
+	if(status != 0)
+		fprintf(stderr, "WARNING: %s exited with status %d\n", recording.program, status);
+	write_profile(&recording, output);
+
+	mapping_array_reset(&recording.mappings);
+	ip_array_reset(&recording.ips);
+	free((void*)recording.program);
+	free(child_argv);
+	free(runner);
+	return status;
+}
+
+/*
+ * Profiles
+ */
+
+static bool add_count(const char* name, size_t samples, struct hashmap* counts)
+{
+	size_t* count = (size_t*)hashmap_get(counts, name);
+
+	if(count == NULL) {
+		if((count = (size_t*)calloc(1, sizeof(size_t))) == NULL || hashmap_put(counts, name, count, NULL) != 0)
+			fatal_message(ENOMEM, "Out of memory");
+	}
+	*count += samples;
+	return true;
+}
+
+static void read_profile(const char* path, struct hashmap* counts)
+{
+	char* line = NULL;
+	size_t line_size = 0;
+	ssize_t len;
+	FILE* file = fopen(path, "r");
+
+	if(file == NULL)
+		fatal_message(errno, "Failed to open %s: %s", path, strerror(errno));
+	if(getline(&line, &line_size, file) <= 0 || strncmp(line, PROFILE_HEADER, sizeof(PROFILE_HEADER) - 1) != 0)
+		fatal_message(EINVAL, "%s isn't a function profile", path);
+	while((len = getline(&line, &line_size, file)) > 0) {
+		char* name;
+		unsigned long long samples = strtoull(line, &name, 10);
+		if(name == line || *name != ' ')
+			continue;
+		name++;
+		name[strcspn(name, "\n")] = '\0';
+		if(*name != '\0')
+			add_count(name, (size_t)samples, counts);
+	}
+	free(line);
+	fclose(file);
+}
+
+static bool collect_counts(const char* name, size_t* count, struct function_array* functions)
+{
+	struct function* function = function_array_append0(functions);
+	if(function == NULL)
+		fatal_message(ENOMEM, "Out of memory");
+	function->name = name;
+	function->samples = *count;
+	return true;
+}
+
+/*
+ * Merge @p count profiles into their functions, hottest first. The names
+ * point into @p counts.
+ */
+static void merge_profiles(char** paths, int count, struct hashmap* counts, struct function_array* functions)
+{
+	hashmap_init(counts, 1024);
+	for(int i = 0; i < count; i++)
+		read_profile(paths[i], counts);
+	function_array_init(functions);
+	hashmap_foreach(counts, (hashmap_iter_func)collect_counts, functions);
+	function_array_sort(functions, compare_samples);
+}
+
+static int command_order(int argc, char** argv)
+{
+	int opt;
+	bool sections = false;
+	size_t total = 0;
+	const char* output = NULL;
+	struct function* function;
+	struct function_array functions;
+	struct hashmap counts;
+	FILE* file;
+
+	while((opt = getopt(argc, argv, "f:o:h")) != -1) {
+		switch(opt) {
+			case 'f':
+				if(strcmp(optarg, "sections") != 0 && strcmp(optarg, "symbols") != 0)
+					fatal_message(EINVAL, "Unknown order format '%s'", optarg);
+				sections = strcmp(optarg, "sections") == 0;
+				break;
+			case 'o': output = optarg; break;
+			case 'h':
+				usage(argv[0]);
+				return 0;
+			default:
+				usage(argv[0]);
+				return 2;
+		}
+	}
+	if(output == NULL || optind >= argc) {
+		usage(argv[0]);
+		return 2;
+	}
+
+	merge_profiles(argv + optind, argc - optind, &counts, &functions);
+	if((file = fopen(output, "w")) == NULL)
+		fatal_message(errno, "Failed to create %s: %s", output, strerror(errno));
+	ARRAY_FOREACH(&functions, function) {
+		// GCC moves some functions into .text.hot., .text.startup. or .text.unlikely.
+		if(sections)
+			fprintf(file, ".text.%s\n.text.hot.%s\n.text.startup.%s\n.text.unlikely.%s\n", function->name,
+			        function->name, function->name, function->name);
+		else
+			fprintf(file, "%s\n", function->name);
+		total += function->samples;
+	}
+	if(ferror(file) || fclose(file) != 0)
+		fatal_message(errno, "Failed to write %s: %s", output, strerror(errno));
+	printf("Wrote %zu hot functions (%zu samples) to %s\n", functions.base.elements, total, output);
+
+	function_array_reset(&functions);
+	hashmap_reset(&counts, free);
+	return 0;
+}
+
+/*
+ * Verification
+ */
+
+struct layout
+{
+	size_t functions;
+	uint64_t bytes;
+	uint64_t span;
+	size_t small_pages;
+	size_t huge_pages;
+};
+
+static int compare_u64(const void* a, const void* b)
+{
+	uint64_t x = *(const uint64_t*)a;
+	uint64_t y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+static size_t count_pages(uint64_t* pages, size_t count)
+{
+	size_t distinct = 0;
+
+	qsort(pages, count, sizeof(uint64_t), compare_u64);
+	for(size_t i = 0; i < count; i++) {
+		if(i == 0 || pages[i] != pages[i - 1])
+			distinct++;
+	}
+	return distinct;
+}
+
+/*
+ * Where the profiled functions are in @p path: how much text they take, how
+ * far apart they are, and how many pages they touch.
+ */
+static void measure_layout(const char* path, const struct function_array* hot, struct layout* layout)
+{
+	uint64_t low = UINT64_MAX, high = 0;
+	uint64_t* small = NULL;
+	uint64_t* huge = NULL;
+	size_t small_count = 0, huge_count = 0;
+	struct hashmap by_name;
+	struct function* function;
+	struct function* symbol;
+	struct function_array symbols;
+	struct elf_file elf;
+
+	memset((void*)layout, 0, sizeof(*layout));
+	load_functions(&elf, path, &symbols);
+	hashmap_init(&by_name, symbols.base.elements);
+	ARRAY_FOREACH(&symbols, symbol) {
+		if(!hashmap_find(&by_name, symbol->name, NULL))
+			hashmap_put(&by_name, symbol->name, symbol, NULL);
+	}
+
+	ARRAY_FOREACH(hot, function) {
+		uint64_t first, last;
+		size_t pages;
+
+		if((symbol = (struct function*)hashmap_get(&by_name, function->name)) == NULL)
+			continue;
+		layout->functions++;
+		layout->bytes += symbol->size;
+		if(symbol->vaddr < low)
+			low = symbol->vaddr;
+		if(symbol->vaddr + symbol->size > high)
+			high = symbol->vaddr + symbol->size;
+
+		first = symbol->vaddr / SMALL_PAGE;
+		last = (symbol->vaddr + symbol->size - 1) / SMALL_PAGE;
+		pages = (size_t)(last - first + 1);
+		if((small = (uint64_t*)realloc(small, (small_count + pages) * sizeof(uint64_t))) == NULL ||
+		   (huge = (uint64_t*)realloc(huge, (huge_count + 2) * sizeof(uint64_t))) == NULL)
+			fatal_message(ENOMEM, "Out of memory");
+		for(uint64_t page = first; page <= last; page++)
+			small[small_count++] = page;
+		huge[huge_count++] = symbol->vaddr / HUGE_PAGE;
+		huge[huge_count++] = (symbol->vaddr + symbol->size - 1) / HUGE_PAGE;
+	}
+	layout->span = high > low ? high - low : 0;
+	layout->small_pages = count_pages(small, small_count);
+	layout->huge_pages = count_pages(huge, huge_count);
+
+	free(small);
+	free(huge);
+	hashmap_reset(&by_name, NULL);
+	function_array_reset(&symbols);
+	elf_file_close(&elf);
+}
+
+static void print_layout(const char* label, const struct layout* layout)
+{
+	printf("%-8s %10zu %12.1f %12.1f %10zu %10zu\n", label, layout->functions, (double)layout->bytes / 1024,
+	       (double)layout->span / 1024, layout->small_pages, layout->huge_pages);
+}
+
+static int run_bench(char** argv)
+{
+	int status = run_command(argv);
+	if(status < 0)
+		fatal_message(-status, "Failed to run %s: %s", argv[0], strerror(-status));
+	return status;
+}
+
+static int command_verify(int argc, char** argv)
+{
+	int opt, status = 0;
+	const char* profile = NULL;
+	const char* runs = "20";
+	const char* cpus = NULL;
+	const char* name;
+	char* bench;
+	char* history;
+	char* bench_name;
+	char** bench_argv;
+	size_t index;
+	struct function_array hot;
+	struct hashmap counts;
+	struct layout before, after;
+
+	while((opt = getopt(argc, argv, "+p:r:c:h")) != -1) {
+		switch(opt) {
+			case 'p': profile = optarg; break;
+			case 'r': runs = optarg; break;
+			case 'c': cpus = optarg; break;
+			case 'h':
+				usage(argv[0]);
+				return 0;
+			default:
+				usage(argv[0]);
+				return 2;
+		}
+	}
+	if(profile == NULL || argc - optind < 2) {
+		usage(argv[0]);
+		return 2;
+	}
+
+	merge_profiles((char**)&profile, 1, &counts, &hot);
+	measure_layout(argv[optind], &hot, &before);
+	measure_layout(argv[optind + 1], &hot, &after);
+	printf("Layout of the %zu profiled functions\n", hot.base.elements);
+	printf("%-8s %10s %12s %12s %10s %10s\n", "link", "found", "text KiB", "span KiB", "4K pages", "2M pages");
+	print_layout("before", &before);
+	print_layout("after", &after);
+	function_array_reset(&hot);
+	hashmap_reset(&counts, free);
+
+	bench = tool_path(BENCH_SUFFIX);
+	if(access(bench, X_OK) != 0) {
+		printf("%s is missing; not measuring cache and TLB misses.\n", bench);
+		free(bench);
+		return 0;
+	}
+
+	// <triple>-bench -n NAME -b LABEL -H HISTORY -r RUNS [-c CPUS] -- PROGRAM ARGS...
+	name = strrchr(argv[optind + 1], PATH_SEP_CHR);
+	bench_name = sprintf_alloc("func-order-%s", name != NULL ? name + 1 : argv[optind + 1]);
+	history = sprintf_alloc("%s/cross-func-order.%d.jsonl", getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp",
+	                        (int)getpid());
+	bench_argv = (char**)calloc((size_t)(argc - optind) + 16, sizeof(char*));
+	if(bench_name == NULL || history == NULL || bench_argv == NULL)
+		fatal_message(ENOMEM, "Out of memory");
+	for(int pass = 0; pass < 2 && status == 0; pass++) {
+		index = 0;
+		bench_argv[index++] = bench;
+		bench_argv[index++] = "-n";
+		bench_argv[index++] = bench_name;
+		bench_argv[index++] = "-b";
+		bench_argv[index++] = pass == 0 ? "before" : "after";
+		bench_argv[index++] = "-H";
+		bench_argv[index++] = history;
+		bench_argv[index++] = "-r";
+		bench_argv[index++] = (char*)runs;
+		if(cpus != NULL) {
+			bench_argv[index++] = "-c";
+			bench_argv[index++] = (char*)cpus;
+		}
+		bench_argv[index++] = "--";
+		bench_argv[index++] = argv[optind + pass];
+		for(int i = optind + 2; i < argc; i++) {
+			if(i == optind + 2 && strcmp(argv[i], "--") == 0)
+				continue;
+			bench_argv[index++] = argv[i];
+		}
+		bench_argv[index] = NULL;
+		printf("\n");
+		status = run_bench(bench_argv);
+	}
+	unlink(history);
+
+	free(bench_argv);
+	free(history);
+	free(bench_name);
+	free(bench);
+	return status;
+}
+
+int main(int argc, char** argv)
+{
+	if(argc < 2) {
+		usage(argv[0]);
+		return 2;
+	}
+	// Subcommands parse their own options, with the subcommand as argv[0].
+	if(strcmp(argv[1], "record") == 0)
+		return command_record(argc - 1, argv + 1);
+	if(strcmp(argv[1], "order") == 0)
+		return command_order(argc - 1, argv + 1);
+	if(strcmp(argv[1], "verify") == 0)
+		return command_verify(argc - 1, argv + 1);
+	if(strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
+		usage(argv[0]);
+		return 0;
+	}
+	usage(argv[0]);
+	return 2;
+}
@@ -0,0 +1,1182 @@
+/**
+ * @file cross-header-cost.c
+ * @author Charles Grunwald <cgrunwald@gmail.com>
+ * @brief Ranks the headers of a target build by how much of its compile time they cost.
+ *
+ * Usage: <triple>-header-cost [-j JOBS] [-n TOP] [-t PERCENT] [-o JSON] [BUILD_DIR|compile_commands.json]
+ *
+ * Every translation unit in compile_commands.json is preprocessed again with
+ * its own command line (the <triple>-gcc/<triple>-g++ cross-cmake put there)
+ * plus -E -H, and the header trees GCC prints are merged into one include
+ * graph. Each header is charged for its size and its approximate token count
+ * every time a TU parses it, both on its own and inclusively - along with
+ * everything parsed underneath it.
+ *
+ * Headers are split into project, toolchain (libstdc++ and GCC's own
+ * headers), sysroot and other headers, and the system headers the project
+ * includes directly in enough of its TUs are suggested for cross-pch.cmake's
+ * CROSS_PCH_<LANG>_HEADERS. The full table can be written out as JSON, to be
+ * kept alongside the build and compared over time.
+ */
+#define _GNU_SOURCE
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "shared.h"
+#include "strutil.h"
+#include "strarray.h"
+#include "hashmap.h"
+#include "dynarray.h"
+#include "json.h"
+#include "libcross.h"
+#include "workqueue.h"
+
+#define PATH_SEP_CHR '/'
+
+#define UNAME_SUFFIX "-header-cost"
+#define COMPILE_COMMANDS "compile_commands.json"
+#define CMAKE_CACHE "CMakeCache.txt"
+#define CMAKE_HOME_KEY "CMAKE_HOME_DIRECTORY:INTERNAL="
+
+// Where GCC stops listing the include tree and starts giving advice.
+#define GUARDS_BANNER "Multiple include guards may be useful for:"
+
+#define DEFAULT_TOP 25
+#define DEFAULT_THRESHOLD 30.0
+
+enum header_category
+{
+	CATEGORY_PROJECT,
+	CATEGORY_TOOLCHAIN,
+	CATEGORY_SYSROOT,
+	CATEGORY_OTHER,
+	CATEGORY_COUNT,
+};
+
+static const char* const category_names[CATEGORY_COUNT] = {
+	"project", "toolchain", "sysroot", "other"
+};
+
+enum tu_language
+{
+	LANG_C,
+	LANG_CXX,
+	LANG_COUNT,
+};
+
+static const char* const language_names[LANG_COUNT] = { "C", "CXX" };
+
+struct header
+{
+	char* path;
+	enum header_category category;
+	bool readable;
+	uint64_t bytes;
+	uint64_t tokens;
+
+	// Times parsed, and the number of TUs parsing it at least once.
+	uint64_t parses;
+	size_t tus;
+	size_t last_tu;
+
+	// Inclusive cost: the header itself plus everything parsed beneath it.
+	uint64_t inclusive_bytes;
+	uint64_t inclusive_tokens;
+
+	// TUs whose project code includes it directly, per language.
+	size_t direct_tus[LANG_COUNT];
+	size_t last_direct_tu[LANG_COUNT];
+};
+
+struct include_record
+{
+	size_t depth;
+	struct header* header;
+};
+
+DEFINE_ARRAY_TYPE(include_records, struct include_record)
+
+struct translation_unit
+{
+	size_t index;
+	char* file;
+	char* directory;
+	char** argv;
+	enum tu_language language;
+	bool failed;
+	uint64_t bytes;
+	uint64_t tokens;
+	struct include_records records;
+};
+
+DEFINE_ARRAY_TYPE(header_list, struct header*)
+
+struct header_cost
+{
+	char* build_dir;
+	char* sysroot;
+	char* toolchain;
+	string_array* project_dirs;
+
+	pthread_mutex_t lock;
+	struct hashmap headers;
+	struct translation_unit** tus;
+	size_t tu_count;
+	size_t failed_count;
+	size_t finished_count;
+	size_t language_tus[LANG_COUNT];
+};
+
+struct pch_candidate
+{
+	struct header* header;
+	char* name;
+};
+
+static CC_NORETURN fatal_message(int code, const char* format, ...)
+{
+	va_list args;
+	fprintf(stderr, "ERROR: ");
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+	fprintf(stderr, "\n");
+	exit(code != 0 ? code : 1);
+}
+
+static void usage(const char* exe)
+{
+	printf("Usage: %s [-j JOBS] [-n TOP] [-t PERCENT] [-o JSON] [-s SYSROOT] [-P DIR]... [BUILD_DIR|" COMPILE_COMMANDS "]\n\n", exe);
+	printf("Preprocesses every translation unit of a cross-cmake build tree with -H and\n");
+	printf("ranks the headers by the bytes and tokens they add across the whole build.\n\n");
+	printf("  -j JOBS     Compilers run at once (default: online CPUs)\n");
+	printf("  -n TOP      Headers listed per table (default: %d)\n", DEFAULT_TOP);
+	printf("  -t PERCENT  Share of TUs including a system header directly that makes\n");
+	printf("              it a PCH candidate (default: %.0f)\n", DEFAULT_THRESHOLD);
+	printf("  -o JSON     Also write every header's numbers to JSON\n");
+	printf("  -s SYSROOT  Sysroot to classify headers against (default: derived from our path)\n");
+	printf("  -P DIR      Project source directory (default: CMAKE_HOME_DIRECTORY and BUILD_DIR)\n");
+}
+
+/*
+ * Paths
+ */
+
+static char* resolve_path(const char* directory, const char* path)
+{
+	char resolved[PATH_MAX] = "";
+	char* joined;
+
+	if(path[0] == PATH_SEP_CHR || directory == NULL)
+		return realpath(path, resolved) != NULL ? strdup(resolved) : strdup(path);
+	if((joined = sprintf_alloc("%s/%s", directory, path)) == NULL)
+		return NULL;
+	if(realpath(joined, resolved) != NULL) {
+		free(joined);
+		return strdup(resolved);
+	}
+	return joined;
+}
+
+static bool path_within(const char* path, const char* dir)
+{
+	size_t len;
+	if(dir == NULL)
+		return false;
+	len = strlen(dir);
+	while(len > 1 && dir[len - 1] == PATH_SEP_CHR)
+		len--;
+	return strncmp(path, dir, len) == 0 && (path[len] == PATH_SEP_CHR || (len == 1 && dir[0] == PATH_SEP_CHR));
+}
+
+// Project first: the sysroot is / on some setups and would swallow everything.
+static enum header_category categorize(const struct header_cost* ctx, const char* path)
+{
+	if(ctx->project_dirs == NULL)
+		return CATEGORY_PROJECT;
+	for(size_t i = 0; i < ctx->project_dirs->len; i++) {
+		if(path_within(path, ctx->project_dirs->ptr[i]))
+			return CATEGORY_PROJECT;
+	}
+	if(path_within(path, ctx->toolchain) && !path_within(path, ctx->sysroot))
+		return CATEGORY_TOOLCHAIN;
+	if(path_within(path, ctx->sysroot))
+		return CATEGORY_SYSROOT;
+	return CATEGORY_OTHER;
+}
+
+/*
+ * How a header is spelled in an #include: what follows the include directory,
+ * minus libstdc++'s c++/<version>/ and any multiarch directory.
+ */
+static char* include_name(const char* path)
+{
+	const char* name = path;
+	const char* next;
+	const char* slash;
+
+	for(next = strstr(path, "/include/"); next != NULL; next = strstr(next + 1, "/include/"))
+		name = next + sizeof("/include/") - 1;
+	if(strncmp(name, "c++/", 4) == 0 && isdigit((unsigned char)name[4]) &&
+	   (slash = strchr(name + 4, PATH_SEP_CHR)) != NULL)
+		name = slash + 1;
+	if((slash = strchr(name, PATH_SEP_CHR)) != NULL) {
+		char component[NAME_MAX + 1] = "";
+		size_t len = (size_t)(slash - name);
+		if(len < sizeof(component)) {
+			memcpy(component, name, len);
+			if(strstr(component, "-linux-") != NULL)
+				name = slash + 1;
+		}
+	}
+	return strdup(name);
+}
+
+/*
+ * Token counting
+ *
+ * Preprocessing tokens of the whole file, conditional blocks included, so
+ * it's an upper bound on what the parser sees. Good enough to rank headers.
+ */
+
+static const char* const punctuators[] = {
+	"->*", "...", "<<=", ">>=", "::", "->", "++", "--", "<<", ">>", "<=", ">=", "==", "!=",
+	"&&", "||", "+=", "-=", "*=", "/=", "%=", "&=", "|=", "^=", "##", ".*", NULL
+};
+
+static size_t punctuator_length(const char* text, const char* end)
+{
+	for(size_t i = 0; punctuators[i] != NULL; i++) {
+		size_t len = strlen(punctuators[i]);
+		if((size_t)(end - text) >= len && memcmp(text, punctuators[i], len) == 0)
+			return len;
+	}
+	return 1;
+}
+
+static uint64_t count_tokens(const char* text, size_t length)
+{
+	uint64_t tokens = 0;
+	const char* p = text;
+	const char* end = text + length;
+
+	while(p < end) {
+		char c = *p;
+		if(isspace((unsigned char)c) || (c == '\\' && p + 1 < end && (p[1] == '\n' || p[1] == '\r'))) {
+			p++;
+		} else if(c == '/' && p + 1 < end && p[1] == '/') {
+			while(p < end && *p != '\n')
+				p++;
+		} else if(c == '/' && p + 1 < end && p[1] == '*') {
+			for(p += 2; p + 1 < end && !(p[0] == '*' && p[1] == '/'); p++)
+				;
+			p += 2;
+		} else if(isalpha((unsigned char)c) || c == '_') {
+			while(p < end && (isalnum((unsigned char)*p) || *p == '_'))
+				p++;
+			// Prefixed literals (u8"", L'') are one token with their prefix.
+			if(p < end && (*p == '"' || *p == '\''))
+				continue;
+			tokens++;
+		} else if(isdigit((unsigned char)c) || (c == '.' && p + 1 < end && isdigit((unsigned char)p[1]))) {
+			for(p++; p < end; p++) {
+				if((*p == '+' || *p == '-') && strchr("eEpP", p[-1]) != NULL)
+					continue;
+				if(!isalnum((unsigned char)*p) && *p != '_' && *p != '.' && *p != '\'')
+					break;
+			}
+			tokens++;
+		} else if(c == '"' || c == '\'') {
+			for(p++; p < end && *p != c && *p != '\n'; p++) {
+				if(*p == '\\')
+					p++;
+			}
+			p++;
+			tokens++;
+		} else {
+			p += punctuator_length(p, end);
+			tokens++;
+		}
+	}
+	return tokens;
+}
+
+static bool measure_file(const char* path, uint64_t* bytes, uint64_t* tokens)
+{
+	struct stat st;
+	void* data;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	*bytes = *tokens = 0;
+	if(fd < 0)
+		return false;
+	if(fstat(fd, &st) != 0) {
+		close(fd);
+		return false;
+	}
+	if(st.st_size > 0) {
+		data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(data == MAP_FAILED) {
+			close(fd);
+			return false;
+		}
+		*bytes = (uint64_t)st.st_size;
+		*tokens = count_tokens((const char*)data, (size_t)st.st_size);
+		munmap(data, (size_t)st.st_size);
+	}
+	close(fd);
+	return true;
+}
+
+/*
+ * compile_commands.json
+ */
+
+// Split a "command" entry the way the shell would; it has no expansions.
+static string_array* split_command(const char* command)
+{
+	string_array* result = NULL;
+	const char* p = command;
+	char* word;
+	size_t len;
+	char quote;
+
+	while(*p != '\0') {
+		while(isspace((unsigned char)*p))
+			p++;
+		if(*p == '\0')
+			break;
+		if((word = (char*)malloc(strlen(p) + 1)) == NULL) {
+			string_array_free(result);
+			return NULL;
+		}
+		len = 0;
+		quote = '\0';
+		for(; *p != '\0' && (quote != '\0' || !isspace((unsigned char)*p)); p++) {
+			if(quote == '\0' && (*p == '"' || *p == '\'')) {
+				quote = *p;
+			} else if(quote != '\0' && *p == quote) {
+				quote = '\0';
+			} else if(*p == '\\' && quote != '\'' && p[1] != '\0') {
+				word[len++] = *++p;
+			} else {
+				word[len++] = *p;
+			}
+		}
+		word[len] = '\0';
+		result = string_array_push(result, word);
+	}
+	return result;
+}
+
+// Arguments that would write something or make -E stop early.
+static size_t dropped_arguments(const char* arg)
+{
+	static const char* const with_value[] = { "-o", "-MF", "-MT", "-MQ", NULL };
+	static const char* const single[] = { "-c", "-S", "-M", "-MM", "-MD", "-MMD", "-MP", "-MG", "-H", "-E", NULL };
+
+	for(size_t i = 0; with_value[i] != NULL; i++) {
+		if(strcmp(arg, with_value[i]) == 0)
+			return 2;
+		if(strncmp(arg, with_value[i], strlen(with_value[i])) == 0)
+			return 1;
+	}
+	for(size_t i = 0; single[i] != NULL; i++) {
+		if(strcmp(arg, single[i]) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+static char** preprocess_argv(string_array* args)
+{
+	static const char* const appended[] = { "-E", "-H", "-w", "-o", "/dev/null", NULL };
+	size_t count = 0;
+	size_t index = 0;
+	char** argv = (char**)calloc(args->len + 8, sizeof(char*));
+
+	if(argv == NULL)
+		return NULL;
+
+	// Launchers end up in front of the compiler with some generators.
+	if(args->len > 1) {
+		const char* name = strrchr(args->ptr[0], PATH_SEP_CHR);
+		name = name != NULL ? name + 1 : args->ptr[0];
+		if(strcmp(name, "ccache") == 0 || strcmp(name, "sccache") == 0)
+			index = 1;
+	}
+	while(index < args->len) {
+		if(index > 0 && dropped_arguments(args->ptr[index]) > 0) {
+			index += dropped_arguments(args->ptr[index]);
+			continue;
+		}
+		argv[count++] = strdup(args->ptr[index++]);
+	}
+	for(size_t i = 0; appended[i] != NULL; i++)
+		argv[count++] = strdup(appended[i]);
+	return argv;
+}
+
+static enum tu_language language_of(const char* file)
+{
+	const char* ext = strrchr(file, '.');
+	return ext != NULL && strcmp(ext, ".c") == 0 ? LANG_C : LANG_CXX;
+}
+
+static struct translation_unit* translation_unit_new(const struct json_value* entry, size_t index)
+{
+	const struct json_value* arguments = json_get(entry, "arguments");
+	const char* command = json_string(json_get(entry, "command"));
+	const char* directory = json_string(json_get(entry, "directory"));
+	const char* file = json_string(json_get(entry, "file"));
+	string_array* args = NULL;
+	struct translation_unit* tu;
+
+	if(file == NULL || (arguments == NULL && command == NULL))
+		return NULL;
+	if(arguments != NULL) {
+		for(size_t i = 0; i < json_count(arguments); i++) {
+			const char* arg = json_string(json_at(arguments, i));
+			if(arg != NULL)
+				args = string_array_push(args, strdup(arg));
+		}
+	} else {
+		args = split_command(command);
+	}
+	if(args == NULL || args->len == 0) {
+		string_array_free(args);
+		return NULL;
+	}
+
+	tu = (struct translation_unit*)calloc(1, sizeof(struct translation_unit));
+	if(tu != NULL) {
+		tu->index = index;
+		tu->directory = directory != NULL ? strdup(directory) : NULL;
+		tu->file = resolve_path(tu->directory, file);
+		tu->language = language_of(file);
+		tu->argv = preprocess_argv(args);
+		include_records_init(&tu->records);
+	}
+	string_array_free(args);
+	return tu;
+}
+
+static void translation_unit_free(struct translation_unit* tu)
+{
+	if(tu != NULL) {
+		for(size_t i = 0; tu->argv != NULL && tu->argv[i] != NULL; i++)
+			free(tu->argv[i]);
+		free(tu->argv);
+		free(tu->file);
+		free(tu->directory);
+		include_records_reset(&tu->records);
+		free(tu);
+	}
+}
+
+/*
+ * Preprocessing
+ */
+
+static struct header* intern_header(struct header_cost* ctx, char* path)
+{
+	struct header* header = (struct header*)hashmap_get(&ctx->headers, path);
+
+	if(header != NULL) {
+		free(path);
+		return header;
+	}
+	header = (struct header*)calloc(1, sizeof(struct header));
+	if(header == NULL || hashmap_put(&ctx->headers, path, header, NULL) != 0)
+		fatal_message(ENOMEM, "Out of memory");
+	header->path = path;
+	header->category = categorize(ctx, path);
+	header->last_tu = SIZE_MAX;
+	header->last_direct_tu[LANG_C] = header->last_direct_tu[LANG_CXX] = SIZE_MAX;
+	return header;
+}
+
+static void header_free(struct header* header)
+{
+	if(header != NULL) {
+		free(header->path);
+		free(header);
+	}
+}
+
+static pid_t start_preprocessor(const struct translation_unit* tu, int* err_fd)
+{
+	int fds[2];
+	pid_t pid;
+
+	if(pipe2(fds, O_CLOEXEC) != 0)
+		return -1;
+	if((pid = fork()) < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+
+	if(pid == 0) {
+		int null_fd = open("/dev/null", O_RDWR);
+		if(null_fd < 0 || dup2(null_fd, STDIN_FILENO) < 0 || dup2(null_fd, STDOUT_FILENO) < 0 ||
+		   dup2(fds[1], STDERR_FILENO) < 0)
+			_exit(127);
+		if(tu->directory != NULL && chdir(tu->directory) != 0)
+			_exit(127);
+		execvp(tu->argv[0], tu->argv);
+		_exit(127);
+	}
+	close(fds[1]);
+	*err_fd = fds[0];
+	return pid;
+}
+
+/*
+ * One line per header opened: its depth as dots, then the path as it was
+ * found. '!' and 'x' mark valid and invalid PCH files instead of a depth.
+ */
+static void preprocess_handler(struct workqueue* CPP_UNUSED(wq), struct translation_unit* tu, struct header_cost* ctx)
+{
+	int fd = -1, status = 0;
+	char* line = NULL;
+	size_t line_size = 0;
+	ssize_t length;
+	string_array* paths = NULL;
+	size_t* depths = NULL;
+	size_t depth_count = 0;
+	FILE* stream;
+	pid_t pid;
+
+	if((pid = start_preprocessor(tu, &fd)) < 0 || (stream = fdopen(fd, "r")) == NULL) {
+		if(fd >= 0)
+			close(fd);
+		tu->failed = true;
+	} else {
+		while((length = getline(&line, &line_size, stream)) > 0) {
+			size_t depth = 0;
+			if(line[length - 1] == '\n')
+				line[--length] = '\0';
+			if(strncmp(line, GUARDS_BANNER, sizeof(GUARDS_BANNER) - 1) == 0)
+				break;
+			while(line[depth] == '.')
+				depth++;
+			if(depth == 0 || line[depth] != ' ')
+				continue;
+			paths = string_array_push(paths, resolve_path(tu->directory, line + depth + 1));
+			depths = (size_t*)realloc(depths, (depth_count + 1) * sizeof(size_t));
+			if(paths == NULL || depths == NULL)
+				fatal_message(ENOMEM, "Out of memory");
+			depths[depth_count++] = depth;
+		}
+		// Drain the rest so the compiler never blocks on a full pipe.
+		while(getline(&line, &line_size, stream) > 0)
+			;
+		fclose(stream);
+		while(waitpid(pid, &status, 0) < 0) {
+			if(errno != EINTR)
+				break;
+		}
+		tu->failed = !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+	}
+	free(line);
+	if(!tu->failed)
+		measure_file(tu->file, &tu->bytes, &tu->tokens);
+
+	pthread_mutex_lock(&ctx->lock);
+	for(size_t i = 0; i < depth_count; i++) {
+		struct include_record* record;
+		if(tu->failed) {
+			free(paths->ptr[i]);
+			continue;
+		}
+		if((record = include_records_append(&tu->records)) == NULL)
+			fatal_message(ENOMEM, "Out of memory");
+		record->depth = depths[i];
+		record->header = intern_header(ctx, paths->ptr[i]);
+	}
+	if(tu->failed) {
+		ctx->failed_count++;
+		fprintf(stderr, "WARNING: Failed to preprocess %s\n", tu->file);
+	}
+	ctx->finished_count++;
+	if(isatty(STDERR_FILENO))
+		fprintf(stderr, "\r[%zu/%zu]", ctx->finished_count, ctx->tu_count);
+	pthread_mutex_unlock(&ctx->lock);
+
+	// The paths are owned by the headers now.
+	if(paths != NULL)
+		paths->len = 0;
+	string_array_free(paths);
+	free(depths);
+}
+
+static void measure_handler(struct workqueue* CPP_UNUSED(wq), struct header* header, void* CPP_UNUSED(userdata))
+{
+	header->readable = measure_file(header->path, &header->bytes, &header->tokens);
+}
+
+static bool collect_header(const char* CPP_UNUSED(key), struct header* header, struct header_list* list)
+{
+	struct header** slot = header_list_append(list);
+	if(slot == NULL)
+		fatal_message(ENOMEM, "Out of memory");
+	*slot = header;
+	return true;
+}
+
+/*
+ * Aggregation
+ */
+
+// Charge everything under each header to it, and note who includes it.
+static void aggregate_tu(struct header_cost* ctx, struct translation_unit* tu)
+{
+	struct stack_entry { struct header* header; uint64_t bytes; uint64_t tokens; };
+	struct stack_entry* stack;
+	size_t top = 0;
+	struct include_record* record;
+
+	stack = (struct stack_entry*)calloc(tu->records.base.elements + 1, sizeof(struct stack_entry));
+	if(stack == NULL)
+		fatal_message(ENOMEM, "Out of memory");
+	ctx->language_tus[tu->language]++;
+
+	ARRAY_FOREACH(&tu->records, record) {
+		struct header* header = record->header;
+		bool direct;
+
+		// Close everything at this depth or deeper, adding it to its parent.
+		while(top >= record->depth && top > 0) {
+			struct stack_entry* done = &stack[--top];
+			done->header->inclusive_bytes += done->bytes;
+			done->header->inclusive_tokens += done->tokens;
+			if(top > 0) {
+				stack[top - 1].bytes += done->bytes;
+				stack[top - 1].tokens += done->tokens;
+			}
+		}
+		direct = top == 0 || stack[top - 1].header->category == CATEGORY_PROJECT;
+
+		header->parses++;
+		if(header->last_tu != tu->index) {
+			header->last_tu = tu->index;
+			header->tus++;
+		}
+		if(direct && header->last_direct_tu[tu->language] != tu->index) {
+			header->last_direct_tu[tu->language] = tu->index;
+			header->direct_tus[tu->language]++;
+		}
+		stack[top].header = header;
+		stack[top].bytes = header->bytes;
+		stack[top].tokens = header->tokens;
+		top++;
+	}
+	while(top > 0) {
+		struct stack_entry* done = &stack[--top];
+		done->header->inclusive_bytes += done->bytes;
+		done->header->inclusive_tokens += done->tokens;
+		if(top > 0) {
+			stack[top - 1].bytes += done->bytes;
+			stack[top - 1].tokens += done->tokens;
+		}
+	}
+	free(stack);
+}
+
+static int compare_total(const void* a, const void* b)
+{
+	const struct header* ha = *(const struct header* const*)a;
+	const struct header* hb = *(const struct header* const*)b;
+	uint64_t ta = ha->bytes * ha->parses, tb = hb->bytes * hb->parses;
+	return ta != tb ? (ta < tb ? 1 : -1) : strcmp(ha->path, hb->path);
+}
+
+static int compare_inclusive(const void* a, const void* b)
+{
+	const struct header* ha = *(const struct header* const*)a;
+	const struct header* hb = *(const struct header* const*)b;
+	if(ha->inclusive_bytes != hb->inclusive_bytes)
+		return ha->inclusive_bytes < hb->inclusive_bytes ? 1 : -1;
+	return strcmp(ha->path, hb->path);
+}
+
+/*
+ * Reporting
+ */
+
+static const char* human_size(uint64_t value, char* buffer, size_t size)
+{
+	static const char* const units[] = { "B", "KiB", "MiB", "GiB", "TiB" };
+	double scaled = (double)value;
+	size_t unit = 0;
+
+	while(scaled >= 1024.0 && unit + 1 < sizeof(units) / sizeof(units[0])) {
+		scaled /= 1024.0;
+		unit++;
+	}
+	if(unit == 0)
+		snprintf(buffer, size, "%" PRIu64 " B", value);
+	else
+		snprintf(buffer, size, "%.1f %s", scaled, units[unit]);
+	return buffer;
+}
+
+static const char* human_count(uint64_t value, char* buffer, size_t size)
+{
+	if(value >= 1000000)
+		snprintf(buffer, size, "%.1fM", (double)value / 1e6);
+	else if(value >= 10000)
+		snprintf(buffer, size, "%.1fk", (double)value / 1e3);
+	else
+		snprintf(buffer, size, "%" PRIu64, value);
+	return buffer;
+}
+
+// Keep tables readable by trimming the uninteresting front of long paths.
+static const char* display_path(const struct header_cost* ctx, const struct header* header)
+{
+	const char* root = NULL;
+	if(header->category == CATEGORY_PROJECT && ctx->project_dirs != NULL) {
+		for(size_t i = 0; i < ctx->project_dirs->len && root == NULL; i++) {
+			if(path_within(header->path, ctx->project_dirs->ptr[i]))
+				root = ctx->project_dirs->ptr[i];
+		}
+	} else if(header->category == CATEGORY_SYSROOT) {
+		root = ctx->sysroot;
+	} else if(header->category == CATEGORY_TOOLCHAIN) {
+		root = ctx->toolchain;
+	}
+	if(root == NULL || strcmp(root, "/") == 0)
+		return header->path;
+	return header->path + strlen(root) + 1;
+}
+
+static void print_table(const struct header_cost* ctx, const char* title, struct header_list* list,
+                        size_t top, bool inclusive)
+{
+	char size[32], tokens[32];
+	struct header** header;
+	size_t shown = 0;
+
+	printf("\n%s:\n", title);
+	printf("  %10s %9s %6s %7s  %-9s %s\n", inclusive ? "Inclusive" : "Total", "Tokens", "TUs", "Parses", "Category", "Header");
+	ARRAY_FOREACH(list, header) {
+		if(shown++ >= top)
+			break;
+		printf("  %10s %9s %6zu %7" PRIu64 "  %-9s %s\n",
+		       human_size(inclusive ? (*header)->inclusive_bytes : (*header)->bytes * (*header)->parses, size, sizeof(size)),
+		       human_count(inclusive ? (*header)->inclusive_tokens : (*header)->tokens * (*header)->parses, tokens, sizeof(tokens)),
+		       (*header)->tus, (*header)->parses, category_names[(*header)->category], display_path(ctx, *header));
+	}
+}
+
+/*
+ * System headers the project includes directly from at least @p threshold
+ * percent of its TUs of a language, costliest first.
+ */
+static size_t pch_candidates(const struct header_cost* ctx, struct header_list* by_inclusive, enum tu_language language,
+                             double threshold, struct pch_candidate** result)
+{
+	struct header** header;
+	struct pch_candidate* candidates;
+	size_t count = 0;
+	size_t tus = ctx->language_tus[language];
+
+	*result = NULL;
+	if(tus == 0)
+		return 0;
+	candidates = (struct pch_candidate*)calloc(by_inclusive->base.elements + 1, sizeof(struct pch_candidate));
+	if(candidates == NULL)
+		fatal_message(ENOMEM, "Out of memory");
+
+	ARRAY_FOREACH(by_inclusive, header) {
+		char* name;
+		bool duplicate = false;
+		if((*header)->category == CATEGORY_PROJECT || !(*header)->readable)
+			continue;
+		if(100.0 * (double)(*header)->direct_tus[language] < threshold * (double)tus)
+			continue;
+		if((name = include_name((*header)->path)) == NULL)
+			fatal_message(ENOMEM, "Out of memory");
+		for(size_t i = 0; i < count && !duplicate; i++)
+			duplicate = strcmp(candidates[i].name, name) == 0;
+		if(duplicate || strchr(name, ';') != NULL) {
+			free(name);
+			continue;
+		}
+		candidates[count].header = *header;
+		candidates[count].name = name;
+		count++;
+	}
+	*result = candidates;
+	return count;
+}
+
+static void pch_candidates_free(struct pch_candidate* candidates, size_t count)
+{
+	for(size_t i = 0; i < count; i++)
+		free(candidates[i].name);
+	free(candidates);
+}
+
+static void print_pch(const struct header_cost* ctx, struct header_list* by_inclusive, double threshold)
+{
+	char size[32];
+
+	for(int language = 0; language < LANG_COUNT; language++) {
+		struct pch_candidate* candidates;
+		size_t tus = ctx->language_tus[language];
+		size_t count = pch_candidates(ctx, by_inclusive, (enum tu_language)language, threshold, &candidates);
+
+		if(tus == 0)
+			continue;
+		printf("\nPCH candidates for %s (included directly in at least %.0f%% of %zu TUs):\n",
+		       language_names[language], threshold, tus);
+		if(count == 0) {
+			printf("  none\n");
+		} else {
+			for(size_t i = 0; i < count; i++) {
+				const struct header* header = candidates[i].header;
+				printf("  %-32s %3.0f%% of TUs, %s per TU\n", candidates[i].name,
+				       100.0 * (double)header->direct_tus[language] / (double)tus,
+				       human_size(header->inclusive_bytes / (header->tus > 0 ? header->tus : 1), size, sizeof(size)));
+			}
+			printf("  -DCROSS_PCH_%s_HEADERS=\"", language_names[language]);
+			for(size_t i = 0; i < count; i++)
+				printf("%s%s", i > 0 ? ";" : "", candidates[i].name);
+			printf("\"\n");
+		}
+		pch_candidates_free(candidates, count);
+	}
+}
+
+static void print_report(const struct header_cost* ctx, struct header_list* by_total, struct header_list* by_inclusive,
+                         size_t top, double threshold)
+{
+	char size[32], tokens[32];
+	uint64_t tu_bytes = 0, tu_tokens = 0, total_bytes;
+	uint64_t category_bytes[CATEGORY_COUNT] = { 0 };
+	uint64_t category_tokens[CATEGORY_COUNT] = { 0 };
+	size_t category_headers[CATEGORY_COUNT] = { 0 };
+	struct header** header;
+
+	for(size_t i = 0; i < ctx->tu_count; i++) {
+		tu_bytes += ctx->tus[i]->bytes;
+		tu_tokens += ctx->tus[i]->tokens;
+	}
+	ARRAY_FOREACH(by_total, header) {
+		category_headers[(*header)->category]++;
+		category_bytes[(*header)->category] += (*header)->bytes * (*header)->parses;
+		category_tokens[(*header)->category] += (*header)->tokens * (*header)->parses;
+	}
+	total_bytes = tu_bytes;
+	for(int i = 0; i < CATEGORY_COUNT; i++)
+		total_bytes += category_bytes[i];
+
+	printf("Preprocessed %zu translation units (%zu failed), %zu distinct headers.\n",
+	       ctx->tu_count - ctx->failed_count, ctx->failed_count, by_total->base.elements);
+	printf("\n  %-10s %8s %10s %9s %6s\n", "Category", "Headers", "Parsed", "Tokens", "Share");
+	printf("  %-10s %8zu %10s %9s %5.1f%%\n", "sources", ctx->tu_count - ctx->failed_count,
+	       human_size(tu_bytes, size, sizeof(size)), human_count(tu_tokens, tokens, sizeof(tokens)),
+	       total_bytes > 0 ? 100.0 * (double)tu_bytes / (double)total_bytes : 0.0);
+	for(int i = 0; i < CATEGORY_COUNT; i++) {
+		if(category_headers[i] == 0)
+			continue;
+		printf("  %-10s %8zu %10s %9s %5.1f%%\n", category_names[i], category_headers[i],
+		       human_size(category_bytes[i], size, sizeof(size)), human_count(category_tokens[i], tokens, sizeof(tokens)),
+		       total_bytes > 0 ? 100.0 * (double)category_bytes[i] / (double)total_bytes : 0.0);
+	}
+
+	print_table(ctx, "Headers by bytes parsed across all TUs", by_total, top, false);
+	print_table(ctx, "Headers by inclusive cost (themselves and everything they include)", by_inclusive, top, true);
+	print_pch(ctx, by_inclusive, threshold);
+}
+
+static void write_json_string(FILE* file, const char* value)
+{
+	fputc('"', file);
+	for(const unsigned char* p = (const unsigned char*)value; *p != '\0'; p++) {
+		if(*p == '"' || *p == '\\')
+			fprintf(file, "\\%c", *p);
+		else if(*p < 0x20)
+			fprintf(file, "\\u%04x", *p);
+		else
+			fputc(*p, file);
+	}
+	fputc('"', file);
+}
+
+static void write_json(const struct header_cost* ctx, struct header_list* by_total, struct header_list* by_inclusive,
+                       double threshold, const char* path)
+{
+	uint64_t tu_bytes = 0, tu_tokens = 0;
+	struct header** header;
+	bool first = true;
+	FILE* file = fopen(path, "w");
+
+	if(file == NULL)
+		fatal_message(errno, "Failed to open %s: %s", path, strerror(errno));
+	for(size_t i = 0; i < ctx->tu_count; i++) {
+		tu_bytes += ctx->tus[i]->bytes;
+		tu_tokens += ctx->tus[i]->tokens;
+	}
+
+	fprintf(file, "{\n  \"version\": 1,\n  \"timestamp\": %lld,\n  \"build_dir\": ", (long long)time(NULL));
+	write_json_string(file, ctx->build_dir);
+	fprintf(file, ",\n  \"sysroot\": ");
+	if(ctx->sysroot != NULL)
+		write_json_string(file, ctx->sysroot);
+	else
+		fprintf(file, "null");
+	fprintf(file, ",\n  \"tus\": %zu,\n  \"failed\": %zu,\n", ctx->tu_count - ctx->failed_count, ctx->failed_count);
+	fprintf(file, "  \"source_bytes\": %" PRIu64 ",\n  \"source_tokens\": %" PRIu64 ",\n", tu_bytes, tu_tokens);
+
+	fprintf(file, "  \"pch\": {");
+	for(int language = 0; language < LANG_COUNT; language++) {
+		struct pch_candidate* candidates;
+		size_t count = pch_candidates(ctx, by_inclusive, (enum tu_language)language, threshold, &candidates);
+		fprintf(file, "%s\n    \"%s\": [", language > 0 ? "," : "", language_names[language]);
+		for(size_t i = 0; i < count; i++) {
+			fprintf(file, "%s", i > 0 ? ", " : "");
+			write_json_string(file, candidates[i].name);
+		}
+		fprintf(file, "]");
+		pch_candidates_free(candidates, count);
+	}
+	fprintf(file, "\n  },\n  \"headers\": [");
+
+	ARRAY_FOREACH(by_total, header) {
+		const struct header* h = *header;
+		fprintf(file, "%s\n    {\"path\": ", first ? "" : ",");
+		write_json_string(file, h->path);
+		fprintf(file, ", \"category\": \"%s\", \"bytes\": %" PRIu64 ", \"tokens\": %" PRIu64
+		        ", \"tus\": %zu, \"parses\": %" PRIu64 ", \"total_bytes\": %" PRIu64 ", \"total_tokens\": %" PRIu64
+		        ", \"inclusive_bytes\": %" PRIu64 ", \"inclusive_tokens\": %" PRIu64
+		        ", \"direct_tus\": {\"C\": %zu, \"CXX\": %zu}}",
+		        category_names[h->category], h->bytes, h->tokens, h->tus, h->parses,
+		        h->bytes * h->parses, h->tokens * h->parses, h->inclusive_bytes, h->inclusive_tokens,
+		        h->direct_tus[LANG_C], h->direct_tus[LANG_CXX]);
+		first = false;
+	}
+	fprintf(file, "\n  ]\n}\n");
+	if(fclose(file) != 0)
+		fatal_message(errno, "Failed to write %s: %s", path, strerror(errno));
+}
+
+/*
+ * Setup
+ */
+
+static void default_roots(struct header_cost* ctx)
+{
+	char exe[PATH_MAX] = "";
+	struct cross_paths paths;
+	struct cross_context cross;
+
+	// <prefix>/bin/<triple>-header-cost => <prefix>, <prefix>/<triple>/sysroot
+	if(proc_path(exe, PATH_MAX) != 0 || cross_context_init(&cross, NULL) != CROSS_OK)
+		return;
+	if(cross_paths_init(&cross, &paths, exe, UNAME_SUFFIX) == CROSS_OK) {
+		if(ctx->sysroot == NULL)
+			cross_resolve_sysroot(&cross, &paths, &ctx->sysroot);
+		ctx->toolchain = strndup(paths.prefix.value, paths.prefix.len);
+		cross_paths_reset(&cross, &paths);
+	}
+}
+
+static char* canonical_or_null(char* path)
+{
+	char resolved[PATH_MAX] = "";
+	if(path == NULL || realpath(path, resolved) == NULL) {
+		free(path);
+		return NULL;
+	}
+	free(path);
+	return strdup(resolved);
+}
+
+static char* cmake_home_directory(const char* build_dir)
+{
+	char* result = NULL;
+	char* line = NULL;
+	size_t line_size = 0;
+	ssize_t length;
+	char* cache = sprintf_alloc("%s/" CMAKE_CACHE, build_dir);
+	FILE* file = cache != NULL ? fopen(cache, "r") : NULL;
+
+	free(cache);
+	if(file == NULL)
+		return NULL;
+	while(result == NULL && (length = getline(&line, &line_size, file)) > 0) {
+		while(length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+			line[--length] = '\0';
+		if(strncmp(line, CMAKE_HOME_KEY, sizeof(CMAKE_HOME_KEY) - 1) == 0)
+			result = strdup(line + sizeof(CMAKE_HOME_KEY) - 1);
+	}
+	free(line);
+	fclose(file);
+	return result;
+}
+
+int main(int argc, char** argv)
+{
+	int opt;
+	size_t jobs = 0;
+	size_t top = DEFAULT_TOP;
+	double threshold = DEFAULT_THRESHOLD;
+	const char* input = ".";
+	const char* json_path = NULL;
+	char* commands_path;
+	char* slash;
+	struct json_value* commands = NULL;
+	struct workqueue wq;
+	struct header_list by_total, by_inclusive;
+	struct header_cost ctx;
+	int code;
+
+	memset((void*)&ctx, 0, sizeof(ctx));
+	while((opt = getopt(argc, argv, "j:n:t:o:s:P:h")) != -1) {
+		switch(opt) {
+			case 'j':
+				jobs = (size_t)strtoul(optarg, NULL, 10);
+				break;
+			case 'n':
+				top = (size_t)strtoul(optarg, NULL, 10);
+				break;
+			case 't':
+				threshold = strtod(optarg, NULL);
+				break;
+			case 'o':
+				json_path = optarg;
+				break;
+			case 's':
+				free(ctx.sysroot);
+				ctx.sysroot = strdup(optarg);
+				break;
+			case 'P':
+				ctx.project_dirs = string_array_push(ctx.project_dirs, canonical_or_null(strdup(optarg)));
+				if(ctx.project_dirs->ptr[ctx.project_dirs->len - 1] == NULL)
+					fatal_message(ENOENT, "Project directory does not exist: %s", optarg);
+				break;
+			case 'h':
+				usage(argv[0]);
+				return 0;
+			default:
+				usage(argv[0]);
+				return 2;
+		}
+	}
+	if(optind + 1 < argc) {
+		usage(argv[0]);
+		return 2;
+	}
+	if(optind < argc)
+		input = argv[optind];
+
+	// BUILD_DIR or the compile_commands.json in it.
+	if(is_folder(input)) {
+		ctx.build_dir = canonical_or_null(strdup(input));
+		commands_path = sprintf_alloc("%s/" COMPILE_COMMANDS, input);
+	} else {
+		commands_path = strdup(input);
+		ctx.build_dir = strdup(input);
+		if((slash = strrchr(ctx.build_dir, PATH_SEP_CHR)) != NULL)
+			*slash = '\0';
+		else
+			strcpy(ctx.build_dir, ".");
+		ctx.build_dir = canonical_or_null(ctx.build_dir);
+	}
+	if(commands_path == NULL || ctx.build_dir == NULL)
+		fatal_message(ENOENT, "Failed to resolve the build directory of %s", input);
+	if((code = json_parse_file(commands_path, &commands)) != 0)
+		fatal_message(-code, "Failed to read %s: %s (configure with -DCMAKE_EXPORT_COMPILE_COMMANDS=ON)",
+		              commands_path, strerror(-code));
+	if(commands->type != JSON_ARRAY || json_count(commands) == 0)
+		fatal_message(EINVAL, "No compile commands in %s", commands_path);
+
+	// Headers from the source and build trees are the project's own.
+	if(ctx.project_dirs == NULL) {
+		char* home = canonical_or_null(cmake_home_directory(ctx.build_dir));
+		if(home != NULL)
+			ctx.project_dirs = string_array_push(ctx.project_dirs, home);
+		ctx.project_dirs = string_array_push(ctx.project_dirs, strdup(ctx.build_dir));
+	}
+	default_roots(&ctx);
+	ctx.sysroot = canonical_or_null(ctx.sysroot);
+	ctx.toolchain = canonical_or_null(ctx.toolchain);
+	if(ctx.sysroot == NULL)
+		fprintf(stderr, "WARNING: Failed to resolve the sysroot; use -s to classify its headers.\n");
+
+	ctx.tus = (struct translation_unit**)calloc(json_count(commands), sizeof(struct translation_unit*));
+	if(ctx.tus == NULL || hashmap_init(&ctx.headers, 4096) != 0)
+		fatal_message(ENOMEM, "Out of memory");
+	for(size_t i = 0; i < json_count(commands); i++) {
+		struct translation_unit* tu = translation_unit_new(json_at(commands, i), ctx.tu_count);
+		if(tu == NULL || tu->argv == NULL || tu->file == NULL) {
+			fprintf(stderr, "WARNING: Skipping unusable entry %zu of %s\n", i, commands_path);
+			translation_unit_free(tu);
+			continue;
+		}
+		ctx.tus[ctx.tu_count++] = tu;
+	}
+	json_free(commands);
+	pthread_mutex_init(&ctx.lock, NULL);
+
+	if(workqueue_init(&wq, jobs, (workqueue_handler)preprocess_handler, &ctx) != 0)
+		fatal_message(1, "Failed to start worker threads");
+	for(size_t i = 0; i < ctx.tu_count; i++) {
+		if(workqueue_push(&wq, ctx.tus[i]) != 0)
+			fatal_message(ENOMEM, "Out of memory");
+	}
+	workqueue_finish(&wq);
+	if(isatty(STDERR_FILENO))
+		fprintf(stderr, "\n");
+	if(ctx.failed_count == ctx.tu_count)
+		fatal_message(1, "Every translation unit failed to preprocess");
+
+	// Each header is only read once, however many TUs parse it.
+	header_list_init(&by_total);
+	hashmap_foreach(&ctx.headers, (hashmap_iter_func)collect_header, &by_total);
+	if(workqueue_init(&wq, jobs, (workqueue_handler)measure_handler, NULL) != 0)
+		fatal_message(1, "Failed to start worker threads");
+	for(size_t i = 0; i < by_total.base.elements; i++) {
+		if(workqueue_push(&wq, ((struct header**)by_total.base.base)[i]) != 0)
+			fatal_message(ENOMEM, "Out of memory");
+	}
+	workqueue_finish(&wq);
+
+	for(size_t i = 0; i < ctx.tu_count; i++) {
+		if(!ctx.tus[i]->failed)
+			aggregate_tu(&ctx, ctx.tus[i]);
+	}
+
+	header_list_init(&by_inclusive);
+	if(header_list_extend(&by_inclusive, (const struct header**)by_total.base.base, by_total.base.elements) != 0)
+		fatal_message(ENOMEM, "Out of memory");
+	header_list_sort(&by_total, compare_total);
+	header_list_sort(&by_inclusive, compare_inclusive);
+
+	print_report(&ctx, &by_total, &by_inclusive, top, threshold);
+	if(json_path != NULL)
+		write_json(&ctx, &by_total, &by_inclusive, threshold, json_path);
+
+	header_list_reset(&by_total);
+	header_list_reset(&by_inclusive);
+	hashmap_reset(&ctx.headers, (hashmap_free_func)header_free);
+	for(size_t i = 0; i < ctx.tu_count; i++)
+		translation_unit_free(ctx.tus[i]);
+	free(ctx.tus);
+	pthread_mutex_destroy(&ctx.lock);
+	string_array_free(ctx.project_dirs);
+	free(ctx.build_dir);
+	free(ctx.sysroot);
+	free(ctx.toolchain);
+	free(commands_path);
+	return ctx.failed_count > 0 ? 1 : 0;
+}
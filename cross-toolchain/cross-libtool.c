@@ -0,0 +1,1717 @@
+/**
+ * @file cross-libtool.c
+ * @author Charles Grunwald <cgrunwald@gmail.com>
+ * @brief A native libtool for autoconf packages built with cross-configure.
+ *
+ * Usage: <triple>-libtool [OPTION]... --mode=MODE COMMAND...
+ *
+ * <triple>-configure points a package's ./libtool at this when CROSS_LIBTOOL
+ * is set, and the package's own script is kept as libtool.orig for the
+ * settings configure chose (shared/static libraries and PIC mode). The
+ * compile, link, install, execute, finish, clean and uninstall modes are
+ * implemented for our ELF target and GNU ld, writing the same .lo and .la
+ * files and .libs/ layout that GNU libtool does, so installed .la files are
+ * the usual ones and either libtool can read what the other wrote.
+ *
+ * Where the script sources ten thousand lines of shell for every call, each
+ * call here costs one exec. Sources are compiled once, as PIC, and the same
+ * object goes into the static archive: PIC code is valid in any x86_64
+ * static link and cross-configure asks for --with-pic anyway. Only packages
+ * configured with pic_mode=no get a second, non-PIC compile. The shared and
+ * static halves of a library link concurrently. Programs link straight
+ * against the build tree's libraries with -rpath-link, so there are no
+ * wrapper scripts and nothing is relinked at install time.
+ */
+#include <dirent.h>
+#include <regex.h>
+#include <sys/stat.h>
+
+#include "shared.h"
+#include "strutil.h"
+#include "strbuf.h"
+#include "strarray.h"
+#include "dynarray.h"
+#include "libcross.h"
+
+#define PATH_SEP_CHR '/'
+
+#define UNAME_SUFFIX "-libtool"
+#define CONFIG_ENV "CROSS_LIBTOOL_CONFIG"
+#define OBJDIR ".libs"
+
+// The GNU libtool release whose file formats we write.
+#define LIBTOOL_COMPAT_VERSION "2.4.6"
+
+// Where the package's libtool script stops its global settings.
+#define TAG_CONFIG_MARKER "# ### BEGIN LIBTOOL TAG CONFIG"
+
+enum libtool_mode
+{
+	MODE_NONE,
+	MODE_COMPILE,
+	MODE_LINK,
+	MODE_INSTALL,
+	MODE_EXECUTE,
+	MODE_FINISH,
+	MODE_CLEAN,
+	MODE_UNINSTALL,
+};
+
+static const char* const mode_names[] = {
+	"", "compile", "link", "install", "execute", "finish", "clean", "uninstall", NULL
+};
+
+enum pic_mode
+{
+	PIC_DEFAULT,
+	PIC_YES,
+	PIC_NO,
+};
+
+struct libtool
+{
+	enum libtool_mode mode;
+	bool quiet;
+	bool dry_run;
+	bool build_shared;
+	bool build_static;
+	enum pic_mode pic;
+	char* tool_prefix;
+	char* sysroot;
+};
+
+// What a .la file says about a library.
+struct la_file
+{
+	char* path;
+	char* dir;
+	char* name;
+	char* dlname;
+	char* library_names;
+	char* old_library;
+	char* dependency_libs;
+	char* libdir;
+	bool installed;
+};
+
+enum link_item_kind
+{
+	ITEM_FLAG,
+	ITEM_OBJECT,
+	ITEM_LIBRARY,
+};
+
+struct link_item
+{
+	enum link_item_kind kind;
+	// Flags and objects; for objects, the PIC one.
+	char* value;
+	// The non-PIC object.
+	char* static_value;
+	struct la_file* la;
+	// -L and -l flags go into the dependency_libs of the library made.
+	bool dependency;
+};
+
+DEFINE_ARRAY_TYPE(link_items, struct link_item)
+
+struct link_job
+{
+	struct libtool* lt;
+	const char* output;
+	char* output_dir;
+	char* objdir;
+	char* libname;
+	struct link_items items;
+	string_array* rpaths;
+	const char* version_info;
+	const char* version_number;
+	const char* release;
+	const char* export_symbols;
+	const char* export_regex;
+	bool avoid_version;
+	bool module;
+	bool static_only;
+	bool all_static;
+	bool shared_only;
+};
+
+static CC_NORETURN fatal_message(int code, const char* format, ...)
+{
+	va_list args;
+	fprintf(stderr, "libtool: error: ");
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+	fprintf(stderr, "\n");
+	exit(code != 0 ? code : 1);
+}
+
+static void usage(const char* exe)
+{
+	printf("Usage: %s [OPTION]... [--mode=]MODE COMMAND...\n\n", exe);
+	printf("A native replacement for an autoconf package's libtool script, for target\n");
+	printf("builds. Settings are read from the package's own script when " CONFIG_ENV "\n");
+	printf("names it.\n\n");
+	printf("  --mode=MODE   compile, link, install, execute, finish, clean or uninstall\n");
+	printf("  --tag=TAG     Accepted for compatibility; disable-shared/disable-static apply\n");
+	printf("  --silent      Don't print the commands run\n");
+	printf("  -n, --dry-run Print the commands without running them\n");
+	printf("  --config      Print the settings in use\n");
+	printf("  --features    Print the kinds of libraries built\n");
+	printf("  --version     Print the libtool version emulated\n");
+}
+
+static void* checked(void* value)
+{
+	if(value == NULL)
+		fatal_message(ENOMEM, "Out of memory");
+	return value;
+}
+
+#define xstrdup(value) ((char*)checked(strdup(value)))
+#define xsprintf(...) ((char*)checked(sprintf_alloc(__VA_ARGS__)))
+
+static bool has_suffix(const char* value, const char* suffix)
+{
+	size_t len = strlen(value), suffix_len = strlen(suffix);
+	return len >= suffix_len && strcmp(value + len - suffix_len, suffix) == 0;
+}
+
+static const char* base_name(const char* path)
+{
+	const char* slash = strrchr(path, PATH_SEP_CHR);
+	return slash != NULL ? slash + 1 : path;
+}
+
+static char* dir_name(const char* path)
+{
+	const char* slash = strrchr(path, PATH_SEP_CHR);
+	if(slash == NULL)
+		return xstrdup(".");
+	if(slash == path)
+		return xstrdup("/");
+	return (char*)checked(strndup(path, (size_t)(slash - path)));
+}
+
+// "dir/name.ext" => "dir/.libs/name<ext>" and friends.
+static char* in_objdir(const char* dir, const char* name)
+{
+	return strcmp(dir, ".") == 0 ? xsprintf(OBJDIR "/%s", name) : xsprintf("%s/" OBJDIR "/%s", dir, name);
+}
+
+static char* in_dir(const char* dir, const char* name)
+{
+	return strcmp(dir, ".") == 0 || name[0] == PATH_SEP_CHR ? xstrdup(name) : xsprintf("%s/%s", dir, name);
+}
+
+static char* absolute_path(const char* path)
+{
+	char cwd[PATH_MAX] = "";
+	if(path[0] == PATH_SEP_CHR || getcwd(cwd, PATH_MAX) == NULL)
+		return xstrdup(path);
+	return xsprintf("%s/%s", cwd, path);
+}
+
+static void args_add(string_array** args, const char* value)
+{
+	*args = (string_array*)checked(string_array_push(*args, xstrdup(value)));
+}
+
+static void args_take(string_array** args, char* value)
+{
+	*args = (string_array*)checked(string_array_push(*args, value));
+}
+
+// NULL-terminate for exec; string_array_free skips the NULL.
+static char** args_finish(string_array** args)
+{
+	*args = (string_array*)checked(string_array_push(*args, NULL));
+	return (*args)->ptr;
+}
+
+/*
+ * Commands
+ */
+
+static char* tool_path(const struct libtool* lt, const char* name)
+{
+	char* path;
+	if(lt->tool_prefix == NULL)
+		return xstrdup(name);
+	path = xsprintf("%s%s", lt->tool_prefix, name);
+	if(access(path, X_OK) != 0) {
+		free(path);
+		return xstrdup(name);
+	}
+	return path;
+}
+
+static void print_command(const struct libtool* lt, char* const* argv)
+{
+	if(lt->quiet && !lt->dry_run)
+		return;
+	printf("libtool: %s:", mode_names[lt->mode]);
+	for(size_t i = 0; argv[i] != NULL; i++) {
+		if(argv[i][0] == '\0' || strpbrk(argv[i], " \t\"'\\$`") != NULL)
+			printf(" \"%s\"", argv[i]);
+		else
+			printf(" %s", argv[i]);
+	}
+	printf("\n");
+	fflush(stdout);
+}
+
+static pid_t spawn_command(const struct libtool* lt, char* const* argv, const char* cwd, bool silence)
+{
+	pid_t pid;
+
+	print_command(lt, argv);
+	if(lt->dry_run)
+		return 0;
+	if((pid = fork()) < 0)
+		fatal_message(errno, "fork: %s", strerror(errno));
+	if(pid == 0) {
+		if(cwd != NULL && chdir(cwd) != 0)
+			_exit(127);
+		if(silence) {
+			int null_fd = open("/dev/null", O_WRONLY);
+			if(null_fd >= 0) {
+				dup2(null_fd, STDOUT_FILENO);
+				dup2(null_fd, STDERR_FILENO);
+			}
+		}
+		execvp(argv[0], argv);
+		fprintf(stderr, "libtool: error: Failed to run %s: %s\n", argv[0], strerror(errno));
+		_exit(127);
+	}
+	return pid;
+}
+
+static int wait_command(pid_t pid)
+{
+	int status;
+	if(pid == 0)
+		return 0;
+	while(waitpid(pid, &status, 0) < 0) {
+		if(errno != EINTR)
+			return 1;
+	}
+	return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+// Like libtool, give up on the first command that fails.
+static void run_tool(const struct libtool* lt, char* const* argv, const char* cwd)
+{
+	int code = wait_command(spawn_command(lt, argv, cwd, false));
+	if(code != 0)
+		exit(code);
+}
+
+static strbuf_t* capture_command(const struct libtool* lt, char* const* argv)
+{
+	int fds[2], code;
+	char buffer[4096];
+	ssize_t count;
+	pid_t pid;
+	strbuf_t* output = (strbuf_t*)checked(strbuf_alloc(4096));
+
+	print_command(lt, argv);
+	if(pipe(fds) != 0 || (pid = fork()) < 0)
+		fatal_message(errno, "Failed to run %s: %s", argv[0], strerror(errno));
+	if(pid == 0) {
+		close(fds[0]);
+		dup2(fds[1], STDOUT_FILENO);
+		close(fds[1]);
+		execvp(argv[0], argv);
+		_exit(127);
+	}
+	close(fds[1]);
+	while((count = read(fds[0], buffer, sizeof(buffer))) != 0) {
+		if(count < 0 && errno == EINTR)
+			continue;
+		if(count < 0)
+			break;
+		output = (strbuf_t*)checked(strbuf_append_with_len(output, buffer, (size_t)count));
+	}
+	close(fds[0]);
+	if((code = wait_command(pid)) != 0)
+		fatal_message(code, "%s failed", argv[0]);
+	return output;
+}
+
+/*
+ * libtool's files are shell variable assignments.
+ */
+
+static char* unquote(char* value)
+{
+	size_t len = strlen(value);
+	while(len > 0 && (value[len - 1] == '\n' || value[len - 1] == '\r'))
+		value[--len] = '\0';
+	if(len >= 2 && (value[0] == '\'' || value[0] == '"') && value[len - 1] == value[0]) {
+		value[len - 1] = '\0';
+		return value + 1;
+	}
+	return value;
+}
+
+static bool read_variables(const char* path, const char* const* names, char** values, const char* stop)
+{
+	char* line = NULL;
+	size_t line_size = 0;
+	FILE* file = fopen(path, "r");
+
+	if(file == NULL)
+		return false;
+	while(getline(&line, &line_size, file) > 0) {
+		char* equals;
+		if(stop != NULL && strncmp(line, stop, strlen(stop)) == 0)
+			break;
+		if(line[0] == '#' || (equals = strchr(line, '=')) == NULL)
+			continue;
+		*equals = '\0';
+		for(size_t i = 0; names[i] != NULL; i++) {
+			if(strcmp(line, names[i]) == 0) {
+				free(values[i]);
+				values[i] = xstrdup(unquote(equals + 1));
+			}
+		}
+	}
+	free(line);
+	fclose(file);
+	return true;
+}
+
+static bool is_yes(const char* value)
+{
+	return value != NULL && strcmp(value, "yes") == 0;
+}
+
+static void load_config(struct libtool* lt, const char* path)
+{
+	static const char* const names[] = { "build_libtool_libs", "build_old_libs", "pic_mode", NULL };
+	char* values[3] = { NULL, NULL, NULL };
+
+	if(!read_variables(path, names, values, TAG_CONFIG_MARKER))
+		fatal_message(errno, "Failed to read %s: %s", path, strerror(errno));
+	if(values[0] != NULL)
+		lt->build_shared = is_yes(values[0]);
+	if(values[1] != NULL)
+		lt->build_static = is_yes(values[1]);
+	if(values[2] != NULL)
+		lt->pic = is_yes(values[2]) ? PIC_YES : strcmp(values[2], "no") == 0 ? PIC_NO : PIC_DEFAULT;
+	for(size_t i = 0; i < 3; i++)
+		free(values[i]);
+}
+
+static void la_file_free(struct la_file* la)
+{
+	if(la != NULL) {
+		free(la->path);
+		free(la->dir);
+		free(la->name);
+		free(la->dlname);
+		free(la->library_names);
+		free(la->old_library);
+		free(la->dependency_libs);
+		free(la->libdir);
+		free(la);
+	}
+}
+
+static struct la_file* la_file_load(const struct libtool* lt, const char* path)
+{
+	static const char* const names[] = {
+		"dlname", "library_names", "old_library", "dependency_libs", "libdir", "installed", NULL
+	};
+	char* values[6] = { NULL, NULL, NULL, NULL, NULL, NULL };
+	struct la_file* la;
+	char* found = xstrdup(path);
+
+	// Installed .la files name each other by their path on the target.
+	if(access(found, R_OK) != 0 && path[0] == PATH_SEP_CHR && lt->sysroot != NULL) {
+		free(found);
+		found = xsprintf("%s%s", lt->sysroot, path);
+	}
+	if(!read_variables(found, names, values, NULL))
+		fatal_message(errno, "Failed to read %s: %s", path, strerror(errno));
+
+	la = (struct la_file*)checked(calloc(1, sizeof(struct la_file)));
+	la->path = found;
+	la->dir = dir_name(found);
+	la->name = xstrdup(base_name(found));
+	la->name[strlen(la->name) - 3] = '\0';
+	la->dlname = values[0] != NULL ? values[0] : xstrdup("");
+	la->library_names = values[1] != NULL ? values[1] : xstrdup("");
+	la->old_library = values[2] != NULL ? values[2] : xstrdup("");
+	la->dependency_libs = values[3] != NULL ? values[3] : xstrdup("");
+	la->libdir = values[4] != NULL ? values[4] : xstrdup("");
+	la->installed = is_yes(values[5]);
+	free(values[5]);
+	return la;
+}
+
+static bool la_is_convenience(const struct la_file* la)
+{
+	return !la->installed && la->libdir[0] == '\0' && la->dlname[0] == '\0';
+}
+
+// The file to hand the linker: the real shared object, or the archive.
+static char* la_library_path(const struct la_file* la, bool shared)
+{
+	if(shared && la->library_names[0] != '\0') {
+		// The first of library_names is the real file.
+		char* realname = (char*)checked(strndup(la->library_names, strcspn(la->library_names, " ")));
+		char* path = la->installed ? in_dir(la->dir, realname) : in_objdir(la->dir, realname);
+		free(realname);
+		return path;
+	}
+	if(la->old_library[0] == '\0')
+		return NULL;
+	return la->installed ? in_dir(la->dir, la->old_library) : in_objdir(la->dir, la->old_library);
+}
+
+static void write_file(const char* path, const char* content)
+{
+	char* temp = xsprintf("%s.tmp%d", path, (int)getpid());
+	FILE* file = fopen(temp, "w");
+	if(file == NULL)
+		fatal_message(errno, "Failed to create %s: %s", temp, strerror(errno));
+	fputs(content, file);
+	if(fclose(file) != 0 || rename(temp, path) != 0) {
+		unlink(temp);
+		fatal_message(errno, "Failed to write %s: %s", path, strerror(errno));
+	}
+	free(temp);
+}
+
+/*
+ * --mode=compile
+ */
+
+static bool is_source_file(const char* arg)
+{
+	static const char* const extensions[] = {
+		".c", ".cc", ".cpp", ".cxx", ".c++", ".C", ".i", ".ii", ".s", ".S", ".sx", ".m", ".mm",
+		".f", ".F", ".for", ".f90", ".F90", ".f95", ".ada", ".adb", ".go", NULL
+	};
+	const char* ext = strrchr(arg, '.');
+	if(arg[0] == '-' || ext == NULL)
+		return false;
+	for(size_t i = 0; extensions[i] != NULL; i++) {
+		if(strcmp(ext, extensions[i]) == 0)
+			return true;
+	}
+	return false;
+}
+
+// "name.c" or "name.lo" => "name<ext>".
+static char* object_name(const char* name, const char* ext)
+{
+	const char* dot = strrchr(name, '.');
+	size_t len = dot != NULL && dot > base_name(name) ? (size_t)(dot - name) : strlen(name);
+	return xsprintf("%.*s%s", (int)len, name, ext);
+}
+
+static int compile_mode(struct libtool* lt, int argc, char** argv)
+{
+	string_array* base = NULL;
+	string_array* pic_args = NULL;
+	string_array* static_args = NULL;
+	const char* output = NULL;
+	const char* source = NULL;
+	bool want_pic, want_static, separate_static;
+	bool no_suppress = false, prefer_non_pic = lt->pic == PIC_NO;
+	bool force_shared = false, force_static = false;
+	char *dir, *name, *pic_object = NULL, *static_object = NULL, *lo_content, *lo_name;
+	pid_t pic_pid = 0, static_pid = 0;
+	int code;
+
+	for(int i = 0; i < argc; i++) {
+		const char* arg = argv[i];
+		if(strcmp(arg, "-o") == 0 && i + 1 < argc) {
+			output = argv[++i];
+		} else if(strcmp(arg, "-static") == 0) {
+			force_static = true;
+		} else if(strcmp(arg, "-shared") == 0) {
+			force_shared = true;
+		} else if(strcmp(arg, "-prefer-pic") == 0) {
+			prefer_non_pic = false;
+		} else if(strcmp(arg, "-prefer-non-pic") == 0) {
+			prefer_non_pic = true;
+		} else if(strcmp(arg, "-no-suppress") == 0) {
+			no_suppress = true;
+		} else if(strcmp(arg, "-Xcompiler") == 0 && i + 1 < argc) {
+			args_add(&base, argv[++i]);
+		} else if(strncmp(arg, "-Wc,", 4) == 0) {
+			char* list = xstrdup(arg + 4);
+			char* saveptr = NULL;
+			for(char* flag = strtok_r(list, ",", &saveptr); flag != NULL; flag = strtok_r(NULL, ",", &saveptr))
+				args_add(&base, flag);
+			free(list);
+		} else {
+			if(is_source_file(arg))
+				source = arg;
+			args_add(&base, arg);
+		}
+	}
+	if(base == NULL || base->len < 2)
+		fatal_message(1, "You must specify a compilation command");
+	if(output == NULL) {
+		char* lo;
+		if(source == NULL)
+			fatal_message(1, "Cannot determine the name of the object file");
+		lo = object_name(base_name(source), ".lo");
+		output = lo;
+	}
+	if(!has_suffix(output, ".lo") && !has_suffix(output, ".o"))
+		fatal_message(1, "Cannot determine the name of the library object from '%s'", output);
+
+	dir = dir_name(output);
+	name = object_name(base_name(output), ".o");
+	lo_name = object_name(output, ".lo");
+
+	want_pic = force_shared || (!force_static && lt->build_shared);
+	want_static = force_static || (!force_shared && lt->build_static) || !want_pic;
+	// One PIC object does for both, unless the package wants non-PIC archives.
+	separate_static = want_pic && want_static && prefer_non_pic;
+
+	if(want_pic) {
+		char* objdir = in_objdir(dir, "");
+		mkdir_p(objdir, 0755);
+		free(objdir);
+		pic_object = in_objdir(dir, name);
+		pic_args = NULL;
+		for(size_t i = 0; i < base->len; i++)
+			args_add(&pic_args, base->ptr[i]);
+		args_add(&pic_args, "-fPIC");
+		args_add(&pic_args, "-DPIC");
+		args_add(&pic_args, "-o");
+		args_add(&pic_args, pic_object);
+		unlink(pic_object);
+		pic_pid = spawn_command(lt, args_finish(&pic_args), NULL, false);
+	}
+	if(want_static) {
+		static_object = in_dir(dir, name);
+		unlink(static_object);
+	}
+	if(!want_pic || separate_static) {
+		for(size_t i = 0; i < base->len; i++)
+			args_add(&static_args, base->ptr[i]);
+		if(lt->pic == PIC_YES && !prefer_non_pic) {
+			args_add(&static_args, "-fPIC");
+			args_add(&static_args, "-DPIC");
+		}
+		args_add(&static_args, "-o");
+		args_add(&static_args, static_object);
+		// The same diagnostics twice are noise, as with libtool.
+		static_pid = spawn_command(lt, args_finish(&static_args), NULL, want_pic && !no_suppress);
+	}
+
+	if((code = wait_command(pic_pid)) != 0 || (code = wait_command(static_pid)) != 0) {
+		wait_command(static_pid);
+		return code;
+	}
+	if(want_pic && want_static && !separate_static && !lt->dry_run) {
+		if(link(pic_object, static_object) != 0) {
+			char* cp_argv[] = { "cp", "-p", pic_object, static_object, NULL };
+			run_tool(lt, cp_argv, NULL);
+		}
+	}
+
+	lo_content = xsprintf("# %s - a libtool object file\n"
+	                      "# Generated by libtool (GNU libtool) " LIBTOOL_COMPAT_VERSION "\n"
+	                      "#\n"
+	                      "# Please DO NOT delete this file!\n"
+	                      "# It is necessary for linking the library.\n\n"
+	                      "# Name of the PIC object.\n"
+	                      "pic_object=%s%s%s\n\n"
+	                      "# Name of the non-PIC object\n"
+	                      "non_pic_object=%s%s%s\n",
+	                      base_name(lo_name),
+	                      want_pic ? "'" OBJDIR "/" : "", want_pic ? name : "none", want_pic ? "'" : "",
+	                      want_static ? "'" : "", want_static ? name : "none", want_static ? "'" : "");
+	if(!lt->dry_run)
+		write_file(lo_name, lo_content);
+
+	free(lo_content);
+	free(lo_name);
+	free(name);
+	free(dir);
+	free(pic_object);
+	free(static_object);
+	string_array_free(base);
+	string_array_free(pic_args);
+	string_array_free(static_args);
+	return 0;
+}
+
+/*
+ * --mode=link
+ */
+
+static void link_item_add(struct link_job* job, enum link_item_kind kind, char* value, char* static_value,
+                          struct la_file* la, bool dependency)
+{
+	struct link_item* item = (struct link_item*)checked(link_items_append(&job->items));
+	item->kind = kind;
+	item->value = value;
+	item->static_value = static_value;
+	item->la = la;
+	item->dependency = dependency;
+}
+
+static void add_lo_object(struct link_job* job, const char* path)
+{
+	static const char* const names[] = { "pic_object", "non_pic_object", NULL };
+	char* values[2] = { NULL, NULL };
+	char* dir = dir_name(path);
+	char *pic = NULL, *non_pic = NULL;
+
+	if(!read_variables(path, names, values, NULL))
+		fatal_message(errno, "Failed to read %s: %s", path, strerror(errno));
+	if(values[0] != NULL && strcmp(values[0], "none") != 0)
+		pic = in_dir(dir, values[0]);
+	if(values[1] != NULL && strcmp(values[1], "none") != 0)
+		non_pic = in_dir(dir, values[1]);
+	if(pic == NULL && non_pic == NULL)
+		fatal_message(1, "%s names no object", path);
+	link_item_add(job, ITEM_OBJECT, pic != NULL ? pic : xstrdup(non_pic), non_pic != NULL ? non_pic : xstrdup(pic),
+	              NULL, false);
+	free(values[0]);
+	free(values[1]);
+	free(dir);
+}
+
+static void parse_link_args(struct link_job* job, int argc, char** argv)
+{
+	for(int i = 0; i < argc; i++) {
+		const char* arg = argv[i];
+		const char* next = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if(i == 0) {
+			link_item_add(job, ITEM_FLAG, xstrdup(arg), NULL, NULL, false);
+		} else if(strcmp(arg, "-o") == 0 && next != NULL) {
+			job->output = argv[++i];
+		} else if(strcmp(arg, "-rpath") == 0 && next != NULL) {
+			args_add(&job->rpaths, argv[++i]);
+		} else if(strcmp(arg, "-R") == 0 && next != NULL) {
+			link_item_add(job, ITEM_FLAG, xsprintf("-Wl,-rpath,%s", argv[++i]), NULL, NULL, false);
+		} else if(strncmp(arg, "-R", 2) == 0) {
+			link_item_add(job, ITEM_FLAG, xsprintf("-Wl,-rpath,%s", arg + 2), NULL, NULL, false);
+		} else if(strcmp(arg, "-version-info") == 0 && next != NULL) {
+			job->version_info = argv[++i];
+		} else if(strcmp(arg, "-version-number") == 0 && next != NULL) {
+			job->version_number = argv[++i];
+		} else if(strcmp(arg, "-release") == 0 && next != NULL) {
+			job->release = argv[++i];
+		} else if(strcmp(arg, "-export-symbols") == 0 && next != NULL) {
+			job->export_symbols = argv[++i];
+		} else if(strcmp(arg, "-export-symbols-regex") == 0 && next != NULL) {
+			job->export_regex = argv[++i];
+		} else if(strcmp(arg, "-avoid-version") == 0) {
+			job->avoid_version = true;
+		} else if(strcmp(arg, "-module") == 0) {
+			job->module = true;
+		} else if(strcmp(arg, "-static") == 0 || strcmp(arg, "-static-libtool-libs") == 0) {
+			job->static_only = true;
+		} else if(strcmp(arg, "-all-static") == 0) {
+			job->static_only = job->all_static = true;
+		} else if(strcmp(arg, "-shared") == 0) {
+			job->shared_only = true;
+		} else if(strcmp(arg, "-export-dynamic") == 0) {
+			link_item_add(job, ITEM_FLAG, xstrdup("-Wl,--export-dynamic"), NULL, NULL, false);
+		} else if(strcmp(arg, "-Xlinker") == 0 && next != NULL) {
+			link_item_add(job, ITEM_FLAG, xstrdup(arg), NULL, NULL, false);
+			link_item_add(job, ITEM_FLAG, xstrdup(argv[++i]), NULL, NULL, false);
+		} else if((strcmp(arg, "-Xcompiler") == 0 || strcmp(arg, "-XCClinker") == 0) && next != NULL) {
+			link_item_add(job, ITEM_FLAG, xstrdup(argv[++i]), NULL, NULL, false);
+		} else if(strncmp(arg, "-Wc,", 4) == 0) {
+			char* list = xstrdup(arg + 4);
+			char* saveptr = NULL;
+			for(char* flag = strtok_r(list, ",", &saveptr); flag != NULL; flag = strtok_r(NULL, ",", &saveptr))
+				link_item_add(job, ITEM_FLAG, xstrdup(flag), NULL, NULL, false);
+			free(list);
+		} else if((strcmp(arg, "-dlopen") == 0 || strcmp(arg, "-dlpreopen") == 0 || strcmp(arg, "-weak") == 0 ||
+		           strcmp(arg, "-precious-files-regex") == 0 || strcmp(arg, "-bindir") == 0 ||
+		           strcmp(arg, "-shrext") == 0) && next != NULL) {
+			// Nothing to do for these on an ELF target without preloading.
+			if(strcmp(arg, "-dlpreopen") == 0)
+				fprintf(stderr, "libtool: warning: -dlpreopen %s is not supported and was ignored\n", next);
+			i++;
+		} else if(strcmp(arg, "-no-undefined") == 0 || strcmp(arg, "-no-install") == 0 ||
+		          strcmp(arg, "-no-fast-install") == 0 || strcmp(arg, "-no-suppress") == 0 ||
+		          strcmp(arg, "-avoid-version") == 0) {
+			continue;
+		} else if(strcmp(arg, "-objectlist") == 0 && next != NULL) {
+			char* line = NULL;
+			size_t line_size = 0;
+			FILE* file = fopen(argv[++i], "r");
+			if(file == NULL)
+				fatal_message(errno, "Failed to read %s: %s", argv[i], strerror(errno));
+			while(getline(&line, &line_size, file) > 0) {
+				char* object = unquote(line);
+				if(has_suffix(object, ".lo"))
+					add_lo_object(job, object);
+				else if(object[0] != '\0')
+					link_item_add(job, ITEM_OBJECT, xstrdup(object), xstrdup(object), NULL, false);
+			}
+			free(line);
+			fclose(file);
+		} else if(strcmp(arg, "-L") == 0 && next != NULL) {
+			link_item_add(job, ITEM_FLAG, xsprintf("-L%s", argv[++i]), NULL, NULL, true);
+		} else if(strncmp(arg, "-L", 2) == 0 || strncmp(arg, "-l", 2) == 0) {
+			link_item_add(job, ITEM_FLAG, xstrdup(arg), NULL, NULL, true);
+		} else if(arg[0] != '-' && has_suffix(arg, ".lo")) {
+			add_lo_object(job, arg);
+		} else if(arg[0] != '-' && has_suffix(arg, ".o")) {
+			link_item_add(job, ITEM_OBJECT, xstrdup(arg), xstrdup(arg), NULL, false);
+		} else if(arg[0] != '-' && has_suffix(arg, ".la")) {
+			link_item_add(job, ITEM_LIBRARY, NULL, NULL, la_file_load(job->lt, arg), false);
+		} else {
+			link_item_add(job, ITEM_FLAG, xstrdup(arg), NULL, NULL, false);
+		}
+	}
+	if(job->output == NULL)
+		fatal_message(1, "You must specify an output file");
+}
+
+/*
+ * Library dependencies, depth first. Uninstalled shared libraries are linked
+ * by path and the libraries they need in turn are only found through
+ * -rpath-link. Static ones bring their own dependency_libs along.
+ */
+struct deplib_state
+{
+	struct link_job* job;
+	string_array* visited;
+	string_array* args;
+	string_array* rpath_links;
+	string_array* rpaths;
+	bool shared;
+};
+
+static bool string_array_contains(const string_array* array, const char* value)
+{
+	for(size_t i = 0; array != NULL && i < array->len; i++) {
+		if(array->ptr[i] != NULL && strcmp(array->ptr[i], value) == 0)
+			return true;
+	}
+	return false;
+}
+
+static void add_unique(string_array** array, char* value)
+{
+	if(string_array_contains(*array, value))
+		free(value);
+	else
+		args_take(array, value);
+}
+
+// Where the dynamic linker looks anyway.
+static bool is_system_libdir(const char* dir)
+{
+	return strcmp(dir, "/lib") == 0 || strcmp(dir, "/lib64") == 0 || strcmp(dir, "/usr/lib") == 0 ||
+	       strcmp(dir, "/usr/lib64") == 0;
+}
+
+static void add_dependency_libs(struct deplib_state* state, const char* list, bool link_them);
+
+static void add_shared_dirs(struct deplib_state* state, const struct la_file* la)
+{
+	add_unique(&state->rpath_links, la->installed ? xstrdup(la->dir) : in_objdir(la->dir, ""));
+	if(la->libdir[0] != '\0' && !is_system_libdir(la->libdir))
+		add_unique(&state->rpaths, xstrdup(la->libdir));
+}
+
+static void add_la_library(struct deplib_state* state, struct la_file* la, bool whole_archive)
+{
+	bool shared = state->shared && la->dlname[0] != '\0';
+	char* path;
+
+	if(string_array_contains(state->visited, la->path))
+		return;
+	args_add(&state->visited, la->path);
+
+	if(!shared) {
+		if((path = la_library_path(la, false)) == NULL)
+			fatal_message(1, "%s has no static library to link", la->path);
+		if(whole_archive)
+			args_add(&state->args, "-Wl,--whole-archive");
+		args_take(&state->args, path);
+		if(whole_archive)
+			args_add(&state->args, "-Wl,--no-whole-archive");
+		add_dependency_libs(state, la->dependency_libs, true);
+		return;
+	}
+	if(la->installed) {
+		args_take(&state->args, xsprintf("-L%s", la->dir));
+		args_take(&state->args, xsprintf("-l%s", strncmp(la->name, "lib", 3) == 0 ? la->name + 3 : la->name));
+	} else {
+		args_take(&state->args, la_library_path(la, true));
+	}
+	add_shared_dirs(state, la);
+	add_dependency_libs(state, la->dependency_libs, false);
+}
+
+// A shared library's own dependencies are its business; the linker only has to find them.
+static void add_indirect_library(struct deplib_state* state, const struct la_file* la)
+{
+	if(string_array_contains(state->visited, la->path))
+		return;
+	args_add(&state->visited, la->path);
+	if(la->dlname[0] != '\0')
+		add_shared_dirs(state, la);
+	add_dependency_libs(state, la->dependency_libs, false);
+}
+
+static void add_dependency_libs(struct deplib_state* state, const char* list, bool link_them)
+{
+	char* copy = xstrdup(list);
+	char* saveptr = NULL;
+
+	for(char* dep = strtok_r(copy, " \t", &saveptr); dep != NULL; dep = strtok_r(NULL, " \t", &saveptr)) {
+		if(has_suffix(dep, ".la")) {
+			struct la_file* la = la_file_load(state->job->lt, dep);
+			if(link_them)
+				add_la_library(state, la, false);
+			else
+				add_indirect_library(state, la);
+			la_file_free(la);
+		} else if(link_them) {
+			args_add(&state->args, dep);
+		}
+	}
+	free(copy);
+}
+
+// The compiler command line for a program or shared library.
+static string_array* link_command(struct link_job* job, bool shared_library)
+{
+	struct deplib_state state;
+	struct link_item* item;
+	bool shared_deps = !job->static_only || shared_library;
+
+	memset(&state, 0, sizeof(state));
+	state.job = job;
+	state.shared = shared_deps;
+
+	ARRAY_FOREACH(&job->items, item) {
+		switch(item->kind) {
+			case ITEM_FLAG:
+				args_add(&state.args, item->value);
+				if(state.args->len == 1) {
+					if(shared_library) {
+						args_add(&state.args, "-shared");
+						args_add(&state.args, "-fPIC");
+					} else if(job->all_static) {
+						args_add(&state.args, "-static");
+					}
+				}
+				break;
+			case ITEM_OBJECT:
+				args_add(&state.args, shared_library ? item->value : item->static_value);
+				break;
+			case ITEM_LIBRARY:
+				add_la_library(&state, item->la, shared_library && la_is_convenience(item->la));
+				break;
+		}
+	}
+	for(size_t i = 0; state.rpath_links != NULL && i < state.rpath_links->len; i++)
+		args_take(&state.args, xsprintf("-Wl,-rpath-link,%s", state.rpath_links->ptr[i]));
+	// Programs find their libraries where they will be installed, as libtool
+	// arranges when it relinks them; there's no running them from here anyway.
+	if(!shared_library) {
+		for(size_t i = 0; job->rpaths != NULL && i < job->rpaths->len; i++)
+			add_unique(&state.rpaths, xstrdup(job->rpaths->ptr[i]));
+		for(size_t i = 0; state.rpaths != NULL && i < state.rpaths->len; i++)
+			args_take(&state.args, xsprintf("-Wl,-rpath,%s", state.rpaths->ptr[i]));
+	}
+	string_array_free(state.visited);
+	string_array_free(state.rpath_links);
+	string_array_free(state.rpaths);
+	return state.args;
+}
+
+static int compare_strings(const void* left, const void* right)
+{
+	return strcmp(*(const char* const*)left, *(const char* const*)right);
+}
+
+// Pull the members out of convenience archives that go into an archive.
+static void extract_convenience(struct link_job* job, const struct la_file* la, string_array** objects)
+{
+	char* archive = la_library_path(la, false);
+	char* archive_abs;
+	char* dir;
+	DIR* handle;
+	struct dirent* entry;
+	string_array* members = NULL;
+	char* ar = tool_path(job->lt, "ar");
+	char* ar_argv[4];
+
+	if(archive == NULL)
+		fatal_message(1, "%s has no archive", la->path);
+	archive_abs = absolute_path(archive);
+	dir = xsprintf("%s/%s.lax/%s", job->objdir, job->libname, la->name);
+
+	// A fresh directory, so members of an older build don't linger.
+	if((handle = opendir(dir)) != NULL) {
+		while((entry = readdir(handle)) != NULL) {
+			char* path;
+			if(entry->d_name[0] == '.' && (entry->d_name[1] == '\0' || strcmp(entry->d_name, "..") == 0))
+				continue;
+			path = xsprintf("%s/%s", dir, entry->d_name);
+			unlink(path);
+			free(path);
+		}
+		closedir(handle);
+	}
+	if(mkdir_p(dir, 0755) != 0)
+		fatal_message(errno, "Failed to create %s: %s", dir, strerror(errno));
+
+	ar_argv[0] = ar;
+	ar_argv[1] = "x";
+	ar_argv[2] = archive_abs;
+	ar_argv[3] = NULL;
+	run_tool(job->lt, ar_argv, dir);
+
+	if((handle = opendir(dir)) != NULL) {
+		while((entry = readdir(handle)) != NULL) {
+			if(entry->d_name[0] != '.')
+				args_take(&members, xsprintf("%s/%s", dir, entry->d_name));
+		}
+		closedir(handle);
+	}
+	// readdir's order isn't stable; archives should be.
+	if(members != NULL) {
+		qsort(members->ptr, members->len, sizeof(char*), compare_strings);
+		for(size_t i = 0; i < members->len; i++)
+			args_add(objects, members->ptr[i]);
+	}
+	string_array_free(members);
+	free(ar);
+	free(dir);
+	free(archive);
+	free(archive_abs);
+}
+
+static pid_t spawn_archive(struct link_job* job, const char* archive, bool pic)
+{
+	string_array* args = NULL;
+	struct link_item* item;
+	pid_t pid;
+
+	// Deterministic, with the symbol index written by ar itself.
+	args_take(&args, tool_path(job->lt, "ar"));
+	args_add(&args, "crsD");
+	args_add(&args, archive);
+	ARRAY_FOREACH(&job->items, item) {
+		if(item->kind == ITEM_OBJECT)
+			args_add(&args, pic ? item->value : item->static_value);
+		else if(item->kind == ITEM_LIBRARY && la_is_convenience(item->la))
+			extract_convenience(job, item->la, &args);
+	}
+	unlink(archive);
+	pid = spawn_command(job->lt, args_finish(&args), NULL, false);
+	string_array_free(args);
+	return pid;
+}
+
+static unsigned long parse_version_part(const char* value, const char* what)
+{
+	char* end;
+	unsigned long result;
+	if(value == NULL || *value == '\0')
+		return 0;
+	result = strtoul(value, &end, 10);
+	if(*end != '\0' || !isdigit((unsigned char)*value))
+		fatal_message(1, "%s '%s' must be a nonnegative integer", what, value);
+	return result;
+}
+
+struct library_names
+{
+	char* realname;
+	char* soname;
+	char* linkname;
+	char* names;
+	unsigned long current;
+	unsigned long revision;
+	unsigned long age;
+};
+
+static void library_names(struct link_job* job, struct library_names* names)
+{
+	char* base = job->release != NULL ? xsprintf("%s-%s", job->libname, job->release) : xstrdup(job->libname);
+	char* parts[3] = { NULL, NULL, NULL };
+	char* spec = NULL;
+	char* saveptr = NULL;
+	unsigned long major;
+
+	memset(names, 0, sizeof(*names));
+	if(job->version_info != NULL || job->version_number != NULL) {
+		size_t count = 0;
+		spec = xstrdup(job->version_info != NULL ? job->version_info : job->version_number);
+		for(char* part = strtok_r(spec, ":", &saveptr); part != NULL && count < 3; part = strtok_r(NULL, ":", &saveptr))
+			parts[count++] = part;
+	}
+	if(job->version_number != NULL && job->version_info == NULL) {
+		// MAJOR:MINOR:REVISION, as libtool maps it for Linux.
+		unsigned long number_major = parse_version_part(parts[0], "MAJOR");
+		names->age = parse_version_part(parts[1], "MINOR");
+		names->revision = parse_version_part(parts[2], "REVISION");
+		names->current = number_major + names->age;
+	} else {
+		names->current = parse_version_part(parts[0], "CURRENT");
+		names->revision = parse_version_part(parts[1], "REVISION");
+		names->age = parse_version_part(parts[2], "AGE");
+		if(names->age > names->current)
+			fatal_message(1, "AGE '%lu' is greater than the current interface number '%lu'", names->age, names->current);
+	}
+	major = names->current - names->age;
+
+	names->linkname = xsprintf("%s.so", base);
+	if(job->avoid_version) {
+		names->realname = xstrdup(names->linkname);
+		names->soname = xstrdup(names->linkname);
+		names->names = xstrdup(names->linkname);
+	} else {
+		names->realname = xsprintf("%s.so.%lu.%lu.%lu", base, major, names->age, names->revision);
+		names->soname = xsprintf("%s.so.%lu", base, major);
+		names->names = xsprintf("%s %s %s", names->realname, names->soname, names->linkname);
+	}
+	free(spec);
+	free(base);
+}
+
+static void library_names_reset(struct library_names* names)
+{
+	free(names->realname);
+	free(names->soname);
+	free(names->linkname);
+	free(names->names);
+}
+
+static void replace_symlink(const char* target, const char* path)
+{
+	if(unlink(path) != 0 && errno != ENOENT)
+		fatal_message(errno, "Failed to remove %s: %s", path, strerror(errno));
+	if(symlink(target, path) != 0)
+		fatal_message(errno, "Failed to link %s to %s: %s", path, target, strerror(errno));
+}
+
+// A version script exporting the -export-symbols list, or what matches the regex.
+static char* version_script(struct link_job* job)
+{
+	strbuf_t* script = (strbuf_t*)checked(strbuf_new("{ global:\n"));
+	char* path = xsprintf("%s/%s.ver", job->objdir, job->libname);
+	char* line = NULL;
+	size_t line_size = 0;
+
+	if(job->export_symbols != NULL) {
+		FILE* file = fopen(job->export_symbols, "r");
+		if(file == NULL)
+			fatal_message(errno, "Failed to read %s: %s", job->export_symbols, strerror(errno));
+		while(getline(&line, &line_size, file) > 0) {
+			char* symbol = unquote(line);
+			if(symbol[0] != '\0' && symbol[0] != '#') {
+				script = (strbuf_t*)checked(strbuf_append(script, symbol));
+				script = (strbuf_t*)checked(strbuf_append(script, ";\n"));
+			}
+		}
+		fclose(file);
+	} else {
+		regex_t regex;
+		string_array* args = NULL;
+		struct link_item* item;
+		strbuf_t* output;
+		char* saveptr = NULL;
+
+		if(regcomp(&regex, job->export_regex, REG_EXTENDED | REG_NOSUB) != 0)
+			fatal_message(EINVAL, "Invalid -export-symbols-regex: %s", job->export_regex);
+		args_take(&args, tool_path(job->lt, "nm"));
+		args_add(&args, "-B");
+		args_add(&args, "-g");
+		args_add(&args, "--defined-only");
+		ARRAY_FOREACH(&job->items, item) {
+			if(item->kind == ITEM_OBJECT)
+				args_add(&args, item->value);
+		}
+		output = capture_command(job->lt, args_finish(&args));
+		for(char* entry = strtok_r(output->ptr, "\n", &saveptr); entry != NULL; entry = strtok_r(NULL, "\n", &saveptr)) {
+			// "ADDRESS TYPE NAME"; the object headers have no type.
+			char* symbol = strrchr(entry, ' ');
+			if(symbol == NULL || symbol - entry < 2 || symbol[-2] != ' ' || regexec(&regex, symbol + 1, 0, NULL, 0) != 0)
+				continue;
+			script = (strbuf_t*)checked(strbuf_append(script, symbol + 1));
+			script = (strbuf_t*)checked(strbuf_append(script, ";\n"));
+		}
+		regfree(&regex);
+		strbuf_free(output);
+		string_array_free(args);
+	}
+	script = (strbuf_t*)checked(strbuf_append(script, "local: *; };\n"));
+	if(!job->lt->dry_run)
+		write_file(path, script->ptr);
+	strbuf_free(script);
+	free(line);
+	return path;
+}
+
+// dependency_libs for the .la: -L/-l as given, .la files by path.
+static char* dependency_libs(struct link_job* job, bool installed)
+{
+	strbuf_t* deps = (strbuf_t*)checked(strbuf_alloc(256));
+	struct link_item* item;
+	char* result;
+
+	ARRAY_FOREACH(&job->items, item) {
+		char* value = NULL;
+		if(item->kind == ITEM_FLAG && item->dependency) {
+			if(strncmp(item->value, "-L", 2) == 0 && item->value[2] != PATH_SEP_CHR && item->value[2] != '=') {
+				char* dir = absolute_path(item->value + 2);
+				value = xsprintf("-L%s", dir);
+				free(dir);
+			} else
+				value = xstrdup(item->value);
+		} else if(item->kind == ITEM_LIBRARY && la_is_convenience(item->la)) {
+			// Its objects are ours now, and so are its dependencies.
+			if(item->la->dependency_libs[0] != '\0')
+				value = xstrdup(item->la->dependency_libs);
+		} else if(item->kind == ITEM_LIBRARY) {
+			if(installed && !item->la->installed)
+				value = xsprintf("%s/%s.la", item->la->libdir, item->la->name);
+			else
+				value = absolute_path(item->la->path);
+		}
+		if(value != NULL) {
+			deps = (strbuf_t*)checked(strbuf_append(deps, " "));
+			deps = (strbuf_t*)checked(strbuf_append(deps, value));
+			free(value);
+		}
+	}
+	result = xstrdup(deps->ptr);
+	strbuf_free(deps);
+	return result;
+}
+
+static void write_la(struct link_job* job, const char* path, const struct library_names* names, bool has_shared,
+                     bool has_static, bool installed)
+{
+	const char* libdir = job->rpaths != NULL ? job->rpaths->ptr[0] : "";
+	char* deps = dependency_libs(job, installed);
+	char* content = xsprintf(
+		"# %s.la - a libtool library file\n"
+		"# Generated by libtool (GNU libtool) " LIBTOOL_COMPAT_VERSION "\n"
+		"#\n"
+		"# Please DO NOT delete this file!\n"
+		"# It is necessary for linking the library.\n\n"
+		"# The name that we can dlopen(3).\n"
+		"dlname='%s'\n\n"
+		"# Names of this library.\n"
+		"library_names='%s'\n\n"
+		"# The name of the static archive.\n"
+		"old_library='%s%s'\n\n"
+		"# Linker flags that cannot go in dependency_libs.\n"
+		"inherited_linker_flags=''\n\n"
+		"# Libraries that this one depends upon.\n"
+		"dependency_libs='%s'\n\n"
+		"# Names of additional weak libraries provided by this library\n"
+		"weak_library_names=''\n\n"
+		"# Version information for %s.\n"
+		"current=%lu\n"
+		"age=%lu\n"
+		"revision=%lu\n\n"
+		"# Is this an already installed library?\n"
+		"installed=%s\n\n"
+		"# Should we warn about portability when linking against -modules?\n"
+		"shouldnotlink=%s\n\n"
+		"# Files to dlopen/dlpreopen\n"
+		"dlopen=''\n"
+		"dlpreopen=''\n\n"
+		"# Directory that this library needs to be installed in:\n"
+		"libdir='%s'\n",
+		job->libname,
+		has_shared ? names->soname : "", has_shared ? names->names : "",
+		has_static ? job->libname : "", has_static ? ".a" : "",
+		deps, job->libname, names->current, names->age, names->revision,
+		installed ? "yes" : "no", job->module ? "yes" : "no", libdir);
+	if(!job->lt->dry_run)
+		write_file(path, content);
+	free(content);
+	free(deps);
+}
+
+static int link_library(struct link_job* job)
+{
+	struct library_names names;
+	bool convenience = job->rpaths == NULL;
+	bool has_shared = !convenience && job->lt->build_shared && !job->static_only;
+	bool has_static = convenience || ((job->lt->build_static || !has_shared) && !job->shared_only);
+	char* archive = NULL;
+	char* la_path;
+	pid_t shared_pid = 0, static_pid = 0;
+	int code;
+
+	if(!job->module && strncmp(job->libname, "lib", 3) != 0)
+		fatal_message(1, "libtool library '%s' must begin with 'lib'", job->output);
+	if(mkdir_p(job->objdir, 0755) != 0)
+		fatal_message(errno, "Failed to create %s: %s", job->objdir, strerror(errno));
+	library_names(job, &names);
+
+	// Both halves at once; they only share their inputs.
+	if(has_static) {
+		archive = xsprintf("%s/%s.a", job->objdir, job->libname);
+		// Convenience archives end up in shared libraries, so use PIC objects.
+		static_pid = spawn_archive(job, archive, convenience);
+	}
+	if(has_shared) {
+		string_array* args = link_command(job, true);
+		char* realpath_out = xsprintf("%s/%s", job->objdir, names.realname);
+		char* script = NULL;
+		args_take(&args, xsprintf("-Wl,-soname,%s", names.soname));
+		if(job->export_symbols != NULL || job->export_regex != NULL) {
+			script = version_script(job);
+			args_take(&args, xsprintf("-Wl,--version-script,%s", script));
+		}
+		args_add(&args, "-o");
+		args_add(&args, realpath_out);
+		shared_pid = spawn_command(job->lt, args_finish(&args), NULL, false);
+		string_array_free(args);
+		free(realpath_out);
+		free(script);
+	}
+	code = wait_command(static_pid);
+	if(wait_command(shared_pid) != 0 || code != 0)
+		return code != 0 ? code : 1;
+
+	if(has_shared && !job->lt->dry_run && !job->avoid_version) {
+		char* path = xsprintf("%s/%s", job->objdir, names.soname);
+		replace_symlink(names.realname, path);
+		free(path);
+		path = xsprintf("%s/%s", job->objdir, names.linkname);
+		replace_symlink(names.realname, path);
+		free(path);
+	}
+
+	// The build tree's .la, the one to install, and .libs/ pointing back.
+	write_la(job, job->output, &names, has_shared, has_static, false);
+	if(!convenience) {
+		la_path = xsprintf("%s/%s.lai", job->objdir, job->libname);
+		write_la(job, la_path, &names, has_shared, has_static, true);
+		free(la_path);
+	}
+	if(!job->lt->dry_run) {
+		char* target = xsprintf("../%s.la", job->libname);
+		la_path = xsprintf("%s/%s.la", job->objdir, job->libname);
+		replace_symlink(target, la_path);
+		free(target);
+		free(la_path);
+	}
+
+	library_names_reset(&names);
+	free(archive);
+	return 0;
+}
+
+static int link_mode(struct libtool* lt, int argc, char** argv)
+{
+	struct link_job job;
+	struct link_item* item;
+	const char* base;
+	int code = 0;
+
+	memset(&job, 0, sizeof(job));
+	job.lt = lt;
+	link_items_init(&job.items);
+	if(argc < 1)
+		fatal_message(1, "You must specify a link command");
+	parse_link_args(&job, argc, argv);
+
+	job.output_dir = dir_name(job.output);
+	job.objdir = in_objdir(job.output_dir, "");
+	job.objdir[strlen(job.objdir) - 1] = '\0';
+	base = base_name(job.output);
+
+	if(has_suffix(job.output, ".la")) {
+		job.libname = (char*)checked(strndup(base, strlen(base) - 3));
+		code = link_library(&job);
+	} else if(has_suffix(job.output, ".a")) {
+		job.libname = (char*)checked(strndup(base, strlen(base) - 2));
+		if(mkdir_p(job.objdir, 0755) != 0)
+			fatal_message(errno, "Failed to create %s: %s", job.objdir, strerror(errno));
+		code = wait_command(spawn_archive(&job, job.output, false));
+	} else if(has_suffix(job.output, ".lo") || has_suffix(job.output, ".o")) {
+		fatal_message(1, "Linking objects into '%s' is not supported", job.output);
+	} else {
+		string_array* args = link_command(&job, false);
+		args_add(&args, "-o");
+		args_add(&args, job.output);
+		run_tool(lt, args_finish(&args), NULL);
+		string_array_free(args);
+	}
+
+	ARRAY_FOREACH(&job.items, item) {
+		free(item->value);
+		free(item->static_value);
+		la_file_free(item->la);
+	}
+	link_items_reset(&job.items);
+	string_array_free(job.rpaths);
+	free(job.output_dir);
+	free(job.objdir);
+	free(job.libname);
+	return code;
+}
+
+/*
+ * --mode=install
+ */
+
+static bool is_shell(const char* path)
+{
+	const char* name = base_name(path);
+	return strcmp(name, "sh") == 0 || strcmp(name, "bash") == 0 || strcmp(name, "dash") == 0;
+}
+
+static void install_file(struct libtool* lt, string_array* install, const char* source, const char* dest)
+{
+	string_array* args = NULL;
+	for(size_t i = 0; i < install->len; i++)
+		args_add(&args, install->ptr[i]);
+	args_add(&args, source);
+	args_add(&args, dest);
+	run_tool(lt, args_finish(&args), NULL);
+	string_array_free(args);
+}
+
+static void install_la(struct libtool* lt, string_array* install, const char* path, const char* dest_dir)
+{
+	struct la_file* la = la_file_load(lt, path);
+	char* source;
+	char* dest;
+	char* lai;
+
+	if(la_is_convenience(la)) {
+		fprintf(stderr, "libtool: warning: not installing convenience library %s\n", path);
+		la_file_free(la);
+		return;
+	}
+	if(la->library_names[0] != '\0') {
+		char* names = xstrdup(la->library_names);
+		char* saveptr = NULL;
+		char* realname = strtok_r(names, " ", &saveptr);
+
+		source = in_objdir(la->dir, realname);
+		dest = xsprintf("%s/%s", dest_dir, realname);
+		install_file(lt, install, source, dest);
+		free(source);
+		free(dest);
+		for(char* name = strtok_r(NULL, " ", &saveptr); name != NULL; name = strtok_r(NULL, " ", &saveptr)) {
+			if(strcmp(name, realname) == 0)
+				continue;
+			dest = xsprintf("%s/%s", dest_dir, name);
+			print_command(lt, (char* []){ "ln", "-sf", realname, dest, NULL });
+			if(!lt->dry_run)
+				replace_symlink(realname, dest);
+			free(dest);
+		}
+		free(names);
+	}
+
+	lai = xsprintf("%s.lai", la->name);
+	source = in_objdir(la->dir, lai);
+	free(lai);
+	dest = xsprintf("%s/%s.la", dest_dir, la->name);
+	install_file(lt, install, source, dest);
+	free(source);
+	free(dest);
+
+	if(la->old_library[0] != '\0') {
+		source = in_objdir(la->dir, la->old_library);
+		dest = xsprintf("%s/%s", dest_dir, la->old_library);
+		install_file(lt, install, source, dest);
+		free(source);
+		free(dest);
+	}
+	la_file_free(la);
+}
+
+static int install_mode(struct libtool* lt, int argc, char** argv)
+{
+	string_array* install = NULL;
+	string_array* files = NULL;
+	const char* target_dir = NULL;
+	const char* dest;
+	bool dest_is_dir;
+	int i = 0;
+
+	if(argc < 1)
+		fatal_message(1, "You must specify an install program");
+	// "$(SHELL) install-sh -c" as well as "/usr/bin/install -c".
+	args_add(&install, argv[i++]);
+	if(is_shell(install->ptr[0]) && i < argc)
+		args_add(&install, argv[i++]);
+
+	for(; i < argc; i++) {
+		const char* arg = argv[i];
+		if(strcmp(arg, "-d") == 0) {
+			// Directories only; nothing for us to do but run it.
+			string_array* args = NULL;
+			for(int j = 0; j < argc; j++)
+				args_add(&args, argv[j]);
+			run_tool(lt, args_finish(&args), NULL);
+			string_array_free(args);
+			string_array_free(install);
+			return 0;
+		} else if(strcmp(arg, "-t") == 0 && i + 1 < argc) {
+			target_dir = argv[++i];
+		} else if((strcmp(arg, "-m") == 0 || strcmp(arg, "-o") == 0 || strcmp(arg, "-g") == 0 ||
+		           strcmp(arg, "-S") == 0) && i + 1 < argc) {
+			args_add(&install, arg);
+			args_add(&install, argv[++i]);
+		} else if(arg[0] == '-' && files == NULL) {
+			args_add(&install, arg);
+		} else {
+			args_add(&files, arg);
+		}
+	}
+	if(files == NULL || (target_dir == NULL && files->len < 2))
+		fatal_message(1, "You must specify a destination");
+	dest = target_dir != NULL ? target_dir : files->ptr[--files->len];
+	dest_is_dir = target_dir != NULL || files->len > 1 || is_folder(dest);
+
+	for(size_t f = 0; f < files->len; f++) {
+		const char* file = files->ptr[f];
+		char* dest_dir = dest_is_dir ? xstrdup(dest) : dir_name(dest);
+		if(has_suffix(file, ".la")) {
+			install_la(lt, install, file, dest_dir);
+		} else {
+			char* dest_path = dest_is_dir ? xsprintf("%s/%s", dest, base_name(file)) : xstrdup(dest);
+			install_file(lt, install, file, dest_path);
+			free(dest_path);
+		}
+		free(dest_dir);
+	}
+	if(target_dir == NULL)
+		free((char*)dest);
+	string_array_free(files);
+	string_array_free(install);
+	return 0;
+}
+
+/*
+ * --mode=clean and --mode=uninstall: the files given plus what they stand for.
+ */
+
+static void add_existing(string_array** list, char* path)
+{
+	struct stat st;
+	if(lstat(path, &st) == 0 && !string_array_contains(*list, path))
+		args_take(list, path);
+	else
+		free(path);
+}
+
+static int remove_mode(struct libtool* lt, int argc, char** argv)
+{
+	string_array* args = NULL;
+	string_array* extra = NULL;
+	int i = 0;
+
+	if(argc < 1)
+		fatal_message(1, "You must specify an RM program");
+	for(; i < argc && (i == 0 || argv[i][0] == '-'); i++)
+		args_add(&args, argv[i]);
+
+	for(; i < argc; i++) {
+		const char* file = argv[i];
+		char* dir = dir_name(file);
+		args_add(&args, file);
+
+		if(has_suffix(file, ".lo") && access(file, R_OK) == 0) {
+			static const char* const names[] = { "pic_object", "non_pic_object", NULL };
+			char* values[2] = { NULL, NULL };
+			read_variables(file, names, values, NULL);
+			for(size_t v = 0; v < 2; v++) {
+				if(values[v] != NULL && strcmp(values[v], "none") != 0)
+					add_existing(&extra, in_dir(dir, values[v]));
+				free(values[v]);
+			}
+		} else if(has_suffix(file, ".la") && access(file, R_OK) == 0) {
+			struct la_file* la = la_file_load(lt, file);
+			char* names = xsprintf("%s %s", la->library_names, la->old_library);
+			char* saveptr = NULL;
+			for(char* name = strtok_r(names, " ", &saveptr); name != NULL; name = strtok_r(NULL, " ", &saveptr))
+				add_existing(&extra, lt->mode == MODE_UNINSTALL ? in_dir(dir, name) : in_objdir(dir, name));
+			if(lt->mode == MODE_CLEAN) {
+				char* name = xsprintf("%s.la", la->name);
+				add_existing(&extra, in_objdir(dir, name));
+				free(name);
+				name = xsprintf("%s.lai", la->name);
+				add_existing(&extra, in_objdir(dir, name));
+				free(name);
+				name = xsprintf("%s.ver", la->name);
+				add_existing(&extra, in_objdir(dir, name));
+				free(name);
+			}
+			free(names);
+			la_file_free(la);
+		} else if(lt->mode == MODE_CLEAN && !has_suffix(file, ".o")) {
+			char* name = xsprintf("lt-%s", base_name(file));
+			add_existing(&extra, in_objdir(dir, base_name(file)));
+			add_existing(&extra, in_objdir(dir, name));
+			free(name);
+		}
+		free(dir);
+	}
+	for(size_t e = 0; extra != NULL && e < extra->len; e++)
+		args_add(&args, extra->ptr[e]);
+	run_tool(lt, args_finish(&args), NULL);
+	string_array_free(extra);
+	string_array_free(args);
+	return 0;
+}
+
+/*
+ * Setup
+ */
+
+static enum libtool_mode parse_mode(const char* name)
+{
+	for(int i = MODE_COMPILE; mode_names[i] != NULL; i++) {
+		if(strcmp(name, mode_names[i]) == 0)
+			return (enum libtool_mode)i;
+	}
+	// Abbreviations libtool accepts.
+	if(strcmp(name, "cc") == 0 || strcmp(name, "c") == 0)
+		return MODE_COMPILE;
+	if(strcmp(name, "l") == 0)
+		return MODE_LINK;
+	if(strcmp(name, "i") == 0)
+		return MODE_INSTALL;
+	if(strcmp(name, "e") == 0)
+		return MODE_EXECUTE;
+	return MODE_NONE;
+}
+
+static void set_tool_paths(struct libtool* lt)
+{
+	char exe[PATH_MAX] = "";
+	struct cross_paths paths;
+	struct cross_context ctx;
+
+	// <prefix>/bin/<triple>-libtool => <prefix>/bin/<triple>-ar and friends.
+	if(proc_path(exe, PATH_MAX) != 0 || cross_context_init(&ctx, NULL) != CROSS_OK)
+		return;
+	if(cross_paths_init(&ctx, &paths, exe, UNAME_SUFFIX) == CROSS_OK) {
+		lt->tool_prefix = xsprintf("%s/%s-", paths.bindir.value, paths.uname.value);
+		cross_resolve_sysroot(&ctx, &paths, &lt->sysroot);
+		cross_paths_reset(&ctx, &paths);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	struct libtool lt;
+	const char* config = getenv(CONFIG_ENV);
+	bool show_config = false, show_features = false;
+	int i;
+
+	memset(&lt, 0, sizeof(lt));
+	lt.build_shared = lt.build_static = true;
+	lt.pic = PIC_DEFAULT;
+	if(config != NULL && config[0] != '\0')
+		load_config(&lt, config);
+	set_tool_paths(&lt);
+
+	for(i = 1; i < argc && lt.mode == MODE_NONE; i++) {
+		const char* arg = argv[i];
+		if(strncmp(arg, "--mode=", 7) == 0) {
+			if((lt.mode = parse_mode(arg + 7)) == MODE_NONE)
+				fatal_message(1, "Invalid operation mode '%s'", arg + 7);
+		} else if(strcmp(arg, "--mode") == 0 && i + 1 < argc) {
+			if((lt.mode = parse_mode(argv[++i])) == MODE_NONE)
+				fatal_message(1, "Invalid operation mode '%s'", argv[i]);
+		} else if(strcmp(arg, "--finish") == 0) {
+			lt.mode = MODE_FINISH;
+		} else if(strncmp(arg, "--tag=", 6) == 0 || (strcmp(arg, "--tag") == 0 && i + 1 < argc)) {
+			const char* tag = arg[5] == '=' ? arg + 6 : argv[++i];
+			if(strcmp(tag, "disable-shared") == 0)
+				lt.build_shared = false;
+			else if(strcmp(tag, "disable-static") == 0)
+				lt.build_static = false;
+		} else if(strcmp(arg, "--silent") == 0 || strcmp(arg, "--quiet") == 0) {
+			lt.quiet = true;
+		} else if(strcmp(arg, "--no-silent") == 0 || strcmp(arg, "--no-quiet") == 0 || strcmp(arg, "--verbose") == 0 ||
+		          strcmp(arg, "-v") == 0) {
+			lt.quiet = false;
+		} else if(strcmp(arg, "-n") == 0 || strcmp(arg, "--dry-run") == 0) {
+			lt.dry_run = true;
+		} else if(strcmp(arg, "--config") == 0) {
+			show_config = true;
+		} else if(strcmp(arg, "--features") == 0) {
+			show_features = true;
+		} else if(strcmp(arg, "--version") == 0) {
+			printf("%s (GNU libtool) " LIBTOOL_COMPAT_VERSION "\n", base_name(argv[0]));
+			return 0;
+		} else if(strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+			usage(argv[0]);
+			return 0;
+		} else if(strcmp(arg, "--debug") == 0 || strcmp(arg, "--no-debug") == 0 ||
+		          strcmp(arg, "--preserve-dup-deps") == 0 || strncmp(arg, "--no-warn", 9) == 0 ||
+		          strncmp(arg, "--warnings=", 11) == 0) {
+			continue;
+		} else if(arg[0] != '-' && (lt.mode = parse_mode(arg)) != MODE_NONE) {
+			continue;
+		} else {
+			break;
+		}
+	}
+
+	if(show_config) {
+		printf("objdir=" OBJDIR "\n");
+		printf("build_libtool_libs=%s\n", lt.build_shared ? "yes" : "no");
+		printf("build_old_libs=%s\n", lt.build_static ? "yes" : "no");
+		printf("pic_mode=%s\n", lt.pic == PIC_YES ? "yes" : lt.pic == PIC_NO ? "no" : "default");
+		printf("shlibpath_var=LD_LIBRARY_PATH\n");
+		return 0;
+	}
+	if(show_features) {
+		printf("%s shared libraries\n", lt.build_shared ? "enable" : "disable");
+		printf("%s static libraries\n", lt.build_static ? "enable" : "disable");
+		return 0;
+	}
+
+	switch(lt.mode) {
+		case MODE_COMPILE:
+			return compile_mode(&lt, argc - i, argv + i);
+		case MODE_LINK:
+			return link_mode(&lt, argc - i, argv + i);
+		case MODE_INSTALL:
+			return install_mode(&lt, argc - i, argv + i);
+		case MODE_CLEAN:
+		case MODE_UNINSTALL:
+			return remove_mode(&lt, argc - i, argv + i);
+		case MODE_FINISH:
+			// No ldconfig for a sysroot.
+			return 0;
+		case MODE_EXECUTE:
+			// Nothing is wrapped, so programs run as they are.
+			while(i + 1 < argc && strcmp(argv[i], "-dlopen") == 0)
+				i += 2;
+			if(i >= argc)
+				fatal_message(1, "You must specify a program to execute");
+			if(!lt.dry_run) {
+				execvp(argv[i], argv + i);
+				fatal_message(errno, "Failed to run %s: %s", argv[i], strerror(errno));
+			}
+			print_command(&lt, argv + i);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 2;
+	}
+}
@@ -0,0 +1,191 @@
+#=============================================================================#
+# Author: Charles Grunwald
+# Shared precompiled headers for sysroot system headers
+#
+# Included after every project() call when CROSS_PCH is enabled in the
+# toolchain file. For each enabled language, a wrapper header including
+# CROSS_PCH_<LANG>_HEADERS is precompiled into
+#
+#   ${CROSS_BIN_DIR}/pch/<lang>-<key>/cross-pch.h.gch/<variant>.gch
+#
+# where <key> covers the compiler, the header list and the base flags, so the
+# cache is shared by every build tree using the same toolchain. One variant is
+# built per configuration, PIC mode and language standard; GCC picks whichever
+# one matches the command line and silently falls back to parsing the headers
+# when none does. Each variant is rebuilt when the contents of any header it
+# was compiled from change.
+#
+# Targets opt in with cross_target_pch() from the toolchain file, which
+# force-includes the wrapper header into their sources; sources that need to
+# define feature macros before their first include should stay out of them.
+#
+# Requires CMake 3.15 or later for CMAKE_PROJECT_INCLUDE.
+#=============================================================================#
+cmake_policy(PUSH)
+cmake_policy(SET CMP0057 NEW)
+
+set(CROSS_PCH_C_HEADERS
+    "stddef.h;stdint.h;stdio.h;stdlib.h;string.h;errno.h"
+    CACHE STRING "System headers precompiled for C targets")
+set(CROSS_PCH_CXX_HEADERS
+    "cstddef;cstdint;string;vector;map;unordered_map;memory;algorithm;functional;iostream"
+    CACHE STRING "System headers precompiled for C++ targets")
+set(CROSS_PCH_STANDARDS
+    ""
+    CACHE STRING "Extra language standards (ex: 11;14) to build C++ header variants for")
+mark_as_advanced(CROSS_PCH_C_HEADERS CROSS_PCH_CXX_HEADERS CROSS_PCH_STANDARDS)
+
+# Hash of the contents of every header listed in a dependency file.
+function(_cross_pch_content_hash _deps _out_var)
+	set(_hashes "")
+	foreach(_dep ${_deps})
+		if(NOT EXISTS "${_dep}")
+			set(${_out_var} "" PARENT_SCOPE)
+			return()
+		endif()
+		file(SHA256 "${_dep}" _hash)
+		string(APPEND _hashes "${_hash} ${_dep}\n")
+	endforeach()
+	string(SHA256 _hash "${_hashes}")
+	set(${_out_var} "${_hash}" PARENT_SCOPE)
+endfunction()
+
+function(_cross_pch_std_flags _lang _out_var)
+	set(_flags "")
+	if(NOT "${_lang}" STREQUAL "CXX")
+		set(${_out_var} "" PARENT_SCOPE)
+		return()
+	endif()
+
+	set(_standards ${CROSS_PCH_STANDARDS})
+	if(CMAKE_CXX_STANDARD)
+		list(APPEND _standards ${CMAKE_CXX_STANDARD})
+	endif()
+	list(REMOVE_DUPLICATES _standards)
+
+	foreach(_std ${_standards})
+		if(DEFINED CMAKE_CXX_EXTENSIONS AND NOT CMAKE_CXX_EXTENSIONS)
+			set(_flag "${CMAKE_CXX${_std}_STANDARD_COMPILE_OPTION}")
+		else()
+			set(_flag "${CMAKE_CXX${_std}_EXTENSION_COMPILE_OPTION}")
+		endif()
+		if(_flag)
+			list(APPEND _flags "${_flag}")
+		endif()
+	endforeach()
+	set(${_out_var} "${_flags}" PARENT_SCOPE)
+endfunction()
+
+# The headers a variant was built from are listed in _deps_file, outside the
+# .gch directory so GCC doesn't try it, after their content hash.
+function(_cross_pch_build_variant _lang _header _gch _deps_file _flags)
+	if(EXISTS "${_gch}" AND EXISTS "${_deps_file}")
+		file(STRINGS "${_deps_file}" _deps)
+		list(GET _deps 0 _recorded)
+		list(REMOVE_AT _deps 0)
+		_cross_pch_content_hash("${_deps}" _hash)
+		if(_hash STREQUAL _recorded)
+			return()
+		endif()
+		message(STATUS "Sysroot headers changed; rebuilding ${_gch}")
+	endif()
+
+	separate_arguments(_args UNIX_COMMAND "${_flags}")
+	if("${_lang}" STREQUAL "CXX")
+		set(_kind "c++-header")
+	else()
+		set(_kind "c-header")
+	endif()
+
+	execute_process(
+		COMMAND "${CMAKE_${_lang}_COMPILER}" --sysroot=${CMAKE_SYSROOT} ${_args}
+		        -MD -MF "${_deps_file}.d" -x ${_kind} "${_header}" -o "${_gch}.tmp"
+		RESULT_VARIABLE _result
+		ERROR_VARIABLE _errors)
+
+	if(_result EQUAL 0)
+		# target: dep dep \
+		#  dep ...
+		file(READ "${_deps_file}.d" _deps)
+		string(REGEX REPLACE "\\\\\n" " " _deps "${_deps}")
+		string(REGEX REPLACE "^[^:]*:" "" _deps "${_deps}")
+		separate_arguments(_deps UNIX_COMMAND "${_deps}")
+		_cross_pch_content_hash("${_deps}" _hash)
+		string(REPLACE ";" "\n" _deps "${_hash};${_deps}")
+		file(WRITE "${_deps_file}" "${_deps}\n")
+		file(REMOVE "${_deps_file}.d")
+		file(RENAME "${_gch}.tmp" "${_gch}")
+	else()
+		file(REMOVE "${_gch}.tmp" "${_deps_file}.d")
+		message(WARNING "Failed to precompile ${_header} (${_flags}):\n${_errors}")
+	endif()
+endfunction()
+
+function(cross_pch_enable _lang)
+	if(NOT CMAKE_${_lang}_COMPILER_LOADED OR NOT CROSS_PCH_${_lang}_HEADERS)
+		return()
+	endif()
+
+	string(SHA1 _key "${CMAKE_${_lang}_COMPILER};${CMAKE_${_lang}_COMPILER_VERSION};${CMAKE_${_lang}_FLAGS};${CROSS_PCH_${_lang}_HEADERS}")
+	string(SUBSTRING "${_key}" 0 16 _key)
+	string(TOLOWER "${_lang}" _lang_lower)
+	set(_dir "${CROSS_BIN_DIR}/pch/${_lang_lower}-${_key}")
+	set(_header "${_dir}/cross-pch.h")
+
+	# Everyone using this toolchain shares the cache, so serialize the builds.
+	file(MAKE_DIRECTORY "${_dir}/cross-pch.h.gch")
+	file(LOCK "${_dir}" DIRECTORY GUARD FUNCTION TIMEOUT 600 RESULT_VARIABLE _lock_result)
+	if(NOT _lock_result EQUAL 0)
+		message(WARNING "Skipping precompiled headers: ${_lock_result}")
+		return()
+	endif()
+
+	if(NOT EXISTS "${_header}")
+		set(_content "/* Generated by ${TRIPLE}-pch.cmake */\n")
+		foreach(_name ${CROSS_PCH_${_lang}_HEADERS})
+			string(APPEND _content "#include <${_name}>\n")
+		endforeach()
+		file(WRITE "${_header}.tmp" "${_content}")
+		file(RENAME "${_header}.tmp" "${_header}")
+	endif()
+
+	if(CMAKE_CONFIGURATION_TYPES)
+		set(_configs ${CMAKE_CONFIGURATION_TYPES})
+	elseif(CMAKE_BUILD_TYPE)
+		set(_configs ${CMAKE_BUILD_TYPE})
+	else()
+		set(_configs "None")
+	endif()
+
+	_cross_pch_std_flags(${_lang} _std_flags)
+
+	foreach(_config ${_configs})
+		string(TOUPPER "${_config}" _config_upper)
+		foreach(_std "" ${_std_flags})
+			foreach(_pic "" "${CMAKE_${_lang}_COMPILE_OPTIONS_PIC}")
+				set(_flags "${CMAKE_${_lang}_FLAGS} ${CMAKE_${_lang}_FLAGS_${_config_upper}} ${_std} ${_pic}")
+				string(STRIP "${_flags}" _flags)
+				string(SHA1 _variant "${_flags}")
+				string(SUBSTRING "${_variant}" 0 12 _variant)
+				_cross_pch_build_variant(${_lang} "${_header}"
+					"${_dir}/cross-pch.h.gch/${_config_upper}-${_variant}.gch"
+					"${_dir}/${_config_upper}-${_variant}.deps" "${_flags}")
+			endforeach()
+		endforeach()
+	endforeach()
+
+	# For cross_target_pch().
+	set_property(GLOBAL PROPERTY CROSS_PCH_${_lang}_HEADER "${_header}")
+	message(STATUS "Precompiled ${_lang} system headers in ${_dir}")
+endfunction()
+
+get_property(_cross_pch_languages GLOBAL PROPERTY ENABLED_LANGUAGES)
+foreach(_cross_pch_lang C CXX)
+	if(_cross_pch_lang IN_LIST _cross_pch_languages)
+		cross_pch_enable(${_cross_pch_lang})
+	endif()
+endforeach()
+unset(_cross_pch_languages)
+unset(_cross_pch_lang)
+
+cmake_policy(POP)
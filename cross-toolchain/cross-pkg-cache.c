@@ -0,0 +1,973 @@
+/**
+ * @file cross-pkg-cache.c
+ * @author Charles Grunwald <cgrunwald@gmail.com>
+ * @brief Build output cache for packages staged into the sysroot.
+ *
+ * Usage: <triple>-pkg-cache [OPTIONS] -- COMMAND [ARGS...]
+ *
+ * COMMAND is a package's whole build: cross-configure or cross-cmake, the
+ * build and the install into the staging prefix. It's keyed on a hash of the
+ * package's source tree, COMMAND itself, the toolchain's identity, the
+ * CROSS_* and compiler flag environment, and the install records of the
+ * packages it depends on. On a hit, the files COMMAND installed last time are
+ * restored into the prefix and COMMAND never runs.
+ *
+ * On a miss, the prefix is snapshotted before and after COMMAND, and every
+ * file it added or changed is stored as the package's installed set. Each
+ * install (cached or not) leaves a record under <prefix>/.cross-pkg that
+ * lists the files and their hashes; dependents hash those records, so a
+ * rebuilt dependency with different output invalidates everything above it.
+ *
+ * The store is a local directory bounded by CROSS_PKG_CACHE_SIZE, evicting
+ * the least recently used packages first. Packages must not be built into
+ * the same prefix concurrently, as the snapshots would mix their files.
+ */
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "shared.h"
+#include "strutil.h"
+#include "strarray.h"
+#include "dynarray.h"
+#include "hashmap.h"
+#include "libcross.h"
+#include "sha256.h"
+#include "workqueue.h"
+
+#define PATH_SEP_CHR '/'
+
+#define UNAME_SUFFIX "-pkg-cache"
+#define CACHE_ENVNAME "CROSS_PKG_CACHE"
+#define SIZE_ENVNAME "CROSS_PKG_CACHE_SIZE"
+#define STAGING_ENVNAME "CMAKE_STAGING_PREFIX"
+#define STAGE_LOG_ENVNAME "CROSS_STAGE_LOG"
+#define DEFAULT_CACHE_DIR ".cache/cross-pkg"
+#define DEFAULT_CACHE_SIZE (10ULL << 30)
+
+#define RECORD_DIR ".cross-pkg"
+#define ENTRY_MANIFEST "manifest"
+#define ENTRY_FILES "files"
+#define MANIFEST_MAGIC "cross-pkg 1"
+
+#define COPY_BUFFER_SIZE (64 * 1024)
+
+// Tools whose identity is part of every key, relative to our bin directory.
+static const char* const toolchain_tools[] = {
+	"-gcc", "-g++", "-ld", "-ar", "-as", "-cmake", "-configure", "-toolchain.cmake", NULL
+};
+
+// Flags that change the output without showing up in COMMAND.
+static const char* const key_environment[] = {
+	"CFLAGS", "CXXFLAGS", "CPPFLAGS", "LDFLAGS", "LIBS", "CC", "CXX", "PKG_CONFIG_PATH", NULL
+};
+
+// Version control metadata never affects the build.
+static const char* const ignored_names[] = {
+	".git", ".hg", ".svn", NULL
+};
+
+struct file_state
+{
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	mode_t mode;
+	long long mtime;
+	long mtime_nsec;
+};
+
+struct source_file
+{
+	char* relpath;
+	char* path;
+	mode_t mode;
+	int error;
+	unsigned char digest[SHA256_DIGEST_SIZE];
+};
+
+DEFINE_ARRAY_TYPE(source_files, struct source_file)
+
+struct pkg_cache
+{
+	char* name;
+	char* source;
+	char* prefix;
+	char* root;
+	string_array* deps;
+	string_array* excludes;
+	char** command;
+	bool verbose;
+	unsigned long long max_size;
+	struct cross_paths paths;
+	struct cross_context ctx;
+};
+
+struct cache_entry
+{
+	char* path;
+	long long atime;
+	unsigned long long size;
+};
+
+DEFINE_ARRAY_TYPE(cache_entries, struct cache_entry)
+
+typedef bool(*walk_handler)(const char* relpath, const char* path, const struct stat* st, void* userdata);
+
+static CC_NORETURN fatal_message(int code, const char* format, ...)
+{
+	va_list args;
+	fprintf(stderr, "ERROR: ");
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+	fprintf(stderr, "\n");
+	exit(code != 0 ? code : 1);
+}
+
+static void verbose_log(const struct pkg_cache* cache, const char* format, ...)
+{
+	va_list args;
+	if(!cache->verbose)
+		return;
+	printf("pkg-cache: ");
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
+	printf("\n");
+	fflush(stdout);
+}
+
+static void usage(const char* exe)
+{
+	printf("Usage: %s [-n NAME] [-s SOURCE] [-p PREFIX] [-d PACKAGE]... [-x PATH]... [-v] -- COMMAND [ARGS...]\n\n", exe);
+	printf("Runs COMMAND, which builds a package and installs it into PREFIX, unless an\n");
+	printf("identical build is cached, in which case its installed files are restored.\n\n");
+	printf("  -n NAME     Package name (default: the source directory's name)\n");
+	printf("  -s SOURCE   Source tree to hash (default: .)\n");
+	printf("  -p PREFIX   Staging prefix (default: $" STAGING_ENVNAME ", then the sysroot)\n");
+	printf("  -d PACKAGE  Package this one builds against (repeatable)\n");
+	printf("  -x PATH     Path under SOURCE to leave out of the source hash (repeatable)\n");
+	printf("  -v          Log cache decisions\n\n");
+	printf("The store is $" CACHE_ENVNAME " (default: ~/" DEFAULT_CACHE_DIR ", 0 disables it)\n");
+	printf("and is kept under $" SIZE_ENVNAME " (default: 10G).\n");
+}
+
+static int compare_strings(const void* a, const void* b)
+{
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static bool is_ignored_name(const char* name)
+{
+	for(const char* const* ignored = ignored_names; *ignored != NULL; ignored++) {
+		if(strcmp(name, *ignored) == 0)
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Visit everything under @p root in sorted order, so hashes don't depend on
+ * the order readdir happens to return. @p handler returns whether to descend
+ * into a directory.
+ */
+static void walk_tree(const char* root, const char* relpath, walk_handler handler, void* userdata)
+{
+	DIR* dir;
+	struct dirent* entry;
+	string_array* names = NULL;
+	char path[PATH_MAX] = "";
+	char child_rel[PATH_MAX] = "";
+	char child_path[PATH_MAX] = "";
+
+	if((size_t)snprintf(path, PATH_MAX, "%s%s%s", root, *relpath != '\0' ? "/" : "", relpath) >= PATH_MAX)
+		return;
+	if((dir = opendir(path)) == NULL)
+		return;
+	while((entry = readdir(dir)) != NULL) {
+		if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 || is_ignored_name(entry->d_name))
+			continue;
+		names = string_array_push(names, strdup(entry->d_name));
+	}
+	closedir(dir);
+	if(names == NULL)
+		return;
+
+	qsort((void*)names->ptr, names->len, sizeof(char*), compare_strings);
+	for(size_t i = 0; i < names->len; i++) {
+		struct stat st;
+		if((size_t)snprintf(child_rel, PATH_MAX, "%s%s%s", relpath, *relpath != '\0' ? "/" : "", names->ptr[i]) >= PATH_MAX)
+			continue;
+		if((size_t)snprintf(child_path, PATH_MAX, "%s/%s", root, child_rel) >= PATH_MAX)
+			continue;
+		if(lstat(child_path, &st) != 0)
+			continue;
+		if(handler(child_rel, child_path, &st, userdata) && S_ISDIR(st.st_mode))
+			walk_tree(root, child_rel, handler, userdata);
+	}
+	string_array_free(names);
+}
+
+/*
+ * Copy @p from to @p to, hashing the contents on the way through when
+ * @p digest is non-NULL.
+ */
+static int copy_file(const char* from, const char* to, mode_t mode, unsigned char* digest)
+{
+	ssize_t count;
+	int in, out, code = 0;
+	struct sha256 ctx;
+	char buffer[COPY_BUFFER_SIZE];
+
+	in = open(from, O_RDONLY | O_CLOEXEC);
+	if(in < 0)
+		return -1;
+	out = open(to, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode);
+	if(out < 0) {
+		close(in);
+		return -1;
+	}
+
+	sha256_init(&ctx);
+	while((count = read(in, buffer, sizeof(buffer))) > 0) {
+		if(write(out, buffer, (size_t)count) != count) {
+			code = -1;
+			break;
+		}
+		sha256_update(&ctx, buffer, (size_t)count);
+	}
+	if(count < 0)
+		code = -1;
+	close(in);
+	if(close(out) != 0)
+		code = -1;
+	// The umask applies at creation; installed modes must survive exactly.
+	if(code == 0 && chmod(to, mode) != 0)
+		code = -1;
+	if(digest != NULL)
+		sha256_final(&ctx, digest);
+	return code;
+}
+
+static void hash_string(struct sha256* ctx, const char* label, const char* value)
+{
+	sha256_update(ctx, label, strlen(label) + 1);
+	if(value != NULL)
+		sha256_update(ctx, value, strlen(value) + 1);
+	else
+		sha256_update(ctx, "", 1);
+}
+
+static void hash_stat(struct sha256* ctx, const char* label, const char* path)
+{
+	struct stat st;
+	char buffer[64] = "";
+	if(stat(path, &st) == 0)
+		snprintf(buffer, sizeof(buffer), "%lld:%lld", (long long)st.st_size, (long long)st.st_mtime);
+	hash_string(ctx, label, path);
+	hash_string(ctx, "stat", buffer);
+}
+
+/*
+ * Source tree hashing
+ */
+
+struct source_walk
+{
+	const struct pkg_cache* cache;
+	struct source_files files;
+	struct sha256* ctx;
+};
+
+static bool is_excluded(const struct pkg_cache* cache, const char* relpath, const char* path)
+{
+	for(size_t i = 0; cache->excludes != NULL && i < cache->excludes->len; i++) {
+		if(strcmp(cache->excludes->ptr[i], relpath) == 0)
+			return true;
+	}
+	return strcmp(path, cache->prefix) == 0;
+}
+
+static bool collect_source(const char* relpath, const char* path, const struct stat* st, void* userdata)
+{
+	struct source_walk* walk = (struct source_walk*)userdata;
+	struct source_file* file;
+	char target[PATH_MAX] = "";
+	char marker[PATH_MAX] = "";
+	ssize_t len;
+
+	if(is_excluded(walk->cache, relpath, path))
+		return false;
+
+	if(S_ISDIR(st->st_mode)) {
+		// Out-of-source build trees inside the source directory aren't sources.
+		if((size_t)snprintf(marker, PATH_MAX, "%s/CMakeCache.txt", path) < PATH_MAX && is_regular_file(marker))
+			return false;
+		if((size_t)snprintf(marker, PATH_MAX, "%s/config.status", path) < PATH_MAX && is_regular_file(marker))
+			return false;
+		return true;
+	}
+
+	if(S_ISLNK(st->st_mode)) {
+		if((len = readlink(path, target, PATH_MAX - 1)) >= 0)
+			target[len] = '\0';
+		hash_string(walk->ctx, "link", relpath);
+		hash_string(walk->ctx, "target", target);
+	} else if(S_ISREG(st->st_mode) && (file = source_files_append0(&walk->files)) != NULL) {
+		file->relpath = strdup(relpath);
+		file->path = strdup(path);
+		file->mode = st->st_mode & 0111;
+	}
+	return false;
+}
+
+static void hash_source_file(struct workqueue* wq, struct source_file* file, void* userdata)
+{
+	file->error = sha256_file(file->path, file->digest);
+}
+
+/*
+ * Hash every file's path, executable bits and contents. The contents are
+ * hashed in parallel; symlinks are hashed by their targets as they're found.
+ */
+static bool hash_source_tree(struct pkg_cache* cache, struct sha256* ctx)
+{
+	bool result = true;
+	struct workqueue wq;
+	struct source_file* file;
+	struct source_walk walk;
+	char hex[SHA256_HEX_SIZE] = "";
+	char mode[16] = "";
+
+	walk.cache = cache;
+	walk.ctx = ctx;
+	source_files_init(&walk.files);
+	walk_tree(cache->source, "", collect_source, &walk);
+
+	if(workqueue_init(&wq, 0, (workqueue_handler)hash_source_file, NULL) != 0) {
+		ARRAY_FOREACH(&walk.files, file)
+			hash_source_file(NULL, file, NULL);
+	} else {
+		ARRAY_FOREACH(&walk.files, file) {
+			if(workqueue_push(&wq, file) != 0)
+				hash_source_file(NULL, file, NULL);
+		}
+		workqueue_finish(&wq);
+	}
+
+	ARRAY_FOREACH(&walk.files, file) {
+		if(file->error != 0) {
+			fprintf(stderr, "WARNING: Failed to hash %s: %s\n", file->path, strerror(-file->error));
+			result = false;
+		}
+		snprintf(mode, sizeof(mode), "%o", (unsigned)file->mode);
+		hash_string(ctx, "file", file->relpath);
+		hash_string(ctx, "mode", mode);
+		hash_string(ctx, "sha256", sha256_hex(file->digest, hex));
+		free(file->relpath);
+		free(file->path);
+	}
+	source_files_reset(&walk.files);
+	return result;
+}
+
+static bool package_key(struct pkg_cache* cache, char key[SHA256_HEX_SIZE])
+{
+	extern char** environ;
+	struct sha256 ctx;
+	unsigned char digest[SHA256_DIGEST_SIZE];
+	char hex[SHA256_HEX_SIZE] = "";
+	char path[PATH_MAX] = "";
+	string_array* cross_env = NULL;
+
+	sha256_init(&ctx);
+	hash_string(&ctx, "version", MANIFEST_MAGIC);
+	hash_string(&ctx, "name", cache->name);
+
+	for(char** arg = cache->command; *arg != NULL; arg++)
+		hash_string(&ctx, "arg", *arg);
+
+	for(const char* const* tool = toolchain_tools; *tool != NULL; tool++) {
+		if((size_t)snprintf(path, PATH_MAX, "%.*s/%.*s%s", (int)cache->paths.bindir.len, cache->paths.bindir.value,
+		                    (int)cache->paths.uname.len, cache->paths.uname.value, *tool) >= PATH_MAX)
+			return false;
+		hash_stat(&ctx, "tool", path);
+	}
+
+	for(const char* const* name = key_environment; *name != NULL; name++)
+		hash_string(&ctx, *name, getenv(*name));
+	// Every CROSS_* knob (LTO, PGO, PCH, ...) other than our own settings.
+	for(char** env = environ; *env != NULL; env++) {
+		if(strncmp(*env, "CROSS_", 6) == 0 && strncmp(*env, CACHE_ENVNAME, strlen(CACHE_ENVNAME)) != 0 &&
+		   strncmp(*env, "CROSS_DEBUG=", 12) != 0)
+			cross_env = string_array_push(cross_env, strdup(*env));
+	}
+	if(cross_env != NULL) {
+		qsort((void*)cross_env->ptr, cross_env->len, sizeof(char*), compare_strings);
+		for(size_t i = 0; i < cross_env->len; i++)
+			hash_string(&ctx, "env", cross_env->ptr[i]);
+		string_array_free(cross_env);
+	}
+
+	// Dependencies are identified by what they installed, not how.
+	for(size_t i = 0; cache->deps != NULL && i < cache->deps->len; i++) {
+		if((size_t)snprintf(path, PATH_MAX, "%s/" RECORD_DIR "/%s", cache->prefix, cache->deps->ptr[i]) >= PATH_MAX ||
+		   sha256_file(path, digest) != 0) {
+			fprintf(stderr, "WARNING: %s has no install record in %s; not caching\n", cache->deps->ptr[i], cache->prefix);
+			return false;
+		}
+		hash_string(&ctx, "dep", cache->deps->ptr[i]);
+		hash_string(&ctx, "record", sha256_hex(digest, hex));
+	}
+
+	if(!hash_source_tree(cache, &ctx))
+		return false;
+
+	sha256_final(&ctx, digest);
+	sha256_hex(digest, key);
+	return true;
+}
+
+/*
+ * Prefix snapshots
+ */
+
+static bool snapshot_file(const char* relpath, const char* path, const struct stat* st, void* userdata)
+{
+	struct file_state* state;
+
+	if(S_ISDIR(st->st_mode))
+		return strcmp(relpath, RECORD_DIR) != 0;
+	if(!S_ISREG(st->st_mode) && !S_ISLNK(st->st_mode))
+		return false;
+	if((state = (struct file_state*)malloc(sizeof(struct file_state))) == NULL)
+		return false;
+	state->dev = st->st_dev;
+	state->ino = st->st_ino;
+	state->size = st->st_size;
+	state->mode = st->st_mode;
+	state->mtime = (long long)st->st_mtime;
+	state->mtime_nsec = st->st_mtim.tv_nsec;
+	if(hashmap_put((struct hashmap*)userdata, relpath, state, NULL) != 0)
+		free(state);
+	return false;
+}
+
+static int snapshot_prefix(const struct pkg_cache* cache, struct hashmap* snapshot)
+{
+	int code = hashmap_init(snapshot, 16384);
+	if(code == 0)
+		walk_tree(cache->prefix, "", snapshot_file, snapshot);
+	return code;
+}
+
+struct snapshot_diff
+{
+	const struct hashmap* before;
+	string_array* changed;
+};
+
+static bool diff_file(const char* relpath, struct file_state* after, struct snapshot_diff* diff)
+{
+	struct file_state* before = NULL;
+	if(!hashmap_find(diff->before, relpath, (void**)&before) || before->ino != after->ino ||
+	   before->dev != after->dev || before->size != after->size || before->mode != after->mode ||
+	   before->mtime != after->mtime || before->mtime_nsec != after->mtime_nsec)
+		diff->changed = string_array_push(diff->changed, strdup(relpath));
+	return true;
+}
+
+/*
+ * <triple>-stage leaves files whose contents didn't change with their old
+ * times, so the snapshots miss them. It logs every file it installed or
+ * found up to date, and those under the prefix are the package's too.
+ */
+static void add_staged_files(const struct pkg_cache* cache, const char* log, const struct hashmap* after,
+                             string_array** changed)
+{
+	char* line = NULL;
+	size_t line_size = 0;
+	size_t prefix_len = strlen(cache->prefix);
+	struct hashmap seen;
+	FILE* file = fopen(log, "r");
+
+	if(file == NULL || hashmap_init(&seen, 1024) != 0) {
+		if(file != NULL)
+			fclose(file);
+		return;
+	}
+	for(size_t i = 0; *changed != NULL && i < (*changed)->len; i++)
+		hashmap_put(&seen, (*changed)->ptr[i], NULL, NULL);
+
+	while(getline(&line, &line_size, file) > 0) {
+		char path[PATH_MAX] = "";
+		char* dir;
+		char* slash;
+		const char* relpath;
+		int len;
+
+		line[strcspn(line, "\n")] = '\0';
+		// The log has paths as they were given; the prefix is canonical.
+		if((slash = strrchr(line, PATH_SEP_CHR)) == NULL || slash == line)
+			continue;
+		*slash = '\0';
+		dir = realpath(line, NULL);
+		if(dir == NULL)
+			continue;
+		len = snprintf(path, PATH_MAX, "%s/%s", dir, slash + 1);
+		free(dir);
+		if((size_t)len >= PATH_MAX || strncmp(path, cache->prefix, prefix_len) != 0 || path[prefix_len] != PATH_SEP_CHR)
+			continue;
+		relpath = path + prefix_len + 1;
+		if(!hashmap_find(after, relpath, NULL) || hashmap_find(&seen, relpath, NULL))
+			continue;
+		hashmap_put(&seen, relpath, NULL, NULL);
+		*changed = string_array_push(*changed, strdup(relpath));
+	}
+	hashmap_reset(&seen, NULL);
+	free(line);
+	fclose(file);
+}
+
+/*
+ * Store and restore
+ */
+
+static bool is_storable_path(const char* relpath)
+{
+	return strpbrk(relpath, "\t\n") == NULL;
+}
+
+static char* entry_path(const struct pkg_cache* cache, const char* key)
+{
+	return sprintf_alloc("%s/%.2s/%s", cache->root, key, key + 2);
+}
+
+static int write_record(const struct pkg_cache* cache, const char* manifest)
+{
+	int code;
+	char path[PATH_MAX] = "";
+	char staging[PATH_MAX] = "";
+
+	if((size_t)snprintf(path, PATH_MAX, "%s/" RECORD_DIR, cache->prefix) >= PATH_MAX || mkdir_p(path, 0755) != 0)
+		return -1;
+	if((size_t)snprintf(path, PATH_MAX, "%s/" RECORD_DIR "/%s", cache->prefix, cache->name) >= PATH_MAX ||
+	   (size_t)snprintf(staging, PATH_MAX, "%s.%ld.tmp", path, (long)getpid()) >= PATH_MAX)
+		return -1;
+	code = copy_file(manifest, staging, 0644, NULL);
+	if(code == 0 && rename(staging, path) != 0)
+		code = -1;
+	if(code != 0)
+		unlink(staging);
+	return code;
+}
+
+/*
+ * Copy the files @p changed names into a new entry, writing the manifest
+ * alongside them, then rename the entry into place.
+ */
+static int store_entry(const struct pkg_cache* cache, const char* entry, const string_array* changed, char** manifest)
+{
+	FILE* file;
+	unsigned long long total = 0;
+	char staging[PATH_MAX] = "";
+	char from[PATH_MAX] = "";
+	char to[PATH_MAX] = "";
+	char target[PATH_MAX] = "";
+	char hex[SHA256_HEX_SIZE] = "";
+	unsigned char digest[SHA256_DIGEST_SIZE];
+	string_array* lines = NULL;
+
+	if((size_t)snprintf(staging, PATH_MAX, "%s.%ld.tmp", entry, (long)getpid()) >= PATH_MAX)
+		return -1;
+	remove_tree(staging);
+	if((size_t)snprintf(to, PATH_MAX, "%s/" ENTRY_FILES, staging) >= PATH_MAX || mkdir_p(to, 0755) != 0)
+		return -1;
+
+	for(size_t i = 0; i < changed->len; i++) {
+		struct stat st;
+		const char* relpath = changed->ptr[i];
+		ssize_t len;
+
+		if((size_t)snprintf(from, PATH_MAX, "%s/%s", cache->prefix, relpath) >= PATH_MAX ||
+		   (size_t)snprintf(to, PATH_MAX, "%s/" ENTRY_FILES "/%s", staging, relpath) >= PATH_MAX)
+			goto failed;
+		if(!is_storable_path(relpath) || lstat(from, &st) != 0 || mkdir_parent(to) != 0)
+			goto failed;
+
+		if(S_ISLNK(st.st_mode)) {
+			if((len = readlink(from, target, PATH_MAX - 1)) < 0)
+				goto failed;
+			target[len] = '\0';
+			if(!is_storable_path(target))
+				goto failed;
+			lines = string_array_push(lines, sprintf_alloc("l\t%s\t%s\n", relpath, target));
+		} else {
+			if(copy_file(from, to, st.st_mode & 07777, digest) != 0)
+				goto failed;
+			total += (unsigned long long)st.st_size;
+			lines = string_array_push(lines, sprintf_alloc("f\t%o\t%lld\t%s\t%s\n", (unsigned)(st.st_mode & 07777),
+			                                               (long long)st.st_size, sha256_hex(digest, hex), relpath));
+		}
+	}
+
+	if((size_t)snprintf(to, PATH_MAX, "%s/" ENTRY_MANIFEST, staging) >= PATH_MAX || (file = fopen(to, "w")) == NULL)
+		goto failed;
+	fprintf(file, MANIFEST_MAGIC "\nname\t%s\nsize\t%llu\n", cache->name, total);
+	for(size_t i = 0; lines != NULL && i < lines->len; i++)
+		fputs(lines->ptr[i], file);
+	if(fclose(file) != 0)
+		goto failed;
+
+	// Losing a race with an identical build is fine; theirs is as good, and
+	// its manifest is what gets recorded.
+	if(rename(staging, entry) != 0) {
+		if((errno != ENOTEMPTY && errno != EEXIST) ||
+		   (size_t)snprintf(to, PATH_MAX, "%s/" ENTRY_MANIFEST, entry) >= PATH_MAX || !is_regular_file(to))
+			goto failed;
+		remove_tree(staging);
+	}
+	string_array_free(lines);
+	*manifest = sprintf_alloc("%s/" ENTRY_MANIFEST, entry);
+	return *manifest != NULL ? 0 : -1;
+
+failed:
+	string_array_free(lines);
+	remove_tree(staging);
+	return -1;
+}
+
+/*
+ * Fill in where @p relpath is installed and the staging file beside it.
+ * Neither is usable when one doesn't fit, so both are cleared.
+ */
+static bool restore_paths(const struct pkg_cache* cache, const char* relpath, char* to, char* staging)
+{
+	if((size_t)snprintf(to, PATH_MAX, "%s/%s", cache->prefix, relpath) < PATH_MAX &&
+	   (size_t)snprintf(staging, PATH_MAX, "%s.%ld.tmp", to, (long)getpid()) < PATH_MAX)
+		return true;
+	to[0] = staging[0] = '\0';
+	return false;
+}
+
+/*
+ * Install every file in the entry's manifest. Files are written beside their
+ * destination and renamed over it, so nothing sees a half-written library.
+ */
+static int restore_entry(const struct pkg_cache* cache, const char* entry)
+{
+	FILE* file;
+	int code = 0;
+	char line[PATH_MAX * 2 + 128];
+	char from[PATH_MAX] = "";
+	char to[PATH_MAX] = "";
+	char staging[PATH_MAX] = "";
+
+	if((size_t)snprintf(from, PATH_MAX, "%s/" ENTRY_MANIFEST, entry) >= PATH_MAX || (file = fopen(from, "r")) == NULL)
+		return -1;
+	if(fgets(line, sizeof(line), file) == NULL || strcmp(line, MANIFEST_MAGIC "\n") != 0) {
+		fclose(file);
+		return -1;
+	}
+
+	while(code == 0 && fgets(line, sizeof(line), file) != NULL) {
+		char* fields[5] = { NULL };
+		char* saveptr = NULL;
+		size_t count = 0;
+		size_t len = strlen(line);
+
+		if(len > 0 && line[len - 1] == '\n')
+			line[--len] = '\0';
+		for(char* tok = strtok_r(line, "\t", &saveptr); tok != NULL && count < 5; tok = strtok_r(NULL, "\t", &saveptr))
+			fields[count++] = tok;
+
+		if(count == 0)
+			continue;
+		if(strcmp(fields[0], "l") == 0 && count == 3) {
+			if(!restore_paths(cache, fields[1], to, staging) || mkdir_parent(to) != 0 || symlink(fields[2], staging) != 0 || rename(staging, to) != 0)
+				code = -1;
+		} else if(strcmp(fields[0], "f") == 0 && count == 5) {
+			mode_t mode = (mode_t)strtoul(fields[1], NULL, 8);
+			if((size_t)snprintf(from, PATH_MAX, "%s/" ENTRY_FILES "/%s", entry, fields[4]) >= PATH_MAX ||
+			   !restore_paths(cache, fields[4], to, staging) || mkdir_parent(to) != 0 || copy_file(from, staging, mode, NULL) != 0 || rename(staging, to) != 0)
+				code = -1;
+		}
+		if(code != 0 && staging[0] != '\0')
+			unlink(staging);
+	}
+	fclose(file);
+	return code;
+}
+
+static unsigned long long manifest_size(const char* manifest)
+{
+	char line[256];
+	unsigned long long size = 0;
+	FILE* file = fopen(manifest, "r");
+	if(file == NULL)
+		return 0;
+	while(fgets(line, sizeof(line), file) != NULL) {
+		if(strncmp(line, "size\t", 5) == 0) {
+			size = strtoull(line + 5, NULL, 10);
+			break;
+		}
+	}
+	fclose(file);
+	return size;
+}
+
+static int compare_entries(const void* a, const void* b)
+{
+	const struct cache_entry* left = (const struct cache_entry*)a;
+	const struct cache_entry* right = (const struct cache_entry*)b;
+	return left->atime < right->atime ? -1 : left->atime > right->atime ? 1 : 0;
+}
+
+/*
+ * Drop the least recently used entries until the store fits. Hits touch
+ * their manifest, so its mtime is the entry's last use.
+ */
+static void evict_entries(const struct pkg_cache* cache, const char* keep)
+{
+	DIR* root;
+	struct dirent* shard;
+	struct cache_entry* entry;
+	struct cache_entries entries;
+	unsigned long long total = 0;
+	char path[PATH_MAX] = "";
+
+	if((root = opendir(cache->root)) == NULL)
+		return;
+	cache_entries_init(&entries);
+	while((shard = readdir(root)) != NULL) {
+		DIR* dir;
+		struct dirent* item;
+		if(strlen(shard->d_name) != 2 || shard->d_name[0] == '.')
+			continue;
+		if((size_t)snprintf(path, PATH_MAX, "%s/%s", cache->root, shard->d_name) >= PATH_MAX || (dir = opendir(path)) == NULL)
+			continue;
+		while((item = readdir(dir)) != NULL) {
+			struct stat st;
+			if(item->d_name[0] == '.' || strstr(item->d_name, ".tmp") != NULL)
+				continue;
+			if((size_t)snprintf(path, PATH_MAX, "%s/%s/%s/" ENTRY_MANIFEST, cache->root, shard->d_name, item->d_name) >= PATH_MAX)
+				continue;
+			if(stat(path, &st) != 0 || (entry = cache_entries_append(&entries)) == NULL)
+				continue;
+			entry->atime = (long long)st.st_mtime;
+			entry->size = manifest_size(path);
+			entry->path = sprintf_alloc("%s/%s/%s", cache->root, shard->d_name, item->d_name);
+			total += entry->size;
+		}
+		closedir(dir);
+	}
+	closedir(root);
+
+	cache_entries_sort(&entries, compare_entries);
+	ARRAY_FOREACH(&entries, entry) {
+		if(total > cache->max_size && entry->path != NULL && strcmp(entry->path, keep) != 0) {
+			verbose_log(cache, "evicting %s", entry->path);
+			remove_tree(entry->path);
+			total -= entry->size;
+		}
+		free(entry->path);
+	}
+	cache_entries_reset(&entries);
+}
+
+static char* cache_root(void)
+{
+	const char* value = getenv(CACHE_ENVNAME);
+	const char* home = getenv("HOME");
+	if(value != NULL && strcmp(value, "0") == 0)
+		return NULL;
+	if(value != NULL && *value == PATH_SEP_CHR)
+		return strdup(value);
+	return home != NULL ? sprintf_alloc("%s/" DEFAULT_CACHE_DIR, home) : NULL;
+}
+
+static unsigned long long parse_size(const char* value)
+{
+	char* end = NULL;
+	unsigned long long size;
+
+	if(value == NULL || *value == '\0')
+		return DEFAULT_CACHE_SIZE;
+	size = strtoull(value, &end, 10);
+	switch(*end) {
+		case 'k': case 'K': size <<= 10; break;
+		case 'm': case 'M': size <<= 20; break;
+		case 'g': case 'G': size <<= 30; break;
+		case 't': case 'T': size <<= 40; break;
+		default: break;
+	}
+	return size > 0 ? size : DEFAULT_CACHE_SIZE;
+}
+
+static void resolve_prefix(struct pkg_cache* cache)
+{
+	char* prefix = NULL;
+	const char* staging = getenv(STAGING_ENVNAME);
+
+	if(cache->prefix == NULL && staging != NULL && *staging != '\0')
+		cache->prefix = strdup(staging);
+	if(cache->prefix == NULL) {
+		if(cross_resolve_sysroot(&cache->ctx, &cache->paths, &prefix) != CROSS_OK)
+			fatal_message(cross_exit_code(&cache->ctx), "%s; use -p to specify the prefix", cross_context_error(&cache->ctx));
+		cache->prefix = strdup(prefix);
+		cross_free(&cache->ctx, prefix);
+	}
+	if(mkdir_p(cache->prefix, 0755) != 0 || (prefix = realpath(cache->prefix, NULL)) == NULL)
+		fatal_message(errno, "Failed to resolve the prefix %s: %s", cache->prefix, strerror(errno));
+	free(cache->prefix);
+	cache->prefix = prefix;
+}
+
+/*
+ * Run the command and, when it succeeds, store what it installed.
+ */
+static int build_and_store(struct pkg_cache* cache, const char* entry)
+{
+	int status;
+	char* manifest = NULL;
+	char stage_log[PATH_MAX] = "";
+	struct hashmap before, after;
+	struct snapshot_diff diff;
+
+	if(snapshot_prefix(cache, &before) != 0)
+		fatal_message(ENOMEM, "Failed to snapshot %s", cache->prefix);
+	// Without a stage log, the snapshot diff alone says what was installed.
+	if((size_t)snprintf(stage_log, PATH_MAX, "%s/stage.%ld.log", cache->root, (long)getpid()) >= PATH_MAX)
+		stage_log[0] = '\0';
+	unlink(stage_log);
+	if(stage_log[0] != '\0' && mkdir_p(cache->root, 0755) == 0)
+		setenv(STAGE_LOG_ENVNAME, stage_log, 1);
+	status = run_command(cache->command);
+	unsetenv(STAGE_LOG_ENVNAME);
+	if(status != 0) {
+		unlink(stage_log);
+		hashmap_reset(&before, free);
+		return status < 0 ? 1 : status;
+	}
+	if(snapshot_prefix(cache, &after) != 0)
+		fatal_message(ENOMEM, "Failed to snapshot %s", cache->prefix);
+
+	diff.before = &before;
+	diff.changed = NULL;
+	hashmap_foreach(&after, (hashmap_iter_func)diff_file, &diff);
+	add_staged_files(cache, stage_log, &after, &diff.changed);
+	unlink(stage_log);
+	hashmap_reset(&before, free);
+	hashmap_reset(&after, free);
+
+	if(diff.changed == NULL) {
+		fprintf(stderr, "WARNING: %s installed nothing into %s; not caching\n", cache->name, cache->prefix);
+		return 0;
+	}
+	qsort((void*)diff.changed->ptr, diff.changed->len, sizeof(char*), compare_strings);
+
+	if(mkdir_parent(entry) != 0 || store_entry(cache, entry, diff.changed, &manifest) != 0) {
+		fprintf(stderr, "WARNING: Failed to cache %s\n", cache->name);
+	} else {
+		verbose_log(cache, "stored %s (%zu files)", cache->name, diff.changed->len);
+		if(write_record(cache, manifest) != 0)
+			fprintf(stderr, "WARNING: Failed to write the install record for %s\n", cache->name);
+		evict_entries(cache, entry);
+	}
+	free(manifest);
+	string_array_free(diff.changed);
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	int opt, status;
+	char exe[PATH_MAX] = "";
+	char key[SHA256_HEX_SIZE] = "";
+	char manifest[PATH_MAX] = "";
+	char* entry;
+	struct pkg_cache cache;
+
+	memset((void*)&cache, 0, sizeof(cache));
+	while((opt = getopt(argc, argv, "+n:s:p:d:x:vh")) != -1) {
+		switch(opt) {
+			case 'n':
+				free(cache.name);
+				cache.name = strdup(optarg);
+				break;
+			case 's':
+				free(cache.source);
+				cache.source = strdup(optarg);
+				break;
+			case 'p':
+				free(cache.prefix);
+				cache.prefix = strdup(optarg);
+				break;
+			case 'd':
+				cache.deps = string_array_push(cache.deps, strdup(optarg));
+				break;
+			case 'x':
+				cache.excludes = string_array_push(cache.excludes, strdup(optarg));
+				break;
+			case 'v':
+				cache.verbose = true;
+				break;
+			case 'h':
+				usage(argv[0]);
+				return 0;
+			default:
+				usage(argv[0]);
+				return 2;
+		}
+	}
+	if(optind >= argc) {
+		usage(argv[0]);
+		return 2;
+	}
+	cache.command = argv + optind;
+
+	if(cross_context_init(&cache.ctx, NULL) != CROSS_OK || proc_path(exe, PATH_MAX) != 0)
+		fatal_message(errno, "Failed to look up our own path");
+	if(cross_paths_init(&cache.ctx, &cache.paths, exe, UNAME_SUFFIX) != CROSS_OK)
+		fatal_message(cross_exit_code(&cache.ctx), "%s", cross_context_error(&cache.ctx));
+
+	resolve_prefix(&cache);
+	if((entry = realpath(cache.source != NULL ? cache.source : ".", NULL)) == NULL)
+		fatal_message(errno, "Failed to resolve the source directory: %s", strerror(errno));
+	free(cache.source);
+	cache.source = entry;
+	if(cache.name == NULL)
+		cache.name = strdup(strrchr(cache.source, PATH_SEP_CHR) + 1);
+	if(strchr(cache.name, PATH_SEP_CHR) != NULL || cache.name[0] == '.' || !is_storable_path(cache.name))
+		fatal_message(EINVAL, "Invalid package name: %s", cache.name);
+	cache.max_size = parse_size(getenv(SIZE_ENVNAME));
+
+	cache.root = cache_root();
+	entry = cache.root != NULL && package_key(&cache, key) ? entry_path(&cache, key) : NULL;
+	if(entry == NULL || (size_t)snprintf(manifest, PATH_MAX, "%s/" ENTRY_MANIFEST, entry) >= PATH_MAX) {
+		verbose_log(&cache, "not caching %s", cache.name);
+		execvp(cache.command[0], cache.command);
+		fatal_message(errno, "Failed to run %s: %s", cache.command[0], strerror(errno));
+	}
+
+	if(is_regular_file(manifest)) {
+		if(restore_entry(&cache, entry) == 0 && write_record(&cache, manifest) == 0) {
+			verbose_log(&cache, "restored %s (%s)", cache.name, key);
+			utimes(manifest, NULL);
+			free(entry);
+			return 0;
+		}
+		fprintf(stderr, "WARNING: Failed to restore %s from the cache; building it\n", cache.name);
+		remove_tree(entry);
+	}
+
+	verbose_log(&cache, "building %s (%s)", cache.name, key);
+	status = build_and_store(&cache, entry);
+	free(entry);
+	return status;
+}
@@ -0,0 +1,562 @@
+/**
+ * @file cross-probe-cc.c
+ * @author Charles Grunwald <cgrunwald@gmail.com>
+ * @brief Memoizing compiler shim for autoconf probes.
+ *
+ * Usage: <triple>-probe-cc COMPILER ARGS...
+ *
+ * cross-configure puts this in front of CC/CXX when CROSS_PROBE_CACHE is set,
+ * and passes the sysroot along in CROSS_PROBE_SYSROOT.
+ * Invocations that compile or link one of autoconf's conftest sources are
+ * keyed on the source, the arguments, the compiler's identity and a
+ * fingerprint of the sysroot, and a previous result (exit status, stdout,
+ * stderr and output file) is replayed instead of running the compiler.
+ * Anything else is exec'd straight through.
+ *
+ * Header dependencies of each cached probe are recorded with -MD and checked
+ * on replay, so a header changing in place still causes a miss. The sysroot
+ * fingerprint covers headers and libraries appearing or disappearing, which
+ * is what most probes actually test for.
+ */
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "shared.h"
+#include "strutil.h"
+#include "strbuf.h"
+#include "sha256.h"
+
+#define ENV_SEP ":"
+#define PATH_SEP_CHR '/'
+
+#define CACHE_ENVNAME "CROSS_PROBE_CACHE"
+#define SYSROOT_ENVNAME "CROSS_PROBE_SYSROOT"
+#define DEFAULT_CACHE_DIR ".cache/cross-probe"
+
+#define CONFTEST_PREFIX "conftest."
+#define ENTRY_STATUS "status"
+#define ENTRY_STDOUT "stdout"
+#define ENTRY_STDERR "stderr"
+#define ENTRY_OUTPUT "output"
+#define ENTRY_DEPS "deps"
+#define ENTRY_DEPFILE "probe.d"
+
+#define COPY_BUFFER_SIZE (64 * 1024)
+
+// Environment that changes what the compiler does or says.
+static const char* const key_environment[] = {
+	"GCC_EXEC_PREFIX", "COMPILER_PATH", "LIBRARY_PATH", "CPATH", "C_INCLUDE_PATH",
+	"CPLUS_INCLUDE_PATH", "LANG", "LC_ALL", "LC_MESSAGES", "SOURCE_DATE_EPOCH", NULL
+};
+
+// Directories whose mtimes make up the sysroot fingerprint.
+static const char* const sysroot_dirs[] = {
+	"/usr/include", "/usr/lib", "/usr/lib64", "/lib", "/lib64",
+	"/usr/lib/pkgconfig", "/usr/local/include", "/usr/local/lib", NULL
+};
+
+struct probe
+{
+	int argc;
+	char** argv;
+	const char* compiler;
+	const char* source;
+	const char* output;
+	bool capture_stdout;
+	bool has_depfile;
+};
+
+static bool is_debug_mode(void)
+{
+	static bool is_debug = false;
+	static bool first_call = true;
+	if(first_call) {
+		char* debug_env = getenv("CROSS_DEBUG");
+		first_call = false;
+		is_debug = debug_env != NULL && (*debug_env == '1');
+	}
+	return is_debug;
+}
+
+static void debuglog(const char* format, ...)
+{
+	if(is_debug_mode()) {
+		va_list args;
+		fprintf(stderr, "DEBUG: ");
+		va_start(args, format);
+		vfprintf(stderr, format, args);
+		va_end(args);
+		fprintf(stderr, "\n");
+	}
+}
+
+static CC_NORETURN exec_compiler(char** argv)
+{
+	execvp(argv[0], argv);
+	fprintf(stderr, "ERROR: Failed to run %s: %s\n", argv[0], strerror(errno));
+	exit(127);
+}
+
+static bool is_conftest_source(const char* arg)
+{
+	const char* ext;
+	if(strncmp(arg, CONFTEST_PREFIX, sizeof(CONFTEST_PREFIX) - 1) != 0)
+		return false;
+	ext = arg + sizeof(CONFTEST_PREFIX) - 1;
+	return (strcmp(ext, "c") == 0 || strcmp(ext, "cc") == 0 || strcmp(ext, "cpp") == 0 ||
+	        strcmp(ext, "cxx") == 0 || strcmp(ext, "C") == 0) && is_regular_file(arg);
+}
+
+// Decide whether this is a probe we know how to replay.
+static bool probe_parse(struct probe* probe, int argc, char** argv)
+{
+	bool compile_only = false, preprocess_only = false, assemble_only = false;
+
+	memset((void*)probe, 0, sizeof(*probe));
+	probe->argc = argc;
+	probe->argv = argv;
+	probe->compiler = argv[0];
+
+	for(int i = 1; i < argc; i++) {
+		const char* arg = argv[i];
+		if(strcmp(arg, "-o") == 0 && i + 1 < argc) {
+			probe->output = argv[++i];
+		} else if(strncmp(arg, "-o", 2) == 0 && arg[2] != '\0') {
+			probe->output = arg + 2;
+		} else if(strcmp(arg, "-c") == 0) {
+			compile_only = true;
+		} else if(strcmp(arg, "-E") == 0) {
+			preprocess_only = true;
+		} else if(strcmp(arg, "-S") == 0) {
+			assemble_only = true;
+		} else if(strncmp(arg, "-M", 2) == 0 || strcmp(arg, "-") == 0 || strncmp(arg, "-save-temps", 11) == 0 ||
+		          strncmp(arg, "-fprofile", 9) == 0 || (strncmp(arg, "-Wl,", 4) == 0 && strstr(arg, "-Map") != NULL)) {
+			// Side outputs we wouldn't capture.
+			return false;
+		} else if(*arg != '-' && is_conftest_source(arg)) {
+			if(probe->source != NULL)
+				return false;
+			probe->source = arg;
+		}
+	}
+
+	if(probe->source == NULL)
+		return false;
+
+	if(preprocess_only) {
+		probe->capture_stdout = probe->output == NULL;
+	} else if(probe->output == NULL) {
+		// conftest.c => conftest.o / conftest.s / a.out
+		probe->output = compile_only ? "conftest.o" : assemble_only ? "conftest.s" : "a.out";
+	}
+	probe->has_depfile = !preprocess_only;
+	return true;
+}
+
+static char* find_program(const char* name)
+{
+	char* paths;
+	char *tok, *saveptr = NULL, *result = NULL;
+	const char* envpath = getenv("PATH");
+
+	if(strchr(name, PATH_SEP_CHR) != NULL)
+		return realpath(name, NULL);
+	if(envpath == NULL || (paths = strdup(envpath)) == NULL)
+		return NULL;
+
+	for(tok = strtok_r(paths, ENV_SEP, &saveptr); tok != NULL; tok = strtok_r(NULL, ENV_SEP, &saveptr)) {
+		char candidate[PATH_MAX] = "";
+		if((size_t)snprintf(candidate, PATH_MAX, "%s/%s", tok, name) >= PATH_MAX)
+			continue;
+		if(is_regular_file(candidate) && access(candidate, X_OK) == 0) {
+			result = realpath(candidate, NULL);
+			break;
+		}
+	}
+	free(paths);
+	return result;
+}
+
+static void hash_string(struct sha256* ctx, const char* label, const char* value)
+{
+	sha256_update(ctx, label, strlen(label) + 1);
+	if(value != NULL)
+		sha256_update(ctx, value, strlen(value) + 1);
+	else
+		sha256_update(ctx, "", 1);
+}
+
+static void hash_stat(struct sha256* ctx, const char* label, const char* path)
+{
+	struct stat st;
+	char buffer[64] = "";
+	if(stat(path, &st) == 0)
+		snprintf(buffer, sizeof(buffer), "%lld:%lld", (long long)st.st_size, (long long)st.st_mtime);
+	hash_string(ctx, label, path);
+	hash_string(ctx, "stat", buffer);
+}
+
+static void hash_sysroot(struct sha256* ctx, const char* sysroot)
+{
+	char path[PATH_MAX] = "";
+	for(const char* const* dir = sysroot_dirs; *dir != NULL; dir++) {
+		if((size_t)snprintf(path, PATH_MAX, "%s%s", sysroot, *dir) < PATH_MAX)
+			hash_stat(ctx, "sysroot", path);
+	}
+}
+
+static bool probe_key(struct probe* probe, char key[SHA256_HEX_SIZE])
+{
+	struct sha256 ctx;
+	unsigned char digest[SHA256_DIGEST_SIZE];
+	unsigned char source_digest[SHA256_DIGEST_SIZE];
+	char source_hex[SHA256_HEX_SIZE];
+	char* compiler;
+	const char* sysroot = getenv(SYSROOT_ENVNAME);
+
+	// Without a sysroot to fingerprint we can't tell when a probe goes stale.
+	if(sysroot == NULL || *sysroot == '\0')
+		return false;
+
+	compiler = find_program(probe->compiler);
+	if(compiler == NULL || sha256_file(probe->source, source_digest) != 0) {
+		free(compiler);
+		return false;
+	}
+
+	sha256_init(&ctx);
+	hash_string(&ctx, "version", "1");
+	hash_stat(&ctx, "compiler", compiler);
+	hash_string(&ctx, "source", sha256_hex(source_digest, source_hex));
+
+	for(int i = 1; i < probe->argc; i++) {
+		const char* arg = probe->argv[i];
+		hash_string(&ctx, "arg", arg);
+		// Search directories are part of the probe's inputs too.
+		if((strncmp(arg, "-I", 2) == 0 || strncmp(arg, "-L", 2) == 0) && arg[2] != '\0')
+			hash_stat(&ctx, "dir", arg + 2);
+		else if((strcmp(arg, "-I") == 0 || strcmp(arg, "-L") == 0 || strcmp(arg, "-isystem") == 0) && i + 1 < probe->argc)
+			hash_stat(&ctx, "dir", probe->argv[i + 1]);
+	}
+
+	for(const char* const* name = key_environment; *name != NULL; name++)
+		hash_string(&ctx, *name, getenv(*name));
+
+	hash_sysroot(&ctx, sysroot);
+
+	sha256_final(&ctx, digest);
+	sha256_hex(digest, key);
+	free(compiler);
+	return true;
+}
+
+static char* cache_root(void)
+{
+	const char* value = getenv(CACHE_ENVNAME);
+	const char* home = getenv("HOME");
+	if(value == NULL || *value == '\0' || strcmp(value, "0") == 0)
+		return NULL;
+	if(*value == PATH_SEP_CHR)
+		return strdup(value);
+	return home != NULL ? sprintf_alloc("%s/" DEFAULT_CACHE_DIR, home) : NULL;
+}
+
+static int copy_file(const char* from, const char* to, mode_t mode)
+{
+	ssize_t count;
+	int in, out, code = 0;
+	char buffer[COPY_BUFFER_SIZE];
+
+	in = open(from, O_RDONLY | O_CLOEXEC);
+	if(in < 0)
+		return -1;
+	out = open(to, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode);
+	if(out < 0) {
+		close(in);
+		return -1;
+	}
+
+	while((count = read(in, buffer, sizeof(buffer))) > 0) {
+		if(write(out, buffer, (size_t)count) != count) {
+			code = -1;
+			break;
+		}
+	}
+	if(count < 0)
+		code = -1;
+	close(in);
+	if(close(out) != 0)
+		code = -1;
+	return code;
+}
+
+static void dump_file(const char* path, int fd)
+{
+	ssize_t count;
+	char buffer[COPY_BUFFER_SIZE];
+	int in = open(path, O_RDONLY | O_CLOEXEC);
+	if(in < 0)
+		return;
+	while((count = read(in, buffer, sizeof(buffer))) > 0) {
+		if(write(fd, buffer, (size_t)count) != count)
+			break;
+	}
+	close(in);
+}
+
+// Path of a file in an entry; false if it doesn't fit, since a truncated
+// path would name some other entry's file.
+static bool entry_path(char* path, const char* entry, const char* name)
+{
+	return (size_t)snprintf(path, PATH_MAX, "%s/%s", entry, name) < PATH_MAX;
+}
+
+// Entries are flat directories, so there's nothing to recurse into.
+static void remove_entry(const char* entry)
+{
+	DIR* dir;
+	struct dirent* item;
+	char path[PATH_MAX] = "";
+
+	dir = opendir(entry);
+	if(dir == NULL)
+		return;
+	while((item = readdir(dir)) != NULL) {
+		if(strcmp(item->d_name, ".") == 0 || strcmp(item->d_name, "..") == 0)
+			continue;
+		if(entry_path(path, entry, item->d_name))
+			unlink(path);
+	}
+	closedir(dir);
+	rmdir(entry);
+}
+
+// Every header the cached probe read must still look the same.
+static bool deps_are_current(const char* deps_path)
+{
+	FILE* file;
+	bool current = true;
+	char line[PATH_MAX + 64] = "";
+
+	file = fopen(deps_path, "r");
+	if(file == NULL)
+		return false;
+
+	while(current && fgets(line, sizeof(line), file) != NULL) {
+		struct stat st;
+		long long size, mtime;
+		int offset = 0;
+		size_t len = strlen(line);
+		if(len > 0 && line[len - 1] == '\n')
+			line[--len] = '\0';
+		if(sscanf(line, "%lld %lld %n", &size, &mtime, &offset) != 2 || offset == 0)
+			continue;
+		current = stat(line + offset, &st) == 0 && (long long)st.st_size == size && (long long)st.st_mtime == mtime;
+		if(!current)
+			debuglog("probe dependency changed: %s", line + offset);
+	}
+	fclose(file);
+	return current;
+}
+
+static bool probe_replay(struct probe* probe, const char* entry, int* status)
+{
+	FILE* file;
+	struct stat st;
+	char path[PATH_MAX] = "";
+
+	if(!entry_path(path, entry, ENTRY_STATUS) || (file = fopen(path, "r")) == NULL)
+		return false;
+	if(fscanf(file, "%d", status) != 1) {
+		fclose(file);
+		return false;
+	}
+	fclose(file);
+
+	if(!entry_path(path, entry, ENTRY_DEPS) || (is_regular_file(path) && !deps_are_current(path)))
+		return false;
+
+	if(probe->output != NULL) {
+		if(!entry_path(path, entry, ENTRY_OUTPUT))
+			return false;
+		unlink(probe->output);
+		if(stat(path, &st) == 0 && copy_file(path, probe->output, st.st_mode & 07777) != 0)
+			return false;
+	}
+
+	if(entry_path(path, entry, ENTRY_STDOUT))
+		dump_file(path, STDOUT_FILENO);
+	if(entry_path(path, entry, ENTRY_STDERR))
+		dump_file(path, STDERR_FILENO);
+	return true;
+}
+
+static int run_compiler(char** argv, const char* stdout_path, const char* stderr_path)
+{
+	int status;
+	pid_t pid = fork();
+	if(pid < 0)
+		return -1;
+
+	if(pid == 0) {
+		int out = open(stdout_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		int err = open(stderr_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if(out < 0 || err < 0 || dup2(out, STDOUT_FILENO) < 0 || dup2(err, STDERR_FILENO) < 0)
+			_exit(127);
+		close(out);
+		close(err);
+		execvp(argv[0], argv);
+		_exit(127);
+	}
+
+	while(waitpid(pid, &status, 0) < 0) {
+		if(errno != EINTR)
+			return -1;
+	}
+	return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+// Turn the make-style depfile into "size mtime path" lines.
+static void write_deps(const char* depfile, const char* deps_path)
+{
+	FILE* in;
+	FILE* out;
+	strbuf_t* content = NULL;
+	char buffer[4096];
+	char *tok, *saveptr = NULL;
+
+	in = fopen(depfile, "r");
+	if(in == NULL)
+		return;
+	while(fgets(buffer, sizeof(buffer), in) != NULL)
+		content = strbuf_append(content, buffer);
+	fclose(in);
+	if(content == NULL)
+		return;
+
+	out = fopen(deps_path, "w");
+	if(out == NULL) {
+		strbuf_free(content);
+		return;
+	}
+
+	// Skip the "target:" part, then every other token is a prerequisite.
+	tok = strchr(content->ptr, ':');
+	for(tok = strtok_r(tok ? tok + 1 : content->ptr, " \t\r\n\\", &saveptr); tok != NULL; tok = strtok_r(NULL, " \t\r\n\\", &saveptr)) {
+		struct stat st;
+		if(is_conftest_source(tok) || stat(tok, &st) != 0)
+			continue;
+		fprintf(out, "%lld %lld %s\n", (long long)st.st_size, (long long)st.st_mtime, tok);
+	}
+	fclose(out);
+	strbuf_free(content);
+}
+
+static int probe_record(struct probe* probe, const char* entry)
+{
+	int status, argi = 0;
+	FILE* file;
+	char** argv;
+	char staging[PATH_MAX] = "";
+	char path[PATH_MAX] = "";
+	char out_path[PATH_MAX] = "";
+	char err_path[PATH_MAX] = "";
+	char dep_path[PATH_MAX] = "";
+	char* dep_arg = NULL;
+
+	// Stage the new entry beside the final one so it can be renamed in.
+	// Too long a path falls back to an uncached compile. The names of the
+	// other files are no longer than ENTRY_DEPFILE.
+	if((size_t)snprintf(staging, PATH_MAX, "%s.%ld.tmp", entry, (long)getpid()) >= PATH_MAX ||
+	   !entry_path(out_path, staging, ENTRY_STDOUT) || !entry_path(err_path, staging, ENTRY_STDERR) ||
+	   !entry_path(dep_path, staging, ENTRY_DEPFILE))
+		return -1;
+	if(mkdir_p(staging, 0755) != 0)
+		return -1;
+
+	argv = (char**)calloc((size_t)probe->argc + 3, sizeof(char*));
+	if(argv == NULL)
+		return -1;
+	for(int i = 0; i < probe->argc; i++)
+		argv[argi++] = probe->argv[i];
+	if(probe->has_depfile) {
+		dep_arg = sprintf_alloc("-Wp,-MD,%s", dep_path);
+		argv[argi++] = dep_arg;
+	}
+	argv[argi] = NULL;
+
+	status = run_compiler(argv, out_path, err_path);
+	free(dep_arg);
+	free(argv);
+	if(status < 0)
+		return -1;
+
+	// Pass the results through before caching them.
+	dump_file(out_path, STDOUT_FILENO);
+	dump_file(err_path, STDERR_FILENO);
+
+	if(probe->capture_stdout || status != 0 || is_regular_file(probe->output)) {
+		struct stat st;
+		if(probe->output != NULL && status == 0 && stat(probe->output, &st) == 0) {
+			entry_path(path, staging, ENTRY_OUTPUT);
+			copy_file(probe->output, path, st.st_mode & 07777);
+		}
+		if(probe->has_depfile) {
+			entry_path(path, staging, ENTRY_DEPS);
+			write_deps(dep_path, path);
+			unlink(dep_path);
+		}
+
+		entry_path(path, staging, ENTRY_STATUS);
+		file = fopen(path, "w");
+		if(file != NULL) {
+			fprintf(file, "%d\n", status);
+			if(fclose(file) == 0 && rename(staging, entry) == 0)
+				return status;
+		}
+	}
+
+	// Couldn't cache it (or lost a race with another configure); that's fine.
+	remove_entry(staging);
+	return status;
+}
+
+int main(int argc, char** argv)
+{
+	int status = 0;
+	struct probe probe;
+	char* root;
+	char key[SHA256_HEX_SIZE] = "";
+	char entry[PATH_MAX] = "";
+
+	if(argc < 2) {
+		fprintf(stderr, "Usage: %s COMPILER ARGS...\n", argv[0]);
+		return 2;
+	}
+
+	root = cache_root();
+	if(root == NULL || !probe_parse(&probe, argc - 1, argv + 1) || !probe_key(&probe, key)) {
+		free(root);
+		exec_compiler(argv + 1);
+	}
+
+	if((size_t)snprintf(entry, PATH_MAX, "%s/%.2s/%s", root, key, key + 2) >= PATH_MAX) {
+		free(root);
+		exec_compiler(argv + 1);
+	}
+	free(root);
+
+	if(is_folder(entry) && probe_replay(&probe, entry, &status)) {
+		debuglog("probe cache hit: %s (%s)", probe.source, key);
+		return status;
+	}
+
+	// Whatever is left is stale and would block the new entry's rename.
+	debuglog("probe cache miss: %s (%s)", probe.source, key);
+	remove_entry(entry);
+	status = probe_record(&probe, entry);
+	if(status < 0)
+		exec_compiler(argv + 1);
+	return status;
+}
@@ -0,0 +1,257 @@
+/**
+ * @file cross-run.c
+ * @author Charles Grunwald <cgrunwald@gmail.com>
+ * @brief Runs target programs against the sysroot's loader and libraries.
+ *
+ * Usage: <triple>-run [-L DIR]... [--] PROGRAM [ARGS...]
+ *
+ * Meant to be CMAKE_CROSSCOMPILING_EMULATOR, so it sits in front of every
+ * test ctest starts and every try_run. A dynamically linked PROGRAM is
+ * replaced in-place by the sysroot's copy of its PT_INTERP loader, with
+ * --library-path set to the -L directories, the program's own RUNPATH and
+ * the sysroot's library directories. Nothing is forked and the environment
+ * is passed through untouched, so no LD_LIBRARY_PATH leaks into the
+ * processes PROGRAM starts and the test's exit status and signals are its
+ * own. The host's ld.so.cache is ignored.
+ *
+ * The loader searches --library-path before any DT_RUNPATH, so the
+ * program's RUNPATH entries are repeated ahead of the sysroot's directories;
+ * otherwise a sysroot copy of a library would shadow the build tree library
+ * under test. $ORIGIN is expanded against the program's directory and
+ * absolute entries are looked up in the sysroot first.
+ *
+ * Static programs and scripts are exec'd directly.
+ */
+#define _GNU_SOURCE
+
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shared.h"
+#include "strutil.h"
+#include "strarray.h"
+#include "elffile.h"
+#include "libcross.h"
+
+#define PATH_SEP_CHR '/'
+#define ENV_SEP ":"
+
+#define UNAME_SUFFIX "-run"
+#define ARGV0_OPTION "--argv0"
+
+// Library directories searched in the sysroot, after any -L directories.
+static const char* const sysroot_libdirs[] = {
+	"lib64", "usr/lib64", "lib/x86_64-linux-gnu", "usr/lib/x86_64-linux-gnu", "lib", "usr/lib", NULL
+};
+
+static CC_NORETURN fatal_message(int code, const char* format, ...)
+{
+	va_list args;
+	fprintf(stderr, "ERROR: ");
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+	fprintf(stderr, "\n");
+	exit(code != 0 ? code : 1);
+}
+
+static void usage(const char* exe)
+{
+	printf("Usage: %s [-L DIR]... [--] PROGRAM [ARGS...]\n\n", exe);
+	printf("Runs a target PROGRAM through the sysroot's loader, with the sysroot's\n");
+	printf("libraries in front of the host's. Use it as CMAKE_CROSSCOMPILING_EMULATOR.\n\n");
+	printf("  -L DIR  Search DIR for libraries before the sysroot (repeatable)\n");
+}
+
+static bool accept_path(struct cross_strref* CPP_UNUSED(path), void* CPP_UNUSED(userdata))
+{
+	return true;
+}
+
+/*
+ * Loaders older than glibc 2.33 don't take --argv0, and treat it as the
+ * program to run. Its help text is in the loader's rodata if it does.
+ */
+static bool loader_has_argv0(const char* loader)
+{
+	bool found = false;
+	struct stat st;
+	void* data;
+	int fd = open(loader, O_RDONLY | O_CLOEXEC);
+
+	if(fd < 0)
+		return false;
+	if(fstat(fd, &st) == 0 && st.st_size > 0) {
+		data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(data != MAP_FAILED) {
+			found = memmem(data, (size_t)st.st_size, ARGV0_OPTION, sizeof(ARGV0_OPTION) - 1) != NULL;
+			munmap(data, (size_t)st.st_size);
+		}
+	}
+	close(fd);
+	return found;
+}
+
+/*
+ * Add PROGRAM's DT_RUNPATH entries to libdirs, as host directories.
+ */
+static string_array* runpath_dirs(string_array* libdirs, const char* sysroot, const char* program, const char* runpath)
+{
+	char *paths, *tok, *dir, *slash;
+	char *saveptr = NULL;
+	char origin[PATH_MAX] = "";
+
+	if(realpath(program, origin) != NULL && (slash = strrchr(origin, PATH_SEP_CHR)) != NULL)
+		*slash = '\0';
+	if((paths = strdup(runpath)) == NULL)
+		return libdirs;
+
+	for(tok = strtok_r(paths, ENV_SEP, &saveptr); tok != NULL; tok = strtok_r(NULL, ENV_SEP, &saveptr)) {
+		if(strncmp(tok, "$ORIGIN", 7) == 0 && *origin)
+			dir = sprintf_alloc("%s%s", origin, tok + 7);
+		else if(strncmp(tok, "${ORIGIN}", 9) == 0 && *origin)
+			dir = sprintf_alloc("%s%s", origin, tok + 9);
+		else if(*tok == PATH_SEP_CHR && strchr(tok, '$') == NULL)
+			dir = sprintf_alloc("%s%s", sysroot, tok);
+		else
+			continue;
+		if(dir == NULL)
+			break;
+		// Build tree entries are host paths, not sysroot ones
+		if(!is_folder(dir) && *tok == PATH_SEP_CHR) {
+			free(dir);
+			dir = strdup(tok);
+		}
+		if(dir != NULL && is_folder(dir))
+			libdirs = string_array_push(libdirs, dir);
+		else
+			free(dir);
+	}
+	free(paths);
+	return libdirs;
+}
+
+static char* library_path(const char* sysroot, string_array* libdirs)
+{
+	char* result = NULL;
+	char* dir;
+	size_t index;
+
+	for(index = 0; sysroot_libdirs[index] != NULL; index++) {
+		if((dir = sprintf_alloc("%s/%s", sysroot, sysroot_libdirs[index])) == NULL)
+			return NULL;
+		if(is_folder(dir))
+			libdirs = string_array_push(libdirs, dir);
+		else
+			free(dir);
+	}
+	if(libdirs == NULL)
+		return strdup("");
+
+	for(index = 0; index < libdirs->len; index++) {
+		char* joined = index == 0 ? strdup(libdirs->ptr[index]) :
+		                            sprintf_alloc("%s:%s", result, libdirs->ptr[index]);
+		free(result);
+		if(joined == NULL)
+			return NULL;
+		result = joined;
+	}
+	string_array_free(libdirs);
+	return result;
+}
+
+/*
+ * Find PROGRAM the way execvp would, so the loader is handed a path.
+ */
+static char* resolve_program(struct cross_context* ctx, const char* program)
+{
+	char* result = NULL;
+
+	if(strchr(program, PATH_SEP_CHR) != NULL)
+		return strdup(program);
+	if(cross_which_path(ctx, program, getenv("PATH"), accept_path, NULL, &result) != CROSS_OK || result == NULL)
+		fatal_message(ENOENT, "Failed to locate %s", program);
+	return result;
+}
+
+int main(int argc, char** argv)
+{
+	int opt, code;
+	size_t index = 0;
+	char exe[PATH_MAX] = "";
+	char* sysroot = NULL;
+	char* program;
+	char* loader;
+	char* libpath;
+	const char* runpath;
+	char** loader_argv;
+	string_array* libdirs = NULL;
+	struct elf_file elf;
+	struct cross_paths paths;
+	struct cross_context ctx;
+
+	while((opt = getopt(argc, argv, "+L:h")) != -1) {
+		switch(opt) {
+			case 'L':
+				libdirs = string_array_push(libdirs, strdup(optarg));
+				break;
+			case 'h':
+				usage(argv[0]);
+				return 0;
+			default:
+				usage(argv[0]);
+				return 2;
+		}
+	}
+	if(optind >= argc) {
+		usage(argv[0]);
+		return 2;
+	}
+
+	if(cross_context_init(&ctx, NULL) != CROSS_OK || proc_path(exe, PATH_MAX) != 0)
+		fatal_message(errno, "Failed to look up our own path");
+	if(cross_paths_init(&ctx, &paths, exe, UNAME_SUFFIX) != CROSS_OK ||
+	   cross_resolve_sysroot(&ctx, &paths, &sysroot) != CROSS_OK)
+		fatal_message(cross_exit_code(&ctx), "%s", cross_context_error(&ctx));
+
+	program = resolve_program(&ctx, argv[optind]);
+	code = elf_file_open(&elf, program);
+	if(code == -ENOEXEC || (code == 0 && elf.interp == NULL)) {
+		if(code == 0)
+			elf_file_close(&elf);
+		execv(program, argv + optind);
+		fatal_message(errno, "Failed to run %s: %s", program, strerror(errno));
+	} else if(code != 0) {
+		fatal_message(-code, "Failed to open %s: %s", program, strerror(-code));
+	}
+
+	if((loader = sprintf_alloc("%s%s", sysroot, elf.interp)) == NULL)
+		fatal_message(ENOMEM, "Out of memory");
+	if((runpath = elf_file_runpath(&elf)) != NULL)
+		libdirs = runpath_dirs(libdirs, sysroot, program, runpath);
+	elf_file_close(&elf);
+	if(access(loader, X_OK) != 0)
+		fatal_message(errno, "Failed to locate the target loader: %s", loader);
+	if((libpath = library_path(sysroot, libdirs)) == NULL)
+		fatal_message(ENOMEM, "Out of memory");
+
+	// loader --library-path P --inhibit-cache [--argv0 NAME] PROGRAM ARGS... NULL
+	loader_argv = (char**)calloc((size_t)(argc - optind) + 8, sizeof(char*));
+	if(loader_argv == NULL)
+		fatal_message(ENOMEM, "Out of memory");
+	loader_argv[index++] = loader;
+	loader_argv[index++] = "--library-path";
+	loader_argv[index++] = libpath;
+	loader_argv[index++] = "--inhibit-cache";
+	if(loader_has_argv0(loader)) {
+		loader_argv[index++] = ARGV0_OPTION;
+		loader_argv[index++] = argv[optind];
+	}
+	loader_argv[index++] = program;
+	for(opt = optind + 1; opt < argc; opt++)
+		loader_argv[index++] = argv[opt];
+
+	execv(loader, loader_argv);
+	fatal_message(errno, "Failed to run %s: %s", loader, strerror(errno));
+}
@@ -0,0 +1,675 @@
+/**
+ * @file cross-stage.c
+ * @author Charles Grunwald <cgrunwald@gmail.com>
+ * @brief Incremental installs into the staging sysroot.
+ *
+ * Usage: <triple>-stage [-j JOBS] [-v] -- COMMAND [ARGS...]
+ *        <triple>-stage --install [INSTALL OPTIONS] SOURCE... DEST
+ *
+ * A plain install rewrites every file it installs, and every package built
+ * against the sysroot afterwards sees newer headers and libraries and
+ * rebuilds. Installs through here leave files whose contents haven't changed
+ * exactly as they were, timestamps included.
+ *
+ * The first form runs an install COMMAND (`make install`, `cmake --install`)
+ * with DESTDIR pointing at a scratch tree next to the sysroot, then merges
+ * the scratch tree in: identical files are skipped, and new or changed ones
+ * are renamed over the old in one step, so nothing sees a half-written file
+ * and a failed install leaves the sysroot untouched. <triple>-cmake runs its
+ * installs this way. If DESTDIR was already set, that is where the tree is
+ * merged.
+ *
+ * The second form is an install(1) for INSTALL, which <triple>-configure
+ * sets. Changed files are cloned (reflinked where the filesystem can) or
+ * copied in the kernel with copy_file_range into a temporary next to the
+ * destination and renamed into place. -s strips with STRIPPROG, defaulting
+ * to the toolchain's strip, before comparing.
+ *
+ * Both forms work through their files in parallel. When CROSS_STAGE_LOG
+ * names a file, every path installed or found up to date is appended to it,
+ * which is how <triple>-pkg-cache learns about the files that were skipped.
+ */
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#if defined(HAVE_LINUX_FS_H)
+#	include <sys/ioctl.h>
+#	include <linux/fs.h>
+#endif
+
+#include "shared.h"
+#include "strutil.h"
+#include "strarray.h"
+#include "libcross.h"
+#include "workqueue.h"
+
+#define PATH_SEP_CHR '/'
+
+#define UNAME_SUFFIX "-stage"
+#define LOG_ENVNAME "CROSS_STAGE_LOG"
+#define SCRATCH_NAME ".cross-stage.XXXXXX"
+#define INSTALL_ARG "--install"
+
+#define COMPARE_BUFFER_SIZE (64 * 1024)
+#define COPY_BUFFER_SIZE (64 * 1024)
+
+struct stage
+{
+	struct cross_context ctx;
+	struct cross_paths paths;
+	bool have_paths;
+	bool verbose;
+	size_t jobs;
+	int log_fd;
+	pthread_mutex_t lock;
+	size_t installed;
+	size_t unchanged;
+	size_t failed;
+	// Merging a scratch tree: files can be moved into place, and keep their times.
+	const char* scratch;
+	const char* root;
+	// install(1): default mode and -p/-s.
+	mode_t mode;
+	bool preserve_times;
+	const char* strip;
+};
+
+struct install_item
+{
+	char* source;
+	char* dest;
+};
+
+static CC_NORETURN fatal_message(int code, const char* format, ...)
+{
+	va_list args;
+	fprintf(stderr, "ERROR: ");
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+	fprintf(stderr, "\n");
+	exit(code != 0 ? code : 1);
+}
+
+static void usage(const char* exe)
+{
+	printf("Usage: %s [-j JOBS] [-v] -- COMMAND [ARGS...]\n", exe);
+	printf("       %s " INSTALL_ARG " [-cCDpsTv] [-m MODE] [-t DIR] SOURCE... DEST\n", exe);
+	printf("       %s " INSTALL_ARG " -d [-m MODE] DIR...\n\n", exe);
+	printf("Runs an install COMMAND into a scratch DESTDIR and merges the result into\n");
+	printf("the sysroot (or the DESTDIR set), leaving unchanged files untouched. With\n");
+	printf(INSTALL_ARG ", works as install(1) with the same behaviour.\n\n");
+	printf("  -j JOBS  Files merged at once (default: one per CPU)\n");
+	printf("  -v       Print each file installed\n");
+}
+
+static void stage_error(struct stage* stage, const char* what, const char* path)
+{
+	fprintf(stderr, "ERROR: Failed to %s %s: %s\n", what, path, strerror(errno));
+	pthread_mutex_lock(&stage->lock);
+	stage->failed++;
+	pthread_mutex_unlock(&stage->lock);
+}
+
+static void stage_done(struct stage* stage, const char* path, bool changed)
+{
+	pthread_mutex_lock(&stage->lock);
+	if(changed)
+		stage->installed++;
+	else
+		stage->unchanged++;
+	if(stage->verbose)
+		printf("-- %s: %s\n", changed ? "Installing" : "Up-to-date", path);
+	pthread_mutex_unlock(&stage->lock);
+	if(stage->log_fd >= 0) {
+		// One write per line, so concurrent installs can share the log.
+		char* line = sprintf_alloc("%s\n", path);
+		if(line != NULL) {
+			if(write(stage->log_fd, line, strlen(line)) < 0)
+				stage->log_fd = -1;
+			free(line);
+		}
+	}
+}
+
+/*
+ * Comparing and copying
+ */
+
+static bool read_full(int fd, char* buffer, size_t size)
+{
+	while(size > 0) {
+		ssize_t count = read(fd, buffer, size);
+		if(count < 0 && errno == EINTR)
+			continue;
+		if(count <= 0)
+			return false;
+		buffer += count;
+		size -= (size_t)count;
+	}
+	return true;
+}
+
+/*
+ * Whether @p path holds the same bytes as @p other_fd (already known to be
+ * @p size long). A straight comparison stops at the first difference and
+ * costs no more than hashing both would.
+ */
+static bool same_contents(int other_fd, const char* path, off_t size)
+{
+	int fd;
+	bool same = true;
+	char* left;
+	char* right;
+
+	if((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+		return false;
+	left = (char*)malloc(COMPARE_BUFFER_SIZE);
+	right = (char*)malloc(COMPARE_BUFFER_SIZE);
+	if(left == NULL || right == NULL || lseek(other_fd, 0, SEEK_SET) != 0)
+		same = false;
+	while(same && size > 0) {
+		size_t chunk = size > COMPARE_BUFFER_SIZE ? COMPARE_BUFFER_SIZE : (size_t)size;
+		same = read_full(other_fd, left, chunk) && read_full(fd, right, chunk) && memcmp(left, right, chunk) == 0;
+		size -= (off_t)chunk;
+	}
+	free(left);
+	free(right);
+	close(fd);
+	return same;
+}
+
+/*
+ * Copy all of @p in to @p out: a reflink where the filesystem shares
+ * extents, else copy_file_range, else read and write.
+ */
+static int clone_contents(int in, int out, off_t CPP_UNUSED(size))
+{
+	ssize_t count;
+	char buffer[COPY_BUFFER_SIZE];
+
+#if defined(FICLONE)
+	if(ioctl(out, FICLONE, in) == 0)
+		return 0;
+#endif
+#if defined(HAVE_COPY_FILE_RANGE)
+	while(size > 0) {
+		count = copy_file_range(in, NULL, out, NULL, (size_t)size, 0);
+		if(count <= 0)
+			break;
+		size -= (off_t)count;
+	}
+	if(size == 0)
+		return 0;
+#endif
+	while((count = read(in, buffer, sizeof(buffer))) != 0) {
+		if(count < 0 && errno == EINTR)
+			continue;
+		if(count < 0 || write(out, buffer, (size_t)count) != count)
+			return -1;
+	}
+	return 0;
+}
+
+// A temporary in @p dest's directory, so the final rename can't cross filesystems.
+static int open_temp(const char* dest, char* temp)
+{
+	int fd;
+	snprintf(temp, PATH_MAX, "%s.stage.XXXXXX", dest);
+	if((fd = mkstemp(temp)) >= 0)
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+	return fd;
+}
+
+static void stage_symlink(struct stage* stage, const char* source, const char* dest)
+{
+	char target[PATH_MAX] = "";
+	char current[PATH_MAX] = "";
+	char temp[PATH_MAX] = "";
+	ssize_t len;
+
+	if((len = readlink(source, target, PATH_MAX - 1)) < 0) {
+		stage_error(stage, "read", source);
+		return;
+	}
+	target[len] = '\0';
+	if((len = readlink(dest, current, PATH_MAX - 1)) >= 0) {
+		current[len] = '\0';
+		if(strcmp(target, current) == 0) {
+			stage_done(stage, dest, false);
+			return;
+		}
+	}
+	snprintf(temp, PATH_MAX, "%s.stage.%ld", dest, (long)getpid());
+	unlink(temp);
+	if(symlink(target, temp) != 0 || rename(temp, dest) != 0) {
+		unlink(temp);
+		stage_error(stage, "install", dest);
+		return;
+	}
+	stage_done(stage, dest, true);
+}
+
+/*
+ * Install @p source as @p dest with @p mode, unless @p dest already holds the
+ * same contents. A scratch tree's files are moved rather than copied.
+ */
+static void stage_file(struct stage* stage, const char* source, const char* dest, mode_t mode)
+{
+	int in, out = -1;
+	char temp[PATH_MAX] = "";
+	struct stat src_st, dest_st;
+	bool have_dest;
+	bool stripped = false;
+
+	if(lstat(source, &src_st) != 0) {
+		stage_error(stage, "stat", source);
+		return;
+	}
+	if(S_ISLNK(src_st.st_mode)) {
+		stage_symlink(stage, source, dest);
+		return;
+	}
+	if((in = open(source, O_RDONLY | O_CLOEXEC)) < 0) {
+		stage_error(stage, "open", source);
+		return;
+	}
+	have_dest = lstat(dest, &dest_st) == 0;
+
+	// Strip a copy first; what matters is how the stripped file compares.
+	if(stage->strip != NULL) {
+		char* argv[] = { (char*)stage->strip, temp, NULL };
+		if((out = open_temp(dest, temp)) < 0 || clone_contents(in, out, src_st.st_size) != 0 || close(out) != 0 ||
+		   run_command(argv) != 0 || stat(temp, &src_st) != 0) {
+			stage_error(stage, "strip", dest);
+			goto cleanup;
+		}
+		close(in);
+		out = -1;
+		if((in = open(temp, O_RDONLY | O_CLOEXEC)) < 0) {
+			stage_error(stage, "open", temp);
+			goto cleanup;
+		}
+		stripped = true;
+	}
+
+	if(have_dest && S_ISREG(dest_st.st_mode) && dest_st.st_size == src_st.st_size &&
+	   same_contents(in, dest, src_st.st_size)) {
+		if((dest_st.st_mode & 07777) != mode && chmod(dest, mode) != 0)
+			stage_error(stage, "chmod", dest);
+		else
+			stage_done(stage, dest, false);
+		goto cleanup;
+	}
+
+	if(stripped) {
+		// The stripped copy is already next to its destination.
+		if(chmod(temp, mode) != 0 || rename(temp, dest) != 0)
+			stage_error(stage, "install", dest);
+		else
+			stage_done(stage, dest, true);
+		goto cleanup;
+	}
+	if(stage->scratch != NULL) {
+		if(rename(source, dest) == 0) {
+			if((src_st.st_mode & 07777) != mode)
+				chmod(dest, mode);
+			stage_done(stage, dest, true);
+			goto cleanup;
+		} else if(errno != EXDEV) {
+			stage_error(stage, "install", dest);
+			goto cleanup;
+		}
+	}
+
+	if(lseek(in, 0, SEEK_SET) != 0 || (out = open_temp(dest, temp)) < 0 ||
+	   clone_contents(in, out, src_st.st_size) != 0 || fchmod(out, mode) != 0) {
+		stage_error(stage, "copy", dest);
+		goto cleanup;
+	}
+	if(stage->preserve_times) {
+		struct timespec times[2] = { src_st.st_atim, src_st.st_mtim };
+		futimens(out, times);
+	}
+	if(close(out) != 0 || rename(temp, dest) != 0) {
+		out = -1;
+		stage_error(stage, "install", dest);
+		goto cleanup;
+	}
+	out = -1;
+	temp[0] = '\0';
+	stage_done(stage, dest, true);
+
+cleanup:
+	if(out >= 0)
+		close(out);
+	if(temp[0] != '\0')
+		unlink(temp);
+	close(in);
+}
+
+/*
+ * Merging a scratch tree. Each directory is read by one handler, which makes
+ * its counterpart under the root and queues its files and subdirectories.
+ */
+static void merge_item(struct workqueue* wq, char* relpath, struct stage* stage)
+{
+	char source[PATH_MAX] = "";
+	char dest[PATH_MAX] = "";
+	struct stat st;
+	DIR* dir;
+	struct dirent* entry;
+
+	snprintf(source, PATH_MAX, "%s%s", stage->scratch, relpath);
+	snprintf(dest, PATH_MAX, "%s%s", stage->root, relpath);
+	if(lstat(source, &st) != 0) {
+		stage_error(stage, "stat", source);
+	} else if(!S_ISDIR(st.st_mode)) {
+		stage_file(stage, source, dest, st.st_mode & 07777);
+	} else if(*dest != '\0' && mkdir_p(dest, st.st_mode & 07777) != 0) {
+		stage_error(stage, "create", dest);
+	} else if((dir = opendir(source)) == NULL) {
+		stage_error(stage, "read", source);
+	} else {
+		while((entry = readdir(dir)) != NULL) {
+			char* child;
+			if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+				continue;
+			if((child = sprintf_alloc("%s/%s", relpath, entry->d_name)) == NULL || workqueue_push(wq, child) != 0) {
+				free(child);
+				stage_error(stage, "queue", source);
+			}
+		}
+		closedir(dir);
+	}
+	free(relpath);
+}
+
+static void install_item(struct workqueue* CPP_UNUSED(wq), struct install_item* item, struct stage* stage)
+{
+	stage_file(stage, item->source, item->dest, stage->mode);
+	free(item->source);
+	free(item->dest);
+	free(item);
+}
+
+static void open_log(struct stage* stage)
+{
+	const char* path = getenv(LOG_ENVNAME);
+	stage->log_fd = -1;
+	if(path != NULL && *path != '\0' && (stage->log_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) < 0)
+		fprintf(stderr, "WARNING: Failed to open %s: %s\n", path, strerror(errno));
+}
+
+static void init_stage(struct stage* stage)
+{
+	char exe[PATH_MAX] = "";
+
+	memset((void*)stage, 0, sizeof(*stage));
+	pthread_mutex_init(&stage->lock, NULL);
+	stage->mode = 0755;
+	open_log(stage);
+	if(proc_path(exe, PATH_MAX) == 0 && cross_context_init(&stage->ctx, NULL) == CROSS_OK &&
+	   cross_paths_init(&stage->ctx, &stage->paths, exe, UNAME_SUFFIX) == CROSS_OK)
+		stage->have_paths = true;
+}
+
+static void reset_stage(struct stage* stage)
+{
+	if(stage->have_paths)
+		cross_paths_reset(&stage->ctx, &stage->paths);
+	if(stage->log_fd >= 0)
+		close(stage->log_fd);
+	pthread_mutex_destroy(&stage->lock);
+}
+
+/*
+ * <triple>-stage -- COMMAND
+ */
+
+// Next to the sysroot, so the merge can rename instead of copying.
+static char* make_scratch(struct stage* stage)
+{
+	char* sysroot = NULL;
+	char* scratch = NULL;
+	const char* tmpdir = getenv("TMPDIR");
+
+	if(stage->have_paths && cross_resolve_sysroot(&stage->ctx, &stage->paths, &sysroot) == CROSS_OK &&
+	   access(sysroot, W_OK) == 0)
+		scratch = sprintf_alloc("%s/" SCRATCH_NAME, sysroot);
+	if(sysroot != NULL)
+		cross_free(&stage->ctx, sysroot);
+	if(scratch == NULL)
+		scratch = sprintf_alloc("%s/" SCRATCH_NAME, tmpdir != NULL && *tmpdir != '\0' ? tmpdir : "/tmp");
+	if(scratch == NULL || mkdtemp(scratch) == NULL)
+		fatal_message(errno, "Failed to create a scratch directory: %s", strerror(errno));
+	return scratch;
+}
+
+static int stage_command(struct stage* stage, char** command)
+{
+	int status;
+	char* scratch;
+	char* root;
+	const char* destdir = getenv("DESTDIR");
+	struct workqueue wq;
+
+	root = strdup(destdir != NULL ? destdir : "");
+	if(root == NULL)
+		fatal_message(ENOMEM, "Out of memory");
+	while(*root != '\0' && root[strlen(root) - 1] == PATH_SEP_CHR)
+		root[strlen(root) - 1] = '\0';
+	scratch = make_scratch(stage);
+
+	// The files logged are the ones merged below, not their scratch copies.
+	setenv("DESTDIR", scratch, 1);
+	unsetenv(LOG_ENVNAME);
+	status = run_command(command);
+	if(status != 0) {
+		remove_tree(scratch);
+		free(scratch);
+		free(root);
+		return status < 0 ? 1 : status;
+	}
+
+	stage->scratch = scratch;
+	stage->root = root;
+	stage->preserve_times = true;
+	if(workqueue_init(&wq, stage->jobs, (workqueue_handler)merge_item, stage) != 0)
+		fatal_message(ENOMEM, "Failed to start the merge workers");
+	if(workqueue_push(&wq, strdup("")) != 0)
+		fatal_message(ENOMEM, "Out of memory");
+	workqueue_finish(&wq);
+
+	printf("-- Staged into %s: %zu installed, %zu up to date%s\n", *root != '\0' ? root : "/", stage->installed,
+	       stage->unchanged, stage->failed > 0 ? ", some failed" : "");
+	remove_tree(scratch);
+	free(scratch);
+	free(root);
+	return stage->failed > 0 ? 1 : 0;
+}
+
+/*
+ * <triple>-stage --install, for INSTALL. Anything it doesn't handle is
+ * passed on to the real install.
+ */
+static CC_NORETURN fallback_install(char** argv)
+{
+	argv[0] = "install";
+	execvp(argv[0], argv);
+	fatal_message(errno, "Failed to run install: %s", strerror(errno));
+}
+
+static char* default_strip(struct stage* stage)
+{
+	const char* strip = getenv("STRIPPROG");
+	char* path;
+	if(strip != NULL && *strip != '\0')
+		return strdup(strip);
+	// These are target binaries, which the host's strip may not understand.
+	if(stage->have_paths && (path = sprintf_alloc("%s/%s-strip", stage->paths.bindir.value, stage->paths.uname.value)) != NULL) {
+		if(access(path, X_OK) == 0)
+			return path;
+		free(path);
+	}
+	return strdup("strip");
+}
+
+static int install_command(struct stage* stage, int argc, char** argv)
+{
+	int opt, option_index;
+	bool directories = false, create_leading = false, no_target_dir = false;
+	const char* target_dir = NULL;
+	size_t dir_len = 0;
+	char* strip = NULL;
+	char* end;
+	struct workqueue wq;
+	static const struct option long_options[] = {
+		{ "directory", no_argument, NULL, 'd' },
+		{ "mode", required_argument, NULL, 'm' },
+		{ "preserve-timestamps", no_argument, NULL, 'p' },
+		{ "strip", no_argument, NULL, 's' },
+		{ "strip-program", required_argument, NULL, 'S' + 0x100 },
+		{ "target-directory", required_argument, NULL, 't' },
+		{ "no-target-directory", no_argument, NULL, 'T' },
+		{ "compare", no_argument, NULL, 'C' },
+		{ "verbose", no_argument, NULL, 'v' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	// argv[0] is --install; getopt starts after it.
+	optind = 1;
+	opterr = 0;
+	while((opt = getopt_long(argc, argv, "bcCdDm:pst:Tv", long_options, &option_index)) != -1) {
+		switch(opt) {
+			case 'c':
+			case 'C':
+				// Copying is all we do, and comparing is the point.
+				break;
+			case 'd':
+				directories = true;
+				break;
+			case 'D':
+				create_leading = true;
+				break;
+			case 'm':
+				// Only octal modes; anything else goes to the real install.
+				stage->mode = (mode_t)strtoul(optarg, &end, 8);
+				if(*end != '\0' || *optarg == '\0')
+					fallback_install(argv);
+				break;
+			case 'p':
+				stage->preserve_times = true;
+				break;
+			case 's':
+				if(strip == NULL)
+					strip = default_strip(stage);
+				break;
+			case 'S' + 0x100:
+				free(strip);
+				strip = strdup(optarg);
+				break;
+			case 't':
+				target_dir = optarg;
+				break;
+			case 'T':
+				no_target_dir = true;
+				break;
+			case 'v':
+				stage->verbose = true;
+				break;
+			default:
+				fallback_install(argv);
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	stage->strip = strip;
+
+	if(directories) {
+		for(int i = 0; i < argc; i++) {
+			if(mkdir_p(argv[i], stage->mode) != 0 || chmod(argv[i], stage->mode) != 0)
+				stage_error(stage, "create", argv[i]);
+		}
+		free(strip);
+		return stage->failed > 0 ? 1 : 0;
+	}
+	if(argc < (target_dir != NULL ? 1 : 2))
+		fatal_message(EINVAL, "install: missing destination operand");
+	if(target_dir == NULL && !no_target_dir && (argc > 2 || is_folder(argv[argc - 1])))
+		target_dir = argv[--argc];
+	else if(target_dir == NULL)
+		argc--;
+	if(create_leading && target_dir != NULL && mkdir_p(target_dir, 0755) != 0)
+		fatal_message(errno, "install: failed to create %s: %s", target_dir, strerror(errno));
+
+	if(target_dir != NULL) {
+		dir_len = strlen(target_dir);
+		while(dir_len > 1 && target_dir[dir_len - 1] == PATH_SEP_CHR)
+			dir_len--;
+	}
+
+	if(workqueue_init(&wq, stage->jobs, (workqueue_handler)install_item, stage) != 0)
+		fatal_message(ENOMEM, "Failed to start the install workers");
+	for(int i = 0; i < argc; i++) {
+		struct install_item* item = (struct install_item*)malloc(sizeof(struct install_item));
+		const char* name = strrchr(argv[i], PATH_SEP_CHR);
+		if(item == NULL)
+			fatal_message(ENOMEM, "Out of memory");
+		item->source = strdup(argv[i]);
+		if(target_dir != NULL)
+			item->dest = sprintf_alloc("%.*s/%s", (int)dir_len, target_dir, name != NULL ? name + 1 : argv[i]);
+		else
+			item->dest = strdup(argv[argc]);
+		if(item->source == NULL || item->dest == NULL)
+			fatal_message(ENOMEM, "Out of memory");
+		if(create_leading && target_dir == NULL && mkdir_parent(item->dest) != 0)
+			stage_error(stage, "create the directory of", item->dest);
+		if(workqueue_push(&wq, item) != 0)
+			fatal_message(ENOMEM, "Out of memory");
+	}
+	workqueue_finish(&wq);
+	free(strip);
+	return stage->failed > 0 ? 1 : 0;
+}
+
+int main(int argc, char** argv)
+{
+	int opt, code;
+	struct stage stage;
+
+	init_stage(&stage);
+	if(argc > 1 && strcmp(argv[1], INSTALL_ARG) == 0) {
+		code = install_command(&stage, argc - 1, argv + 1);
+		reset_stage(&stage);
+		return code;
+	}
+
+	while((opt = getopt(argc, argv, "+j:vh")) != -1) {
+		switch(opt) {
+			case 'j':
+				stage.jobs = (size_t)strtoul(optarg, NULL, 10);
+				break;
+			case 'v':
+				stage.verbose = true;
+				break;
+			case 'h':
+				usage(argv[0]);
+				return 0;
+			default:
+				usage(argv[0]);
+				return 2;
+		}
+	}
+	if(optind >= argc) {
+		usage(argv[0]);
+		return 2;
+	}
+	code = stage_command(&stage, argv + optind);
+	reset_stage(&stage);
+	return code;
+}
@@ -0,0 +1,728 @@
+/**
+ * @file cross-sysroot-index.c
+ * @author Charles Grunwald <cgrunwald@gmail.com>
+ * @brief Indexes the sysroot's libraries, headers and packages for CMake.
+ *
+ * Every find_library, find_path and find_package call in a project stats a
+ * long list of candidate paths under the sysroot, most of which don't exist.
+ * This walks the handful of directories those searches actually cover, once,
+ * and writes the result out as a CMake script that the toolchain file
+ * includes:
+ *
+ *   - the UnixPaths search prefixes the sysroot doesn't have, so they can be
+ *     dropped from the search;
+ *   - <Package>_DIR for every package config file with a single location;
+ *   - the pkg-config directories;
+ *   - the first directory providing each library and top-level header, for
+ *     cross_find_library and cross_find_path.
+ *
+ * The modification time of every directory read is recorded in the index, so
+ * running the tool again only rewrites it when one of them has changed.
+ */
+#include <dirent.h>
+#include <getopt.h>
+#include <sys/stat.h>
+
+#include "shared.h"
+#include "strutil.h"
+#include "strarray.h"
+#include "hashmap.h"
+#include "libcross.h"
+
+#define PATH_SEP_CHR '/'
+
+#define UNAME_SUFFIX "-sysroot-index"
+#define INDEX_FILENAME "sysroot-index.cmake"
+#define INDEX_VERSION 2
+#define STAMP_PREFIX "#@ "
+#define STAMP_ABSENT "-"
+
+struct sysroot_index
+{
+	char* sysroot;
+	size_t sysroot_len;
+	char* arch;
+	bool verbose;
+
+	string_array* stamps;
+	string_array* absent;
+	string_array* libdirs;
+	string_array* includedirs;
+	string_array* pkgconfigdirs;
+	string_array* package_dirs;
+
+	struct hashmap libraries;
+	struct hashmap headers;
+	struct hashmap packages;
+	struct hashmap seen_dirs;
+};
+
+// UnixPaths search locations that only help when the sysroot has them.
+static const char* const optional_paths[] = {
+	"/usr/local", "/usr/X11R6", "/usr/pkg", "/opt", "/usr/include/X11", "/usr/lib/X11", NULL
+};
+
+static const char* const search_prefixes[] = { "/usr/local", "/usr", "", NULL };
+
+// Marks a package found in more than one place; find_package has to decide.
+static char ambiguous_package[] = "";
+
+static CC_NORETURN fatal_message(int code, const char* format, ...)
+{
+	va_list args;
+	fprintf(stderr, "ERROR: ");
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+	fprintf(stderr, "\n");
+	exit(code != 0 ? code : 1);
+}
+
+static void usage(const char* exe)
+{
+	printf("Usage: %s [-s SYSROOT] [-a ARCH] [-o INDEX] [-c] [-f] [-v]\n\n", exe);
+	printf("Writes an index of the sysroot's libraries, headers and CMake packages\n");
+	printf("for the toolchain file, unless the existing one is still current.\n\n");
+	printf("  -s SYSROOT  Sysroot to index (default: derived from our path)\n");
+	printf("  -a ARCH     CPU whose multiarch directories come first (default: the\n");
+	printf("              one in our target triple)\n");
+	printf("  -o INDEX    Index to write (default: next to the sysroot)\n");
+	printf("  -c          Only check; exit with 1 if the index is out of date\n");
+	printf("  -f          Rewrite the index even if it is current\n");
+	printf("  -v          Report what was done\n");
+}
+
+static ALWAYS_INLINE long mtime_nsec(const struct stat* st)
+{
+#if defined(__APPLE__)
+	return st->st_mtimespec.tv_nsec;
+#else
+	return st->st_mtim.tv_nsec;
+#endif
+}
+
+static bool sysroot_stat(const struct sysroot_index* index, const char* relpath, struct stat* st)
+{
+	char path[PATH_MAX];
+	if((size_t)snprintf(path, PATH_MAX, "%s%s", index->sysroot, relpath) >= PATH_MAX)
+		return false;
+	return stat(path, st) == 0;
+}
+
+static void add_stamp(struct sysroot_index* index, const char* relpath, const struct stat* st)
+{
+	char* stamp = st != NULL ?
+		sprintf_alloc("%lld.%09ld %s", (long long)st->st_mtime, mtime_nsec(st), relpath) :
+		sprintf_alloc(STAMP_ABSENT " %s", relpath);
+	if(stamp == NULL || (index->stamps = string_array_push(index->stamps, stamp)) == NULL)
+		fatal_message(ENOMEM, "Failed to record %s", relpath);
+}
+
+static bool is_stamped(const struct sysroot_index* index, const char* relpath)
+{
+	for(size_t i = 0; index->stamps != NULL && i < index->stamps->len; i++) {
+		const char* path = strchr(index->stamps->ptr[i], ' ');
+		if(path != NULL && strcmp(path + 1, relpath) == 0)
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Stat @p relpath and stamp it. Absent paths are stamped too, so that their
+ * creation invalidates the index.
+ */
+static bool stamp_dir_stat(struct sysroot_index* index, const char* relpath, struct stat* st)
+{
+	bool exists = sysroot_stat(index, relpath, st) && S_ISDIR(st->st_mode);
+	if(!is_stamped(index, relpath))
+		add_stamp(index, relpath, exists ? st : NULL);
+	return exists;
+}
+
+static ALWAYS_INLINE bool stamp_dir(struct sysroot_index* index, const char* relpath)
+{
+	struct stat st;
+	return stamp_dir_stat(index, relpath, &st);
+}
+
+/*
+ * Stamps @p relpath, returning true if it exists and is the first path seen
+ * for that directory. /lib is often a link to /usr/lib, for one.
+ */
+static bool stamp_new_dir(struct sysroot_index* index, const char* relpath)
+{
+	struct stat st;
+	char key[64];
+
+	if(!stamp_dir_stat(index, relpath, &st))
+		return false;
+	snprintf(key, sizeof(key), "%llx:%llx", (unsigned long long)st.st_dev, (unsigned long long)st.st_ino);
+	if(hashmap_find(&index->seen_dirs, key, NULL))
+		return false;
+	if(hashmap_put(&index->seen_dirs, key, NULL, NULL) != 0)
+		fatal_message(ENOMEM, "Failed to record %s", relpath);
+	return true;
+}
+
+static bool has_suffix(const char* value, size_t len, const char* suffix, size_t suffix_len)
+{
+	return len > suffix_len && memcmp(value + len - suffix_len, suffix, suffix_len) == 0;
+}
+
+/*
+ * The names end up in CMake variable names and lists; skip anything that
+ * would need quoting there.
+ */
+static bool is_plain_name(const char* name)
+{
+	for(const char* p = name; *p != '\0'; p++) {
+		if(!isalnum((unsigned char)*p) && strchr("_.+-@", *p) == NULL)
+			return false;
+	}
+	return *name != '\0';
+}
+
+static void push_unique(string_array** array, const char* value)
+{
+	for(size_t i = 0; *array != NULL && i < (*array)->len; i++) {
+		if(strcmp((*array)->ptr[i], value) == 0)
+			return;
+	}
+	if((*array = string_array_push(*array, strdup(value))) == NULL)
+		fatal_message(ENOMEM, "Failed to record %s", value);
+}
+
+static DIR* sysroot_opendir(const struct sysroot_index* index, const char* relpath)
+{
+	char path[PATH_MAX];
+	if((size_t)snprintf(path, PATH_MAX, "%s%s", index->sysroot, relpath) >= PATH_MAX)
+		return NULL;
+	return opendir(path);
+}
+
+static void index_libraries(struct sysroot_index* index, const char* libdir)
+{
+	DIR* dir;
+	struct dirent* entry;
+
+	if((dir = sysroot_opendir(index, libdir)) == NULL)
+		return;
+	while((entry = readdir(dir)) != NULL) {
+		char name[NAME_MAX + 1];
+		size_t len = strlen(entry->d_name);
+		size_t name_len;
+		char* path;
+		void* previous = NULL;
+		bool shared;
+
+		// find_library only considers the unversioned names.
+		if(len < 4 || memcmp(entry->d_name, "lib", 3) != 0)
+			continue;
+		shared = has_suffix(entry->d_name, len, ".so", 3);
+		if(!shared && !has_suffix(entry->d_name, len, ".a", 2))
+			continue;
+
+		name_len = len - 3 - (shared ? 3 : 2);
+		memcpy(name, entry->d_name + 3, name_len);
+		name[name_len] = '\0';
+		if(!is_plain_name(name))
+			continue;
+
+		// An earlier directory wins, and within a directory .so beats .a.
+		if(hashmap_find(&index->libraries, name, &previous)) {
+			size_t dir_len = strlen(libdir);
+			const char* prev = (const char*)previous;
+			if(!shared || strncmp(prev, libdir, dir_len) != 0 || strchr(prev + dir_len + 1, PATH_SEP_CHR) != NULL)
+				continue;
+			free(previous);
+		}
+
+		path = sprintf_alloc("%s/%s", libdir, entry->d_name);
+		if(path == NULL || hashmap_put(&index->libraries, name, path, NULL) != 0)
+			fatal_message(ENOMEM, "Failed to index %s", entry->d_name);
+	}
+	closedir(dir);
+}
+
+static void index_headers(struct sysroot_index* index, const char* includedir)
+{
+	DIR* dir;
+	struct dirent* entry;
+
+	if((dir = sysroot_opendir(index, includedir)) == NULL)
+		return;
+	while((entry = readdir(dir)) != NULL) {
+		if(entry->d_name[0] == '.' || !is_plain_name(entry->d_name))
+			continue;
+		if(hashmap_find(&index->headers, entry->d_name, NULL))
+			continue;
+		if(hashmap_put(&index->headers, entry->d_name, (void*)includedir, NULL) != 0)
+			fatal_message(ENOMEM, "Failed to index %s", entry->d_name);
+	}
+	closedir(dir);
+}
+
+/*
+ * Returns the package name for a config file name, following find_package's
+ * <Name>Config.cmake and <lowercase-name>-config.cmake conventions. A
+ * lowercase config file takes the spelling of its package directory when
+ * that only differs in case (cmake/Foo/foo-config.cmake is Foo), since that's
+ * the name find_package is called with.
+ */
+static bool package_name(const char* filename, const char* dirname, char* name, size_t name_size)
+{
+	size_t len = strlen(filename);
+	size_t name_len;
+
+	if(has_suffix(filename, len, "Config.cmake", sizeof("Config.cmake") - 1))
+		name_len = len - (sizeof("Config.cmake") - 1);
+	else if(has_suffix(filename, len, "-config.cmake", sizeof("-config.cmake") - 1))
+		name_len = len - (sizeof("-config.cmake") - 1);
+	else
+		return false;
+
+	if(name_len == 0 || name_len >= name_size)
+		return false;
+	if(filename[name_len] == '-' && strlen(dirname) == name_len && strncasecmp(dirname, filename, name_len) == 0)
+		memcpy(name, dirname, name_len);
+	else
+		memcpy(name, filename, name_len);
+	name[name_len] = '\0';
+	return is_plain_name(name);
+}
+
+static void index_package_dir(struct sysroot_index* index, const char* pkgdir)
+{
+	DIR* dir;
+	struct dirent* entry;
+	char name[NAME_MAX + 1];
+	char* stored = NULL;
+	const char* dirname = strrchr(pkgdir, PATH_SEP_CHR);
+
+	dirname = dirname != NULL ? dirname + 1 : pkgdir;
+	if(!stamp_dir(index, pkgdir) || (dir = sysroot_opendir(index, pkgdir)) == NULL)
+		return;
+	while((entry = readdir(dir)) != NULL) {
+		void* previous = NULL;
+		if(!package_name(entry->d_name, dirname, name, sizeof(name)))
+			continue;
+		if(hashmap_find(&index->packages, name, &previous)) {
+			if(previous != ambiguous_package && strcmp((const char*)previous, pkgdir) != 0)
+				hashmap_put(&index->packages, name, ambiguous_package, NULL);
+			continue;
+		}
+		if(stored == NULL) {
+			stored = strdup(pkgdir);
+			if(stored == NULL || (index->package_dirs = string_array_push(index->package_dirs, stored)) == NULL)
+				fatal_message(ENOMEM, "Failed to index %s", pkgdir);
+		}
+		if(hashmap_put(&index->packages, name, stored, NULL) != 0)
+			fatal_message(ENOMEM, "Failed to index %s", entry->d_name);
+	}
+	closedir(dir);
+}
+
+/*
+ * <dir>/cmake/<Name>*, which covers what CMake's own packages and most
+ * others install.
+ */
+static void index_packages(struct sysroot_index* index, const char* basedir)
+{
+	DIR* dir;
+	struct dirent* entry;
+	char cmakedir[PATH_MAX];
+	char pkgdir[PATH_MAX];
+
+	if((size_t)snprintf(cmakedir, PATH_MAX, "%s/cmake", basedir) >= PATH_MAX)
+		return;
+	if(!stamp_dir(index, cmakedir) || (dir = sysroot_opendir(index, cmakedir)) == NULL)
+		return;
+	while((entry = readdir(dir)) != NULL) {
+		if(entry->d_name[0] == '.' || !is_plain_name(entry->d_name))
+			continue;
+		if((size_t)snprintf(pkgdir, PATH_MAX, "%s/%s", cmakedir, entry->d_name) >= PATH_MAX)
+			continue;
+#ifdef _DIRENT_HAVE_D_TYPE
+		if(entry->d_type != DT_UNKNOWN && entry->d_type != DT_DIR && entry->d_type != DT_LNK)
+			continue;
+#endif
+		index_package_dir(index, pkgdir);
+	}
+	closedir(dir);
+}
+
+static void add_libdir(struct sysroot_index* index, const char* libdir)
+{
+	char path[PATH_MAX];
+	if(!stamp_new_dir(index, libdir))
+		return;
+	push_unique(&index->libdirs, libdir);
+	if((size_t)snprintf(path, PATH_MAX, "%s/pkgconfig", libdir) < PATH_MAX && stamp_new_dir(index, path))
+		push_unique(&index->pkgconfigdirs, path);
+}
+
+static int compare_strings(const void* a, const void* b)
+{
+	return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+/*
+ * Multiarch directories in a stable order: the target CPU's first (so an
+ * i386-linux-gnu directory can't shadow x86_64-linux-gnu), then the rest
+ * alphabetically.
+ */
+static void sort_multiarch(const struct sysroot_index* index, string_array* multiarch)
+{
+	size_t front = 0;
+	size_t arch_len = index->arch != NULL ? strlen(index->arch) : 0;
+
+	if(multiarch == NULL)
+		return;
+	qsort(multiarch->ptr, multiarch->len, sizeof(char*), compare_strings);
+	for(size_t i = 0; arch_len > 0 && i < multiarch->len; i++) {
+		char* name = multiarch->ptr[i];
+		if(strncmp(name, index->arch, arch_len) != 0 || name[arch_len] != '-')
+			continue;
+		memmove(&multiarch->ptr[front + 1], &multiarch->ptr[front], (i - front) * sizeof(char*));
+		multiarch->ptr[front++] = name;
+	}
+}
+
+static void index_prefix(struct sysroot_index* index, const char* prefix)
+{
+	DIR* dir;
+	struct dirent* entry;
+	char path[PATH_MAX];
+	string_array* multiarch = NULL;
+
+	if((size_t)snprintf(path, PATH_MAX, "%s/lib", prefix) >= PATH_MAX)
+		return;
+
+	// Debian multiarch directories (lib/x86_64-linux-gnu) come first.
+	if((dir = sysroot_opendir(index, path)) != NULL) {
+		while((entry = readdir(dir)) != NULL) {
+			if(strstr(entry->d_name, "-linux-") != NULL && is_plain_name(entry->d_name))
+				push_unique(&multiarch, entry->d_name);
+		}
+		closedir(dir);
+	}
+	sort_multiarch(index, multiarch);
+
+	for(size_t i = 0; multiarch != NULL && i < multiarch->len; i++) {
+		snprintf(path, PATH_MAX, "%s/lib/%s", prefix, multiarch->ptr[i]);
+		add_libdir(index, path);
+	}
+	for(const char* const* libname = (const char* const[]){ "lib64", "lib", "lib32", "libx32", NULL }; *libname; libname++) {
+		snprintf(path, PATH_MAX, "%s/%s", prefix, *libname);
+		add_libdir(index, path);
+	}
+
+	for(size_t i = 0; multiarch != NULL && i < multiarch->len; i++) {
+		snprintf(path, PATH_MAX, "%s/include/%s", prefix, multiarch->ptr[i]);
+		if(stamp_new_dir(index, path))
+			push_unique(&index->includedirs, path);
+	}
+	snprintf(path, PATH_MAX, "%s/include", prefix);
+	if(stamp_new_dir(index, path))
+		push_unique(&index->includedirs, path);
+
+	snprintf(path, PATH_MAX, "%s/share/pkgconfig", prefix);
+	if(stamp_new_dir(index, path))
+		push_unique(&index->pkgconfigdirs, path);
+
+	string_array_free(multiarch);
+}
+
+static void index_build(struct sysroot_index* index)
+{
+	char path[PATH_MAX];
+
+	for(const char* const* optional = optional_paths; *optional; optional++) {
+		if(!stamp_dir(index, *optional))
+			push_unique(&index->absent, *optional);
+	}
+
+	for(const char* const* prefix = search_prefixes; *prefix; prefix++) {
+		// The root prefix is stamped as the sysroot itself.
+		if(**prefix != '\0' && !stamp_dir(index, *prefix))
+			continue;
+		if(**prefix == '\0')
+			stamp_dir(index, "/");
+		index_prefix(index, *prefix);
+	}
+
+	for(size_t i = 0; index->libdirs != NULL && i < index->libdirs->len; i++) {
+		index_libraries(index, index->libdirs->ptr[i]);
+		index_packages(index, index->libdirs->ptr[i]);
+	}
+	for(const char* const* prefix = search_prefixes; *prefix; prefix++) {
+		snprintf(path, PATH_MAX, "%s/share", *prefix);
+		if(stamp_new_dir(index, path))
+			index_packages(index, path);
+	}
+	for(size_t i = 0; index->includedirs != NULL && i < index->includedirs->len; i++)
+		index_headers(index, index->includedirs->ptr[i]);
+}
+
+/*
+ * Stamps
+ */
+
+static bool stamp_is_current(const struct sysroot_index* index, const char* line)
+{
+	struct stat st;
+	long long sec;
+	long nsec;
+	int offset = 0;
+
+	if(strncmp(line, STAMP_ABSENT " ", sizeof(STAMP_ABSENT)) == 0) {
+		line += sizeof(STAMP_ABSENT);
+		return !sysroot_stat(index, line, &st) || !S_ISDIR(st.st_mode);
+	}
+	if(sscanf(line, "%lld.%ld %n", &sec, &nsec, &offset) != 2 || offset == 0)
+		return false;
+	return sysroot_stat(index, line + offset, &st) && S_ISDIR(st.st_mode) &&
+	       (long long)st.st_mtime == sec && mtime_nsec(&st) == nsec;
+}
+
+static bool index_is_current(const struct sysroot_index* index, const char* output)
+{
+	char line[PATH_MAX + 64];
+	bool current = false;
+	bool versioned = false;
+	FILE* file = fopen(output, "r");
+
+	if(file == NULL)
+		return false;
+
+	while(fgets(line, sizeof(line), file) != NULL) {
+		size_t len = strlen(line);
+		if(len > 0 && line[len - 1] == '\n')
+			line[--len] = '\0';
+		if(strncmp(line, STAMP_PREFIX, sizeof(STAMP_PREFIX) - 1) == 0) {
+			current = stamp_is_current(index, line + sizeof(STAMP_PREFIX) - 1);
+			if(!current)
+				break;
+		} else if(line[0] != '#') {
+			int version = 0;
+			versioned = sscanf(line, "set(CROSS_SYSROOT_INDEX_VERSION %d)", &version) == 1 && version == INDEX_VERSION;
+			break;
+		}
+	}
+
+	fclose(file);
+	return current && versioned;
+}
+
+/*
+ * Output
+ */
+
+static bool collect_key(const char* key, void* value, string_array** keys)
+{
+	if(value != ambiguous_package)
+		*keys = string_array_push(*keys, (char*)key);
+	return *keys != NULL;
+}
+
+static string_array* sorted_keys(const struct hashmap* map)
+{
+	string_array* keys = string_array_alloc(map->count > 0 ? map->count : 1);
+	if(keys == NULL)
+		fatal_message(ENOMEM, "Failed to sort the index");
+	hashmap_foreach(map, (hashmap_iter_func)collect_key, &keys);
+	if(keys == NULL)
+		fatal_message(ENOMEM, "Failed to sort the index");
+	qsort(keys->ptr, keys->len, sizeof(char*), compare_strings);
+	return keys;
+}
+
+static void write_list(FILE* file, const char* name, const string_array* values)
+{
+	fprintf(file, "set(%s \"", name);
+	for(size_t i = 0; values != NULL && i < values->len; i++)
+		fprintf(file, "%s%s", i > 0 ? ";" : "", values->ptr[i]);
+	fprintf(file, "\")\n");
+}
+
+static void write_map(FILE* file, const char* prefix, const struct hashmap* map)
+{
+	string_array* keys = sorted_keys(map);
+	for(size_t i = 0; i < keys->len; i++) {
+		const char* value = (const char*)hashmap_get(map, keys->ptr[i]);
+		if(value != NULL)
+			fprintf(file, "set(%s%s \"%s\")\n", prefix, keys->ptr[i], value);
+	}
+	// The keys belong to the map.
+	free(keys);
+}
+
+static void index_write(const struct sysroot_index* index, const char* output)
+{
+	int fd;
+	FILE* file;
+	string_array* packages;
+	char* temp = sprintf_alloc("%s.XXXXXX", output);
+
+	if(temp == NULL || (fd = mkstemp(temp)) < 0 || (file = fdopen(fd, "w")) == NULL)
+		fatal_message(errno, "Failed to create %s: %s", output, strerror(errno));
+
+	fprintf(file, "# Generated by the sysroot indexer for %s; do not edit.\n", index->sysroot);
+	for(size_t i = 0; index->stamps != NULL && i < index->stamps->len; i++)
+		fprintf(file, STAMP_PREFIX "%s\n", index->stamps->ptr[i]);
+	fprintf(file, "set(CROSS_SYSROOT_INDEX_VERSION %d)\n", INDEX_VERSION);
+	write_list(file, "CROSS_SYSROOT_ABSENT_PATHS", index->absent);
+	write_list(file, "CROSS_SYSROOT_LIBRARY_DIRS", index->libdirs);
+	write_list(file, "CROSS_SYSROOT_INCLUDE_DIRS", index->includedirs);
+	write_list(file, "CROSS_SYSROOT_PKGCONFIG_DIRS", index->pkgconfigdirs);
+
+	packages = sorted_keys(&index->packages);
+	write_list(file, "CROSS_SYSROOT_PACKAGES", packages);
+	free(packages);
+
+	write_map(file, "CROSS_SYSROOT_PACKAGE_", &index->packages);
+	write_map(file, "CROSS_SYSROOT_LIBRARY_", &index->libraries);
+	write_map(file, "CROSS_SYSROOT_HEADER_", &index->headers);
+
+	if(fclose(file) != 0 || rename(temp, output) != 0) {
+		int code = errno;
+		unlink(temp);
+		fatal_message(code, "Failed to write %s: %s", output, strerror(code));
+	}
+	free(temp);
+}
+
+static void index_reset(struct sysroot_index* index)
+{
+	// Package and header values point into the arrays below.
+	hashmap_reset(&index->libraries, free);
+	hashmap_reset(&index->headers, NULL);
+	hashmap_reset(&index->packages, NULL);
+	hashmap_reset(&index->seen_dirs, NULL);
+	string_array_free(index->stamps);
+	string_array_free(index->absent);
+	string_array_free(index->libdirs);
+	string_array_free(index->includedirs);
+	string_array_free(index->pkgconfigdirs);
+	string_array_free(index->package_dirs);
+	free(index->sysroot);
+	free(index->arch);
+}
+
+/*
+ * Fills in what wasn't given on the command line from our own path:
+ * <prefix>/bin/<triple>-sysroot-index => <prefix>/<triple>/sysroot, and the
+ * CPU from <triple>.
+ */
+static void resolve_defaults(struct sysroot_index* index)
+{
+	char exe[PATH_MAX] = "";
+	struct cross_paths paths;
+	struct cross_context ctx;
+
+	if(index->sysroot != NULL && index->arch != NULL)
+		return;
+	if(proc_path(exe, PATH_MAX) != 0 || cross_context_init(&ctx, NULL) != CROSS_OK)
+		return;
+	if(cross_paths_init(&ctx, &paths, exe, UNAME_SUFFIX) == CROSS_OK) {
+		if(index->sysroot == NULL)
+			cross_resolve_sysroot(&ctx, &paths, &index->sysroot);
+		if(index->arch == NULL && paths.uname.value != NULL)
+			index->arch = strndup(paths.uname.value, strcspn(paths.uname.value, "-"));
+		cross_paths_reset(&ctx, &paths);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	int opt;
+	bool check_only = false;
+	bool force = false;
+	char* output = NULL;
+	struct sysroot_index index;
+
+	memset((void*)&index, 0, sizeof(index));
+	while((opt = getopt(argc, argv, "s:a:o:cfvh")) != -1) {
+		switch(opt) {
+			case 's':
+				free(index.sysroot);
+				index.sysroot = strdup(optarg);
+				break;
+			case 'a':
+				free(index.arch);
+				index.arch = strdup(optarg);
+				break;
+			case 'o':
+				free(output);
+				output = strdup(optarg);
+				break;
+			case 'c':
+				check_only = true;
+				break;
+			case 'f':
+				force = true;
+				break;
+			case 'v':
+				index.verbose = true;
+				break;
+			case 'h':
+				usage(argv[0]);
+				return 0;
+			default:
+				usage(argv[0]);
+				return 2;
+		}
+	}
+
+	resolve_defaults(&index);
+	if(index.sysroot == NULL)
+		fatal_message(1, "Failed to resolve the sysroot; use -s to specify it.");
+	if(!is_folder(index.sysroot))
+		fatal_message(ENOENT, "Sysroot does not exist: %s", index.sysroot);
+
+	// Stamps are relative to the sysroot, so it has to be spelled consistently.
+	index.sysroot_len = strlen(index.sysroot);
+	while(index.sysroot_len > 1 && index.sysroot[index.sysroot_len - 1] == PATH_SEP_CHR)
+		index.sysroot[--index.sysroot_len] = '\0';
+
+	// <prefix>/<triple>/sysroot => <prefix>/<triple>/sysroot-index.cmake
+	if(output == NULL) {
+		char* base = strrchr(index.sysroot, PATH_SEP_CHR);
+		int dir_len = base != NULL && base != index.sysroot ? (int)(base - index.sysroot) : 0;
+		if((output = sprintf_alloc("%.*s/" INDEX_FILENAME, dir_len, index.sysroot)) == NULL)
+			fatal_message(ENOMEM, "Failed to resolve the index path");
+	}
+
+	if(!force && index_is_current(&index, output)) {
+		if(index.verbose)
+			printf("%s is up to date.\n", output);
+		free(output);
+		free(index.sysroot);
+		free(index.arch);
+		return 0;
+	}
+	if(check_only) {
+		if(index.verbose)
+			printf("%s is out of date.\n", output);
+		free(output);
+		free(index.sysroot);
+		free(index.arch);
+		return 1;
+	}
+
+	if(hashmap_init(&index.libraries, 1024) != 0 || hashmap_init(&index.headers, 1024) != 0 ||
+	   hashmap_init(&index.packages, 256) != 0 || hashmap_init(&index.seen_dirs, 64) != 0)
+		fatal_message(ENOMEM, "Failed to allocate the index");
+
+	index_build(&index);
+	index_write(&index, output);
+	if(index.verbose) {
+		printf("Wrote %s: %zu libraries, %zu headers, %zu packages.\n", output,
+		       index.libraries.count, index.headers.count, index.packages.count);
+	}
+
+	index_reset(&index);
+	free(output);
+	return 0;
+}
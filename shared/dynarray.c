@@ -27,29 +27,13 @@
 #include "shared.h"
 #include "dynarray.h"
 
-#define INCREMENT 16
+#define MIN_CAPACITY 16
 
-int dynarray_init(struct dynarray* a)
+void dynarray_release(struct dynarray* a)
 {
-	if(UNLIKELY(!a))
-		return -EINVAL;
-	
-	a->base = NULL;
-	a->elements = 0;
-	
-	return 0;
-}
-
-int dynarray_reset(struct dynarray* a)
-{
-	if(UNLIKELY(!a))
-		return -EINVAL;
-	
 	free(a->base);
-	a->base = NULL;
-	a->elements = 0;
-	
-	return 0;
+	a->base = a->inline_base;
+	a->capacity = a->inline_capacity;
 }
 
 #if !defined(HAVE_BUILTIN_ADD_OVERFLOW)
@@ -59,7 +43,7 @@ static inline bool add_overflow(size_t a, size_t b, size_t* out)
 	if(UNLIKELY(a > 0 && b > SIZE_MAX - a))
 		return true;
 	
-	*out = a + INCREMENT;
+	*out = a + b;
 	return false;
 }
 
@@ -67,31 +51,75 @@ static inline bool add_overflow(size_t a, size_t b, size_t* out)
 #define add_overflow __builtin_add_overflow
 #endif
 
-void* dynarray_append(struct dynarray* a, size_t element_size)
+int dynarray_reserve(struct dynarray* a, size_t element_size, size_t count)
 {
-	if(!(a->elements % INCREMENT)) {
-		void* new_base;
-		size_t new_cap;
-		
-		if(UNLIKELY(add_overflow(a->elements, INCREMENT, &new_cap))) {
-			errno = EOVERFLOW;
-			return NULL;
-		}
-		
+	void* new_base;
+	size_t new_cap;
+	
+	if(count <= a->capacity)
+		return 0;
+	
+	// Double, so appends are amortized O(1) no matter the size.
+	new_cap = a->capacity << 1;
+	if(new_cap < a->capacity || new_cap < count)
+		new_cap = count;
+	if(new_cap < MIN_CAPACITY)
+		new_cap = MIN_CAPACITY;
+	
+	if(a->base == a->inline_base) {
+		new_base = reallocarray(NULL, new_cap, element_size);
+		if(UNLIKELY(!new_base))
+			return -errno;
+		if(a->elements)
+			memcpy(new_base, a->base, a->elements * element_size);
+	} else {
 		new_base = reallocarray(a->base, new_cap, element_size);
 		if(UNLIKELY(!new_base))
-			return NULL;
-		
-		a->base = new_base;
+			return -errno;
+	}
+	
+	a->base = new_base;
+	a->capacity = new_cap;
+	return 0;
+}
+
+void* dynarray_grow(struct dynarray* a, size_t element_size, size_t count)
+{
+	size_t needed;
+	void* element;
+	
+	if(UNLIKELY(add_overflow(a->elements, count, &needed))) {
+		errno = EOVERFLOW;
+		return NULL;
 	}
 	
-	return ((unsigned char*)a->base) + a->elements++ * element_size;
+	if(UNLIKELY(dynarray_reserve(a, element_size, needed) != 0))
+		return NULL;
+	
+	element = ((unsigned char*)a->base) + a->elements * element_size;
+	a->elements = needed;
+	return element;
+}
+
+int dynarray_extend(struct dynarray* a, size_t element_size, const void* src, size_t count)
+{
+	void* dest;
+	
+	if(!count)
+		return 0;
+	
+	dest = dynarray_append_n(a, element_size, count);
+	if(UNLIKELY(!dest))
+		return -errno;
+	
+	memcpy(dest, src, count * element_size);
+	return 0;
 }
 
 void dynarray_sort(struct dynarray* a,
                     size_t element_size,
                     int (* cmp)(const void* a, const void* b))
 {
-	if(LIKELY(a->elements))
-		qsort(a->base, a->elements - 1, element_size, cmp);
+	if(LIKELY(a->elements > 1))
+		qsort(a->base, a->elements, element_size, cmp);
 }
@@ -1,7 +1,11 @@
 /**
  * @file dyn-array.h
- * 
- * TODO: Description
+ *
+ * Growable arrays of fixed-size elements. Capacity grows geometrically, so
+ * appending is amortized O(1). Types declared with DEFINE_ARRAY_TYPE_INLINE
+ * keep their first few elements inside the array struct itself and only
+ * touch the heap once they outgrow it; such arrays must not be copied or
+ * moved while they hold elements, since base may point into the struct.
  */
 #ifndef _ARRAY_H_
 #define _ARRAY_H_
@@ -10,6 +14,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <memory.h>
+#include <errno.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -19,13 +24,82 @@ struct dynarray
 {
 	void *base;
 	size_t elements;
+	size_t capacity;
+	void *inline_base;
+	size_t inline_capacity;
 };
 
-int dynarray_init(struct dynarray *a);
-int dynarray_reset(struct dynarray *a);
-void *dynarray_append(struct dynarray *a, size_t element_size);
+void dynarray_release(struct dynarray *a);
+int dynarray_reserve(struct dynarray *a, size_t element_size, size_t count);
+void *dynarray_grow(struct dynarray *a, size_t element_size, size_t count);
+int dynarray_extend(struct dynarray *a, size_t element_size, const void *src, size_t count);
 void dynarray_sort(struct dynarray *a, size_t element_size, int (*cmp)(const void *a, const void *b));
 
+static inline int dynarray_init(struct dynarray *a)
+{
+	if (__builtin_expect(!a, 0))
+		return -EINVAL;
+
+	a->base = NULL;
+	a->elements = 0;
+	a->capacity = 0;
+	a->inline_base = NULL;
+	a->inline_capacity = 0;
+
+	return 0;
+}
+
+static inline int dynarray_init_inline(struct dynarray *a, void *storage, size_t capacity)
+{
+	if (__builtin_expect(!a || (!storage && capacity), 0))
+		return -EINVAL;
+
+	a->base = storage;
+	a->elements = 0;
+	a->capacity = capacity;
+	a->inline_base = storage;
+	a->inline_capacity = capacity;
+
+	return 0;
+}
+
+static inline int dynarray_reset(struct dynarray *a)
+{
+	if (__builtin_expect(!a, 0))
+		return -EINVAL;
+
+	if (a->base != a->inline_base)
+		dynarray_release(a);
+	a->elements = 0;
+
+	return 0;
+}
+
+/**
+ * Append @p count uninitialized elements and return the first of them, or
+ * NULL when the array can't grow.
+ */
+static inline void *dynarray_append_n(struct dynarray *a, size_t element_size, size_t count)
+{
+	if (__builtin_expect(count <= a->capacity - a->elements, 1)) {
+		void *element = (unsigned char *)a->base + a->elements * element_size;
+		a->elements += count;
+		return element;
+	}
+	return dynarray_grow(a, element_size, count);
+}
+
+static inline void *dynarray_append(struct dynarray *a, size_t element_size)
+{
+	return dynarray_append_n(a, element_size, 1);
+}
+
+/* Drop every element but keep the storage for reuse. */
+static inline void dynarray_clear(struct dynarray *a)
+{
+	a->elements = 0;
+}
+
 #define ARRAY_FOREACH(array_, iter_)                                      \
 	for (iter_ = (array_)->base.base;                                          \
 		 iter_ <                                                               \
@@ -37,20 +111,28 @@ void dynarray_sort(struct dynarray *a, size_t element_size, int (*cmp)(const voi
 				  (array_)->base.elements - 1);                                \
 		 iter_ >= (typeof(iter_))(array_)->base.base; iter_--)
 
-#define DEFINE_ARRAY_TYPE(array_type_, element_type_)                          \
-	struct array_type_ {                                                       \
-		struct dynarray base;                                                 \
-	};                                                                         \
+#define _DEFINE_ARRAY_FUNCTIONS(array_type_, element_type_, init_)             \
 	__attribute__((unused)) static inline int array_type_##_init(              \
 		struct array_type_ *array)                                             \
 	{                                                                          \
-		return dynarray_init((struct dynarray *)array);                      \
+		return init_;                                                          \
 	}                                                                          \
 	__attribute__((unused)) static inline int array_type_##_reset(             \
 		struct array_type_ *array)                                             \
 	{                                                                          \
 		return dynarray_reset((struct dynarray *)array);                     \
 	}                                                                          \
+	__attribute__((unused)) static inline void array_type_##_clear(            \
+		struct array_type_ *array)                                             \
+	{                                                                          \
+		dynarray_clear((struct dynarray *)array);                            \
+	}                                                                          \
+	__attribute__((unused)) static inline int array_type_##_reserve(           \
+		struct array_type_ *array, size_t count)                               \
+	{                                                                          \
+		return dynarray_reserve((struct dynarray *)array,                    \
+								 sizeof(element_type_), count);                \
+	}                                                                          \
 	__attribute__((unused)) static inline element_type_ *array_type_##_append( \
 		struct array_type_ *array)                                             \
 	{                                                                          \
@@ -67,6 +149,19 @@ void dynarray_sort(struct dynarray *a, size_t element_size, int (*cmp)(const voi
 																			   \
 		return element;                                                        \
 	}                                                                          \
+	__attribute__((unused)) static inline element_type_                        \
+		*array_type_##_append_n(struct array_type_ *array, size_t count)       \
+	{                                                                          \
+		return (element_type_ *)dynarray_append_n((struct dynarray *)array,  \
+												  sizeof(element_type_),       \
+												  count);                      \
+	}                                                                          \
+	__attribute__((unused)) static inline int array_type_##_extend(            \
+		struct array_type_ *array, const element_type_ *src, size_t count)     \
+	{                                                                          \
+		return dynarray_extend((struct dynarray *)array,                     \
+								sizeof(element_type_), src, count);            \
+	}                                                                          \
 	__attribute__((unused)) static inline void array_type_##_sort(             \
 		struct array_type_ *array, int (*cmp)(const void *a, const void *b))   \
 	{                                                                          \
@@ -74,6 +169,22 @@ void dynarray_sort(struct dynarray *a, size_t element_size, int (*cmp)(const voi
 						cmp);                                                  \
 	}
 
+#define DEFINE_ARRAY_TYPE(array_type_, element_type_)                          \
+	struct array_type_ {                                                       \
+		struct dynarray base;                                                 \
+	};                                                                         \
+	_DEFINE_ARRAY_FUNCTIONS(array_type_, element_type_,                        \
+		dynarray_init((struct dynarray *)array))
+
+#define DEFINE_ARRAY_TYPE_INLINE(array_type_, element_type_, inline_count_)    \
+	struct array_type_ {                                                       \
+		struct dynarray base;                                                 \
+		element_type_ storage[inline_count_];                                  \
+	};                                                                         \
+	_DEFINE_ARRAY_FUNCTIONS(array_type_, element_type_,                        \
+		dynarray_init_inline((struct dynarray *)array, array->storage,       \
+							 inline_count_))
+
 
 #ifdef __cplusplus
 };
@@ -0,0 +1,346 @@
+/**
+ * @file elffile.c
+ * @author Charles Grunwald <cgrunwald@gmail.com>
+ */
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shared.h"
+#include "elffile.h"
+
+#define ELF_CLASS64     2
+#define ELF_DATA2LSB    1
+#define ELF_IDENT_CLASS 4
+#define ELF_IDENT_DATA  5
+
+// Bounds-checked view of `count` records of `type` at `offset` in the mapping.
+#define ELF_TABLE(ELF,TYPE,OFFSET,COUNT) \
+	((const TYPE*)elf_range((ELF), (uint64_t)(OFFSET), (uint64_t)(COUNT) * sizeof(TYPE)))
+
+static ALWAYS_INLINE const void* elf_range(const struct elf_file* elf, uint64_t offset, uint64_t length)
+{
+	if(UNLIKELY(offset > elf->size || length > elf->size - offset))
+		return NULL;
+	return elf->data + offset;
+}
+
+// The dynamic section stores virtual addresses, so we need to map those back
+// onto file offsets via the PT_LOAD segments.
+static bool elf_vaddr_offset(const struct elf_file* elf, uint64_t vaddr, uint64_t* offset)
+{
+	for(uint16_t i = 0; i < elf->ehdr->e_phnum; i++) {
+		const struct elf64_phdr* ph = &elf->phdrs[i];
+		if(ph->p_type == ELF_PT_LOAD && vaddr >= ph->p_vaddr && vaddr - ph->p_vaddr < ph->p_filesz) {
+			*offset = ph->p_offset + (vaddr - ph->p_vaddr);
+			return true;
+		}
+	}
+	return false;
+}
+
+static ALWAYS_INLINE const char* elf_str(const struct elf_file* elf, uint64_t index)
+{
+	if(UNLIKELY(elf->strtab == NULL || index >= elf->strtab_size))
+		return NULL;
+	// Reject strings that would run off the end of the table.
+	if(memchr(elf->strtab + index, '\0', elf->strtab_size - index) == NULL)
+		return NULL;
+	return elf->strtab + index;
+}
+
+static const struct elf64_dyn* elf_dyn_find(const struct elf_file* elf, int64_t tag)
+{
+	for(size_t i = 0; i < elf->dynamic_count; i++) {
+		if(elf->dynamic[i].d_tag == tag)
+			return &elf->dynamic[i];
+	}
+	return NULL;
+}
+
+static const void* elf_dyn_pointer(const struct elf_file* elf, int64_t tag, uint64_t length)
+{
+	uint64_t offset;
+	const struct elf64_dyn* dyn = elf_dyn_find(elf, tag);
+	if(dyn == NULL || !elf_vaddr_offset(elf, dyn->d_val, &offset))
+		return NULL;
+	return elf_range(elf, offset, length);
+}
+
+static void elf_load_dynamic(struct elf_file* elf)
+{
+	const struct elf64_dyn* dyn;
+
+	for(uint16_t i = 0; i < elf->ehdr->e_phnum; i++) {
+		const struct elf64_phdr* ph = &elf->phdrs[i];
+		if(ph->p_type == ELF_PT_DYNAMIC) {
+			elf->dynamic = ELF_TABLE(elf, struct elf64_dyn, ph->p_offset, ph->p_filesz / sizeof(struct elf64_dyn));
+			elf->dynamic_count = elf->dynamic ? (size_t)(ph->p_filesz / sizeof(struct elf64_dyn)) : 0;
+		} else if(ph->p_type == ELF_PT_INTERP) {
+			const char* interp = elf_range(elf, ph->p_offset, ph->p_filesz);
+			if(interp != NULL && ph->p_filesz > 0 && interp[ph->p_filesz - 1] == '\0')
+				elf->interp = interp;
+		}
+	}
+
+	// Stop at DT_NULL so the lookups below never walk padding.
+	for(size_t i = 0; i < elf->dynamic_count; i++) {
+		if(elf->dynamic[i].d_tag == ELF_DT_NULL) {
+			elf->dynamic_count = i;
+			break;
+		}
+	}
+
+	dyn = elf_dyn_find(elf, ELF_DT_STRSZ);
+	if(dyn != NULL) {
+		elf->strtab = elf_dyn_pointer(elf, ELF_DT_STRTAB, dyn->d_val);
+		elf->strtab_size = elf->strtab ? (size_t)dyn->d_val : 0;
+	}
+}
+
+bool elf_is_elf_magic(const void* data, size_t size)
+{
+	return size >= 4 && memcmp(data, "\x7f" "ELF", 4) == 0;
+}
+
+int elf_file_open(struct elf_file* elf, const char* path)
+{
+	int code;
+	struct stat st;
+
+	if(UNLIKELY(!elf || !path))
+		return -EINVAL;
+
+	memset((void*)elf, 0, sizeof(*elf));
+	elf->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(elf->fd < 0)
+		return -errno;
+
+	if(fstat(elf->fd, &st) != 0) {
+		code = -errno;
+		goto fail;
+	} else if(!S_ISREG(st.st_mode) || (size_t)st.st_size < sizeof(struct elf64_ehdr)) {
+		code = -ENOEXEC;
+		goto fail;
+	}
+
+	elf->size = (size_t)st.st_size;
+	elf->data = mmap(NULL, elf->size, PROT_READ, MAP_PRIVATE, elf->fd, 0);
+	if(elf->data == MAP_FAILED) {
+		elf->data = NULL;
+		code = -errno;
+		goto fail;
+	}
+
+	elf->ehdr = (const struct elf64_ehdr*)elf->data;
+	if(!elf_is_elf_magic(elf->data, elf->size) ||
+	   elf->ehdr->e_ident[ELF_IDENT_CLASS] != ELF_CLASS64 ||
+	   elf->ehdr->e_ident[ELF_IDENT_DATA] != ELF_DATA2LSB ||
+	   elf->ehdr->e_phentsize != sizeof(struct elf64_phdr)) {
+		code = -ENOEXEC;
+		goto fail;
+	}
+
+	elf->phdrs = ELF_TABLE(elf, struct elf64_phdr, elf->ehdr->e_phoff, elf->ehdr->e_phnum);
+	if(elf->phdrs == NULL) {
+		code = -ENOEXEC;
+		goto fail;
+	}
+
+	elf_load_dynamic(elf);
+	return 0;
+
+fail:
+	elf_file_close(elf);
+	return code;
+}
+
+void elf_file_close(struct elf_file* elf)
+{
+	if(elf != NULL) {
+		if(elf->data != NULL)
+			munmap((void*)elf->data, elf->size);
+		if(elf->fd >= 0)
+			close(elf->fd);
+		memset((void*)elf, 0, sizeof(*elf));
+		elf->fd = -1;
+	}
+}
+
+static const char* elf_dyn_string(const struct elf_file* elf, int64_t tag)
+{
+	const struct elf64_dyn* dyn = elf_dyn_find(elf, tag);
+	return dyn != NULL ? elf_str(elf, dyn->d_val) : NULL;
+}
+
+const char* elf_file_soname(const struct elf_file* elf)
+{
+	return elf_dyn_string(elf, ELF_DT_SONAME);
+}
+
+const char* elf_file_rpath(const struct elf_file* elf)
+{
+	return elf_dyn_string(elf, ELF_DT_RPATH);
+}
+
+const char* elf_file_runpath(const struct elf_file* elf)
+{
+	return elf_dyn_string(elf, ELF_DT_RUNPATH);
+}
+
+size_t elf_file_foreach_needed(const struct elf_file* elf, elf_string_handler handler, void* userdata)
+{
+	size_t count = 0;
+	for(size_t i = 0; i < elf->dynamic_count; i++) {
+		if(elf->dynamic[i].d_tag == ELF_DT_NEEDED) {
+			const char* name = elf_str(elf, elf->dynamic[i].d_val);
+			if(name == NULL)
+				continue;
+			count++;
+			if(!handler(name, userdata))
+				break;
+		}
+	}
+	return count;
+}
+
+static uint64_t elf_dyn_value(const struct elf_file* elf, int64_t tag)
+{
+	const struct elf64_dyn* dyn = elf_dyn_find(elf, tag);
+	return dyn != NULL ? dyn->d_val : 0;
+}
+
+size_t elf_file_foreach_verdef(const struct elf_file* elf, elf_string_handler handler, void* userdata)
+{
+	uint64_t offset;
+	size_t count = 0;
+	uint64_t entries = elf_dyn_value(elf, ELF_DT_VERDEFNUM);
+	const struct elf64_dyn* dyn = elf_dyn_find(elf, ELF_DT_VERDEF);
+
+	if(dyn == NULL || !elf_vaddr_offset(elf, dyn->d_val, &offset))
+		return 0;
+
+	for(uint64_t i = 0; i < entries; i++) {
+		const struct elf64_verdef* vd = ELF_TABLE(elf, struct elf64_verdef, offset, 1);
+		const struct elf64_verdaux* vda;
+		const char* name;
+		if(vd == NULL)
+			break;
+
+		// The first aux entry holds the version's own name. The rest name
+		// its predecessors, which don't matter for lookups.
+		vda = ELF_TABLE(elf, struct elf64_verdaux, offset + vd->vd_aux, 1);
+		name = vda != NULL ? elf_str(elf, vda->vda_name) : NULL;
+		if(name != NULL) {
+			count++;
+			if(!handler(name, userdata))
+				break;
+		}
+
+		if(vd->vd_next == 0)
+			break;
+		offset += vd->vd_next;
+	}
+	return count;
+}
+
+size_t elf_file_foreach_verneed(const struct elf_file* elf, elf_verneed_handler handler, void* userdata)
+{
+	uint64_t offset;
+	size_t count = 0;
+	uint64_t entries = elf_dyn_value(elf, ELF_DT_VERNEEDNUM);
+	const struct elf64_dyn* dyn = elf_dyn_find(elf, ELF_DT_VERNEED);
+
+	if(dyn == NULL || !elf_vaddr_offset(elf, dyn->d_val, &offset))
+		return 0;
+
+	for(uint64_t i = 0; i < entries; i++) {
+		uint64_t aux_offset;
+		const char* file;
+		const struct elf64_verneed* vn = ELF_TABLE(elf, struct elf64_verneed, offset, 1);
+		if(vn == NULL)
+			break;
+
+		file = elf_str(elf, vn->vn_file);
+		aux_offset = offset + vn->vn_aux;
+		for(uint16_t j = 0; file != NULL && j < vn->vn_cnt; j++) {
+			const char* version;
+			const struct elf64_vernaux* vna = ELF_TABLE(elf, struct elf64_vernaux, aux_offset, 1);
+			if(vna == NULL)
+				break;
+
+			version = elf_str(elf, vna->vna_name);
+			if(version != NULL) {
+				count++;
+				if(!handler(file, version, userdata))
+					return count;
+			}
+
+			if(vna->vna_next == 0)
+				break;
+			aux_offset += vna->vna_next;
+		}
+
+		if(vn->vn_next == 0)
+			break;
+		offset += vn->vn_next;
+	}
+	return count;
+}
+
+static size_t elf_foreach_function_in(const struct elf_file* elf, uint32_t type, elf_symbol_handler handler,
+                                      void* userdata, bool* found)
+{
+	size_t count = 0;
+	const struct elf64_shdr* shdrs;
+
+	if(elf->ehdr->e_shoff == 0 || elf->ehdr->e_shentsize != sizeof(struct elf64_shdr))
+		return 0;
+	shdrs = ELF_TABLE(elf, struct elf64_shdr, elf->ehdr->e_shoff, elf->ehdr->e_shnum);
+	for(uint16_t i = 0; shdrs != NULL && i < elf->ehdr->e_shnum; i++) {
+		const struct elf64_shdr* sh = &shdrs[i];
+		const struct elf64_shdr* strsh;
+		const struct elf64_sym* syms;
+		const char* strtab;
+		uint64_t nsyms;
+
+		if(sh->sh_type != type || sh->sh_link >= elf->ehdr->e_shnum)
+			continue;
+		strsh = &shdrs[sh->sh_link];
+		nsyms = sh->sh_size / sizeof(struct elf64_sym);
+		syms = ELF_TABLE(elf, struct elf64_sym, sh->sh_offset, nsyms);
+		strtab = elf_range(elf, strsh->sh_offset, strsh->sh_size);
+		if(syms == NULL || strtab == NULL || strsh->sh_size == 0 || strtab[strsh->sh_size - 1] != '\0')
+			continue;
+		*found = true;
+
+		for(uint64_t j = 0; j < nsyms; j++) {
+			const struct elf64_sym* sym = &syms[j];
+			if((sym->st_info & 0xf) != ELF_STT_FUNC || sym->st_shndx == 0 || sym->st_size == 0 ||
+			   sym->st_name >= strsh->sh_size)
+				continue;
+			count++;
+			if(!handler(strtab + sym->st_name, sym->st_value, sym->st_size, userdata))
+				return count;
+		}
+	}
+	return count;
+}
+
+size_t elf_file_foreach_function(const struct elf_file* elf, elf_symbol_handler handler, void* userdata)
+{
+	bool found = false;
+	size_t count = elf_foreach_function_in(elf, ELF_SHT_SYMTAB, handler, userdata, &found);
+	return found ? count : elf_foreach_function_in(elf, ELF_SHT_DYNSYM, handler, userdata, &found);
+}
+
+bool elf_file_vaddr(const struct elf_file* elf, uint64_t offset, uint64_t* vaddr)
+{
+	for(uint16_t i = 0; i < elf->ehdr->e_phnum; i++) {
+		const struct elf64_phdr* ph = &elf->phdrs[i];
+		if(ph->p_type == ELF_PT_LOAD && offset >= ph->p_offset && offset - ph->p_offset < ph->p_filesz) {
+			*vaddr = ph->p_vaddr + (offset - ph->p_offset);
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,202 @@
+/**
+ * @file elffile.h
+ * @author Charles Grunwald <cgrunwald@gmail.com>
+ * @brief Zero-copy, mmap-based reader for the dynamic section of 64-bit ELF files.
+ *
+ * Only what's needed to follow a binary's dependencies is exposed: DT_NEEDED,
+ * DT_SONAME, DT_RPATH/DT_RUNPATH, and the GNU symbol version needs and
+ * definitions, plus the function symbols for attributing addresses. All
+ * returned strings point directly into the mapped file and stay valid until
+ * elf_file_close.
+ */
+#ifndef _ELFFILE_H_
+#define _ELFFILE_H_
+#pragma once
+
+#include <stdint.h>
+#include "shared.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Not every host (cygwin included) ships <elf.h>, so we carry the handful of
+// definitions we need.
+#define ELF_ET_EXEC 2
+#define ELF_ET_DYN  3
+
+#define ELF_PT_LOAD    1
+#define ELF_PT_DYNAMIC 2
+#define ELF_PT_INTERP  3
+
+#define ELF_SHT_SYMTAB 2
+#define ELF_SHT_DYNSYM 11
+
+#define ELF_STT_FUNC 2
+
+#define ELF_DT_NULL        0
+#define ELF_DT_NEEDED      1
+#define ELF_DT_STRTAB      5
+#define ELF_DT_STRSZ       10
+#define ELF_DT_SONAME      14
+#define ELF_DT_RPATH       15
+#define ELF_DT_RUNPATH     29
+#define ELF_DT_VERDEF      0x6ffffffc
+#define ELF_DT_VERDEFNUM   0x6ffffffd
+#define ELF_DT_VERNEED     0x6ffffffe
+#define ELF_DT_VERNEEDNUM  0x6fffffff
+
+struct elf64_ehdr
+{
+	unsigned char e_ident[16];
+	uint16_t e_type;
+	uint16_t e_machine;
+	uint32_t e_version;
+	uint64_t e_entry;
+	uint64_t e_phoff;
+	uint64_t e_shoff;
+	uint32_t e_flags;
+	uint16_t e_ehsize;
+	uint16_t e_phentsize;
+	uint16_t e_phnum;
+	uint16_t e_shentsize;
+	uint16_t e_shnum;
+	uint16_t e_shstrndx;
+};
+
+struct elf64_phdr
+{
+	uint32_t p_type;
+	uint32_t p_flags;
+	uint64_t p_offset;
+	uint64_t p_vaddr;
+	uint64_t p_paddr;
+	uint64_t p_filesz;
+	uint64_t p_memsz;
+	uint64_t p_align;
+};
+
+struct elf64_shdr
+{
+	uint32_t sh_name;
+	uint32_t sh_type;
+	uint64_t sh_flags;
+	uint64_t sh_addr;
+	uint64_t sh_offset;
+	uint64_t sh_size;
+	uint32_t sh_link;
+	uint32_t sh_info;
+	uint64_t sh_addralign;
+	uint64_t sh_entsize;
+};
+
+struct elf64_sym
+{
+	uint32_t st_name;
+	unsigned char st_info;
+	unsigned char st_other;
+	uint16_t st_shndx;
+	uint64_t st_value;
+	uint64_t st_size;
+};
+
+struct elf64_dyn
+{
+	int64_t d_tag;
+	uint64_t d_val;
+};
+
+struct elf64_verneed
+{
+	uint16_t vn_version;
+	uint16_t vn_cnt;
+	uint32_t vn_file;
+	uint32_t vn_aux;
+	uint32_t vn_next;
+};
+
+struct elf64_vernaux
+{
+	uint32_t vna_hash;
+	uint16_t vna_flags;
+	uint16_t vna_other;
+	uint32_t vna_name;
+	uint32_t vna_next;
+};
+
+struct elf64_verdef
+{
+	uint16_t vd_version;
+	uint16_t vd_flags;
+	uint16_t vd_ndx;
+	uint16_t vd_cnt;
+	uint32_t vd_hash;
+	uint32_t vd_aux;
+	uint32_t vd_next;
+};
+
+struct elf64_verdaux
+{
+	uint32_t vda_name;
+	uint32_t vda_next;
+};
+
+struct elf_file
+{
+	int fd;
+	size_t size;
+	const unsigned char* data;
+	const struct elf64_ehdr* ehdr;
+	const struct elf64_phdr* phdrs;
+	const struct elf64_dyn* dynamic;
+	size_t dynamic_count;
+	const char* strtab;
+	size_t strtab_size;
+	const char* interp;
+};
+
+/**
+ * Callback used by the iteration functions. Return false to stop iterating.
+ */
+typedef bool(*elf_string_handler)(const char* value, void* userdata);
+typedef bool(*elf_verneed_handler)(const char* file, const char* version, void* userdata);
+typedef bool(*elf_symbol_handler)(const char* name, uint64_t vaddr, uint64_t size, void* userdata);
+
+bool elf_is_elf_magic(const void* data, size_t size);
+
+/**
+ * Map and validate @p path. Returns 0 on success, or a negative errno value.
+ * -ENOEXEC is returned for files that aren't 64-bit little-endian ELF objects.
+ */
+int elf_file_open(struct elf_file* elf, const char* path);
+void elf_file_close(struct elf_file* elf);
+
+static ALWAYS_INLINE bool elf_file_is_loadable(const struct elf_file* elf)
+{
+	return elf->ehdr->e_type == ELF_ET_EXEC || elf->ehdr->e_type == ELF_ET_DYN;
+}
+
+const char* elf_file_soname(const struct elf_file* elf);
+const char* elf_file_rpath(const struct elf_file* elf);
+const char* elf_file_runpath(const struct elf_file* elf);
+
+size_t elf_file_foreach_needed(const struct elf_file* elf, elf_string_handler handler, void* userdata);
+size_t elf_file_foreach_verdef(const struct elf_file* elf, elf_string_handler handler, void* userdata);
+size_t elf_file_foreach_verneed(const struct elf_file* elf, elf_verneed_handler handler, void* userdata);
+
+/**
+ * Every defined function symbol with a size, from .symtab, or from .dynsym
+ * for stripped files.
+ */
+size_t elf_file_foreach_function(const struct elf_file* elf, elf_symbol_handler handler, void* userdata);
+
+/**
+ * Map a file @p offset inside a PT_LOAD segment to its virtual address.
+ */
+bool elf_file_vaddr(const struct elf_file* elf, uint64_t offset, uint64_t* vaddr);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* _ELFFILE_H_ */
@@ -0,0 +1,173 @@
+/**
+ * @file hashmap.c
+ * @author Charles Grunwald <cgrunwald@gmail.com>
+ */
+#include "shared.h"
+#include "hashmap.h"
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME        0x100000001b3ULL
+
+#define MIN_BUCKETS 16
+
+uint64_t hash_fnv1a(const void* data, size_t length)
+{
+	uint64_t hash = FNV_OFFSET_BASIS;
+	const unsigned char* p = (const unsigned char*)data;
+	while(length-- > 0) {
+		hash ^= *p++;
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+static ALWAYS_INLINE size_t bucket_index(const struct hashmap* map, uint64_t hash)
+{
+	// Bucket counts are always a power of 2.
+	return (size_t)(hash & (map->bucket_count - 1));
+}
+
+int hashmap_init(struct hashmap* map, size_t size_hint)
+{
+	size_t count = MIN_BUCKETS;
+	if(UNLIKELY(!map))
+		return -EINVAL;
+
+	while(count < size_hint + size_hint / 3)
+		count <<= 1;
+
+	map->buckets = (struct hashmap_entry**)calloc(count, sizeof(struct hashmap_entry*));
+	if(UNLIKELY(!map->buckets))
+		return -ENOMEM;
+
+	map->bucket_count = count;
+	map->count = 0;
+	return 0;
+}
+
+void hashmap_reset(struct hashmap* map, hashmap_free_func free_value)
+{
+	if(UNLIKELY(!map || !map->buckets))
+		return;
+
+	for(size_t i = 0; i < map->bucket_count; i++) {
+		struct hashmap_entry* entry = map->buckets[i];
+		while(entry != NULL) {
+			struct hashmap_entry* next = entry->next;
+			if(free_value != NULL)
+				free_value(entry->value);
+			free(entry);
+			entry = next;
+		}
+	}
+
+	free(map->buckets);
+	map->buckets = NULL;
+	map->bucket_count = 0;
+	map->count = 0;
+}
+
+static struct hashmap_entry** hashmap_slot(const struct hashmap* map, const char* key, uint64_t hash)
+{
+	struct hashmap_entry** slot = &map->buckets[bucket_index(map, hash)];
+	while(*slot != NULL) {
+		if((*slot)->hash == hash && strcmp((*slot)->key, key) == 0)
+			break;
+		slot = &(*slot)->next;
+	}
+	return slot;
+}
+
+bool hashmap_find(const struct hashmap* map, const char* key, void** value)
+{
+	struct hashmap_entry* entry;
+	uint64_t hash = hash_fnv1a(key, strlen(key));
+
+	entry = *hashmap_slot(map, key, hash);
+	if(entry == NULL)
+		return false;
+	if(value != NULL)
+		*value = entry->value;
+	return true;
+}
+
+static void hashmap_grow(struct hashmap* map)
+{
+	struct hashmap old = *map;
+	struct hashmap_entry** buckets = (struct hashmap_entry**)calloc(old.bucket_count * 2, sizeof(struct hashmap_entry*));
+
+	// Growth is an optimization, so a failed allocation just leaves us with
+	// longer chains.
+	if(UNLIKELY(!buckets))
+		return;
+
+	map->buckets = buckets;
+	map->bucket_count = old.bucket_count * 2;
+	for(size_t i = 0; i < old.bucket_count; i++) {
+		struct hashmap_entry* entry = old.buckets[i];
+		while(entry != NULL) {
+			struct hashmap_entry* next = entry->next;
+			size_t index = bucket_index(map, entry->hash);
+			entry->next = map->buckets[index];
+			map->buckets[index] = entry;
+			entry = next;
+		}
+	}
+	free(old.buckets);
+}
+
+int hashmap_put(struct hashmap* map, const char* key, void* value, void** previous)
+{
+	size_t key_len = strlen(key);
+	uint64_t hash = hash_fnv1a(key, key_len);
+	struct hashmap_entry** slot = hashmap_slot(map, key, hash);
+
+	if(*slot != NULL) {
+		if(previous != NULL)
+			*previous = (*slot)->value;
+		(*slot)->value = value;
+		return 0;
+	}
+
+	*slot = (struct hashmap_entry*)malloc(sizeof(struct hashmap_entry) + key_len + 1);
+	if(UNLIKELY(!*slot))
+		return -ENOMEM;
+
+	(*slot)->next = NULL;
+	(*slot)->hash = hash;
+	(*slot)->value = value;
+	memcpy((*slot)->key, key, key_len + 1);
+	if(previous != NULL)
+		*previous = NULL;
+
+	if(++map->count > map->bucket_count - map->bucket_count / 4)
+		hashmap_grow(map);
+	return 0;
+}
+
+bool hashmap_remove(struct hashmap* map, const char* key, void** value)
+{
+	struct hashmap_entry* entry;
+	struct hashmap_entry** slot = hashmap_slot(map, key, hash_fnv1a(key, strlen(key)));
+
+	entry = *slot;
+	if(entry == NULL)
+		return false;
+
+	*slot = entry->next;
+	if(value != NULL)
+		*value = entry->value;
+	free(entry);
+	map->count--;
+	return true;
+}
+
+void hashmap_foreach(const struct hashmap* map, hashmap_iter_func handler, void* userdata)
+{
+	for(size_t i = 0; i < map->bucket_count; i++) {
+		for(struct hashmap_entry* entry = map->buckets[i]; entry != NULL; entry = entry->next) {
+			if(!handler(entry->key, entry->value, userdata))
+				return;
+		}
+	}
+}
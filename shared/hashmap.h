@@ -0,0 +1,68 @@
+/**
+ * @file hashmap.h
+ * @author Charles Grunwald <cgrunwald@gmail.com>
+ * @brief String-keyed hash map with separate chaining.
+ *
+ * Keys are copied into the map, values are owned by the caller. The map
+ * doesn't do any locking of its own.
+ */
+#ifndef _HASHMAP_H_
+#define _HASHMAP_H_
+#pragma once
+
+#include <stdint.h>
+#include "shared.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct hashmap_entry
+{
+	struct hashmap_entry* next;
+	uint64_t hash;
+	void* value;
+	char key[];
+};
+
+struct hashmap
+{
+	struct hashmap_entry** buckets;
+	size_t bucket_count;
+	size_t count;
+};
+
+typedef void(*hashmap_free_func)(void* value);
+typedef bool(*hashmap_iter_func)(const char* key, void* value, void* userdata);
+
+uint64_t hash_fnv1a(const void* data, size_t length);
+
+int hashmap_init(struct hashmap* map, size_t size_hint);
+void hashmap_reset(struct hashmap* map, hashmap_free_func free_value);
+
+/**
+ * Lookup @p key. Returns true if it was found, storing its value in @p value
+ * when that's non-NULL. This allows NULL to be stored as a value.
+ */
+bool hashmap_find(const struct hashmap* map, const char* key, void** value);
+
+/**
+ * Insert or replace @p key. When replacing, the previous value is stored to
+ * @p previous if that's non-NULL. Returns 0 on success or -ENOMEM.
+ */
+int hashmap_put(struct hashmap* map, const char* key, void* value, void** previous);
+
+bool hashmap_remove(struct hashmap* map, const char* key, void** value);
+void hashmap_foreach(const struct hashmap* map, hashmap_iter_func handler, void* userdata);
+
+static ALWAYS_INLINE void* hashmap_get(const struct hashmap* map, const char* key)
+{
+	void* value = NULL;
+	return hashmap_find(map, key, &value) ? value : NULL;
+}
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* _HASHMAP_H_ */
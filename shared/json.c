@@ -0,0 +1,385 @@
+/**
+ * @file json.c
+ * @author Charles Grunwald <cgrunwald@gmail.com>
+ */
+#include <sys/stat.h>
+
+#include "shared.h"
+#include "json.h"
+
+#define JSON_MAX_DEPTH 256
+
+struct json_parser
+{
+	const char* p;
+	const char* end;
+	int depth;
+};
+
+static int parse_value(struct json_parser* parser, struct json_value** result);
+
+static void skip_space(struct json_parser* parser)
+{
+	while(parser->p < parser->end &&
+	      (*parser->p == ' ' || *parser->p == '\t' || *parser->p == '\n' || *parser->p == '\r'))
+		parser->p++;
+}
+
+static bool consume(struct json_parser* parser, const char* literal, size_t len)
+{
+	if((size_t)(parser->end - parser->p) < len || memcmp(parser->p, literal, len) != 0)
+		return false;
+	parser->p += len;
+	return true;
+}
+
+static struct json_value* value_new(enum json_type type)
+{
+	struct json_value* value = (struct json_value*)calloc(1, sizeof(struct json_value));
+	if(value != NULL) {
+		value->type = type;
+		if(type == JSON_ARRAY || type == JSON_OBJECT)
+			json_members_init(&value->members);
+	}
+	return value;
+}
+
+static size_t encode_utf8(uint32_t code, char* out)
+{
+	if(code < 0x80) {
+		out[0] = (char)code;
+		return 1;
+	} else if(code < 0x800) {
+		out[0] = (char)(0xc0 | (code >> 6));
+		out[1] = (char)(0x80 | (code & 0x3f));
+		return 2;
+	} else if(code < 0x10000) {
+		out[0] = (char)(0xe0 | (code >> 12));
+		out[1] = (char)(0x80 | ((code >> 6) & 0x3f));
+		out[2] = (char)(0x80 | (code & 0x3f));
+		return 3;
+	}
+	out[0] = (char)(0xf0 | (code >> 18));
+	out[1] = (char)(0x80 | ((code >> 12) & 0x3f));
+	out[2] = (char)(0x80 | ((code >> 6) & 0x3f));
+	out[3] = (char)(0x80 | (code & 0x3f));
+	return 4;
+}
+
+static bool parse_hex4(struct json_parser* parser, uint32_t* code)
+{
+	*code = 0;
+	if(parser->end - parser->p < 4)
+		return false;
+	for(int i = 0; i < 4; i++) {
+		char c = *parser->p++;
+		*code <<= 4;
+		if(c >= '0' && c <= '9')
+			*code |= (uint32_t)(c - '0');
+		else if(c >= 'a' && c <= 'f')
+			*code |= (uint32_t)(c - 'a' + 10);
+		else if(c >= 'A' && c <= 'F')
+			*code |= (uint32_t)(c - 'A' + 10);
+		else
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Parse the string at the parser's position, which must be past the opening
+ * quote. Escapes never expand, so the raw length bounds the result.
+ */
+static int parse_string(struct json_parser* parser, char** result)
+{
+	const char* start = parser->p;
+	char* out;
+	char* string;
+
+	while(parser->p < parser->end && *parser->p != '"') {
+		if(*parser->p == '\\')
+			parser->p++;
+		parser->p++;
+	}
+	if(parser->p >= parser->end)
+		return -EINVAL;
+
+	string = out = (char*)malloc((size_t)(parser->p - start) + 1);
+	if(string == NULL)
+		return -ENOMEM;
+
+	parser->end = parser->p;
+	parser->p = start;
+	while(parser->p < parser->end) {
+		char c = *parser->p++;
+		uint32_t code;
+		if(c != '\\') {
+			*out++ = c;
+			continue;
+		}
+		switch(c = *parser->p++) {
+			case '"': case '\\': case '/': *out++ = c; break;
+			case 'b': *out++ = '\b'; break;
+			case 'f': *out++ = '\f'; break;
+			case 'n': *out++ = '\n'; break;
+			case 'r': *out++ = '\r'; break;
+			case 't': *out++ = '\t'; break;
+			case 'u':
+				if(!parse_hex4(parser, &code))
+					goto invalid;
+				// Surrogate pairs; a lone surrogate is passed through as-is.
+				if(code >= 0xd800 && code < 0xdc00 && parser->end - parser->p >= 6 &&
+				   parser->p[0] == '\\' && parser->p[1] == 'u') {
+					uint32_t low;
+					parser->p += 2;
+					if(!parse_hex4(parser, &low) || low < 0xdc00 || low > 0xdfff)
+						goto invalid;
+					code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+				}
+				out += encode_utf8(code, out);
+				break;
+			default:
+				goto invalid;
+		}
+	}
+	*out = '\0';
+	*result = string;
+	return 0;
+
+invalid:
+	free(string);
+	return -EINVAL;
+}
+
+static int parse_container(struct json_parser* parser, struct json_value* container, char close)
+{
+	int code;
+
+	skip_space(parser);
+	if(parser->p < parser->end && *parser->p == close) {
+		parser->p++;
+		return 0;
+	}
+
+	for(;;) {
+		struct json_member* member = json_members_append0(&container->members);
+		if(member == NULL)
+			return -ENOMEM;
+
+		skip_space(parser);
+		if(close == '}') {
+			const char* end = parser->end;
+			if(parser->p >= parser->end || *parser->p++ != '"')
+				return -EINVAL;
+			code = parse_string(parser, &member->key);
+			parser->end = end;
+			if(code != 0)
+				return code;
+			parser->p++;
+			skip_space(parser);
+			if(parser->p >= parser->end || *parser->p++ != ':')
+				return -EINVAL;
+		}
+
+		if((code = parse_value(parser, &member->value)) != 0)
+			return code;
+
+		skip_space(parser);
+		if(parser->p >= parser->end)
+			return -EINVAL;
+		if(*parser->p == ',') {
+			parser->p++;
+			continue;
+		}
+		if(*parser->p++ != close)
+			return -EINVAL;
+		return 0;
+	}
+}
+
+static int parse_number(struct json_parser* parser, struct json_value* value)
+{
+	char buffer[64];
+	char* endp;
+	size_t len = 0;
+
+	while(parser->p + len < parser->end && len < sizeof(buffer) - 1 &&
+	      strchr("+-0123456789.eE", parser->p[len]) != NULL)
+		len++;
+	if(len == 0)
+		return -EINVAL;
+
+	// strtod wants a terminated string, which the input isn't.
+	memcpy(buffer, parser->p, len);
+	buffer[len] = '\0';
+	value->number = strtod(buffer, &endp);
+	if(endp != buffer + len)
+		return -EINVAL;
+	parser->p += len;
+	return 0;
+}
+
+static int parse_value(struct json_parser* parser, struct json_value** result)
+{
+	int code = 0;
+	struct json_value* value = NULL;
+
+	skip_space(parser);
+	if(parser->p >= parser->end)
+		return -EINVAL;
+
+	switch(*parser->p) {
+		case '{':
+		case '[':
+			if(++parser->depth > JSON_MAX_DEPTH)
+				return -EINVAL;
+			value = value_new(*parser->p == '{' ? JSON_OBJECT : JSON_ARRAY);
+			if(value == NULL)
+				return -ENOMEM;
+			parser->p++;
+			code = parse_container(parser, value, value->type == JSON_OBJECT ? '}' : ']');
+			parser->depth--;
+			break;
+		case '"': {
+			const char* end = parser->end;
+			if((value = value_new(JSON_STRING)) == NULL)
+				return -ENOMEM;
+			parser->p++;
+			code = parse_string(parser, &value->string);
+			parser->end = end;
+			parser->p++;
+			break;
+		}
+		case 't':
+		case 'f':
+			if((value = value_new(JSON_BOOL)) == NULL)
+				return -ENOMEM;
+			value->boolean = *parser->p == 't';
+			if(!consume(parser, value->boolean ? "true" : "false", value->boolean ? 4 : 5))
+				code = -EINVAL;
+			break;
+		case 'n':
+			if((value = value_new(JSON_NULL)) == NULL)
+				return -ENOMEM;
+			if(!consume(parser, "null", 4))
+				code = -EINVAL;
+			break;
+		default:
+			if((value = value_new(JSON_NUMBER)) == NULL)
+				return -ENOMEM;
+			code = parse_number(parser, value);
+			break;
+	}
+
+	if(code != 0) {
+		json_free(value);
+		return code;
+	}
+	*result = value;
+	return 0;
+}
+
+int json_parse(const char* text, size_t length, struct json_value** result)
+{
+	int code;
+	struct json_parser parser = { text, text + length, 0 };
+
+	*result = NULL;
+	if((code = parse_value(&parser, result)) != 0)
+		return code;
+
+	skip_space(&parser);
+	if(parser.p != parser.end) {
+		json_free(*result);
+		*result = NULL;
+		return -EINVAL;
+	}
+	return 0;
+}
+
+int json_parse_file(const char* path, struct json_value** result)
+{
+	int code;
+	char* text;
+	size_t done = 0;
+	struct stat st;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	*result = NULL;
+	if(fd < 0)
+		return -errno;
+	if(fstat(fd, &st) != 0) {
+		code = -errno;
+		close(fd);
+		return code;
+	}
+
+	text = (char*)malloc((size_t)st.st_size + 1);
+	if(text == NULL) {
+		close(fd);
+		return -ENOMEM;
+	}
+	while(done < (size_t)st.st_size) {
+		ssize_t count = read(fd, text + done, (size_t)st.st_size - done);
+		if(count < 0 && errno == EINTR)
+			continue;
+		if(count <= 0)
+			break;
+		done += (size_t)count;
+	}
+	close(fd);
+
+	code = json_parse(text, done, result);
+	free(text);
+	return code;
+}
+
+void json_free(struct json_value* value)
+{
+	struct json_member* member;
+
+	if(value == NULL)
+		return;
+	if(value->type == JSON_STRING) {
+		free(value->string);
+	} else if(value->type == JSON_ARRAY || value->type == JSON_OBJECT) {
+		ARRAY_FOREACH(&value->members, member) {
+			free(member->key);
+			json_free(member->value);
+		}
+		json_members_reset(&value->members);
+	}
+	free(value);
+}
+
+const struct json_value* json_get(const struct json_value* object, const char* key)
+{
+	struct json_member* member;
+
+	if(object == NULL || object->type != JSON_OBJECT)
+		return NULL;
+	ARRAY_FOREACH(&object->members, member) {
+		if(member->key != NULL && strcmp(member->key, key) == 0)
+			return member->value;
+	}
+	return NULL;
+}
+
+const struct json_value* json_at(const struct json_value* array, size_t index)
+{
+	if(array == NULL || array->type != JSON_ARRAY || index >= array->members.base.elements)
+		return NULL;
+	return ((struct json_member*)array->members.base.base)[index].value;
+}
+
+size_t json_count(const struct json_value* value)
+{
+	if(value == NULL || (value->type != JSON_ARRAY && value->type != JSON_OBJECT))
+		return 0;
+	return value->members.base.elements;
+}
+
+const char* json_string(const struct json_value* value)
+{
+	return value != NULL && value->type == JSON_STRING ? value->string : NULL;
+}
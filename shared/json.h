@@ -0,0 +1,74 @@
+/**
+ * @file json.h
+ * @author Charles Grunwald <cgrunwald@gmail.com>
+ * @brief Minimal JSON reader.
+ *
+ * Enough to read the replies of CMake's file API and similar tool output: the
+ * whole document is parsed into a tree of json_value nodes that is released
+ * with json_free. Numbers are stored as doubles and strings are unescaped to
+ * UTF-8.
+ */
+#ifndef _JSON_H_
+#define _JSON_H_
+#pragma once
+
+#include "shared.h"
+#include "dynarray.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum json_type
+{
+	JSON_NULL,
+	JSON_BOOL,
+	JSON_NUMBER,
+	JSON_STRING,
+	JSON_ARRAY,
+	JSON_OBJECT,
+};
+
+struct json_value;
+
+struct json_member
+{
+	char* key;
+	struct json_value* value;
+};
+
+DEFINE_ARRAY_TYPE(json_members, struct json_member)
+
+struct json_value
+{
+	enum json_type type;
+	union {
+		bool boolean;
+		double number;
+		char* string;
+		struct json_members members;
+	};
+};
+
+/**
+ * Parse @p length bytes of @p text. Returns 0 or a negative errno value:
+ * -EINVAL for malformed input and -ENOMEM when out of memory.
+ */
+int json_parse(const char* text, size_t length, struct json_value** result);
+int json_parse_file(const char* path, struct json_value** result);
+void json_free(struct json_value* value);
+
+/**
+ * Lookup helpers. All of them accept NULL and values of the wrong type, and
+ * return NULL (or 0) for them, so lookups can be chained.
+ */
+const struct json_value* json_get(const struct json_value* object, const char* key);
+const struct json_value* json_at(const struct json_value* array, size_t index);
+size_t json_count(const struct json_value* value);
+const char* json_string(const struct json_value* value);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* _JSON_H_ */
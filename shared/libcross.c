@@ -0,0 +1,702 @@
+/**
+ * @file libcross.c
+ * @author Charles Grunwald <cgrunwald@gmail.com>
+ */
+#include "shared.h"
+#include "strutil.h"
+#include "libcross.h"
+
+#define ENV_SEP ":"
+#define PATH_SEP_STR "/"
+#define PATH_SEP_CHR '/'
+
+#define DEBUG_ENVNAME "CROSS_DEBUG"
+
+#define TOOLCHAIN_ARG "-DCMAKE_TOOLCHAIN_FILE="
+#define INSTALL_PREFIX_ARG "-DCMAKE_INSTALL_PREFIX="
+#define CYGWIN_WIN32_ARG "-DWIN32=0"
+#define HOST_MEMORY_ARG "-DCROSS_HOST_MEMORY_MB="
+#define HOST_CPUS_ARG "-DCROSS_HOST_CPUS="
+
+#define CMAKE_ARGS_COUNT 5
+
+#define MEMINFO_PATH "/proc/meminfo"
+#define CGROUP_ROOT "/sys/fs/cgroup"
+
+#define USHIFT(SIZE,VALUE,COUNT) \
+	(((uint ## SIZE ## _t)(VALUE)) << ((uint ## SIZE ## _t)(COUNT)))
+
+#define AS_U16_ARG(A,B) \
+	( USHIFT(16,B,8) | ((uint16_t)(A)) )
+
+#define AS_U32_ARG(A,B,C,D) \
+	( USHIFT(32,D,24) | \
+	  USHIFT(32,C,16) | \
+	  USHIFT(32,B,8)  | \
+	  ((uint32_t)(A))  )
+
+struct cmake_search
+{
+	struct cross_context* ctx;
+	const struct cross_strref* exe;
+};
+
+static void* default_malloc(size_t size, void* CPP_UNUSED(userdata))
+{
+	return malloc(size);
+}
+
+static void default_free(void* ptr, void* CPP_UNUSED(userdata))
+{
+	free(ptr);
+}
+
+static void default_log(const char* message, void* CPP_UNUSED(userdata))
+{
+	printf("DEBUG: %s\n", message);
+}
+
+static void debuglog(struct cross_context* ctx, const char* format, ...)
+{
+	if(ctx->debug && ctx->log != NULL) {
+		va_list args;
+		char message[PATH_MAX + 64];
+		va_start(args, format);
+		vsnprintf(message, sizeof(message), format, args);
+		va_end(args);
+		ctx->log(message, ctx->log_userdata);
+	}
+}
+
+static int set_error(struct cross_context* ctx, int error, int sys_errno, const char* format, ...)
+{
+	va_list args;
+	ctx->error = error;
+	ctx->sys_errno = sys_errno;
+	va_start(args, format);
+	vsnprintf(ctx->message, sizeof(ctx->message), format, args);
+	va_end(args);
+	return error;
+}
+
+static ALWAYS_INLINE int set_enomem(struct cross_context* ctx)
+{
+	return set_error(ctx, CROSS_ENOMEM, ENOMEM, "%s", cross_strerror(CROSS_ENOMEM));
+}
+
+int cross_context_init(struct cross_context* ctx, const struct cross_allocator* allocator)
+{
+	if(ctx == NULL)
+		return CROSS_EINVAL;
+
+	memset((void*)ctx, 0, sizeof(*ctx));
+	if(allocator != NULL) {
+		if(allocator->malloc == NULL || allocator->free == NULL)
+			return CROSS_EINVAL;
+		ctx->allocator = *allocator;
+	} else {
+		ctx->allocator.malloc = default_malloc;
+		ctx->allocator.free = default_free;
+	}
+	ctx->log = default_log;
+	return CROSS_OK;
+}
+
+void cross_context_set_debug(struct cross_context* ctx, bool debug)
+{
+	ctx->debug = debug;
+}
+
+void cross_context_set_logger(struct cross_context* ctx, cross_log_func log, void* userdata)
+{
+	ctx->log = log;
+	ctx->log_userdata = userdata;
+}
+
+bool cross_debug_from_env(void)
+{
+	const char* debug_env = getenv(DEBUG_ENVNAME);
+	return debug_env != NULL && (*debug_env == '1');
+}
+
+const char* cross_context_error(const struct cross_context* ctx)
+{
+	return ctx->error == CROSS_OK ? "" : ctx->message;
+}
+
+const char* cross_strerror(int error)
+{
+	switch(error) {
+		case CROSS_OK:           return "Success";
+		case CROSS_ENOMEM:       return "Out of memory";
+		case CROSS_EINVAL:       return "Invalid argument";
+		case CROSS_ETOOLONG:     return "Path too long";
+		case CROSS_EPATH:        return "Failed to resolve the toolchain layout";
+		case CROSS_EUNAME:       return "Failed to resolve the target uname";
+		case CROSS_ENOTOOLCHAIN: return "Failed to locate the CMake toolchain file";
+		case CROSS_ENOPREFIX:    return "Failed to locate the install prefix";
+		case CROSS_ENOCMAKE:     return "Failed to locate cmake executable";
+		case CROSS_ESYSTEM:      return "System error";
+		default:                 return "Unknown error";
+	}
+}
+
+int cross_exit_code(const struct cross_context* ctx)
+{
+	// The wrappers have always exited with the errno behind a failure.
+	if(ctx->error == CROSS_OK)
+		return 0;
+	return ctx->sys_errno != 0 ? ctx->sys_errno : 1;
+}
+
+void* cross_malloc(struct cross_context* ctx, size_t size)
+{
+	return ctx->allocator.malloc(size, ctx->allocator.userdata);
+}
+
+void cross_free(struct cross_context* ctx, void* ptr)
+{
+	if(ptr != NULL)
+		ctx->allocator.free(ptr, ctx->allocator.userdata);
+}
+
+char* cross_strndup(struct cross_context* ctx, const char* value, size_t len)
+{
+	char* result = (char*)cross_malloc(ctx, len + 1);
+	if(LIKELY(result != NULL)) {
+		memcpy(result, value, len);
+		result[len] = '\0';
+	}
+	return result;
+}
+
+static ALWAYS_INLINE int strref_cmp(const struct cross_strref* self, const struct cross_strref* other)
+{
+	return self->len == other->len ? strcmp(self->value, other->value) : (int)(self->len - other->len);
+}
+
+static bool strref_set(struct cross_context* ctx, struct cross_strref* self, const char* value, size_t len)
+{
+	self->value = (const char*)cross_strndup(ctx, value, len);
+	self->len = self->value != NULL ? len : 0;
+	return self->value != NULL;
+}
+
+static void strref_reset(struct cross_context* ctx, struct cross_strref* self)
+{
+	cross_free(ctx, (void*)self->value);
+	memset((void*)self, 0, sizeof(*self));
+}
+
+void cross_paths_reset(struct cross_context* ctx, struct cross_paths* paths)
+{
+	if(paths != NULL) {
+		strref_reset(ctx, &paths->abspath);
+		strref_reset(ctx, &paths->bindir);
+		strref_reset(ctx, &paths->prefix);
+		strref_reset(ctx, &paths->uname);
+	}
+}
+
+int cross_paths_init(struct cross_context* ctx, struct cross_paths* paths, const char* exe, const char* suffix)
+{
+	char buffer[PATH_MAX] = "";
+	char *psearch, *pbase, *pdir = &(buffer[0]);
+	size_t dir_len, base_len, buffer_len;
+
+	memset((void*)paths, 0, sizeof(*paths));
+	if(exe == NULL || suffix == NULL)
+		return set_error(ctx, CROSS_EINVAL, EINVAL, "%s", cross_strerror(CROSS_EINVAL));
+
+	buffer_len = strlen(exe);
+	if(buffer_len >= PATH_MAX)
+		return set_error(ctx, CROSS_ETOOLONG, ENAMETOOLONG, "Path too long: %s", exe);
+
+	// Initialize the path containing our executable
+	debuglog(ctx, "Initializing exe abspath...");
+	if(!strref_set(ctx, &paths->abspath, exe, buffer_len))
+		return set_enomem(ctx);
+	memcpy(buffer, exe, buffer_len + 1);
+
+	// Resolve the location of the last '/' in the process path.
+	debuglog(ctx, "Locating the path of our bin folder...");
+	pbase = xstrrchr(buffer, buffer_len, PATH_SEP_CHR);
+	if(pbase == NULL) {
+		cross_paths_reset(ctx, paths);
+		return set_error(ctx, CROSS_EPATH, 0, "Failed to resolve parent folder of: %s", buffer);
+	}
+
+	// Based on that, figure out the length of our bin folder path, then
+	// terminate it.
+	dir_len = (size_t)pbase - (size_t)pdir;
+	*pbase++ = '\0';
+	base_len = buffer_len - dir_len - 1;
+	debuglog(ctx, "  => '%s'", pdir);
+
+	// Store the bindir
+	if(!strref_set(ctx, &paths->bindir, pdir, dir_len)) {
+		cross_paths_reset(ctx, paths);
+		return set_enomem(ctx);
+	}
+
+	// Resolve the cross compiler's prefix folder.
+	debuglog(ctx, "Locating our executable's prefix path...");
+	psearch = xstrrchr(pdir, dir_len, PATH_SEP_CHR);
+	if(psearch == NULL) {
+		cross_paths_reset(ctx, paths);
+		return set_error(ctx, CROSS_EPATH, 0, "Failed to resolve parent folder of: %s", pdir);
+	}
+
+	*psearch = '\0';
+	if(!strref_set(ctx, &paths->prefix, pdir, (size_t)psearch - (size_t)pdir)) {
+		cross_paths_reset(ctx, paths);
+		return set_enomem(ctx);
+	}
+	debuglog(ctx, "  => %s", paths->prefix.value);
+
+	// Resolve the uname for tha cross compiler's target.
+	debuglog(ctx, "Resolving the target uname of our cross compiler...");
+	psearch = xstrrstr(pbase, base_len, suffix, strlen(suffix));
+	if(psearch == NULL) {
+		cross_paths_reset(ctx, paths);
+		return set_error(ctx, CROSS_EUNAME, 0, "Failed to resolve the end of our target uname string: %s", pbase);
+	}
+
+	// Set our field.
+	if(!strref_set(ctx, &paths->uname, pbase, (size_t)psearch - (size_t)pbase)) {
+		cross_paths_reset(ctx, paths);
+		return set_enomem(ctx);
+	}
+	debuglog(ctx, "  => %s", paths->uname.value);
+	return CROSS_OK;
+}
+
+static ALWAYS_INLINE bool which_handled(struct cross_strref* path, cross_which_handler handler, void* userdata)
+{
+	return is_regular_file(path->value) && access(path->value, X_OK) == 0 && handler(path, userdata);
+}
+
+int cross_which_path(struct cross_context* ctx, const char* name, const char* envpath,
+                     cross_which_handler handler, void* userdata, char** result)
+{
+	char filepath[PATH_MAX] = "";
+	char *paths, *saveptr, *tok = NULL;
+	struct cross_strref path_value = { 0, (const char*)&filepath[0] };
+
+	*result = NULL;
+	if(envpath == NULL)
+		return CROSS_OK;
+
+	// Duplicate environment path.
+	paths = cross_strndup(ctx, envpath, strlen(envpath));
+	if(paths == NULL)
+		return set_enomem(ctx);
+
+	tok = strtok_r(paths, ENV_SEP, &saveptr);
+	if(tok != NULL) {
+		do {
+			int len = snprintf(filepath, PATH_MAX, "%s" PATH_SEP_STR "%s", tok, name);
+			if(len < 0 || len >= PATH_MAX)
+				continue;
+
+			path_value.len = (size_t)len;
+			debuglog(ctx, "  + Checking %s...", filepath);
+			if(which_handled(&path_value, handler, userdata))
+				break;
+
+			path_value.len += 4;
+			if((path_value.len + 1) > PATH_MAX)
+				continue;
+
+			strcat(filepath, ".exe");
+			debuglog(ctx, "  + Checking %s...", filepath);
+			if(which_handled(&path_value, handler, userdata))
+				break;
+		} while((tok = strtok_r(NULL, ENV_SEP, &saveptr)) != NULL);
+	}
+
+	cross_free(ctx, paths);
+	if(tok != NULL && (*result = cross_strndup(ctx, filepath, path_value.len)) == NULL)
+		return set_enomem(ctx);
+	return CROSS_OK;
+}
+
+static bool handle_cmake_path(struct cross_strref* path, struct cmake_search* search)
+{
+	bool result;
+	debuglog(search->ctx, "Verifying '%s' != '%s'...", path->value, search->exe->value);
+	result = strref_cmp(path, search->exe) != 0;
+	debuglog(search->ctx, "  => %s", result ? "true" : "false");
+	return result;
+}
+
+int cross_find_cmake(struct cross_context* ctx, const struct cross_paths* paths, char** result)
+{
+	int code;
+	struct cmake_search search = { ctx, &paths->abspath };
+
+	debuglog(ctx, "Attempting to resolve cmake executable path...");
+	code = cross_which_path(ctx, "cmake", getenv("PATH"), (cross_which_handler)handle_cmake_path, &search, result);
+	if(code == CROSS_OK && *result == NULL)
+		code = set_error(ctx, CROSS_ENOCMAKE, ENOENT, "%s!", cross_strerror(CROSS_ENOCMAKE));
+	return code;
+}
+
+static int format_path(struct cross_context* ctx, char** result, const char* format, ...)
+{
+	int len;
+	va_list args;
+	char buffer[PATH_MAX];
+
+	va_start(args, format);
+	len = vsnprintf(buffer, sizeof(buffer), format, args);
+	va_end(args);
+
+	if(len < 0 || len >= PATH_MAX)
+		return set_error(ctx, CROSS_ETOOLONG, ENAMETOOLONG, "%s", cross_strerror(CROSS_ETOOLONG));
+	if((*result = cross_strndup(ctx, buffer, (size_t)len)) == NULL)
+		return set_enomem(ctx);
+	return CROSS_OK;
+}
+
+int cross_resolve_toolchain_path(struct cross_context* ctx, const struct cross_paths* paths, char** result)
+{
+	int code;
+
+	// First resolve and check the CMake toolchain file..
+	debuglog(ctx, "Resolving CMake toolchain file...");
+	code = format_path(ctx, result, "%s/%s" CROSS_TOOLCHAIN_SUFFIX, paths->bindir.value, paths->uname.value);
+	if(code != CROSS_OK)
+		return code;
+
+	debuglog(ctx, "  => '%s'", *result);
+	debuglog(ctx, "Checking toolchain file...");
+	if(access(*result, R_OK) != 0) {
+		code = set_error(ctx, CROSS_ENOTOOLCHAIN, errno,
+		                 "Failed to locate cross compiler's CMake toolchain file: %s!", *result);
+		cross_free(ctx, *result);
+		*result = NULL;
+		return code;
+	}
+	debuglog(ctx, "  => OK");
+	return CROSS_OK;
+}
+
+int cross_resolve_sysroot(struct cross_context* ctx, const struct cross_paths* paths, char** result)
+{
+	int code;
+
+	debuglog(ctx, "Resolving sysroot...");
+	code = format_path(ctx, result, "%s/%s/sysroot", paths->prefix.value, paths->uname.value);
+	if(code != CROSS_OK)
+		return code;
+
+	debuglog(ctx, "  => '%s'", *result);
+	if(!is_folder(*result)) {
+		code = set_error(ctx, CROSS_EPATH, ENOENT, "Sysroot does not exist: %s", *result);
+		cross_free(ctx, *result);
+		*result = NULL;
+		return code;
+	}
+	return CROSS_OK;
+}
+
+int cross_resolve_install_prefix(struct cross_context* ctx, const struct cross_paths* paths, char** result)
+{
+	int code;
+
+	// First resolve and check the install prefix folder
+	debuglog(ctx, "Resolving install prefix...");
+	code = format_path(ctx, result, "%s/%s/sysroot/usr", paths->prefix.value, paths->uname.value);
+	if(code != CROSS_OK)
+		return code;
+
+	debuglog(ctx, "  => '%s'", *result);
+	debuglog(ctx, "Checking install prefix existence...");
+	if(!is_folder(*result)) {
+		code = set_error(ctx, CROSS_ENOPREFIX, errno != 0 ? errno : ENOENT,
+		                 "Failed to locate install prefix: %s!", *result);
+		cross_free(ctx, *result);
+		*result = NULL;
+		return code;
+	}
+	debuglog(ctx, "  => OK");
+	return CROSS_OK;
+}
+
+static int prefix_arg(struct cross_context* ctx, const char* prefix, size_t prefix_len, char** value)
+{
+	size_t len = strlen(*value);
+	char* arg = (char*)cross_malloc(ctx, prefix_len + len + 1);
+	if(arg == NULL) {
+		cross_free(ctx, *value);
+		*value = NULL;
+		return set_enomem(ctx);
+	}
+	memcpy(arg, prefix, prefix_len);
+	memcpy(arg + prefix_len, *value, len + 1);
+	cross_free(ctx, *value);
+	*value = arg;
+	return CROSS_OK;
+}
+
+int cross_resolve_toolchain_arg(struct cross_context* ctx, const struct cross_paths* paths, char** result)
+{
+	int code = cross_resolve_toolchain_path(ctx, paths, result);
+	if(code != CROSS_OK)
+		return code;
+	return prefix_arg(ctx, TOOLCHAIN_ARG, sizeof(TOOLCHAIN_ARG) - 1, result);
+}
+
+int cross_resolve_install_prefix_arg(struct cross_context* ctx, const struct cross_paths* paths, char** result)
+{
+	int code = cross_resolve_install_prefix(ctx, paths, result);
+	if(code != CROSS_OK)
+		return code;
+	return prefix_arg(ctx, INSTALL_PREFIX_ARG, sizeof(INSTALL_PREFIX_ARG) - 1, result);
+}
+
+static ALWAYS_INLINE uint16_t load_u16(const char* arg)
+{
+	uint16_t value;
+	memcpy(&value, arg, sizeof(value));
+	return value;
+}
+
+static ALWAYS_INLINE uint32_t load_u32(const char* arg)
+{
+	uint32_t value;
+	memcpy(&value, arg, sizeof(value));
+	return value;
+}
+
+static ALWAYS_INLINE bool is_cmake_command_u16(uint16_t arg)
+{
+	switch(arg)
+	{
+		case AS_U16_ARG('-', 'E'): // NOLINT
+		case AS_U16_ARG('-', 'L'): // NOLINT
+		case AS_U16_ARG('-', 'N'): // NOLINT
+		case AS_U16_ARG('-', 'P'): // NOLINT
+		case AS_U16_ARG('-', 'h'): // NOLINT
+		case AS_U16_ARG('-', 'H'): // NOLINT
+		case AS_U16_ARG('/', '?'): // NOLINT
+		case AS_U16_ARG('-', 'u'): // NOLINT
+		case AS_U16_ARG('-', 'v'): // NOLINT
+		case AS_U16_ARG('/', 'v'): // NOLINT
+			return true;
+		default:
+			return false;
+	}
+}
+
+static ALWAYS_INLINE bool is_cmake_command_u32(const char* arg, size_t arglen)
+{
+	switch(load_u32(arg))
+	{
+		case AS_U32_ARG('v','e','r','s'):
+		case AS_U32_ARG('b','u','i','l'):
+		case AS_U32_ARG('f','i','n','d'):
+		case AS_U32_ARG('g','r','a','p'):
+		case AS_U32_ARG('s','y','s','t'):
+		case AS_U32_ARG('c','h','e','c'):
+		case AS_U32_ARG('h','e','l','p'):
+			return true;
+		case AS_U32_ARG('i','n','s','t'):
+			// --install, but not --install-prefix
+			return arglen == 2 + sizeof("install") - 1;
+		case AS_U32_ARG('d','e','b','u'):
+			// --debug-trycompile
+			return arglen >= 2 + sizeof("debug") + 4 &&
+			       load_u32(arg + sizeof("debug")) == AS_U32_ARG('t','r','y','c');
+		default:
+			return false;
+	}
+}
+
+bool cross_is_cmake_generate(struct cross_context* ctx, int argc, char** argv)
+{
+	debuglog(ctx, "Attempting to identify if cmake was run in generation mode...");
+	for(int i = 1; i < argc; i++) {
+		const char* arg = argv[i];
+		size_t arglen = strlen(arg);
+
+		debuglog(ctx, "  + check('%s')...", arg);
+		if(arglen >= 2 && is_cmake_command_u16(load_u16(arg))) {
+			debuglog(ctx, "  => NO");
+			return false;
+		}
+
+		if(arglen >= 6 && arg[1] == '-' && is_cmake_command_u32(arg + 2, arglen)) {
+			debuglog(ctx, "  => NO");
+			return false;
+		}
+	}
+	debuglog(ctx, "  => OK");
+	return true;
+}
+
+static bool read_number_file(const char* path, unsigned long long* value)
+{
+	char buffer[64] = "";
+	char* end = NULL;
+	FILE* file = fopen(path, "r");
+
+	if(file == NULL)
+		return false;
+	if(fgets(buffer, sizeof(buffer), file) == NULL)
+		buffer[0] = '\0';
+	fclose(file);
+	*value = strtoull(buffer, &end, 10);
+	return end != buffer;
+}
+
+static unsigned long long meminfo_available(void)
+{
+	char line[128];
+	unsigned long long kb = 0;
+	FILE* file = fopen(MEMINFO_PATH, "r");
+
+	if(file != NULL) {
+		while(fgets(line, sizeof(line), file) != NULL) {
+			if(strncmp(line, "MemAvailable:", 13) == 0) {
+				kb = strtoull(line + 13, NULL, 10);
+				break;
+			}
+		}
+		fclose(file);
+	}
+	if(kb == 0) {
+		long pages = sysconf(_SC_AVPHYS_PAGES);
+		long page_size = sysconf(_SC_PAGESIZE);
+		if(pages > 0 && page_size > 0)
+			kb = (unsigned long long)pages * (unsigned long long)page_size / 1024;
+	}
+	return kb * 1024;
+}
+
+/*
+ * Headroom left under a cgroup memory limit, v2 then v1. Containers see their
+ * own cgroup at the root of the hierarchy.
+ */
+static unsigned long long cgroup_memory_headroom(void)
+{
+	unsigned long long limit = 0, usage = 0;
+
+	if(read_number_file(CGROUP_ROOT "/memory.max", &limit))
+		read_number_file(CGROUP_ROOT "/memory.current", &usage);
+	else if(read_number_file(CGROUP_ROOT "/memory/memory.limit_in_bytes", &limit))
+		read_number_file(CGROUP_ROOT "/memory/memory.usage_in_bytes", &usage);
+	if(limit == 0)
+		return 0;
+	return usage < limit ? limit - usage : 1;
+}
+
+static unsigned int cgroup_cpu_quota(void)
+{
+	char buffer[64] = "";
+	unsigned long long quota = 0, period = 0;
+	FILE* file = fopen(CGROUP_ROOT "/cpu.max", "r");
+
+	// v2: "<quota> <period>", or "max <period>" when unlimited.
+	if(file != NULL) {
+		if(fgets(buffer, sizeof(buffer), file) != NULL && strncmp(buffer, "max", 3) != 0) {
+			char* end = NULL;
+			quota = strtoull(buffer, &end, 10);
+			period = strtoull(end, NULL, 10);
+		}
+		fclose(file);
+	} else if(read_number_file(CGROUP_ROOT "/cpu/cpu.cfs_quota_us", &quota)) {
+		read_number_file(CGROUP_ROOT "/cpu/cpu.cfs_period_us", &period);
+	}
+	if(quota == 0 || period == 0)
+		return 0;
+	return (unsigned int)((quota + period - 1) / period);
+}
+
+void cross_query_host_resources(struct cross_host_resources* resources)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned long long memory = meminfo_available();
+	unsigned long long headroom = cgroup_memory_headroom();
+	unsigned int quota = cgroup_cpu_quota();
+
+	if(headroom != 0 && (memory == 0 || headroom < memory))
+		memory = headroom;
+	resources->memory_mb = memory / (1024 * 1024);
+	resources->cpus = cpus > 0 ? (unsigned int)cpus : 0;
+	if(quota != 0 && (resources->cpus == 0 || quota < resources->cpus))
+		resources->cpus = quota;
+}
+
+void cross_free_argv(struct cross_context* ctx, int argc, char** argv)
+{
+	if(argv != NULL) {
+		for(int i = 0; i < argc; i++)
+			cross_free(ctx, argv[i]);
+		cross_free(ctx, argv);
+	}
+}
+
+/*
+ * The toolchain file sizes its job pools from these; it can't see cgroup
+ * limits itself. Unknown values are left out.
+ */
+static int host_resource_args(struct cross_context* ctx, char** argv, int* argi)
+{
+	int code = CROSS_OK;
+	struct cross_host_resources resources;
+
+	cross_query_host_resources(&resources);
+	debuglog(ctx, "Host resources: %llu MB available, %u CPUs", resources.memory_mb, resources.cpus);
+	if(resources.memory_mb != 0)
+		code = format_path(ctx, &argv[(*argi)++], HOST_MEMORY_ARG "%llu", resources.memory_mb);
+	if(code == CROSS_OK && resources.cpus != 0)
+		code = format_path(ctx, &argv[(*argi)++], HOST_CPUS_ARG "%u", resources.cpus);
+	return code;
+}
+
+int cross_cmake_argv(struct cross_context* ctx, const struct cross_paths* paths, int argc, char** argv,
+                     int* out_argc, char*** out_argv)
+{
+	int code, argi = 0;
+	bool generate = cross_is_cmake_generate(ctx, argc, argv);
+	int child_argc = argc + (generate ? CMAKE_ARGS_COUNT : 0);
+	size_t sz_args = sizeof(char*) * (size_t)(child_argc + 1);
+	char** child_argv;
+
+	*out_argc = 0;
+	*out_argv = NULL;
+
+	// Alloc our child args array
+	child_argv = (char**)cross_malloc(ctx, sz_args);
+	if(child_argv == NULL)
+		return set_enomem(ctx);
+	memset((void*)child_argv, 0, sz_args);
+
+	// Populate our child args array
+	code = cross_find_cmake(ctx, paths, &child_argv[argi++]);
+	if(code == CROSS_OK && generate) {
+		code = cross_resolve_toolchain_arg(ctx, paths, &child_argv[argi++]);
+		if(code == CROSS_OK)
+			code = cross_resolve_install_prefix_arg(ctx, paths, &child_argv[argi++]);
+		if(code == CROSS_OK && (child_argv[argi++] = cross_strndup(ctx, CYGWIN_WIN32_ARG, sizeof(CYGWIN_WIN32_ARG) - 1)) == NULL)
+			code = set_enomem(ctx);
+		if(code == CROSS_OK)
+			code = host_resource_args(ctx, child_argv, &argi);
+	}
+
+	for(int i = 1; code == CROSS_OK && i < argc; i++) {
+		if((child_argv[argi++] = cross_strndup(ctx, argv[i], strlen(argv[i]))) == NULL)
+			code = set_enomem(ctx);
+	}
+
+	if(code != CROSS_OK) {
+		cross_free_argv(ctx, child_argc, child_argv);
+		return code;
+	}
+
+	*out_argc = argi;
+	*out_argv = child_argv;
+	return CROSS_OK;
+}
@@ -0,0 +1,177 @@
+/**
+ * @file libcross.h
+ * @author Charles Grunwald <cgrunwald@gmail.com>
+ * @brief In-process toolchain resolution for the cross wrappers.
+ *
+ * Everything the wrappers need to locate their toolchain, split out of
+ * cross-cmake so build daemons can do the same without forking. All state
+ * lives in a caller-owned cross_context: there are no globals, nothing calls
+ * exit(), and every allocation goes through the context's allocator. One
+ * context per thread, or external locking, is all that's required.
+ *
+ * Functions returning int return CROSS_OK (0) or a negative cross_error.
+ * cross_context_error describes the most recent failure on that context.
+ * Strings handed back to the caller are freed with cross_free.
+ */
+#ifndef _LIBCROSS_H_
+#define _LIBCROSS_H_
+#pragma once
+
+#include "shared.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CROSS_ERROR_MESSAGE_SIZE 512
+
+#define CROSS_CMAKE_SUFFIX "-cmake"
+#define CROSS_TOOLCHAIN_SUFFIX "-toolchain.cmake"
+
+enum cross_error
+{
+	CROSS_OK = 0,
+	CROSS_ENOMEM = -1,
+	CROSS_EINVAL = -2,
+	CROSS_ETOOLONG = -3,
+	CROSS_EPATH = -4,
+	CROSS_EUNAME = -5,
+	CROSS_ENOTOOLCHAIN = -6,
+	CROSS_ENOPREFIX = -7,
+	CROSS_ENOCMAKE = -8,
+	CROSS_ESYSTEM = -9,
+};
+
+struct cross_allocator
+{
+	void* (*malloc)(size_t size, void* userdata);
+	void (*free)(void* ptr, void* userdata);
+	void* userdata;
+};
+
+typedef void(*cross_log_func)(const char* message, void* userdata);
+
+struct cross_context
+{
+	struct cross_allocator allocator;
+	cross_log_func log;
+	void* log_userdata;
+	bool debug;
+	int error;
+	int sys_errno;
+	char message[CROSS_ERROR_MESSAGE_SIZE];
+};
+
+struct cross_strref
+{
+	size_t len;
+	const char* value;
+};
+
+/**
+ * The paths derived from a wrapper's location:
+ *
+ *   abspath  <prefix>/bin/<uname><suffix>
+ *   bindir   <prefix>/bin
+ *   prefix   <prefix>
+ *   uname    the target triple
+ */
+struct cross_paths
+{
+	struct cross_strref abspath;
+	struct cross_strref bindir;
+	struct cross_strref prefix;
+	struct cross_strref uname;
+};
+
+typedef bool(*cross_which_handler)(struct cross_strref* path, void* userdata);
+
+/**
+ * Initialize @p ctx. A NULL @p allocator uses malloc/free. Debug logging
+ * defaults to off and goes to stdout unless a logger is installed.
+ */
+int cross_context_init(struct cross_context* ctx, const struct cross_allocator* allocator);
+void cross_context_set_debug(struct cross_context* ctx, bool debug);
+void cross_context_set_logger(struct cross_context* ctx, cross_log_func log, void* userdata);
+
+/**
+ * Reads CROSS_DEBUG the same way the wrappers always have.
+ */
+bool cross_debug_from_env(void);
+
+const char* cross_context_error(const struct cross_context* ctx);
+const char* cross_strerror(int error);
+
+/**
+ * Maps a cross_error to the process exit code the wrappers use for it.
+ */
+int cross_exit_code(const struct cross_context* ctx);
+
+void* cross_malloc(struct cross_context* ctx, size_t size);
+void cross_free(struct cross_context* ctx, void* ptr);
+char* cross_strndup(struct cross_context* ctx, const char* value, size_t len);
+
+/**
+ * Split @p exe, the wrapper's absolute path, into its cross_paths. @p suffix
+ * is the wrapper's name after the triple (ex: CROSS_CMAKE_SUFFIX).
+ */
+int cross_paths_init(struct cross_context* ctx, struct cross_paths* paths, const char* exe, const char* suffix);
+void cross_paths_reset(struct cross_context* ctx, struct cross_paths* paths);
+
+/**
+ * Look for an executable @p name in the ':' separated @p envpath, also trying
+ * a ".exe" suffix. The first candidate @p handler accepts is stored in
+ * @p result; CROSS_ENOCMAKE is never returned, a miss leaves it NULL.
+ */
+int cross_which_path(struct cross_context* ctx, const char* name, const char* envpath,
+                     cross_which_handler handler, void* userdata, char** result);
+
+/**
+ * Find the real cmake on PATH, skipping the wrapper itself.
+ */
+int cross_find_cmake(struct cross_context* ctx, const struct cross_paths* paths, char** result);
+
+int cross_resolve_toolchain_path(struct cross_context* ctx, const struct cross_paths* paths, char** result);
+int cross_resolve_sysroot(struct cross_context* ctx, const struct cross_paths* paths, char** result);
+int cross_resolve_install_prefix(struct cross_context* ctx, const struct cross_paths* paths, char** result);
+
+/**
+ * The "-DCMAKE_TOOLCHAIN_FILE=..." and "-DCMAKE_INSTALL_PREFIX=..." arguments.
+ */
+int cross_resolve_toolchain_arg(struct cross_context* ctx, const struct cross_paths* paths, char** result);
+int cross_resolve_install_prefix_arg(struct cross_context* ctx, const struct cross_paths* paths, char** result);
+
+/**
+ * What this process can use of the machine: available memory, capped by the
+ * headroom under a cgroup memory limit, and online CPUs, capped by a cgroup
+ * CPU quota. Either is 0 when it can't be determined.
+ */
+struct cross_host_resources
+{
+	unsigned long long memory_mb;
+	unsigned int cpus;
+};
+
+void cross_query_host_resources(struct cross_host_resources* resources);
+
+/**
+ * Whether a cmake command line configures a build tree, as opposed to
+ * running one of cmake's tool modes (--build, -E, -P, --version...).
+ */
+bool cross_is_cmake_generate(struct cross_context* ctx, int argc, char** argv);
+
+/**
+ * Build the full cmake command line for @p argv: the real cmake, then our
+ * definitions (including the host's resources) when generating, then the
+ * caller's arguments. The result is
+ * NULL terminated; release it with cross_free_argv.
+ */
+int cross_cmake_argv(struct cross_context* ctx, const struct cross_paths* paths, int argc, char** argv,
+                     int* out_argc, char*** out_argv);
+void cross_free_argv(struct cross_context* ctx, int argc, char** argv);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* _LIBCROSS_H_ */
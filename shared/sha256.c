@@ -0,0 +1,165 @@
+/**
+ * @file sha256.c
+ * @author Charles Grunwald <cgrunwald@gmail.com>
+ */
+#include "shared.h"
+#include "sha256.h"
+
+#define SHA256_READ_SIZE (256 * 1024)
+
+#define ROTR(X,N) (((X) >> (N)) | ((X) << (32 - (N))))
+
+static const uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static void sha256_transform(uint32_t state[8], const unsigned char block[64])
+{
+	uint32_t w[64];
+	uint32_t a, b, c, d, e, f, g, h;
+
+	for(int i = 0; i < 16; i++) {
+		w[i] = ((uint32_t)block[i * 4] << 24) | ((uint32_t)block[i * 4 + 1] << 16) |
+		       ((uint32_t)block[i * 4 + 2] << 8) | (uint32_t)block[i * 4 + 3];
+	}
+	for(int i = 16; i < 64; i++) {
+		uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	a = state[0]; b = state[1]; c = state[2]; d = state[3];
+	e = state[4]; f = state[5]; g = state[6]; h = state[7];
+
+	for(int i = 0; i < 64; i++) {
+		uint32_t s1 = ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25);
+		uint32_t ch = (e & f) ^ (~e & g);
+		uint32_t t1 = h + s1 + ch + sha256_k[i] + w[i];
+		uint32_t s0 = ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22);
+		uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+		uint32_t t2 = s0 + maj;
+		h = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+
+	state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+	state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+void sha256_init(struct sha256* ctx)
+{
+	ctx->state[0] = 0x6a09e667;
+	ctx->state[1] = 0xbb67ae85;
+	ctx->state[2] = 0x3c6ef372;
+	ctx->state[3] = 0xa54ff53a;
+	ctx->state[4] = 0x510e527f;
+	ctx->state[5] = 0x9b05688c;
+	ctx->state[6] = 0x1f83d9ab;
+	ctx->state[7] = 0x5be0cd19;
+	ctx->length = 0;
+	ctx->buffer_len = 0;
+}
+
+void sha256_update(struct sha256* ctx, const void* data, size_t length)
+{
+	const unsigned char* p = (const unsigned char*)data;
+	ctx->length += length;
+
+	if(ctx->buffer_len > 0) {
+		size_t take = sizeof(ctx->buffer) - ctx->buffer_len;
+		if(take > length)
+			take = length;
+		memcpy(ctx->buffer + ctx->buffer_len, p, take);
+		ctx->buffer_len += take;
+		p += take;
+		length -= take;
+		if(ctx->buffer_len < sizeof(ctx->buffer))
+			return;
+		sha256_transform(ctx->state, ctx->buffer);
+		ctx->buffer_len = 0;
+	}
+
+	// Hash whole blocks straight out of the caller's buffer.
+	while(length >= sizeof(ctx->buffer)) {
+		sha256_transform(ctx->state, p);
+		p += sizeof(ctx->buffer);
+		length -= sizeof(ctx->buffer);
+	}
+
+	if(length > 0) {
+		memcpy(ctx->buffer, p, length);
+		ctx->buffer_len = length;
+	}
+}
+
+void sha256_final(struct sha256* ctx, unsigned char digest[SHA256_DIGEST_SIZE])
+{
+	uint64_t bits = ctx->length * 8;
+	unsigned char pad[72] = { 0x80 };
+	size_t pad_len = (ctx->buffer_len < 56 ? 56 : 120) - ctx->buffer_len;
+
+	for(int i = 0; i < 8; i++)
+		pad[pad_len + (size_t)i] = (unsigned char)(bits >> (56 - i * 8));
+	sha256_update(ctx, pad, pad_len + 8);
+
+	for(int i = 0; i < 8; i++) {
+		digest[i * 4] = (unsigned char)(ctx->state[i] >> 24);
+		digest[i * 4 + 1] = (unsigned char)(ctx->state[i] >> 16);
+		digest[i * 4 + 2] = (unsigned char)(ctx->state[i] >> 8);
+		digest[i * 4 + 3] = (unsigned char)ctx->state[i];
+	}
+}
+
+char* sha256_hex(const unsigned char digest[SHA256_DIGEST_SIZE], char hex[SHA256_HEX_SIZE])
+{
+	static const char digits[] = "0123456789abcdef";
+	for(int i = 0; i < SHA256_DIGEST_SIZE; i++) {
+		hex[i * 2] = digits[digest[i] >> 4];
+		hex[i * 2 + 1] = digits[digest[i] & 0xf];
+	}
+	hex[SHA256_HEX_SIZE - 1] = '\0';
+	return hex;
+}
+
+int sha256_fd(int fd, unsigned char digest[SHA256_DIGEST_SIZE])
+{
+	ssize_t count;
+	struct sha256 ctx;
+	unsigned char* buffer = (unsigned char*)malloc(SHA256_READ_SIZE);
+	if(UNLIKELY(!buffer))
+		return -ENOMEM;
+
+	sha256_init(&ctx);
+	while((count = read(fd, buffer, SHA256_READ_SIZE)) != 0) {
+		if(count < 0) {
+			int code = errno;
+			if(code == EINTR)
+				continue;
+			free(buffer);
+			return -code;
+		}
+		sha256_update(&ctx, buffer, (size_t)count);
+	}
+
+	free(buffer);
+	sha256_final(&ctx, digest);
+	return 0;
+}
+
+int sha256_file(const char* path, unsigned char digest[SHA256_DIGEST_SIZE])
+{
+	int code;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+		return -errno;
+	code = sha256_fd(fd, digest);
+	close(fd);
+	return code;
+}
@@ -0,0 +1,48 @@
+/**
+ * @file sha256.h
+ * @author Charles Grunwald <cgrunwald@gmail.com>
+ * @brief SHA-256, for content-addressing files in our manifests and caches.
+ */
+#ifndef _SHA256_H_
+#define _SHA256_H_
+#pragma once
+
+#include <stdint.h>
+#include "shared.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SHA256_DIGEST_SIZE 32
+#define SHA256_HEX_SIZE (SHA256_DIGEST_SIZE * 2 + 1)
+
+struct sha256
+{
+	uint32_t state[8];
+	uint64_t length;
+	size_t buffer_len;
+	unsigned char buffer[64];
+};
+
+void sha256_init(struct sha256* ctx);
+void sha256_update(struct sha256* ctx, const void* data, size_t length);
+void sha256_final(struct sha256* ctx, unsigned char digest[SHA256_DIGEST_SIZE]);
+
+/**
+ * Writes the lowercase hex form of @p digest, including the terminator.
+ */
+char* sha256_hex(const unsigned char digest[SHA256_DIGEST_SIZE], char hex[SHA256_HEX_SIZE]);
+
+/**
+ * Hash the contents of an open file descriptor from its current offset to
+ * EOF. Returns 0 on success or a negative errno value.
+ */
+int sha256_fd(int fd, unsigned char digest[SHA256_DIGEST_SIZE]);
+int sha256_file(const char* path, unsigned char digest[SHA256_DIGEST_SIZE]);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* _SHA256_H_ */
@@ -2,20 +2,25 @@
  * @file shared.c
  * @author Charles Grunwald <cgrunwald@gmail.com>
  */
+#define _GNU_SOURCE
+
+#include <ftw.h>
 #include <sys/stat.h>
 #include "shared.h"
 
 bool is_regular_file(const char *path)
 {
 	struct stat path_stat;
-	stat(path, &path_stat);
+	if(stat(path, &path_stat) != 0)
+		return false;
 	return S_ISREG(path_stat.st_mode) ? true : false; // NOLINT
 }
 
 bool is_folder(const char *path)
 {
 	struct stat path_stat;
-	stat(path, &path_stat);
+	if(stat(path, &path_stat) != 0)
+		return false;
 	return S_ISDIR(path_stat.st_mode) ? true : false; // NOLINT
 }
 
@@ -35,3 +40,70 @@ ALWAYS_INLINE int proc_path(void* buffer, size_t buffersize)
 	errno = EOVERFLOW;
 	return -1;
 }
+
+// Create path and any missing parents; parents get 0755, path gets mode.
+int mkdir_p(const char* path, mode_t mode)
+{
+	char buffer[PATH_MAX] = "";
+	if((size_t)snprintf(buffer, PATH_MAX, "%s", path) >= PATH_MAX) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	for(char* p = buffer + 1; *p != '\0'; p++) {
+		if(*p == '/') {
+			*p = '\0';
+			if(mkdir(buffer, 0755) != 0 && errno != EEXIST)
+				return -1;
+			*p = '/';
+		}
+	}
+	return mkdir(buffer, mode) != 0 && errno != EEXIST ? -1 : 0;
+}
+
+// Create the directory path will be created in.
+int mkdir_parent(const char* path)
+{
+	char buffer[PATH_MAX] = "";
+	char* slash;
+	if((size_t)snprintf(buffer, PATH_MAX, "%s", path) >= PATH_MAX) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	if((slash = strrchr(buffer, '/')) == NULL || slash == buffer)
+		return 0;
+	*slash = '\0';
+	return mkdir_p(buffer, 0755);
+}
+
+static int remove_path(const char* path, const struct stat* st, int type, struct FTW* ftw)
+{
+	return remove(path) != 0 && errno != ENOENT ? -1 : 0;
+}
+
+// Remove path and everything under it, without following symlinks.
+void remove_tree(const char* path)
+{
+	nftw(path, remove_path, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+// Run argv, searched for on PATH, and wait for it. Returns its exit status,
+// 128 + the signal that killed it, or -errno.
+int run_command(char* const* argv)
+{
+	int status;
+	pid_t pid;
+
+	fflush(stdout);
+	if((pid = fork()) < 0)
+		return -errno;
+	if(pid == 0) {
+		execvp(argv[0], argv);
+		fprintf(stderr, "ERROR: Failed to run %s: %s\n", argv[0], strerror(errno));
+		_exit(127);
+	}
+	while(waitpid(pid, &status, 0) < 0) {
+		if(errno != EINTR)
+			return -errno;
+	}
+	return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
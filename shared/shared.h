@@ -182,6 +182,12 @@ bool is_folder(const char *path);
 bool is_regular_file(const char *path);
 int proc_path(void *buffer, size_t buffersize);
 
+// Filesystem and process utils
+int mkdir_p(const char *path, mode_t mode);
+int mkdir_parent(const char *path);
+void remove_tree(const char *path);
+int run_command(char *const *argv);
+
 #ifdef __cplusplus
 }
 #endif
@@ -22,27 +22,48 @@ typedef struct string_array
 	char* ptr[];
 } string_array;
 
+#define STRING_ARRAY_MIN_CAPACITY 8
+
 static ALWAYS_INLINE string_array* string_array_alloc(size_t maxlen)
 {
 	string_array* array = malloc(OFFSET_OF(string_array, ptr) + maxlen * sizeof(char*));
-	array->maxlen = 0;
+	if (!array)
+		return array;
+	array->maxlen = maxlen;
 	array->len = 0;
 	return array;
 }
 
+/**
+ * Make room for at least @p maxlen entries. Like push, the array may move;
+ * on failure NULL is returned and the original array is left intact.
+ */
+static ALWAYS_INLINE string_array* string_array_reserve(string_array* array, size_t maxlen)
+{
+	string_array* resized;
+	size_t newmaxlen;
+	if (!array)
+		return string_array_alloc(maxlen > STRING_ARRAY_MIN_CAPACITY ? maxlen : STRING_ARRAY_MIN_CAPACITY);
+	if (maxlen <= array->maxlen)
+		return array;
+	newmaxlen = array->maxlen * 2;
+	if (newmaxlen < maxlen)
+		newmaxlen = maxlen;
+	if (newmaxlen < STRING_ARRAY_MIN_CAPACITY)
+		newmaxlen = STRING_ARRAY_MIN_CAPACITY;
+	resized = realloc(array, OFFSET_OF(string_array, ptr) + newmaxlen * sizeof(char*));
+	if (!resized)
+		return resized;
+	resized->maxlen = newmaxlen;
+	return resized;
+}
+
 static ALWAYS_INLINE string_array* string_array_push(string_array* array, char* str)
 {
-	if (!array) {
-		array = string_array_alloc(1);
-		if (!array)
-			return array;
-	}
-	if (array->len + 1 > array->maxlen) {
-		size_t newmaxlen = (array->len + 1) > (array->maxlen * 2) ? (array->len + 1) : (array->maxlen * 2);
-		array = realloc(array, OFFSET_OF(string_array, ptr) + newmaxlen * sizeof(char*));
+	if (!array || array->len == array->maxlen) {
+		array = string_array_reserve(array, array ? array->len + 1 : 1);
 		if (!array)
 			return array;
-		array->maxlen = newmaxlen;
 	}
 	array->ptr[array->len++] = str;
 	return array;
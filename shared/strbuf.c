@@ -11,6 +11,8 @@
 #include "shared.h"
 #include "strbuf.h"
 
+#define STRBUF_MIN_CAPACITY 64
+
 strbuf_t* strbuf_alloc(size_t maxlen)
 {
 	strbuf_t* buf = (strbuf_t*)malloc(offsetof(struct strbuf, ptr) + maxlen + 1);
@@ -47,18 +49,34 @@ strbuf_t* strbuf_new(const char* str)
 	return strbuf_new_with_len(str, len);
 }
 
+strbuf_t* strbuf_reserve(strbuf_t* buf, size_t maxlen)
+{
+	strbuf_t* resized;
+	size_t newmaxlen;
+	if(!buf)
+		return strbuf_alloc(maxlen > STRBUF_MIN_CAPACITY ? maxlen : STRBUF_MIN_CAPACITY);
+	if(maxlen <= buf->maxlen)
+		return buf;
+	newmaxlen = buf->maxlen * 2;
+	if(newmaxlen < maxlen)
+		newmaxlen = maxlen;
+	if(newmaxlen < STRBUF_MIN_CAPACITY)
+		newmaxlen = STRBUF_MIN_CAPACITY;
+	resized = realloc(buf, offsetof(struct strbuf, ptr) + newmaxlen + 1);
+	if(UNLIKELY(!resized))
+		return resized;
+	resized->maxlen = newmaxlen;
+	return resized;
+}
+
 strbuf_t* strbuf_append_with_len(strbuf_t* buf, const char* str, size_t len)
 {
 	if(!str || !len)
 		return buf;
-	if(!buf)
-		return strbuf_new_with_len(str, len);
-	if(buf->len + len > buf->maxlen) {
-		size_t newmaxlen = (buf->len + len) > (buf->maxlen * 2) ? (buf->len + len) : (buf->maxlen * 2);
-		buf = realloc(buf, offsetof(struct strbuf, ptr) + newmaxlen + 1);
+	if(!buf || buf->len + len > buf->maxlen) {
+		buf = strbuf_reserve(buf, (buf ? buf->len : 0) + len);
 		if(!buf)
 			return buf;
-		buf->maxlen = newmaxlen;
 	}
 	memcpy(buf->ptr + buf->len, str, len);
 	buf->ptr[buf->len += len] = '\0';
@@ -26,6 +26,7 @@ strbuf_t* strbuf_alloc(size_t maxlen);
 void strbuf_free(strbuf_t* buf);
 strbuf_t* strbuf_new_with_len(const char* str, size_t len);
 strbuf_t* strbuf_new(const char* str);
+strbuf_t* strbuf_reserve(strbuf_t* buf, size_t maxlen);
 strbuf_t* strbuf_append_with_len(strbuf_t* buf, const char* str, size_t len);
 strbuf_t* strbuf_append(strbuf_t* buf, const char* str);
 
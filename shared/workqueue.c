@@ -0,0 +1,126 @@
+/**
+ * @file workqueue.c
+ * @author Charles Grunwald <cgrunwald@gmail.com>
+ */
+#include "shared.h"
+#include "workqueue.h"
+
+size_t workqueue_default_threads(void)
+{
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (size_t)count : 1;
+}
+
+static void* workqueue_main(void* param)
+{
+	struct workqueue* wq = (struct workqueue*)param;
+
+	pthread_mutex_lock(&wq->lock);
+	for(;;) {
+		struct workqueue_item* item;
+		while(wq->head == NULL && !wq->closing)
+			pthread_cond_wait(&wq->ready, &wq->lock);
+		if(wq->head == NULL)
+			break;
+
+		item = wq->head;
+		wq->head = item->next;
+		if(wq->head == NULL)
+			wq->tail = NULL;
+		pthread_mutex_unlock(&wq->lock);
+
+		wq->handler(wq, item->value, wq->userdata);
+		free(item);
+
+		pthread_mutex_lock(&wq->lock);
+		if(--wq->pending == 0)
+			pthread_cond_broadcast(&wq->idle);
+	}
+	pthread_mutex_unlock(&wq->lock);
+	return NULL;
+}
+
+int workqueue_init(struct workqueue* wq, size_t thread_count, workqueue_handler handler, void* userdata)
+{
+	int code = 0;
+	if(UNLIKELY(!wq || !handler))
+		return -EINVAL;
+
+	memset((void*)wq, 0, sizeof(*wq));
+	wq->thread_count = thread_count ? thread_count : workqueue_default_threads();
+	wq->handler = handler;
+	wq->userdata = userdata;
+	wq->threads = (pthread_t*)calloc(wq->thread_count, sizeof(pthread_t));
+	if(UNLIKELY(!wq->threads))
+		return -ENOMEM;
+
+	pthread_mutex_init(&wq->lock, NULL);
+	pthread_cond_init(&wq->ready, NULL);
+	pthread_cond_init(&wq->idle, NULL);
+
+	for(size_t i = 0; i < wq->thread_count; i++) {
+		code = pthread_create(&wq->threads[i], NULL, workqueue_main, wq);
+		if(code != 0) {
+			// Keep whatever workers we did manage to start.
+			wq->thread_count = i;
+			break;
+		}
+	}
+
+	if(wq->thread_count == 0) {
+		workqueue_finish(wq);
+		return -code;
+	}
+	return 0;
+}
+
+int workqueue_push(struct workqueue* wq, void* value)
+{
+	struct workqueue_item* item = (struct workqueue_item*)malloc(sizeof(struct workqueue_item));
+	if(UNLIKELY(!item))
+		return -ENOMEM;
+
+	item->next = NULL;
+	item->value = value;
+
+	pthread_mutex_lock(&wq->lock);
+	if(wq->tail != NULL)
+		wq->tail->next = item;
+	else
+		wq->head = item;
+	wq->tail = item;
+	wq->pending++;
+	pthread_cond_signal(&wq->ready);
+	pthread_mutex_unlock(&wq->lock);
+	return 0;
+}
+
+void workqueue_wait(struct workqueue* wq)
+{
+	pthread_mutex_lock(&wq->lock);
+	while(wq->pending > 0)
+		pthread_cond_wait(&wq->idle, &wq->lock);
+	pthread_mutex_unlock(&wq->lock);
+}
+
+void workqueue_finish(struct workqueue* wq)
+{
+	if(wq->thread_count > 0)
+		workqueue_wait(wq);
+
+	pthread_mutex_lock(&wq->lock);
+	wq->closing = true;
+	pthread_cond_broadcast(&wq->ready);
+	pthread_mutex_unlock(&wq->lock);
+
+	for(size_t i = 0; i < wq->thread_count; i++)
+		pthread_join(wq->threads[i], NULL);
+
+	free(wq->threads);
+	wq->threads = NULL;
+	wq->thread_count = 0;
+
+	pthread_cond_destroy(&wq->idle);
+	pthread_cond_destroy(&wq->ready);
+	pthread_mutex_destroy(&wq->lock);
+}
@@ -0,0 +1,64 @@
+/**
+ * @file workqueue.h
+ * @author Charles Grunwald <cgrunwald@gmail.com>
+ * @brief Fixed-size pthread worker pool fed from a FIFO of opaque items.
+ *
+ * Handlers may push further items onto the queue they're running on, which
+ * is how the directory scanners fan out. workqueue_wait returns once the queue
+ * has drained and every handler has returned.
+ */
+#ifndef _WORKQUEUE_H_
+#define _WORKQUEUE_H_
+#pragma once
+
+#include <pthread.h>
+#include "shared.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct workqueue;
+typedef void(*workqueue_handler)(struct workqueue* wq, void* item, void* userdata);
+
+struct workqueue_item
+{
+	struct workqueue_item* next;
+	void* value;
+};
+
+struct workqueue
+{
+	pthread_mutex_t lock;
+	pthread_cond_t ready;
+	pthread_cond_t idle;
+	struct workqueue_item* head;
+	struct workqueue_item* tail;
+	size_t pending;
+	bool closing;
+	size_t thread_count;
+	pthread_t* threads;
+	workqueue_handler handler;
+	void* userdata;
+};
+
+size_t workqueue_default_threads(void);
+
+/**
+ * Start @p thread_count workers (0 uses workqueue_default_threads). Returns 0 on
+ * success or a negative errno value.
+ */
+int workqueue_init(struct workqueue* wq, size_t thread_count, workqueue_handler handler, void* userdata);
+int workqueue_push(struct workqueue* wq, void* item);
+void workqueue_wait(struct workqueue* wq);
+
+/**
+ * Wait for the queue to drain, then stop and join the workers.
+ */
+void workqueue_finish(struct workqueue* wq);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* _WORKQUEUE_H_ */